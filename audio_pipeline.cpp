@@ -0,0 +1,21 @@
+#include "audio_pipeline.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static bool load_threaded() {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    bool threaded = cores > 1;
+    const char* value = getenv("LARK_PIPELINE");
+    if (value && value[0] && strcmp(value, "auto") != 0) {
+        threaded = strcmp(value, "0") != 0;
+    }
+    LOG_I("Pipeline: %s (%ld cores online)\n", threaded ? "one thread per stage" : "single thread", cores);
+    return threaded;
+}
+
+bool pipeline_threaded() {
+    static const bool threaded = load_threaded();
+    return threaded;
+}
@@ -0,0 +1,98 @@
+#ifndef AUDIO_PIPELINE_H
+#define AUDIO_PIPELINE_H
+
+#include <atomic>
+#include <vector>
+#include <errno.h>
+#include <semaphore.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "spsc_queue.h"
+
+// Run the audio path as pipelined stages, one thread each (read, decode,
+// DSP, output), instead of serially on the decoder thread. Read once from
+// the environment: LARK_PIPELINE=1 forces it, LARK_PIPELINE=0 collapses
+// to one thread; by default it is on when more than one core is online.
+bool pipeline_threaded();
+
+// Compressed frame, read -> decode
+enum PacketStatus {
+    PACKET_FRAME = 0,
+    PACKET_END,   // past the last frame
+    PACKET_ERROR, // read failure (frame is the one that failed)
+};
+
+struct Packet {
+    std::vector<unsigned char> storage; // copy of the frame (pipelined only)
+    const unsigned char* data;
+    size_t size;
+    PacketStatus status;
+    unsigned int frame;
+    unsigned int generation;            // seek generation it was read in
+};
+
+// Interleaved PCM, decode -> DSP -> output
+struct PcmBlock {
+    std::vector<int16_t> pcm;
+    size_t samples;
+    unsigned int channels;
+    uint64_t timeline_end; // written position once output, 0 to leave it
+    bool last;             // end of stream marker (no samples)
+};
+
+// --- StageQueue Class ---
+// Lock-free SPSC queue of pooled buffers between two stage threads, with a
+// semaphore to sleep on while it is empty. Buffers come from a fixed pool
+// whose free list is a StageQueue too, so push() never finds the queue full
+// and a stage blocks only on an empty input (or on no free buffer).
+//
+// pop() returns NULL when woken by wake(): the caller checks its stop
+// conditions and pops again.
+template <typename T>
+class StageQueue {
+public:
+    explicit StageQueue(size_t capacity) : queue(capacity), depth(NULL) {
+        sem_init(&items, 0, 0);
+    }
+    ~StageQueue() { sem_destroy(&items); }
+
+    // Publish the fill level to a metrics gauge
+    void set_depth_gauge(std::atomic<uint32_t>* gauge) { depth = gauge; }
+
+    void push(T* item) {
+        queue.push(item);
+        if (depth) depth->store((uint32_t)queue.size(), std::memory_order_relaxed);
+        sem_post(&items);
+    }
+
+    T* pop() {
+        while (sem_wait(&items) == -1 && errno == EINTR) {}
+        T* item = NULL;
+        if (!queue.pop(&item)) return NULL;
+        if (depth) depth->store((uint32_t)queue.size(), std::memory_order_relaxed);
+        return item;
+    }
+
+    void wake() { sem_post(&items); }
+
+    size_t capacity() const { return queue.capacity(); }
+
+    // Only while neither side is running
+    void reset() {
+        queue.clear();
+        sem_destroy(&items);
+        sem_init(&items, 0, 0);
+        if (depth) depth->store(0, std::memory_order_relaxed);
+    }
+
+private:
+    SpscQueue<T*> queue;
+    sem_t items;
+    std::atomic<uint32_t>* depth;
+
+    StageQueue(const StageQueue&);
+    StageQueue& operator=(const StageQueue&);
+};
+
+#endif // AUDIO_PIPELINE_H
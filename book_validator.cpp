@@ -0,0 +1,112 @@
+#include "book_validator.h"
+#include "clip_decoder.h"
+#include "logger.h"
+#include "worker_pool.h"
+#include <sys/stat.h>
+
+const char* book_health_name(int health) {
+    switch (health) {
+        case BOOK_OK: return "ok";
+        case BOOK_TRUNCATED: return "truncated";
+        case BOOK_CORRUPT: return "corrupt";
+        case BOOK_UNREADABLE: return "unreadable";
+        default: return "unchecked";
+    }
+}
+
+// Frames stored in the file: the sample table of a book copied partially
+// still describes all of it. Frames are stored in order, so the stored
+// ones are a prefix of the table.
+static bool stored_frames(Mp4Index& index, uint32_t* stored) {
+    uint32_t frames = index.frame_count();
+    uint64_t offset;
+    uint32_t size;
+    if (!index.locate(frames - 1, &offset, &size)) return false;
+    if (offset + size <= index.file_size()) {
+        *stored = frames;
+        return true;
+    }
+
+    // Bisect: lo is stored (or -1), hi is not
+    int64_t lo = -1;
+    int64_t hi = frames - 1;
+    while (hi - lo > 1) {
+        int64_t mid = lo + (hi - lo) / 2;
+        if (!index.locate((uint32_t)mid, &offset, &size)) return false;
+        if (offset + size <= index.file_size()) lo = mid;
+        else hi = mid;
+    }
+    *stored = (uint32_t)(lo + 1);
+    return true;
+}
+
+bool validate_book(const char* path, BookCheck* result) {
+    result->health = BOOK_UNREADABLE;
+    result->frames = 0;
+    result->playable_frames = 0;
+    result->playable_seconds = 0;
+    result->bad_frames = 0;
+    result->file_size = 0;
+
+    // Size before anything is read: a file still being copied must not be
+    // recorded with the result of a partial copy
+    struct stat st;
+    if (stat(path, &st) != 0) return true;
+    result->file_size = (uint64_t)st.st_size;
+
+    ClipDecoder clip;
+    if (!clip.open(path)) {
+        LOG_W("Validator: %s: unreadable\n", path);
+        return true;
+    }
+    Mp4Index& index = clip.index();
+    result->frames = index.frame_count();
+    unsigned long rate = clip.samplerate() > 0 ? clip.samplerate() : index.samplerate();
+    if (result->frames == 0 || rate == 0) return true;
+
+    if (!stored_frames(index, &result->playable_frames)) {
+        result->health = BOOK_CORRUPT;
+        LOG_W("Validator: %s: sample table: %s\n", path, index.error());
+        return true;
+    }
+    result->playable_seconds = (double)result->playable_frames * index.samples_per_frame() / rate;
+    if (!WorkerPool::checkpoint()) return false;
+
+    // Spot decode the stored part, first and last frames included
+    uint32_t playable = result->playable_frames;
+    uint32_t run = playable < VALIDATE_SPOT_FRAMES ? playable : VALIDATE_SPOT_FRAMES;
+    bool read_failed = false;
+    for (int spot = 0; spot < VALIDATE_SPOTS && run > 0; spot++) {
+        uint32_t start = (uint32_t)((uint64_t)(playable - run) * spot / (VALIDATE_SPOTS - 1));
+        if (!WorkerPool::checkpoint()) return false;
+        if (!clip.seek(start)) {
+            read_failed = true;
+            break;
+        }
+        for (uint32_t f = 0; f < run; f++) {
+            const int16_t* pcm;
+            size_t frames;
+            if (!clip.decode(&pcm, &frames)) {
+                read_failed = true;
+                break;
+            }
+        }
+        if (read_failed) break;
+    }
+    result->bad_frames = (uint32_t)clip.errors();
+
+    if (read_failed) {
+        result->health = BOOK_CORRUPT;
+        LOG_W("Validator: %s: %s\n", path, index.error() ? index.error() : "decoder error");
+    } else if (result->bad_frames > 0) {
+        result->health = BOOK_CORRUPT;
+    } else if (result->playable_frames < result->frames) {
+        result->health = BOOK_TRUNCATED;
+    } else {
+        result->health = BOOK_OK;
+    }
+    LOG_I("Validator: %s: %s, %u of %u frames stored (%.0f s), %u bad frames\n", path,
+          book_health_name(result->health), result->playable_frames, result->frames,
+          result->playable_seconds, result->bad_frames);
+    return true;
+}
@@ -0,0 +1,39 @@
+#ifndef BOOK_VALIDATOR_H
+#define BOOK_VALIDATOR_H
+
+#include <stdint.h>
+
+// Spot checks across the timeline: frames decoded at each one (after the
+// priming frame of the seek)
+#define VALIDATE_SPOTS 16
+#define VALIDATE_SPOT_FRAMES 4
+
+// Health of a book, as recorded in the history journal (BookStatus)
+enum BookHealth {
+    BOOK_UNCHECKED = 0,
+    BOOK_OK,
+    BOOK_TRUNCATED,  // the sample table points past the end of the file
+    BOOK_CORRUPT,    // frames FAAD2 rejects, or an inconsistent sample table
+    BOOK_UNREADABLE, // no audio track could be found (e.g. moov not copied yet)
+};
+
+const char* book_health_name(int health);
+
+struct BookCheck {
+    BookHealth health;
+    uint32_t frames;          // in the sample table
+    uint32_t playable_frames; // stored before the end of the file
+    double playable_seconds;
+    uint32_t bad_frames;      // spot-decoded frames FAAD2 rejected
+    uint64_t file_size;       // before the check (0 if missing), to spot files still growing
+};
+
+// Checks a book without reading it whole: the frame at the end of the
+// sample table must lie inside the file (otherwise the last one that does
+// is found by bisection), and VALIDATE_SPOTS runs of frames spread over
+// the playable part are decoded with a throwaway ClipDecoder. About a
+// hundred kilobytes of reads per book.
+// For worker tasks: false if WorkerPool::checkpoint() cancelled it.
+bool validate_book(const char* path, BookCheck* result);
+
+#endif // BOOK_VALIDATOR_H
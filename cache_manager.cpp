@@ -0,0 +1,265 @@
+#include "cache_manager.h"
+#include "logger.h"
+#include <glib.h>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#define CACHE_DEFAULT_BUDGET_MB 24
+#define CACHE_DEFAULT_RSS_CEILING_MB 64
+#define CACHE_DEFAULT_MEM_LOW_MB 24
+#define CACHE_DEFAULT_PSI_PCT 10
+
+static size_t env_mb(const char* name, size_t fallback_mb) {
+    const char* value = getenv(name);
+    if (!value || !value[0]) return fallback_mb << 20;
+    char* end = NULL;
+    long n = strtol(value, &end, 10);
+    return (end && *end == '\0' && n >= 0) ? (size_t)n << 20 : fallback_mb << 20;
+}
+
+static CacheConfig load_config() {
+    CacheConfig config;
+    config.budget_bytes = env_mb("LARK_CACHE_BUDGET_MB", CACHE_DEFAULT_BUDGET_MB);
+    config.rss_ceiling_bytes = env_mb("LARK_RSS_CEILING_MB", CACHE_DEFAULT_RSS_CEILING_MB);
+    config.mem_low_bytes = env_mb("LARK_MEM_LOW_MB", CACHE_DEFAULT_MEM_LOW_MB);
+    const char* psi = getenv("LARK_MEM_PSI_PCT");
+    config.psi_threshold = (psi && psi[0]) ? atoi(psi) : CACHE_DEFAULT_PSI_PCT;
+    return config;
+}
+
+const CacheConfig& cache_config() {
+    static const CacheConfig config = load_config();
+    return config;
+}
+
+// Memory the system can hand out without swapping, in bytes. Kernels
+// before 3.14 (most Kindles) have no MemAvailable: free plus page cache
+// is the usual approximation there. 0 if unknown.
+static size_t read_mem_available() {
+    FILE* f = fopen("/proc/meminfo", "r");
+    if (!f) return 0;
+    char line[128];
+    unsigned long long available = 0, free_kb = 0, buffers = 0, cached = 0;
+    bool has_available = false;
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long kb;
+        if (sscanf(line, "MemAvailable: %llu", &kb) == 1) {
+            available = kb;
+            has_available = true;
+        } else if (sscanf(line, "MemFree: %llu", &kb) == 1) {
+            free_kb = kb;
+        } else if (sscanf(line, "Buffers: %llu", &kb) == 1) {
+            buffers = kb;
+        } else if (sscanf(line, "Cached: %llu", &kb) == 1) {
+            cached = kb;
+        }
+    }
+    fclose(f);
+    return (size_t)((has_available ? available : free_kb + buffers + cached) * 1024);
+}
+
+// Memory pressure stall ("some avg10", percent), -1 without PSI (< 4.20)
+static int read_memory_psi() {
+    FILE* f = fopen("/proc/pressure/memory", "r");
+    if (!f) return -1;
+    float avg10 = -1;
+    if (fscanf(f, "some avg10=%f", &avg10) != 1) avg10 = -1;
+    fclose(f);
+    return avg10 < 0 ? -1 : (int)avg10;
+}
+
+static size_t read_rss() {
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    unsigned long size = 0, resident = 0;
+    if (fscanf(f, "%lu %lu", &size, &resident) != 2) resident = 0;
+    fclose(f);
+    return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static gboolean maintain_idle(gpointer data) {
+    static_cast<CacheManager*>(data)->maintain();
+    return FALSE;
+}
+
+// =================================================================================
+// CacheManager Implementation
+// =================================================================================
+
+CacheManager::CacheManager() : used(0), maintain_scheduled(false), metrics(NULL) {}
+
+void CacheManager::set_metrics(PlaybackMetrics* metrics) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->metrics = metrics;
+    publish_locked();
+}
+
+int CacheManager::add_cache(const char* name, CachePriority priority, unsigned int rebuild_cost,
+                            CacheShrinkCallback shrink, void* user_data) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry entry;
+    entry.name = name;
+    entry.priority = priority;
+    entry.rebuild_cost = rebuild_cost;
+    entry.shrink = shrink;
+    entry.user_data = user_data;
+    entry.bytes = 0;
+    entry.last_used_us = metrics_now_us();
+    entry.active = true;
+    entries.push_back(entry);
+    return (int)entries.size() - 1;
+}
+
+void CacheManager::remove_cache(int id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (id < 0 || id >= (int)entries.size() || !entries[id].active) return;
+    used -= entries[id].bytes;
+    entries[id].bytes = 0;
+    entries[id].active = false;
+    publish_locked();
+}
+
+bool CacheManager::reserve(int id, size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (id < 0 || id >= (int)entries.size() || !entries[id].active) return false;
+    Entry& entry = entries[id];
+    size_t budget = cache_config().budget_bytes;
+
+    if (used + bytes > budget) {
+        // Only room taken from less important caches may be granted
+        size_t sheddable = 0;
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (entries[i].active && entries[i].priority < entry.priority) sheddable += entries[i].bytes;
+        }
+        if (used + bytes - budget > sheddable) {
+            LOG_W("Cache: %s denied %lu KB (%lu/%lu KB used)\n", entry.name, (unsigned long)(bytes >> 10),
+                  (unsigned long)(used >> 10), (unsigned long)(budget >> 10));
+            return false;
+        }
+        if (!maintain_scheduled) {
+            maintain_scheduled = true;
+            g_idle_add(maintain_idle, this);
+        }
+    }
+
+    entry.bytes += bytes;
+    entry.last_used_us = metrics_now_us();
+    used += bytes;
+    publish_locked();
+    return true;
+}
+
+void CacheManager::release(int id, size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (id < 0 || id >= (int)entries.size() || !entries[id].active) return;
+    // Bytes already taken back by shed() are not counted twice
+    if (bytes > entries[id].bytes) bytes = entries[id].bytes;
+    entries[id].bytes -= bytes;
+    used -= bytes;
+    publish_locked();
+}
+
+void CacheManager::touch(int id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (id < 0 || id >= (int)entries.size()) return;
+    entries[id].last_used_us = metrics_now_us();
+}
+
+size_t CacheManager::used_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return used;
+}
+
+void CacheManager::publish_locked() {
+    if (!metrics) return;
+    metrics->cache_bytes.store(used, std::memory_order_relaxed);
+}
+
+size_t CacheManager::shed(size_t bytes, CachePriority max_priority, const char* reason) {
+    // Victims, cheapest loss first: priority, then rebuild cost, then LRU
+    std::vector<std::pair<uint64_t, int> > order;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < entries.size(); i++) {
+            const Entry& e = entries[i];
+            if (!e.active || e.bytes == 0 || e.priority > max_priority) continue;
+            // Sort key: priority (8 bits), cost (16 bits), last use (40 bits of ms)
+            uint64_t cost = e.rebuild_cost < 0xffff ? e.rebuild_cost : 0xffff;
+            uint64_t key = ((uint64_t)e.priority << 56) | (cost << 40) | ((e.last_used_us / 1000) & 0xffffffffffULL);
+            order.push_back(std::make_pair(key, (int)i));
+        }
+    }
+    std::sort(order.begin(), order.end());
+
+    size_t freed = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+        if (bytes > 0 && freed >= bytes) break;
+        Entry victim;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            victim = entries[order[i].second];
+        }
+        // Without the lock: the cache may call release() from here
+        size_t got = victim.shrink(bytes > 0 ? bytes - freed : 0, victim.user_data);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        Entry& entry = entries[order[i].second];
+        if (got > entry.bytes) got = entry.bytes;
+        entry.bytes -= got;
+        used -= got;
+        freed += got;
+        publish_locked();
+        if (got > 0) {
+            LOG_I("Cache: shed %lu KB of %s (%s)\n", (unsigned long)(got >> 10), entry.name, reason);
+            if (metrics) {
+                PlaybackMetrics::add(metrics->cache_sheds, 1);
+                PlaybackMetrics::add(metrics->cache_shed_bytes, got);
+            }
+        }
+    }
+    return freed;
+}
+
+void CacheManager::maintain() {
+    const CacheConfig& config = cache_config();
+    size_t over = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        maintain_scheduled = false;
+        if (used > config.budget_bytes) over = used - config.budget_bytes;
+    }
+    if (over > 0) shed(over, CACHE_PRIORITY_HIGH, "over budget");
+
+    // System pressure: the framework needs the memory back
+    size_t available = read_mem_available();
+    int psi = read_memory_psi();
+    if (available > 0 && available < config.mem_low_bytes / 2) {
+        shed(0, CACHE_PRIORITY_NORMAL, "memory critical");
+    } else if (psi >= 0 && psi >= config.psi_threshold) {
+        shed(0, CACHE_PRIORITY_NORMAL, "memory stall");
+    } else if (available > 0 && available < config.mem_low_bytes) {
+        shed(0, CACHE_PRIORITY_LOW, "memory low");
+    }
+
+    // Own footprint: caches first, then give freed heap back to the system
+    size_t rss = read_rss();
+    if (rss > config.rss_ceiling_bytes) {
+        shed(rss - config.rss_ceiling_bytes, CACHE_PRIORITY_NORMAL, "RSS ceiling");
+#ifdef __GLIBC__
+        malloc_trim(0);
+#endif
+        rss = read_rss();
+    }
+    if (metrics) metrics->rss_kb.store((uint32_t)(rss >> 10), std::memory_order_relaxed);
+}
+
+CacheManager& cache_manager() {
+    static CacheManager manager;
+    return manager;
+}
@@ -0,0 +1,106 @@
+#ifndef CACHE_MANAGER_H
+#define CACHE_MANAGER_H
+
+#include <mutex>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "playback_metrics.h"
+
+// Under pressure, caches are shed in priority order, LOW first
+enum CachePriority {
+    CACHE_PRIORITY_LOW = 0, // cosmetic, cheap to rebuild (cover art)
+    CACHE_PRIORITY_NORMAL,  // saves work during playback (A/B loop PCM)
+    CACHE_PRIORITY_HIGH,    // playback glitches without it
+};
+
+// Asks a cache to free at least `bytes` (everything if it cannot free
+// selectively). Returns the bytes freed immediately; a cache owned by
+// another thread returns 0, frees on that thread and reports it with
+// CacheManager::release(). Always called on the GTK main loop, without the
+// manager lock held.
+typedef size_t (*CacheShrinkCallback)(size_t bytes, void* user_data);
+
+// Read once from the environment:
+//   LARK_CACHE_BUDGET_MB=n  total size of all registered caches (default 24)
+//   LARK_RSS_CEILING_MB=n   resident memory of the process (default 64)
+//   LARK_MEM_LOW_MB=n       system memory available under which caches are
+//                           shed: LOW below n, NORMAL too below n/2 (default 24)
+//   LARK_MEM_PSI_PCT=n      memory PSI "some avg10" above which NORMAL
+//                           caches are shed as well (default 10)
+struct CacheConfig {
+    size_t budget_bytes;
+    size_t rss_ceiling_bytes;
+    size_t mem_low_bytes;
+    int psi_threshold;
+};
+
+const CacheConfig& cache_config();
+
+// --- CacheManager Class ---
+// Central accounting for the caches that compete for the memory the
+// player shares with the Kindle framework. Caches report their size with
+// reserve()/release(); the manager keeps their sum within the budget and,
+// when the system runs low on memory or the process grows past its RSS
+// ceiling, sheds caches in order of priority, then rebuild cost, then
+// least recent use.
+//
+// reserve()/release()/touch() may be called from any thread (the decoder).
+// Shedding only happens on the GTK main loop, in maintain(), so cache
+// owners never see their shrink callback on an unexpected thread; a
+// reserve() that needs room from other caches schedules it.
+class CacheManager {
+public:
+    CacheManager();
+
+    void set_metrics(PlaybackMetrics* metrics);
+
+    // rebuild_cost: relative cost of refilling the cache once it is shed
+    // (e.g. 1 for a file read, 10 for decoding); cheaper caches go first
+    // within a priority. Returns the cache id.
+    int add_cache(const char* name, CachePriority priority, unsigned int rebuild_cost,
+                  CacheShrinkCallback shrink, void* user_data);
+    void remove_cache(int id);
+
+    // Account `bytes` more to a cache. Fails (nothing is accounted) when
+    // the budget cannot hold them even after shedding every cache of a
+    // lower priority.
+    bool reserve(int id, size_t bytes);
+    void release(int id, size_t bytes);
+    // Mark a cache as used (LRU order within a priority)
+    void touch(int id);
+
+    size_t used_bytes() const;
+
+    // Check memory pressure, the RSS ceiling and the budget, and shed what
+    // is needed. Called periodically on the GTK main loop.
+    void maintain();
+
+private:
+    struct Entry {
+        const char* name;
+        CachePriority priority;
+        unsigned int rebuild_cost;
+        CacheShrinkCallback shrink;
+        void* user_data;
+        size_t bytes;
+        uint64_t last_used_us;
+        bool active;
+    };
+
+    mutable std::mutex mutex;
+    std::vector<Entry> entries;
+    size_t used;
+    bool maintain_scheduled;
+    PlaybackMetrics* metrics;
+
+    // Shed caches up to `max_priority` until `bytes` are freed (0: shed
+    // all of them). Returns the bytes freed.
+    size_t shed(size_t bytes, CachePriority max_priority, const char* reason);
+    void publish_locked();
+};
+
+CacheManager& cache_manager();
+
+#endif // CACHE_MANAGER_H
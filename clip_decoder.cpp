@@ -0,0 +1,153 @@
+#include "clip_decoder.h"
+#include "energy_profile.h"
+#include "logger.h"
+#include "pcm_kernels.h"
+#include <string.h>
+
+extern "C" {
+#include <faad/neaacdec.h>
+}
+
+// =================================================================================
+// ClipDecoder Implementation
+// =================================================================================
+
+ClipDecoder::ClipDecoder()
+    : faad(NULL), rate(0), next_frame(0), error_count(0), downmix_channels(0) {
+}
+
+ClipDecoder::~ClipDecoder() {
+    close();
+}
+
+bool ClipDecoder::open(const char* path) {
+    close();
+    if (!idx.open(path)) {
+        LOG_W("ClipDecoder: %s: %s\n", path, idx.error());
+        return false;
+    }
+    if (!restart_faad()) {
+        idx.close();
+        return false;
+    }
+    return true;
+}
+
+void ClipDecoder::close() {
+    if (faad) {
+        NeAACDecClose((NeAACDecHandle)faad);
+        faad = NULL;
+    }
+    idx.close();
+    next_frame = 0;
+    error_count = 0;
+}
+
+bool ClipDecoder::restart_faad() {
+    if (faad) NeAACDecClose((NeAACDecHandle)faad);
+    NeAACDecHandle handle = NeAACDecOpen();
+    if (!handle) {
+        faad = NULL;
+        return false;
+    }
+    NeAACDecConfigurationPtr config = NeAACDecGetCurrentConfiguration(handle);
+    config->outputFormat = FAAD_FMT_16BIT;
+    config->downMatrix = 0; // Downmixed below with the PCM kernels
+    NeAACDecSetConfiguration(handle, config);
+
+    unsigned long samplerate;
+    unsigned char channels;
+    if (NeAACDecInit2(handle, const_cast<unsigned char*>(idx.asc()), idx.asc_size(), &samplerate, &channels) < 0) {
+        LOG_W("ClipDecoder: FAAD2 rejected the AudioSpecificConfig\n");
+        NeAACDecClose(handle);
+        faad = NULL;
+        return false;
+    }
+    faad = handle;
+    rate = samplerate;
+    return true;
+}
+
+bool ClipDecoder::seek(uint32_t frame) {
+    if (!idx.is_open() || frame >= idx.frame_count()) return false;
+    if (!restart_faad()) return false;
+    next_frame = frame > 0 ? frame - 1 : 0;
+    if (next_frame < frame) {
+        const int16_t* pcm;
+        unsigned long samples;
+        unsigned int channels;
+        const unsigned char* positions;
+        if (!decode_raw(&pcm, &samples, &channels, &positions)) return false;
+    }
+    return true;
+}
+
+bool ClipDecoder::decode_raw(const int16_t** pcm, unsigned long* samples, unsigned int* channels,
+                             const unsigned char** positions) {
+    uint32_t size;
+    {
+        ProfileScope scope(STAGE_READ);
+        if (!idx.read_frame(next_frame, &packet, &size)) return false;
+    }
+    next_frame++;
+
+    NeAACDecFrameInfo info;
+    void* out;
+    {
+        ProfileScope scope(STAGE_DECODE);
+        out = NeAACDecDecode((NeAACDecHandle)faad, &info, &packet[0], size);
+    }
+    if (info.error > 0 || !out) {
+        error_count++;
+        *pcm = NULL;
+        *samples = 0;
+        *channels = 0;
+        return true;
+    }
+    *pcm = (const int16_t*)out;
+    *samples = info.samples;
+    *channels = info.channels > 0 ? info.channels : 1;
+    *positions = info.channel_position;
+    return true;
+}
+
+bool ClipDecoder::decode(const int16_t** pcm, size_t* frames) {
+    if (!faad) return false;
+    const int16_t* raw;
+    unsigned long samples;
+    unsigned int channels;
+    const unsigned char* positions = NULL;
+    if (!decode_raw(&raw, &samples, &channels, &positions)) return false;
+
+    const PcmKernels& kernels = pcm_kernels();
+    if (!raw) {
+        // Rejected frame: a frame of silence keeps the timeline
+        size_t silent = idx.samples_per_frame();
+        if (stereo.size() < silent * 2) stereo.resize(silent * 2);
+        memset(&stereo[0], 0, silent * 2 * sizeof(int16_t));
+        *pcm = &stereo[0];
+        *frames = silent;
+        return true;
+    }
+
+    size_t count = samples / channels;
+    if (channels == 2) {
+        *pcm = raw;
+        *frames = count;
+        return true;
+    }
+    if (stereo.size() < count * 2) stereo.resize(count * 2);
+    if (channels == 1) {
+        kernels.interleave(raw, raw, &stereo[0], count);
+    } else {
+        if (channels != downmix_channels) {
+            downmix_matrix.resize(2 * channels);
+            pcm_stereo_downmix_matrix(positions, channels, &downmix_matrix[0]);
+            downmix_channels = channels;
+        }
+        kernels.downmix(raw, &stereo[0], count, channels, 2, &downmix_matrix[0]);
+    }
+    *pcm = &stereo[0];
+    *frames = count;
+    return true;
+}
@@ -0,0 +1,55 @@
+#ifndef CLIP_DECODER_H
+#define CLIP_DECODER_H
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mp4_index.h"
+
+// --- ClipDecoder Class ---
+// Throwaway FAAD2 decoder over an Mp4Index: decodes short runs of frames
+// anywhere in a book to interleaved stereo, independently of mp4read and
+// of the playing Decoder, so it can run while a book plays.
+class ClipDecoder {
+public:
+    ClipDecoder();
+    ~ClipDecoder();
+
+    bool open(const char* path);
+    void close();
+    Mp4Index& index() { return idx; }
+    unsigned long samplerate() const { return rate; }
+
+    // Continue decoding at frame. A fresh FAAD2 instance decodes the
+    // frame before it first and drops it (MDCT overlap), like the
+    // Decoder's seeks, so output is exact from the first frame on.
+    bool seek(uint32_t frame);
+    uint32_t position() const { return next_frame; }
+
+    // Decode the next frame into interleaved stereo (mono is duplicated,
+    // surround downmixed). False at the end of the book or when the frame
+    // cannot be read (index().error() says why). A frame FAAD2 rejects
+    // comes out as silence and is counted in errors().
+    bool decode(const int16_t** pcm, size_t* frames);
+    unsigned long errors() const { return error_count; }
+
+private:
+    Mp4Index idx;
+    void* faad;
+    unsigned long rate;
+    uint32_t next_frame;
+    unsigned long error_count;
+
+    std::vector<uint8_t> packet;
+    std::vector<int16_t> stereo;
+    std::vector<float> downmix_matrix;
+    unsigned int downmix_channels;
+
+    bool restart_faad();
+    // Decode the frame at next_frame; NULL (and *samples 0) on a FAAD2 error
+    bool decode_raw(const int16_t** pcm, unsigned long* samples, unsigned int* channels,
+                    const unsigned char** positions);
+};
+
+#endif // CLIP_DECODER_H
@@ -0,0 +1,264 @@
+#include "clip_export.h"
+#include "clip_decoder.h"
+#include "energy_profile.h"
+#include "logger.h"
+#include "pcm_kernels.h"
+#include "playback_metrics.h"
+#include "worker_pool.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+extern "C" {
+#include <faad/neaacdec.h>
+#include "mpeg4/audio.h"
+}
+
+#define EXPORT_SECOND 1000000000ULL
+
+// A decoded segment on its way to the file. Segment s goes to slot
+// s % slots; the decoder thread owning it fills the slot once the writer
+// handed it over (segment == s) and sets ready.
+struct ExportSlot {
+    std::vector<int16_t> pcm; // interleaved stereo
+    size_t frames;
+    long segment;
+    bool ready;
+};
+
+struct ExportState {
+    const char* book;
+    uint64_t start_sample;    // output range, samples per channel
+    uint64_t end_sample;
+    uint32_t first_frame;     // AAC frame holding start_sample
+    uint32_t samples_per_frame;
+    long segments;
+    int threads;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<ExportSlot> slots;
+    bool abort;
+    bool failed;
+};
+
+struct ExportThread {
+    ExportState* state;
+    int index;
+    pthread_t thread;
+};
+
+// Decode the part of segment s inside the output range into slot
+static bool decode_segment(ExportState* state, ClipDecoder& clip, long s, ExportSlot* slot) {
+    uint32_t frame = state->first_frame + (uint32_t)s * EXPORT_SEGMENT_FRAMES;
+    uint64_t pos = (uint64_t)frame * state->samples_per_frame;
+    uint64_t from = pos > state->start_sample ? pos : state->start_sample;
+    uint64_t to = pos + (uint64_t)EXPORT_SEGMENT_FRAMES * state->samples_per_frame;
+    if (to > state->end_sample) to = state->end_sample;
+
+    slot->frames = 0;
+    if (!clip.seek(frame)) return false;
+    while (pos < to) {
+        const int16_t* pcm;
+        size_t frames;
+        if (!clip.decode(&pcm, &frames)) return false;
+        uint64_t a = pos > from ? pos : from;
+        uint64_t b = pos + frames < to ? pos + frames : to;
+        if (b > a) {
+            size_t need = (slot->frames + (size_t)(b - a)) * 2;
+            if (slot->pcm.size() < need) slot->pcm.resize(need); // frames longer than the index says
+            memcpy(&slot->pcm[slot->frames * 2], pcm + (a - pos) * 2, (size_t)(b - a) * 2 * sizeof(int16_t));
+            slot->frames += (size_t)(b - a);
+        }
+        pos += frames;
+    }
+    return true;
+}
+
+// Runs with the scheduling class and nice value of the worker that started
+// the export (inherited), so it stays behind playback like the pool
+static void* export_thread_func(void* arg) {
+    ExportThread* self = static_cast<ExportThread*>(arg);
+    ExportState* state = self->state;
+    energy_name_thread("lark-export");
+
+    ClipDecoder clip;
+    bool opened = clip.open(state->book);
+    long slot_count = (long)state->slots.size();
+    for (long s = self->index; s < state->segments; s += state->threads) {
+        ExportSlot* slot = &state->slots[s % slot_count];
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            while (!state->abort && (slot->segment != s || slot->ready)) state->changed.wait(lock);
+            if (state->abort) break;
+        }
+        bool decoded = opened && decode_segment(state, clip, s, slot);
+
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (!decoded) {
+            LOG_E("Export: segment %ld: %s\n", s, clip.index().error() ? clip.index().error() : "decoder error");
+            state->failed = true;
+            state->abort = true;
+        } else {
+            slot->ready = true;
+        }
+        state->changed.notify_all();
+        if (!decoded) break;
+    }
+    return NULL;
+}
+
+static int export_threads(long segments) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cpus > EXPORT_MAX_THREADS ? EXPORT_MAX_THREADS : (cpus > 1 ? (int)cpus : 1);
+    if (segments < threads) threads = segments > 1 ? (int)segments : 1;
+    return threads;
+}
+
+bool export_wav(const char* book, int64_t start_ns, int64_t end_ns, const char* out_path,
+                ExportResult* result) {
+    uint64_t start_us = metrics_now_us();
+    result->seconds = 0;
+    result->elapsed = 0;
+    result->threads = 0;
+    result->bytes = 0;
+
+    ClipDecoder clip;
+    if (!clip.open(book)) {
+        LOG_E("Export: %s: unreadable\n", book);
+        return false;
+    }
+    Mp4Index& index = clip.index();
+    unsigned long rate = clip.samplerate() > 0 ? clip.samplerate() : index.samplerate();
+    uint32_t spf = index.samples_per_frame();
+    if (rate == 0 || spf == 0 || index.frame_count() == 0) return false;
+
+    ExportState state;
+    uint64_t total = (uint64_t)index.frame_count() * spf;
+    state.book = book;
+    state.start_sample = start_ns > 0 ? (uint64_t)start_ns * rate / EXPORT_SECOND : 0;
+    state.end_sample = end_ns > 0 ? (uint64_t)end_ns * rate / EXPORT_SECOND : 0;
+    if (state.end_sample > total) state.end_sample = total;
+    if (state.end_sample <= state.start_sample) {
+        LOG_W("Export: empty range %lld-%lld ms\n", (long long)(start_ns / 1000000), (long long)(end_ns / 1000000));
+        return false;
+    }
+    state.samples_per_frame = spf;
+    state.first_frame = (uint32_t)(state.start_sample / spf);
+    uint32_t end_frame = (uint32_t)((state.end_sample + spf - 1) / spf);
+    state.segments = (end_frame - state.first_frame + EXPORT_SEGMENT_FRAMES - 1) / EXPORT_SEGMENT_FRAMES;
+    state.threads = export_threads(state.segments);
+    state.abort = false;
+    state.failed = false;
+
+    // Every buffer of the export, allocated here once
+    state.slots.resize(state.threads > 1 ? state.threads * EXPORT_SLOTS_PER_THREAD : 1);
+    for (size_t i = 0; i < state.slots.size(); i++) {
+        state.slots[i].pcm.resize((size_t)EXPORT_SEGMENT_FRAMES * spf * 2);
+        state.slots[i].frames = 0;
+        state.slots[i].segment = (long)i;
+        state.slots[i].ready = false;
+    }
+
+    audio_file* out = open_audio_file(out_path, (int)rate, 2, FAAD_FMT_16BIT, OUTPUT_WAV, 0);
+    if (!out) {
+        LOG_E("Export: cannot create %s\n", out_path);
+        return false;
+    }
+
+    // Failures of the decoder threads show up as abort; state.failed is
+    // only read once they are joined
+    bool failed = false;
+    std::vector<ExportThread> threads(state.threads > 1 ? state.threads : 0);
+    size_t started = 0;
+    for (; started < threads.size(); started++) {
+        threads[started].state = &state;
+        threads[started].index = (int)started;
+        if (pthread_create(&threads[started].thread, NULL, export_thread_func, &threads[started]) != 0) {
+            LOG_E("Export: failed to create decoder thread\n");
+            failed = true;
+            break;
+        }
+    }
+
+    // Write the segments in order, fading the ends of the clip
+    uint64_t fade = (uint64_t)rate * EXPORT_FADE_MS / 1000;
+    uint64_t written = 0;
+    bool cancelled = false;
+    for (long s = 0; s < state.segments && !failed; s++) {
+        if (!WorkerPool::checkpoint()) {
+            cancelled = true;
+            break;
+        }
+        ExportSlot* slot = &state.slots[s % state.slots.size()];
+        if (threads.empty()) {
+            if (!decode_segment(&state, clip, s, slot)) {
+                LOG_E("Export: segment %ld: %s\n", s, index.error() ? index.error() : "decoder error");
+                failed = true;
+                break;
+            }
+        } else {
+            std::unique_lock<std::mutex> lock(state.mutex);
+            while (!state.abort && !slot->ready) state.changed.wait(lock);
+            if (!slot->ready) break;
+        }
+
+        size_t frames = slot->frames;
+        if (written < fade) {
+            size_t n = fade - written < frames ? (size_t)(fade - written) : frames;
+            pcm_kernels().gain_ramp(&slot->pcm[0], n, 2, (float)written / fade, (float)(written + n) / fade);
+        }
+        uint64_t left = state.end_sample - state.start_sample - written;
+        if (left < frames + fade) {
+            // The fade-out covers the last fade frames of the clip
+            size_t skip = left > fade ? (size_t)(left - fade) : 0;
+            pcm_kernels().gain_ramp(&slot->pcm[skip * 2], frames - skip, 2,
+                                    (float)(left - skip) / fade, (float)(left - frames) / fade);
+        }
+        if (frames > 0 && write_audio_file(out, &slot->pcm[0], (int)(frames * 2)) != frames * 2) {
+            LOG_E("Export: write to %s failed\n", out_path);
+            failed = true;
+        }
+        written += frames;
+
+        if (!threads.empty()) {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            slot->ready = false;
+            slot->segment = s + (long)state.slots.size();
+            state.changed.notify_all();
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.abort = true;
+        state.changed.notify_all();
+    }
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i].thread, NULL);
+    }
+
+    bool ok = !cancelled && !failed && !state.failed;
+    if (close_audio_file(out) != 0) {
+        if (ok) LOG_E("Export: write to %s failed\n", out_path);
+        ok = false;
+    }
+    if (!ok) {
+        unlink(out_path);
+        if (cancelled) LOG_I("Export: %s cancelled\n", out_path);
+        return false;
+    }
+
+    result->seconds = (double)written / rate;
+    result->elapsed = (metrics_now_us() - start_us) / 1e6;
+    result->threads = state.threads;
+    result->bytes = 44 + written * 2 * sizeof(int16_t);
+    LOG_I("Export: %s: %.0f s of audio in %.1f s (%d thread%s)\n", out_path, result->seconds,
+          result->elapsed, result->threads, result->threads > 1 ? "s" : "");
+    return true;
+}
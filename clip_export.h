@@ -0,0 +1,33 @@
+#ifndef CLIP_EXPORT_H
+#define CLIP_EXPORT_H
+
+#include <stdint.h>
+
+// Segments decoded independently, each from a primed seek so that the
+// joins are sample exact (~3 s at 44.1 kHz)
+#define EXPORT_SEGMENT_FRAMES 128
+// Decoder threads at most, one per online CPU
+#define EXPORT_MAX_THREADS 4
+// Decoded segments in flight per decoder thread
+#define EXPORT_SLOTS_PER_THREAD 2
+// Ramps at both ends of the clip, so that it does not start or stop on a click
+#define EXPORT_FADE_MS 10
+
+struct ExportResult {
+    double seconds;   // audio written
+    double elapsed;   // wall time
+    int threads;      // decoder threads used
+    uint64_t bytes;   // size of the WAV file
+};
+
+// Decode [start_ns, end_ns) of a book (clamped to it) into a 16-bit stereo
+// WAV file through the mpeg4/audio.c writer. Segments of
+// EXPORT_SEGMENT_FRAMES frames are decoded by a ClipDecoder per thread into
+// buffers allocated up front and written in order; on a single CPU the
+// calling thread decodes them itself.
+// For worker tasks: calls WorkerPool::checkpoint() between segments. False
+// when cancelled or on an error; the partial file is removed.
+bool export_wav(const char* book, int64_t start_ns, int64_t end_ns, const char* out_path,
+                ExportResult* result);
+
+#endif // CLIP_EXPORT_H
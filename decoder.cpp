@@ -0,0 +1,1130 @@
+#include "decoder.h"
+#include "cache_manager.h"
+#include "energy_profile.h"
+#include "logger.h"
+#include "pcm_kernels.h"
+#include "realtime.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+
+extern "C" {
+#include <faad/neaacdec.h>
+#include "mpeg4/mp4read.h"
+}
+
+// Poll interval while waiting for a file that is still being written
+#define DECODER_GROW_POLL_MS 250
+
+std::mutex mp4_mutex;
+
+const char* PIPE_PATH = "/tmp/kinamp_audio_pipe";
+
+// =================================================================================
+// Decoder Implementation
+// =================================================================================
+
+Decoder::Decoder(PlaybackMetrics* metrics, SpeechEq* eq, const char* pipe_path)
+    : pipe_path(pipe_path), stop_flag(false), running(false), thread_id(0), start_ns(0), metrics(metrics), eq(eq), start_request_us(0),
+      first_write(true), exit_state_value(EXIT_NONE), bytes_out(0), writing(false), waiting(false), written_samples(0), loop_a_ns(0), loop_b_ns(0),
+      loop_cache_bytes(0), drop_loop_cache(false), out_rate(44100), out_channels(0), speed(1.0f), stretch_channels(0),
+      threaded(pipeline_threaded()), pipe_fd(-1), packet_queue(PIPELINE_PACKETS), free_packets(PIPELINE_PACKETS),
+      pcm_queue(PIPELINE_BLOCKS), filtered_queue(PIPELINE_BLOCKS), free_blocks(PIPELINE_BLOCKS),
+      read_thread(0), dsp_thread(0), output_thread(0), stages_stop(false), output_failed(false), seek_request(0),
+      read_generation(0), fade_request_ms(0), fading(false), fade_total(0), fade_pos(0),
+      cue_request(0), cue_anchor_count(0), emitted_frames(0) {
+    loop_cache_id = cache_manager().add_cache("loop_pcm", CACHE_PRIORITY_NORMAL, 10, shrink_loop_cache, this);
+    sem_init(&reader_wake, 0, 0);
+    // Filter scratch, never reallocated (it may be locked): longer writes
+    // are filtered in chunks
+    out_buffer.resize(AB_LOOP_CHUNK_SAMPLES * 2);
+    if (threaded) {
+        packets.resize(PIPELINE_PACKETS);
+        for (size_t i = 0; i < packets.size(); i++) {
+            packets[i].storage.reserve(PIPELINE_PACKET_BYTES);
+        }
+        blocks.resize(PIPELINE_BLOCKS);
+        for (size_t i = 0; i < blocks.size(); i++) {
+            blocks[i].pcm.resize(PIPELINE_BLOCK_SAMPLES);
+        }
+        packet_queue.set_depth_gauge(&metrics->queue_depth[QUEUE_PACKETS]);
+        pcm_queue.set_depth_gauge(&metrics->queue_depth[QUEUE_PCM]);
+        filtered_queue.set_depth_gauge(&metrics->queue_depth[QUEUE_FILTERED]);
+    }
+
+    // Ensure pipe exists
+    unlink(pipe_path);
+    if (mkfifo(pipe_path, 0666) == -1) {
+        LOG_E("Decoder: Failed to create named pipe: %s\n", strerror(errno));
+    }
+}
+
+Decoder::~Decoder() {
+    stop();
+    cache_manager().remove_cache(loop_cache_id);
+    sem_destroy(&reader_wake);
+    unlink(pipe_path.c_str());
+}
+
+bool Decoder::start(const char* filepath, gint64 start_ns) {
+    if (running) {
+        stop();
+    }
+
+    current_filepath = filepath;
+    this->start_ns = start_ns > 0 ? start_ns : 0;
+    exit_state_value = EXIT_NONE;
+    bytes_out = 0;
+    writing = false;
+    waiting = false;
+    written_samples = 0;
+    start_request_us = metrics_now_us();
+    fade_request_ms = 0;
+    fading = false;
+    stretch_channels = 0;
+    out_channels = 0;
+    cue_request = 0;
+    {
+        std::lock_guard<std::mutex> lock(cue_mutex);
+        cue_anchor_count = 0;
+    }
+    emitted_frames = 0;
+    stop_flag = false;
+    running = true;
+
+    if (pthread_create(&thread_id, NULL, thread_func, this) != 0) {
+        LOG_E("Decoder: Failed to create thread: %s\n", strerror(errno));
+        running = false;
+        return false;
+    }
+    return true;
+}
+
+void Decoder::stop() {
+    if (!running) return;
+
+    // Signal stop
+    stop_flag = true;
+
+    // We assume the caller (MusicBackend) has already broken the pipe 
+    // by setting GStreamer state to NULL. This unblocks the write().
+    // Stages waiting on their queues are woken to see the flag.
+    if (threaded) {
+        packet_queue.wake();
+        free_packets.wake();
+        pcm_queue.wake();
+        filtered_queue.wake();
+        free_blocks.wake();
+        sem_post(&reader_wake);
+    }
+
+    // Wait for thread
+    if (thread_id != 0) {
+        pthread_join(thread_id, NULL);
+        thread_id = 0;
+    }
+
+    running = false;
+}
+
+bool Decoder::is_running() const {
+    return running;
+}
+
+gint64 Decoder::written_position() const {
+    uint64_t samples = written_samples.load(std::memory_order_relaxed);
+    if (samples == ~0ULL || out_rate == 0) return -1;
+    return (gint64)(samples * DECODER_SECOND / out_rate);
+}
+
+void Decoder::set_ab_loop(gint64 a_ns, gint64 b_ns) {
+    loop_a_ns = a_ns;
+    loop_b_ns = b_ns;
+}
+
+void Decoder::clear_ab_loop() {
+    loop_a_ns = 0;
+    loop_b_ns = 0;
+}
+
+void Decoder::set_speed(float speed) {
+    if (speed < STRETCH_MIN_SPEED) speed = STRETCH_MIN_SPEED;
+    if (speed > STRETCH_MAX_SPEED) speed = STRETCH_MAX_SPEED;
+    this->speed = speed;
+}
+
+void Decoder::set_cue(int rate) {
+    if (rate > CUE_MAX_RATE) rate = CUE_MAX_RATE;
+    if (rate < -CUE_MAX_RATE) rate = -CUE_MAX_RATE;
+    if (rate > 0 && rate < CUE_MIN_RATE) rate = CUE_MIN_RATE;
+    if (rate < 0 && rate > -CUE_MIN_RATE) rate = -CUE_MIN_RATE;
+    cue_request = rate;
+}
+
+bool Decoder::cue_position(uint64_t played_frames, gint64* position_ns) const {
+    std::lock_guard<std::mutex> lock(cue_mutex);
+    if (cue_anchor_count == 0 || out_rate == 0) return false;
+
+    // Latest snippet started at or before the played frame; past the ring
+    // the oldest one is the best guess
+    unsigned int kept = cue_anchor_count < CUE_ANCHORS ? cue_anchor_count : CUE_ANCHORS;
+    const CueAnchor* anchor = NULL;
+    for (unsigned int i = 0; i < kept; i++) {
+        anchor = &cue_anchors[(cue_anchor_count - 1 - i) % CUE_ANCHORS];
+        if (anchor->frame <= played_frames) break;
+    }
+    if (anchor->frame > played_frames) {
+        if (cue_anchor_count <= CUE_ANCHORS) return false; // still before the first snippet
+        *position_ns = anchor->position_ns;
+        return true;
+    }
+    // The output runs at speed x book time
+    uint64_t frames = played_frames - anchor->frame;
+    *position_ns = anchor->position_ns + (gint64)(frames * DECODER_SECOND / out_rate * speed);
+    return true;
+}
+
+void Decoder::publish_cue_anchor(uint64_t sample) {
+    std::lock_guard<std::mutex> lock(cue_mutex);
+    CueAnchor& anchor = cue_anchors[cue_anchor_count % CUE_ANCHORS];
+    anchor.position_ns = out_rate > 0 ? (gint64)(sample * DECODER_SECOND / out_rate) : 0;
+    anchor.frame = emitted_frames.load(std::memory_order_relaxed);
+    cue_anchor_count++;
+}
+
+void Decoder::start_fade(int duration_ms) {
+    fade_request_ms = duration_ms > 0 ? duration_ms : 1;
+}
+
+void Decoder::cancel_fade() {
+    fade_request_ms = -1;
+}
+
+size_t Decoder::shrink_loop_cache(size_t bytes, void* user_data) {
+    (void)bytes;
+    // Called on the main loop: the decoder thread owns loop_pcm and frees
+    // it on its next iteration
+    Decoder* self = static_cast<Decoder*>(user_data);
+    size_t cached = self->loop_cache_bytes.exchange(0);
+    if (cached > 0) self->drop_loop_cache = true;
+    return cached;
+}
+
+// Open and configure FAAD2 for the open mp4read file; NULL on failure
+static NeAACDecHandle open_faad(unsigned long* samplerate, unsigned char* channels) {
+    NeAACDecHandle hDecoder = NeAACDecOpen();
+    if (!hDecoder) {
+        LOG_E("Decoder: Failed to open FAAD2 decoder\n");
+        return NULL;
+    }
+
+    // Configure FAAD2
+    NeAACDecConfigurationPtr config = NeAACDecGetCurrentConfiguration(hDecoder);
+    config->outputFormat = FAAD_FMT_16BIT; // 16-bit signed integers
+    config->downMatrix = 0;                // Surround is downmixed by decode_loop()
+    NeAACDecSetConfiguration(hDecoder, config);
+
+    // Initialize Decoder with AudioSpecificConfig from MP4
+    if (NeAACDecInit2(hDecoder, mp4config.asc.buf, mp4config.asc.size, samplerate, channels) < 0) {
+        LOG_E("Decoder: Failed to initialize FAAD2 with ASC\n");
+        NeAACDecClose(hDecoder);
+        return NULL;
+    }
+    return hDecoder;
+}
+
+// The frame holding `sample` is past the end of a complete book. Rather
+// than starting over at 0:00 (and checkpointing that), read on from the
+// last frame and drop everything before `sample`: the run ends there.
+static void seek_past_end(uint64_t sample, unsigned long samples_per_frame,
+                          uint64_t* frame_start, uint64_t* output_start) {
+    unsigned long last = mp4config.frame.nsamples > 0 ? mp4config.frame.nsamples - 1 : 0;
+    mp4read_seek(last);
+    *frame_start = (uint64_t)last * samples_per_frame;
+    *output_start = sample;
+}
+
+// Restart decoding so that output resumes exactly at `sample`: a fresh
+// FAAD2 instance, seeked one frame early like the initial seek
+void* Decoder::restart_at(void* handle, uint64_t sample, unsigned long samples_per_frame,
+                          uint64_t* frame_start, uint64_t* output_start) {
+    NeAACDecClose((NeAACDecHandle)handle);
+    unsigned long samplerate;
+    unsigned char channels;
+    NeAACDecHandle hDecoder = open_faad(&samplerate, &channels);
+    if (!hDecoder) return NULL;
+
+    unsigned long target_frame = sample / samples_per_frame;
+    if (target_frame > 0) target_frame--;
+    if (!seek_source(target_frame)) {
+        LOG_E("Decoder: Failed to seek to frame %lu\n", target_frame);
+        NeAACDecClose(hDecoder);
+        return NULL;
+    }
+    *frame_start = (uint64_t)target_frame * samples_per_frame;
+    *output_start = sample;
+    return hDecoder;
+}
+
+void* Decoder::thread_func(void* arg) {
+    Decoder* self = static_cast<Decoder*>(arg);
+    self->decode_loop();
+    return NULL;
+}
+
+void* Decoder::read_thread_func(void* arg) {
+    static_cast<Decoder*>(arg)->read_stage();
+    return NULL;
+}
+
+void* Decoder::dsp_thread_func(void* arg) {
+    static_cast<Decoder*>(arg)->dsp_stage();
+    return NULL;
+}
+
+void* Decoder::output_thread_func(void* arg) {
+    static_cast<Decoder*>(arg)->output_stage();
+    return NULL;
+}
+
+void Decoder::account_stage(PipelineStage stage, uint64_t* last_cpu_us) {
+    uint64_t now = thread_cpu_us();
+    PlaybackMetrics::add(metrics->stage_cpu_us[stage], now - *last_cpu_us);
+    *last_cpu_us = now;
+}
+
+// =================================================================================
+// Read stage
+// =================================================================================
+
+bool Decoder::read_packet(Packet* packet, unsigned int generation) {
+    while (!stop_flag && !stages_stop) {
+        uint64_t t0 = metrics_now_us();
+        int read_ret;
+        {
+            ProfileScope scope(STAGE_READ);
+            read_ret = mp4read_frame();
+        }
+        if (read_ret == MP4READ_AGAIN) {
+            // The file is still being copied or fragments are still coming
+            waiting.store(true, std::memory_order_relaxed);
+            usleep(DECODER_GROW_POLL_MS * 1000);
+            if (threaded && (unsigned int)(seek_request.load(std::memory_order_acquire) >> 32) != generation) {
+                return false;
+            }
+            continue;
+        }
+        waiting.store(false, std::memory_order_relaxed);
+
+        packet->frame = mp4config.frame.current;
+        if (read_ret != 0) {
+            packet->status = mp4config.frame.current >= mp4config.frame.nsamples ? PACKET_END : PACKET_ERROR;
+            packet->size = 0;
+            return true;
+        }
+        uint64_t t1 = metrics_now_us();
+        PlaybackMetrics::add(metrics->read_time_us, t1 - t0);
+        if (t1 - t0 >= PlaybackMetrics::READ_STALL_US) {
+            PlaybackMetrics::add(metrics->read_stalls, 1);
+            PlaybackMetrics::add(metrics->read_stall_us, t1 - t0);
+        }
+
+        packet->status = PACKET_FRAME;
+        packet->size = mp4config.bitbuf.size;
+        if (threaded) {
+            // mp4read reuses its buffer for the next frame
+            packet->storage.assign(mp4config.bitbuf.data, mp4config.bitbuf.data + mp4config.bitbuf.size);
+            packet->data = packet->storage.empty() ? NULL : &packet->storage[0];
+        } else {
+            packet->data = mp4config.bitbuf.data;
+        }
+        return true;
+    }
+    return false;
+}
+
+int Decoder::seek_indexed(unsigned long frame, unsigned int generation) {
+    int ret;
+    while ((ret = mp4read_seek(frame)) == MP4READ_AGAIN && !stop_flag && !stages_stop) {
+        // A fragmented file still being copied: the fragment is still to come
+        waiting.store(true, std::memory_order_relaxed);
+        usleep(DECODER_GROW_POLL_MS * 1000);
+        if (threaded && (unsigned int)(seek_request.load(std::memory_order_acquire) >> 32) != generation) {
+            break;
+        }
+    }
+    waiting.store(false, std::memory_order_relaxed);
+    return ret;
+}
+
+void Decoder::read_stage() {
+    energy_name_thread("lark-read");
+    uint64_t cpu_us = thread_cpu_us();
+    unsigned int generation = 0;
+    bool seek_failed = false;
+    bool ended = false;
+    Packet* packet = NULL;
+
+    // mp4read is used from this thread only while it runs: the decoder
+    // thread holds mp4_mutex and does not touch the reader until joined
+    while (!stages_stop) {
+        uint64_t request = seek_request.load(std::memory_order_acquire);
+        if ((unsigned int)(request >> 32) != generation) {
+            generation = (unsigned int)(request >> 32);
+            seek_failed = seek_indexed((unsigned int)request, generation) != 0;
+            ended = false;
+        }
+        if (ended) {
+            // Nothing more to read unless the decoder seeks back
+            while (sem_wait(&reader_wake) == -1 && errno == EINTR) {}
+            continue;
+        }
+
+        if (!packet) packet = free_packets.pop();
+        if (!packet) continue;
+        if (seek_failed) {
+            packet->status = PACKET_ERROR;
+            packet->frame = (unsigned int)request;
+            packet->size = 0;
+        } else if (!read_packet(packet, generation)) {
+            continue;
+        }
+        packet->generation = generation;
+        ended = packet->status != PACKET_FRAME;
+        packet_queue.push(packet);
+        packet = NULL;
+        account_stage(PIPELINE_READ, &cpu_us);
+    }
+}
+
+Packet* Decoder::next_packet() {
+    if (!threaded) {
+        return read_packet(&inline_packet, 0) ? &inline_packet : NULL;
+    }
+    while (!stop_flag) {
+        Packet* packet = packet_queue.pop();
+        if (!packet) continue;
+        if (packet->generation == read_generation) return packet;
+        // Read before the last seek
+        free_packets.push(packet);
+    }
+    return NULL;
+}
+
+void Decoder::recycle_packet(Packet* packet) {
+    if (threaded) free_packets.push(packet);
+}
+
+bool Decoder::seek_source(unsigned long frame) {
+    if (!threaded) return seek_indexed(frame, 0) == 0;
+    // Failures come back as a PACKET_ERROR in the new generation
+    read_generation++;
+    seek_request.store(((uint64_t)read_generation << 32) | (uint32_t)frame, std::memory_order_release);
+    sem_post(&reader_wake);
+    return true;
+}
+
+// =================================================================================
+// DSP and output stages
+// =================================================================================
+
+bool Decoder::start_stages() {
+    stages_stop = false;
+    output_failed = false;
+    metrics->pipeline_threads.store(threaded ? PIPELINE_STAGE_COUNT : 1, std::memory_order_relaxed);
+    if (!threaded) return true;
+
+    packet_queue.reset();
+    free_packets.reset();
+    pcm_queue.reset();
+    filtered_queue.reset();
+    free_blocks.reset();
+    sem_destroy(&reader_wake);
+    sem_init(&reader_wake, 0, 0);
+    for (size_t i = 0; i < packets.size(); i++) free_packets.push(&packets[i]);
+    for (size_t i = 0; i < blocks.size(); i++) free_blocks.push(&blocks[i]);
+    seek_request = 0;
+    read_generation = 0;
+
+    if (pthread_create(&read_thread, NULL, read_thread_func, this) != 0) {
+        LOG_E("Decoder: Failed to create read thread: %s\n", strerror(errno));
+        read_thread = 0;
+        return false;
+    }
+    if (pthread_create(&dsp_thread, NULL, dsp_thread_func, this) != 0) {
+        LOG_E("Decoder: Failed to create DSP thread: %s\n", strerror(errno));
+        dsp_thread = 0;
+        return false;
+    }
+    if (pthread_create(&output_thread, NULL, output_thread_func, this) != 0) {
+        LOG_E("Decoder: Failed to create output thread: %s\n", strerror(errno));
+        output_thread = 0;
+        return false;
+    }
+    return true;
+}
+
+void Decoder::finish_stages(bool drain) {
+    if (!threaded) return;
+
+    // At the end of the file, let everything queued reach the pipe first
+    bool drained = false;
+    if (drain && dsp_thread != 0 && output_thread != 0) {
+        PcmBlock* block = NULL;
+        while (!block && !stop_flag) block = free_blocks.pop();
+        if (block) {
+            block->samples = 0;
+            block->last = true;
+            pcm_queue.push(block);
+            drained = true;
+        }
+    }
+
+    stages_stop = true;
+    sem_post(&reader_wake);
+    free_packets.wake();
+    if (!drained) {
+        pcm_queue.wake();
+        filtered_queue.wake();
+    }
+    if (read_thread != 0) {
+        pthread_join(read_thread, NULL);
+        read_thread = 0;
+    }
+    if (dsp_thread != 0) {
+        pthread_join(dsp_thread, NULL);
+        dsp_thread = 0;
+    }
+    if (output_thread != 0) {
+        pthread_join(output_thread, NULL);
+        output_thread = 0;
+    }
+    waiting.store(false, std::memory_order_relaxed);
+}
+
+bool Decoder::emit(const int16_t* pcm, size_t samples, unsigned int channels, uint64_t timeline_end) {
+    if (speed == 1.0f) return emit_pcm(pcm, samples, channels, timeline_end);
+
+    // Stretched ahead of the DSP stage, so that fades and the EQ run on
+    // output time. The stretch lags by a segment; the timeline does not.
+    if (channels != stretch_channels) {
+        stretch.configure(out_rate, channels, speed);
+        stretch_channels = channels;
+    }
+    size_t frames;
+    {
+        ProfileScope scope(STAGE_STRETCH);
+        frames = stretch.process(pcm, samples / channels, &stretch_pcm);
+    }
+    if (frames == 0) return true;
+    return emit_pcm(&stretch_pcm[0], frames * channels, channels, timeline_end);
+}
+
+bool Decoder::emit_pcm(const int16_t* pcm, size_t samples, unsigned int channels, uint64_t timeline_end) {
+    emitted_frames.fetch_add(samples / channels, std::memory_order_relaxed);
+    if (!threaded) {
+        if (!write_pcm(pcm, samples, channels)) return false;
+        if (timeline_end > 0) written_samples.store(timeline_end, std::memory_order_relaxed);
+        return true;
+    }
+
+    while (samples > 0) {
+        PcmBlock* block = NULL;
+        while (!block) {
+            if (stop_flag || output_failed) return false;
+            block = free_blocks.pop();
+        }
+        size_t n = samples < block->pcm.size() ? samples : block->pcm.size();
+        n -= n % channels;
+        memcpy(&block->pcm[0], pcm, n * sizeof(int16_t));
+        block->samples = n;
+        block->channels = channels;
+        block->timeline_end = n == samples ? timeline_end : 0;
+        block->last = false;
+        pcm_queue.push(block);
+        pcm += n;
+        samples -= n;
+    }
+    return true;
+}
+
+bool Decoder::emit_cue(const int16_t* pcm, uint64_t begin, uint64_t from, uint64_t to, unsigned int channels,
+                       uint64_t fade_in, uint64_t fade_out, uint64_t fade) {
+    cue_pcm.assign(pcm + (from - begin) * channels, pcm + (to - begin) * channels);
+    int16_t* out = &cue_pcm[0];
+    if (fade_in != CUE_NO_FADE && from < fade_in + fade) {
+        uint64_t ramp_to = to < fade_in + fade ? to : fade_in + fade;
+        pcm_kernels().gain_ramp(out, ramp_to - from, channels,
+                                (float)(from - fade_in) / fade, (float)(ramp_to - fade_in) / fade);
+    }
+    if (fade_out != CUE_NO_FADE && to + fade > fade_out) {
+        uint64_t ramp_from = from + fade > fade_out ? from : fade_out - fade;
+        pcm_kernels().gain_ramp(out + (ramp_from - from) * channels, to - ramp_from, channels,
+                                (float)(fade_out - ramp_from) / fade, (float)(fade_out - to) / fade);
+    }
+    return emit(out, cue_pcm.size(), channels, to);
+}
+
+void Decoder::dsp_stage() {
+    energy_name_thread("lark-dsp");
+    realtime_enter_thread("dsp");
+    uint64_t cpu_us = thread_cpu_us();
+    while (true) {
+        PcmBlock* block = pcm_queue.pop();
+        if (!block) {
+            if (stop_flag || stages_stop) break;
+            continue;
+        }
+        // The block belongs to the next stage once pushed
+        bool last = block->last;
+        if (!last && !output_failed && needs_filter()) {
+            filter_pcm(&block->pcm[0], block->samples, block->channels);
+        }
+        filtered_queue.push(block);
+        account_stage(PIPELINE_DSP, &cpu_us);
+        if (last) break;
+    }
+}
+
+void Decoder::output_stage() {
+    energy_name_thread("lark-output");
+    realtime_enter_thread("output");
+    uint64_t cpu_us = thread_cpu_us();
+    while (true) {
+        PcmBlock* block = filtered_queue.pop();
+        if (!block) {
+            if (stop_flag || stages_stop) break;
+            continue;
+        }
+        bool last = block->last;
+        if (!last && !output_failed) {
+            if (output_pcm(&block->pcm[0], block->samples)) {
+                if (block->timeline_end > 0) written_samples.store(block->timeline_end, std::memory_order_relaxed);
+            } else {
+                // Keep recycling so the decoder sees the flag instead of a full pool
+                output_failed = true;
+            }
+        }
+        free_blocks.push(block);
+        account_stage(PIPELINE_OUTPUT, &cpu_us);
+        if (last) break;
+    }
+}
+
+void Decoder::decode_loop() {
+    LOG_I("Decoder: Starting for %s\n", current_filepath.c_str());
+    energy_name_thread("lark-decoder");
+    metrics->realtime_mode.store(realtime_enter_thread("decoder"), std::memory_order_relaxed);
+    bool lock_memory = realtime_config().lock_memory;
+
+    std::lock_guard<std::mutex> lock(mp4_mutex);
+
+    // Initialize MP4 reader (parses atoms, seeks, etc.)
+    if (mp4read_open(const_cast<char*>(current_filepath.c_str())) != 0) {
+        LOG_E("Decoder: Failed to open file with mp4read: %s\n", current_filepath.c_str());
+        exit_state_value = EXIT_FAILED;
+        return;
+    }
+    // Packet copies sized for the largest frame of the sample table, so that
+    // the read stage does not reallocate (frames of a growing file indexed
+    // later may still be larger)
+    for (size_t i = 0; i < packets.size(); i++) {
+        packets[i].storage.reserve(mp4config.frame.maxsize);
+    }
+    if (lock_memory) {
+        // Frame table and frame buffer: touched on every frame
+        mp4read_lock_memory(1);
+        realtime_lock(&out_buffer[0], out_buffer.size() * sizeof(int16_t));
+        for (size_t i = 0; i < blocks.size(); i++) {
+            realtime_lock(&blocks[i].pcm[0], blocks[i].pcm.size() * sizeof(int16_t));
+        }
+    }
+
+    // Initialize FAAD2
+    unsigned long samplerate;
+    unsigned char channels;
+    NeAACDecHandle hDecoder = open_faad(&samplerate, &channels);
+    if (!hDecoder) {
+        mp4read_close();
+        exit_state_value = EXIT_FAILED;
+        return;
+    }
+    LOG_I("Decoder: Starting for %lu %d\n", samplerate, channels);
+    out_rate = samplerate;
+    // Everything past the decoder is mono or stereo
+    if (channels > 2) channels = 2;
+
+    unsigned long samples_per_frame = 1024;
+    if (mp4config.frame.nsamples > 0 && mp4config.samples > 0) {
+         samples_per_frame = mp4config.samples / mp4config.frame.nsamples;
+    }
+
+    // Output position (per channel) of the next decoded frame, and the
+    // sample where output starts (earlier samples of the frame are dropped)
+    uint64_t frame_start = 0;
+    uint64_t output_start = 0;
+
+    // A/B loop bounds in samples; the crossfade is taken from the end of the region
+    uint64_t loop_a = 0, loop_b = 0, loop_xfade = 0;
+    unsigned int loop_channels = channels > 0 ? channels : 2;
+    bool looping = loop_b_ns > loop_a_ns;
+    bool loop_cached = false;
+    loop_pcm.clear();
+    // The previous capture is replaced (or was shed) either way
+    size_t previous_cache = loop_cache_bytes.exchange(0);
+    if (previous_cache > 0) cache_manager().release(loop_cache_id, previous_cache);
+    drop_loop_cache = false;
+
+    // Seek if requested. The seeks wait for frames of a growing file that
+    // are not indexed yet, like the read stage, until stopped.
+    stages_stop = false;
+    unsigned int generation = (unsigned int)(seek_request.load(std::memory_order_acquire) >> 32);
+    if (looping) {
+        loop_a = (uint64_t)loop_a_ns * samplerate / DECODER_SECOND;
+        loop_b = (uint64_t)loop_b_ns * samplerate / DECODER_SECOND;
+        loop_xfade = (uint64_t)samplerate * AB_LOOP_CROSSFADE_MS / 1000;
+        if (loop_b - loop_a < 2 * loop_xfade) loop_xfade = 0;
+
+        // Start one frame early: the first frame after a seek only primes
+        // the decoder's overlap buffer
+        unsigned long target_frame = loop_a / samples_per_frame;
+        if (target_frame > 0) target_frame--;
+        if (seek_indexed(target_frame, generation) != 0) {
+            LOG_W("Decoder: Failed to seek to loop start (frame %lu)\n", target_frame);
+            looping = false;
+            seek_past_end(loop_a, samples_per_frame, &frame_start, &output_start);
+        } else {
+            frame_start = (uint64_t)target_frame * samples_per_frame;
+            output_start = loop_a;
+            size_t cache_bytes = (loop_b - loop_a) * loop_channels * sizeof(int16_t);
+            loop_cached = cache_manager().reserve(loop_cache_id, cache_bytes);
+            if (loop_cached) {
+                loop_cache_bytes = cache_bytes;
+                loop_pcm.reserve((loop_b - loop_a) * loop_channels);
+            } else {
+                // No room: decode the region again on every pass, without
+                // the crossfade (it needs the head of the region)
+                loop_xfade = 0;
+            }
+            LOG_I("Decoder: A/B loop %llu-%llu samples%s\n",
+                  (unsigned long long)loop_a, (unsigned long long)loop_b, loop_cached ? "" : " (uncached)");
+        }
+    } else {
+        // Start one frame early for the same reason, and drop the samples
+        // before the requested position
+        uint64_t start_sample = (uint64_t)this->start_ns * samplerate / DECODER_SECOND;
+        unsigned long target_frame = start_sample / samples_per_frame;
+        if (target_frame > 0) target_frame--;
+        if (seek_indexed(target_frame, generation) == 0) {
+            frame_start = (uint64_t)target_frame * samples_per_frame;
+            output_start = start_sample;
+            if (start_sample > 0) {
+                LOG_I("Decoder: Seeked to sample %llu (frame %lu)\n",
+                      (unsigned long long)start_sample, target_frame);
+            }
+        } else {
+            LOG_W("Decoder: Failed to seek to frame %lu\n", target_frame);
+            seek_past_end(start_sample, samples_per_frame, &frame_start, &output_start);
+        }
+    }
+
+    int fd = open(pipe_path.c_str(), O_WRONLY);
+    if (fd == -1) {
+        LOG_E("Decoder: Failed to open pipe: %s\n", strerror(errno));
+        NeAACDecClose(hDecoder);
+        mp4read_close();
+        exit_state_value = EXIT_FAILED;
+        return;
+    }
+
+#ifdef F_GETPIPE_SZ
+    int pipe_size = fcntl(fd, F_GETPIPE_SZ);
+    if (pipe_size > 0) {
+        metrics->buffer_capacity.store((uint32_t)pipe_size, std::memory_order_relaxed);
+    }
+#endif
+    first_write = true;
+    pipe_fd = fd;
+    bool stages_ok = start_stages();
+    uint64_t cpu_us = thread_cpu_us();
+    uint64_t wall_us = metrics_now_us();
+
+    // Replay position in loop_pcm once the loop region is cached (-1 before)
+    long long replay_pos = -1;
+    if (looping) written_samples = ~0ULL;
+
+    // Substituted for frames FAAD2 fails to decode, so that the timeline
+    // (and the position reported by the clock) never drifts
+    unsigned int last_channels = channels > 0 ? channels : 2;
+    std::vector<int16_t> silence(samples_per_frame * 2 * last_channels, 0);
+    // FAAD2 has produced output since it was opened or restarted. The first
+    // frame only primes it and yields nothing, so it is not replaced.
+    bool primed = false;
+
+    // Surround to stereo, rebuilt when the channel layout changes
+    std::vector<float> downmix_matrix;
+    std::vector<int16_t> downmix_pcm(samples_per_frame * 2 * 2);
+    unsigned int downmix_channels = 0;
+    bool end_of_file = false;
+
+    // Cue/review: the snippet being played, [cue_start, cue_start + cue_len),
+    // and where playback resumed after the last one (faded in from there)
+    uint64_t total_samples = mp4config.samples;
+    uint64_t cue_len = (uint64_t)samplerate * CUE_SNIPPET_MS / 1000;
+    uint64_t cue_fade = (uint64_t)samplerate * CUE_FADE_MS / 1000;
+    if (cue_fade == 0) cue_fade = 1;
+    bool cueing = false;
+    uint64_t cue_start = 0;
+    uint64_t cue_fade_in = CUE_NO_FADE;
+    uint64_t resume_fade_in = CUE_NO_FADE;
+
+    while (!stop_flag && stages_ok) {
+        uint64_t now_us = metrics_now_us();
+        PlaybackMetrics::add(metrics->pipeline_us, now_us - wall_us);
+        wall_us = now_us;
+        account_stage(PIPELINE_DECODE, &cpu_us);
+
+        if (drop_loop_cache.exchange(false) && loop_cached) {
+            // Shed under memory pressure: keep looping, from the file
+            if (lock_memory && !loop_pcm.empty()) {
+                realtime_unlock(&loop_pcm[0], loop_pcm.size() * sizeof(int16_t));
+            }
+            std::vector<int16_t>().swap(loop_pcm);
+            loop_cached = false;
+            loop_xfade = 0;
+            if (replay_pos >= 0) {
+                hDecoder = (NeAACDecHandle)restart_at(hDecoder, loop_a + replay_pos, samples_per_frame, &frame_start, &output_start);
+                primed = false;
+                replay_pos = -1;
+                if (!hDecoder) break;
+            }
+            LOG_I("Decoder: A/B loop cache dropped, looping from the file\n");
+        }
+        if (replay_pos >= 0) {
+            // Serve the loop from cached PCM: no file I/O, no FAAD2.
+            // One iteration is [0, L - xfade), where the head already holds
+            // the crossfade from the tail.
+            uint64_t loop_len = (loop_pcm.size() / loop_channels) - loop_xfade;
+            uint64_t chunk = loop_len - replay_pos;
+            if (chunk > AB_LOOP_CHUNK_SAMPLES) chunk = AB_LOOP_CHUNK_SAMPLES;
+            if (!emit(&loop_pcm[replay_pos * loop_channels], chunk * loop_channels, loop_channels, 0)) break;
+            replay_pos += chunk;
+            if ((uint64_t)replay_pos >= loop_len) {
+                replay_pos = 0;
+                cache_manager().touch(loop_cache_id);
+            }
+            continue;
+        }
+
+        // Next frame from the MP4 container
+        Packet* packet = next_packet();
+        if (!packet) break;
+        if (packet->status != PACKET_FRAME) {
+            PacketStatus status = packet->status;
+            unsigned int failed_frame = packet->frame;
+            recycle_packet(packet);
+            // End of file or error. A loop running past the end of the
+            // book keeps what was captured.
+            if (looping && loop_cached && !loop_pcm.empty()) {
+                loop_b = loop_a + loop_pcm.size() / loop_channels;
+                if (loop_b - loop_a < 2 * loop_xfade) loop_xfade = 0;
+                finish_loop_capture(loop_channels, loop_xfade);
+                replay_pos = 0;
+                continue;
+            }
+            if (looping && !loop_cached && frame_start > loop_a) {
+                hDecoder = (NeAACDecHandle)restart_at(hDecoder, loop_a, samples_per_frame, &frame_start, &output_start);
+                primed = false;
+                if (!hDecoder) break;
+                continue;
+            }
+            end_of_file = status == PACKET_END;
+            if (!end_of_file) {
+                LOG_E("Decoder: Failed to read frame %u\n", failed_frame);
+            }
+            break;
+        }
+
+        uint64_t t1 = metrics_now_us();
+        NeAACDecFrameInfo frameInfo;
+        void* sample_buffer;
+        {
+            ProfileScope scope(STAGE_DECODE);
+            sample_buffer = NeAACDecDecode(hDecoder, &frameInfo,
+                                           const_cast<unsigned char*>(packet->data),
+                                           packet->size);
+        }
+        metrics->decode_time.record(metrics_now_us() - t1);
+        recycle_packet(packet);
+
+        const int16_t* pcm = (const int16_t*)sample_buffer;
+        if (frameInfo.error > 0) {
+             PlaybackMetrics::add(metrics->faad_errors, 1);
+             LOG_W("Decoder: FAAD Warning: %s\n", NeAACDecGetErrorMessage(frameInfo.error));
+             // One frame of silence in place of the broken one
+             if (primed) {
+                 pcm = &silence[0];
+                 frameInfo.samples = samples_per_frame * last_channels;
+                 frameInfo.channels = (unsigned char)last_channels;
+                 if (frameInfo.samples > silence.size()) frameInfo.samples = silence.size();
+             } else {
+                 frameInfo.samples = 0;
+             }
+        } else {
+            PlaybackMetrics::add(metrics->frames_decoded, 1);
+            if (frameInfo.samples > 0) primed = true;
+        }
+
+        if (frameInfo.samples == 0) continue;
+
+        // frameInfo.samples is the total number of samples (channels * samples_per_channel)
+        // We configured FAAD_FMT_16BIT, so each sample is 2 bytes (int16_t).
+        unsigned int ch = frameInfo.channels > 0 ? frameInfo.channels : channels;
+        if (ch > 2) {
+            size_t frames = frameInfo.samples / ch;
+            if (ch != downmix_channels) {
+                downmix_matrix.resize(2 * ch);
+                pcm_stereo_downmix_matrix(frameInfo.channel_position, ch, &downmix_matrix[0]);
+                downmix_channels = ch;
+            }
+            if (downmix_pcm.size() < frames * 2) downmix_pcm.resize(frames * 2);
+            pcm_kernels().downmix(pcm, &downmix_pcm[0], frames, ch, 2, &downmix_matrix[0]);
+            pcm = &downmix_pcm[0];
+            ch = 2;
+            frameInfo.samples = frames * 2;
+        }
+        last_channels = ch;
+        out_channels = ch;
+        uint64_t begin = frame_start;
+        uint64_t end = begin + frameInfo.samples / ch;
+        frame_start = end;
+        uint64_t from = begin > output_start ? begin : output_start;
+
+        if (looping) {
+            uint64_t to = end < loop_b ? end : loop_b;
+            if (from >= to) continue;
+            if (loop_cached) {
+                if (loop_pcm.empty()) loop_channels = ch;
+                loop_pcm.insert(loop_pcm.end(), pcm + (from - begin) * ch, pcm + (to - begin) * ch);
+            }
+
+            // The crossfade tail is held back and mixed into the loop head
+            uint64_t play_to = loop_b - loop_xfade;
+            if (to < play_to) play_to = to;
+            if (from < play_to && !emit(pcm + (from - begin) * ch, (play_to - from) * ch, ch, 0)) break;
+
+            if (to >= loop_b) {
+                if (loop_cached) {
+                    finish_loop_capture(loop_channels, loop_xfade);
+                    replay_pos = 0;
+                } else {
+                    hDecoder = (NeAACDecHandle)restart_at(hDecoder, loop_a, samples_per_frame, &frame_start, &output_start);
+                    primed = false;
+                    if (!hDecoder) break;
+                }
+            }
+            continue;
+        }
+
+        if (from >= end) continue;
+        int cue = cue_request.load(std::memory_order_relaxed);
+        if (!cueing && cue != 0) {
+            // Snippets start here; what was emitted plays out first
+            cueing = true;
+            cue_start = from;
+            cue_fade_in = CUE_NO_FADE;
+            publish_cue_anchor(cue_start);
+        } else if (cueing && cue == 0 && end + cue_fade <= cue_start + cue_len) {
+            // Released before the fade-out: carry on from here
+            cueing = false;
+            resume_fade_in = cue_fade_in;
+        }
+        if (!cueing) {
+            bool ok;
+            if (resume_fade_in != CUE_NO_FADE && from < resume_fade_in + cue_fade) {
+                ok = emit_cue(pcm, begin, from, end, ch, resume_fade_in, CUE_NO_FADE, cue_fade);
+            } else {
+                resume_fade_in = CUE_NO_FADE;
+                ok = emit(pcm + (from - begin) * ch, (end - from) * ch, ch, end);
+            }
+            if (!ok) break;
+            continue;
+        }
+
+        uint64_t cue_end = cue_start + cue_len;
+        uint64_t to = end < cue_end ? end : cue_end;
+        if (from < to && !emit_cue(pcm, begin, from, to, ch, cue_fade_in, cue_end, cue_fade)) break;
+        if (to < cue_end) continue;
+
+        if (cue == 0) {
+            // Released during the fade-out: resume after the snippet
+            cueing = false;
+            resume_fade_in = cue_end;
+            if (to < end && !emit_cue(pcm, begin, to, end, ch, cue_end, CUE_NO_FADE, cue_fade)) break;
+            continue;
+        }
+
+        // Jump through the frame index to the next snippet; the frames in
+        // between are never read. At either end of the book the snippet
+        // nearest to it repeats.
+        int64_t target = (int64_t)cue_start + (int64_t)cue * (int64_t)cue_len;
+        int64_t last = (int64_t)total_samples - (int64_t)(2 * cue_len);
+        if (target > last) target = last;
+        if (target < 0) target = 0;
+        hDecoder = (NeAACDecHandle)restart_at(hDecoder, (uint64_t)target, samples_per_frame, &frame_start, &output_start);
+        primed = false;
+        if (!hDecoder) break;
+        cue_start = (uint64_t)target;
+        cue_fade_in = cue_start;
+        publish_cue_anchor(cue_start);
+    }
+
+    // Let the stages drain at the end of the file, stop them otherwise
+    finish_stages(end_of_file);
+    if (output_failed) end_of_file = false;
+    account_stage(PIPELINE_DECODE, &cpu_us);
+    PlaybackMetrics::add(metrics->pipeline_us, metrics_now_us() - wall_us);
+
+    if (end_of_file) {
+        exit_state_value = EXIT_END_OF_FILE;
+    } else {
+        exit_state_value = stop_flag ? EXIT_STOPPED : EXIT_FAILED;
+    }
+
+    close(fd);
+    pipe_fd = -1;
+    if (hDecoder) NeAACDecClose(hDecoder);
+    if (lock_memory) {
+        mp4read_lock_memory(0);
+        realtime_unlock(&out_buffer[0], out_buffer.size() * sizeof(int16_t));
+        for (size_t i = 0; i < blocks.size(); i++) {
+            realtime_unlock(&blocks[i].pcm[0], blocks[i].pcm.size() * sizeof(int16_t));
+        }
+        if (!loop_pcm.empty()) {
+            realtime_unlock(&loop_pcm[0], loop_pcm.size() * sizeof(int16_t));
+        }
+    }
+    mp4read_close();
+    if (!looping) {
+        std::vector<int16_t>().swap(loop_pcm);
+    }
+    LOG_I("Decoder: Thread exiting.\n");
+}
+
+bool Decoder::needs_filter() {
+    int request = fade_request_ms.exchange(0, std::memory_order_relaxed);
+    if (request > 0) {
+        fade_total = (uint64_t)request * out_rate / 1000;
+        if (fade_total == 0) fade_total = 1;
+        fade_pos = 0;
+        fading = true;
+    } else if (request < 0) {
+        fading = false;
+    }
+    return fading || eq->enabled();
+}
+
+void Decoder::filter_pcm(int16_t* pcm, size_t samples, unsigned int channels) {
+    ProfileScope scope(STAGE_EQ);
+    size_t frames = samples / channels;
+    uint64_t t0 = metrics_now_us();
+    if (eq->process(pcm, frames, channels, out_rate)) {
+        PlaybackMetrics::add(metrics->eq_time_us, metrics_now_us() - t0);
+        PlaybackMetrics::add(metrics->eq_audio_us, (uint64_t)frames * 1000000 / out_rate);
+    }
+    if (fading) {
+        apply_fade(pcm, samples, channels);
+    }
+}
+
+bool Decoder::output_pcm(const int16_t* pcm, size_t samples) {
+    // Bytes still queued in the pipe; an empty pipe after the first
+    // write means the sink has drained everything we gave it.
+    int queued = 0;
+    if (ioctl(pipe_fd, FIONREAD, &queued) == 0) {
+        metrics->buffer_fill.store((uint32_t)queued, std::memory_order_relaxed);
+        metrics->last_write_us.store(metrics_now_us(), std::memory_order_relaxed);
+        if (queued == 0 && !first_write) {
+            PlaybackMetrics::add(metrics->underruns, 1);
+        }
+    }
+
+    ProfileScope scope(STAGE_OUTPUT);
+    const char* data = (const char*)pcm;
+    size_t to_write = samples * sizeof(int16_t);
+    writing.store(true, std::memory_order_relaxed);
+    while (to_write > 0) {
+        ssize_t written = write(pipe_fd, data, to_write);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            if (errno != EPIPE) {
+                LOG_E("Decoder: write error: %s\n", strerror(errno));
+            }
+            // EPIPE: reader closed pipe, expected during stop
+            writing.store(false, std::memory_order_relaxed);
+            return false;
+        }
+        data += written;
+        to_write -= written;
+        bytes_out.fetch_add((uint64_t)written, std::memory_order_relaxed);
+    }
+    writing.store(false, std::memory_order_relaxed);
+
+    if (first_write) {
+        metrics->seek_latency.record(metrics_now_us() - start_request_us);
+        first_write = false;
+    }
+    return true;
+}
+
+bool Decoder::write_pcm(const int16_t* pcm, size_t samples, unsigned int channels) {
+    if (!needs_filter()) return output_pcm(pcm, samples);
+
+    // Filtered in a copy: the source may be the A/B loop cache
+    size_t chunk = out_buffer.size() / channels * channels;
+    while (samples > 0) {
+        size_t n = samples < chunk ? samples : chunk;
+        memcpy(&out_buffer[0], pcm, n * sizeof(int16_t));
+        filter_pcm(&out_buffer[0], n, channels);
+        if (!output_pcm(&out_buffer[0], n)) return false;
+        pcm += n;
+        samples -= n;
+    }
+    return true;
+}
+
+void Decoder::apply_fade(int16_t* pcm, size_t samples, unsigned int channels) {
+    size_t frames = samples / channels;
+
+    // Linear ramp, silence once the fade is complete
+    size_t ramp = 0;
+    if (fade_pos < fade_total) {
+        ramp = fade_total - fade_pos < frames ? (size_t)(fade_total - fade_pos) : frames;
+        float from = 1.0f - (float)fade_pos / fade_total;
+        float to = 1.0f - (float)(fade_pos + ramp) / fade_total;
+        pcm_kernels().gain_ramp(pcm, ramp, channels, from, to);
+        fade_pos += ramp;
+    }
+    if (ramp < frames) {
+        memset(pcm + ramp * channels, 0, (frames - ramp) * channels * sizeof(int16_t));
+    }
+}
+
+void Decoder::finish_loop_capture(unsigned int channels, uint64_t xfade) {
+    // Mix the last xfade samples of the region into its head with a linear
+    // crossfade, so that looping from the tail back to A is click-free.
+    size_t len = loop_pcm.size() / channels;
+    if (xfade == 0 || len < 2 * xfade) return;
+
+    int16_t* head = &loop_pcm[0];
+    const int16_t* tail = &loop_pcm[(len - xfade) * channels];
+    // Head weight (i + 0.5) / xfade for frame i
+    pcm_kernels().mix(tail, head, head, xfade, channels, 0.5f / xfade, (xfade + 0.5f) / xfade);
+    realtime_lock(&loop_pcm[0], loop_pcm.size() * sizeof(int16_t));
+    LOG_I("Decoder: A/B loop cached (%lu samples), replaying from memory\n", (unsigned long)len);
+}
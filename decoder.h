@@ -0,0 +1,248 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <glib.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "audio_pipeline.h"
+#include "playback_metrics.h"
+#include "speech_eq.h"
+#include "time_stretch.h"
+
+// Timeline positions are in nanoseconds (same unit as GST_SECOND), but the
+// decoder itself does not depend on GStreamer.
+#define DECODER_SECOND ((guint64)1000000000ULL)
+
+// A/B loop: the region is decoded once, then replayed from memory
+#define AB_LOOP_CROSSFADE_MS 20
+#define AB_LOOP_MAX_SECONDS 60
+#define AB_LOOP_CHUNK_SAMPLES 4096
+
+// Pipelined audio path: compressed frames queued between read and decode
+// (~370 ms at 44.1 kHz, rides out slow reads) and PCM blocks in flight
+// between decode, DSP and output
+#define PIPELINE_PACKETS 16
+#define PIPELINE_BLOCKS 6
+#define PIPELINE_PACKET_BYTES 4096
+#define PIPELINE_BLOCK_SAMPLES (AB_LOOP_CHUNK_SAMPLES * 2)
+
+// Cue/review: CUE_SNIPPET_MS of audio for every rate * CUE_SNIPPET_MS of
+// book time, faded in and out at the jumps
+#define CUE_SNIPPET_MS 200
+#define CUE_FADE_MS 8
+#define CUE_MIN_RATE 2
+#define CUE_MAX_RATE 16
+#define CUE_NO_FADE UINT64_MAX
+// Snippet starts remembered to map output back to book time: enough for
+// the PCM queued in the stages and the pipe
+#define CUE_ANCHORS 8
+
+// Named pipe the decoder writes PCM into (read by the GStreamer filesrc)
+extern const char* PIPE_PATH;
+
+// Global mutex to protect the non-reentrant mp4read library
+extern std::mutex mp4_mutex;
+
+// --- Decoder Class ---
+// Reads, decodes, filters (speech EQ, fades) and writes PCM into the pipe.
+// With pipeline_threaded() each of those is a stage on its own thread,
+// connected by StageQueues of pooled buffers; otherwise the decoder thread
+// runs them serially. Seeks within a run (uncached A/B loop) go to the read
+// stage as a request; packets read before it are dropped by generation.
+class Decoder {
+public:
+    Decoder(PlaybackMetrics* metrics, SpeechEq* eq, const char* pipe_path = PIPE_PATH);
+    ~Decoder();
+
+    // Start decoding the specified file in a separate thread, with output
+    // beginning at start_ns (sample accurate).
+    // Returns true if thread started successfully.
+    bool start(const char* filepath, gint64 start_ns = 0);
+
+    // Stop the decoding thread.
+    // This sets the stop flag and waits for the thread to join.
+    void stop();
+
+    // Check if the decoder thread is currently running.
+    bool is_running() const;
+
+    // Loop the region [a_ns, b_ns) on the next start(). The first pass is
+    // decoded and cached; later passes are served from the cache, with a
+    // short crossfade at the loop point. Only while stopped: the decoder
+    // thread reads the loop without locking.
+    void set_ab_loop(gint64 a_ns, gint64 b_ns);
+    void clear_ab_loop();
+
+    // Playback speed from the next start(), pitch kept (TimeStretch).
+    // Positions stay in book time; the pipe carries 1 / speed of it. Only
+    // while stopped: the decoder thread reads the speed without locking.
+    void set_speed(float speed);
+    float get_speed() const { return speed; }
+
+    // Cue (rate > 0) or review (rate < 0) in the running decoder: short
+    // snippets, jumping through the frame index between them instead of
+    // decoding everything. 0 returns to normal playback from where the
+    // snippets got to, in the same run. Ignored while looping.
+    void set_cue(int rate);
+    int cue_rate() const { return cue_request.load(std::memory_order_relaxed); }
+    // Book position of the output frame played_frames of this run, once
+    // cue/review was used and that frame is past the first snippet
+    bool cue_position(uint64_t played_frames, gint64* position_ns) const;
+
+    // Ramp the output gain down to silence over the next duration_ms of
+    // decoded audio (picked up by the decoder thread on its next write).
+    // cancel_fade() restores full volume. A new start() also resets it.
+    void start_fade(int duration_ms);
+    void cancel_fade();
+    bool is_fading() const { return fading; }
+
+    // Liveness, polled by the backend watchdog
+    enum ExitState { EXIT_NONE, EXIT_END_OF_FILE, EXIT_STOPPED, EXIT_FAILED };
+    ExitState exit_state() const { return (ExitState)exit_state_value.load(); }
+    // Bytes handed to the pipe since start(); stops advancing when either
+    // the decoder or the sink stalls
+    uint64_t bytes_written() const { return bytes_out.load(std::memory_order_relaxed); }
+    // True while blocked writing to the pipe (the sink is not consuming)
+    bool in_write() const { return writing.load(std::memory_order_relaxed); }
+    // True while waiting for a growing file to receive the next frame
+    bool waiting_for_data() const { return waiting.load(std::memory_order_relaxed); }
+    // Timeline position (ns) of the last sample written, or -1 while looping
+    gint64 written_position() const;
+    unsigned long sample_rate() const { return out_rate; }
+    // Channels of the PCM written for the last decoded frame (FAAD2 may
+    // upmix mono, parametric stereo), 0 before the first one
+    unsigned int output_channels() const { return out_channels; }
+
+private:
+    std::string pipe_path;
+    std::atomic<bool> stop_flag;
+    std::atomic<bool> running;
+    pthread_t thread_id;
+    std::string current_filepath;
+    gint64 start_ns;
+    PlaybackMetrics* metrics;
+    SpeechEq* eq;
+    uint64_t start_request_us;
+    bool first_write;
+
+    std::atomic<int> exit_state_value;
+    std::atomic<uint64_t> bytes_out;
+    std::atomic<bool> writing;
+    std::atomic<bool> waiting;
+    std::atomic<uint64_t> written_samples; // timeline samples per channel, ~0 while looping
+
+    gint64 loop_a_ns;
+    gint64 loop_b_ns;
+    std::vector<int16_t> loop_pcm; // interleaved PCM of the loop region
+
+    // loop_pcm is a CACHE_PRIORITY_NORMAL cache: under memory pressure the
+    // main loop asks for it back and the decoder thread keeps looping from
+    // the file instead
+    int loop_cache_id;
+    std::atomic<size_t> loop_cache_bytes; // accounted to the cache manager
+    std::atomic<bool> drop_loop_cache;
+
+    unsigned long out_rate; // sample rate of the running decoder
+    unsigned int out_channels;
+
+    // Applied to decoded PCM ahead of the DSP stage
+    float speed;
+    TimeStretch stretch;
+    unsigned int stretch_channels; // 0 until configured for this run
+    std::vector<int16_t> stretch_pcm;
+
+    // Pipelined stages (unused when collapsed to one thread)
+    bool threaded;
+    int pipe_fd;
+    std::vector<Packet> packets;
+    std::vector<PcmBlock> blocks;
+    StageQueue<Packet> packet_queue;   // read -> decode
+    StageQueue<Packet> free_packets;   // decode -> read
+    StageQueue<PcmBlock> pcm_queue;    // decode -> DSP
+    StageQueue<PcmBlock> filtered_queue; // DSP -> output
+    StageQueue<PcmBlock> free_blocks;  // output -> decode
+    sem_t reader_wake;                 // seek requests and stop, once the reader reached the end
+    pthread_t read_thread, dsp_thread, output_thread;
+    std::atomic<bool> stages_stop;
+    std::atomic<bool> output_failed;
+    std::atomic<uint64_t> seek_request; // (generation << 32) | frame
+    unsigned int read_generation;       // decode side: generation of the last request
+    Packet inline_packet;               // single thread: points into mp4read's buffer
+
+    // Fade requests from the GUI thread: ms > 0 to start, -1 to cancel
+    std::atomic<int> fade_request_ms;
+    std::atomic<bool> fading;
+    uint64_t fade_total;              // samples per channel
+    uint64_t fade_pos;
+
+    // Cue/review requests from the GUI thread, and where the snippets are
+    std::atomic<int> cue_request;
+    struct CueAnchor {
+        gint64 position_ns;   // book time of the snippet start
+        uint64_t frame;       // output frame it starts at
+    };
+    mutable std::mutex cue_mutex;
+    CueAnchor cue_anchors[CUE_ANCHORS]; // ring, oldest overwritten
+    unsigned int cue_anchor_count;      // published this run
+    std::atomic<uint64_t> emitted_frames; // output frames emitted this run
+    std::vector<int16_t> cue_pcm;   // snippet edges being faded
+
+    // Copy of the PCM being written when it is filtered or faded (the
+    // source may be the A/B loop cache, which must stay intact)
+    std::vector<int16_t> out_buffer;
+
+    static void* thread_func(void* arg);
+    static void* read_thread_func(void* arg);
+    static void* dsp_thread_func(void* arg);
+    static void* output_thread_func(void* arg);
+    static size_t shrink_loop_cache(size_t bytes, void* user_data);
+    void decode_loop();
+
+    // Read stage. read_packet() waits for growing files; false when
+    // stopping or, pipelined, when a seek request arrives meanwhile.
+    // seek_indexed() is mp4read_seek() waiting the same way for a frame
+    // that is not indexed yet (MP4READ_AGAIN when it gave up).
+    void read_stage();
+    bool read_packet(Packet* packet, unsigned int generation);
+    int seek_indexed(unsigned long frame, unsigned int generation);
+    Packet* next_packet(); // decode side, NULL when stopping
+    void recycle_packet(Packet* packet);
+    bool seek_source(unsigned long frame);
+    // Fresh FAAD2 instance and seek, so that output resumes exactly at sample
+    void* restart_at(void* hDecoder, uint64_t sample, unsigned long samples_per_frame,
+                     uint64_t* frame_start, uint64_t* output_start);
+
+    // Hand decoded PCM to the DSP and output stages (or run them inline);
+    // false once the pipe reader is gone. timeline_end: position to
+    // publish once written, 0 for none.
+    bool emit(const int16_t* pcm, size_t samples, unsigned int channels, uint64_t timeline_end);
+    bool emit_pcm(const int16_t* pcm, size_t samples, unsigned int channels, uint64_t timeline_end);
+    // Emit samples [from, to) of a frame starting at begin, fading in over
+    // fade samples from fade_in and out over fade samples up to fade_out
+    // (CUE_NO_FADE for none)
+    bool emit_cue(const int16_t* pcm, uint64_t begin, uint64_t from, uint64_t to, unsigned int channels,
+                  uint64_t fade_in, uint64_t fade_out, uint64_t fade);
+    void publish_cue_anchor(uint64_t sample);
+    bool start_stages();
+    void finish_stages(bool drain);
+    void dsp_stage();
+    void output_stage();
+    void account_stage(PipelineStage stage, uint64_t* last_cpu_us);
+
+    // DSP: pick up fade requests; true if the PCM must be filtered
+    bool needs_filter();
+    void filter_pcm(int16_t* pcm, size_t samples, unsigned int channels);
+    // Output: write interleaved samples to the pipe
+    bool output_pcm(const int16_t* pcm, size_t samples);
+    // Inline DSP and output (single thread)
+    bool write_pcm(const int16_t* pcm, size_t samples, unsigned int channels);
+    void apply_fade(int16_t* pcm, size_t samples, unsigned int channels);
+    void finish_loop_capture(unsigned int channels, uint64_t xfade);
+};
+
+#endif // DECODER_H
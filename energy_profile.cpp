@@ -0,0 +1,226 @@
+#include "energy_profile.h"
+#include "playback_metrics.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char* stage_names[STAGE_COUNT] = {
+    "read", "decode", "eq", "output", "ui", "lipc", "history", "stretch",
+};
+
+static bool load_enabled() {
+    const char* value = getenv("LARK_PROFILE");
+    return value && value[0] && strcmp(value, "0") != 0;
+}
+
+bool energy_profile_enabled() {
+    static const bool enabled = load_enabled();
+    return enabled;
+}
+
+uint64_t thread_cpu_us() {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0;
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+void energy_name_thread(const char* name) {
+    prctl(PR_SET_NAME, name, 0, 0, 0);
+}
+
+// Read "key: value" from a /proc file already loaded into buf
+static uint64_t proc_field(const char* buf, const char* key) {
+    const char* p = strstr(buf, key);
+    if (!p) return 0;
+    p += strlen(key);
+    while (*p == ':' || *p == ' ' || *p == '\t') p++;
+    return strtoull(p, NULL, 10);
+}
+
+static bool read_proc_file(const char* path, char* buf, size_t size) {
+    FILE* f = fopen(path, "r");
+    if (!f) return false;
+    size_t n = fread(buf, 1, size - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    return n > 0;
+}
+
+// Thread names end up in report keys
+static std::string report_name(const std::string& name) {
+    std::string out = name;
+    for (size_t i = 0; i < out.size(); i++) {
+        char c = out[i];
+        bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_';
+        if (!ok) out[i] = '_';
+    }
+    return out;
+}
+
+// =================================================================================
+// EnergyProfiler Implementation
+// =================================================================================
+
+EnergyProfiler::EnergyProfiler()
+    : first_sample_us(0), last_sample_us(0), audio_us(0), ticks_per_second(sysconf(_SC_CLK_TCK)) {
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        stage_cpu_us[i].store(0, std::memory_order_relaxed);
+    }
+    if (ticks_per_second <= 0) ticks_per_second = 100;
+}
+
+bool EnergyProfiler::read_thread(int tid, ThreadState* state) {
+    char path[64];
+    char buf[4096]; // status is ~1.5KB
+
+    snprintf(path, sizeof(path), "/proc/self/task/%d/stat", tid);
+    if (!read_proc_file(path, buf, sizeof(buf))) return false;
+    // The name is in parentheses and may itself contain spaces or ')'
+    char* open_paren = strchr(buf, '(');
+    char* close_paren = strrchr(buf, ')');
+    if (!open_paren || !close_paren || close_paren < open_paren) return false;
+    unsigned long long utime = 0, stime = 0;
+    if (sscanf(close_paren + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+               &utime, &stime) != 2) {
+        return false;
+    }
+    if (tid == getpid()) {
+        state->name = "main"; // GTK main loop: UI, drawing, history
+    } else {
+        state->name = report_name(std::string(open_paren + 1, close_paren - open_paren - 1));
+    }
+    memset(&state->counters, 0, sizeof(state->counters));
+    state->counters.cpu_ticks = utime + stime;
+
+    snprintf(path, sizeof(path), "/proc/self/task/%d/status", tid);
+    if (read_proc_file(path, buf, sizeof(buf))) {
+        state->counters.wakeups = proc_field(buf, "\nvoluntary_ctxt_switches");
+        state->counters.preemptions = proc_field(buf, "nonvoluntary_ctxt_switches");
+    }
+
+    // Needs CONFIG_TASK_IO_ACCOUNTING; counters stay 0 without it
+    snprintf(path, sizeof(path), "/proc/self/task/%d/io", tid);
+    if (read_proc_file(path, buf, sizeof(buf))) {
+        state->counters.read_bytes = proc_field(buf, "rchar");
+        state->counters.write_bytes = proc_field(buf, "wchar");
+        state->counters.disk_read_bytes = proc_field(buf, "\nread_bytes");
+        state->counters.disk_write_bytes = proc_field(buf, "\nwrite_bytes");
+    }
+    return true;
+}
+
+static inline uint64_t delta(uint64_t now, uint64_t before) {
+    return now >= before ? now - before : 0;
+}
+
+void EnergyProfiler::sample(bool playing) {
+    uint64_t now = metrics_now_us();
+    bool baseline = first_sample_us == 0;
+    if (baseline) {
+        first_sample_us = now;
+    } else if (playing) {
+        audio_us += now - last_sample_us;
+    }
+    last_sample_us = now;
+
+    DIR* dir = opendir("/proc/self/task");
+    if (!dir) return;
+
+    std::map<int, ThreadState> current;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        int tid = atoi(entry->d_name);
+        if (tid <= 0) continue;
+
+        ThreadState state;
+        if (!read_thread(tid, &state)) continue;
+        current[tid] = state;
+        // The first sample is only a baseline: startup is not listening
+        if (baseline) continue;
+
+        // A thread seen for the first time started since the last sample:
+        // all of its usage belongs to this interval
+        ThreadCounters before;
+        memset(&before, 0, sizeof(before));
+        std::map<int, ThreadState>::const_iterator prev = threads.find(tid);
+        if (prev != threads.end()) before = prev->second.counters;
+
+        ThreadCounters& total = totals[state.name];
+        total.cpu_ticks += delta(state.counters.cpu_ticks, before.cpu_ticks);
+        total.wakeups += delta(state.counters.wakeups, before.wakeups);
+        total.preemptions += delta(state.counters.preemptions, before.preemptions);
+        total.read_bytes += delta(state.counters.read_bytes, before.read_bytes);
+        total.write_bytes += delta(state.counters.write_bytes, before.write_bytes);
+        total.disk_read_bytes += delta(state.counters.disk_read_bytes, before.disk_read_bytes);
+        total.disk_write_bytes += delta(state.counters.disk_write_bytes, before.disk_write_bytes);
+    }
+    closedir(dir);
+    threads.swap(current);
+}
+
+bool EnergyProfiler::write_report(const std::string& path) const {
+    if (audio_us == 0) return false;
+
+    std::string tmp_path = path + ".tmp";
+    FILE* f = fopen(tmp_path.c_str(), "w");
+    if (!f) return false;
+
+    // Everything below is per hour of audio played
+    const double scale = 3600e6 / (double)audio_us;
+    const double ms_per_tick = 1000.0 / (double)ticks_per_second;
+    fprintf(f, "wall_seconds=%llu\n", (unsigned long long)((last_sample_us - first_sample_us) / 1000000));
+    fprintf(f, "audio_seconds=%llu\n", (unsigned long long)(audio_us / 1000000));
+
+    ThreadCounters sum;
+    memset(&sum, 0, sizeof(sum));
+    uint64_t main_ticks = 0;
+    for (std::map<std::string, ThreadCounters>::const_iterator it = totals.begin(); it != totals.end(); ++it) {
+        const char* name = it->first.c_str();
+        const ThreadCounters& t = it->second;
+        fprintf(f, "thread.%s.cpu_ms=%lld\n", name, (long long)(t.cpu_ticks * ms_per_tick * scale));
+        fprintf(f, "thread.%s.wakeups=%lld\n", name, (long long)(t.wakeups * scale));
+        fprintf(f, "thread.%s.preemptions=%lld\n", name, (long long)(t.preemptions * scale));
+        fprintf(f, "thread.%s.read_kb=%lld\n", name, (long long)(t.read_bytes * scale / 1024));
+        fprintf(f, "thread.%s.write_kb=%lld\n", name, (long long)(t.write_bytes * scale / 1024));
+        fprintf(f, "thread.%s.disk_read_kb=%lld\n", name, (long long)(t.disk_read_bytes * scale / 1024));
+        fprintf(f, "thread.%s.disk_write_kb=%lld\n", name, (long long)(t.disk_write_bytes * scale / 1024));
+        sum.cpu_ticks += t.cpu_ticks;
+        sum.wakeups += t.wakeups;
+        sum.preemptions += t.preemptions;
+        sum.disk_read_bytes += t.disk_read_bytes;
+        sum.disk_write_bytes += t.disk_write_bytes;
+        if (it->first == "main") main_ticks = t.cpu_ticks;
+    }
+
+    uint64_t stage_us[STAGE_COUNT];
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        stage_us[i] = stage_cpu_us[i].load(std::memory_order_relaxed);
+        fprintf(f, "stage.%s.cpu_ms=%lld\n", stage_names[i], (long long)(stage_us[i] * scale / 1000));
+    }
+    // Main thread time outside the measured stages: GTK drawing, layout and
+    // main loop overhead. Approximate: LIPC callbacks may run elsewhere.
+    uint64_t main_stages_us = stage_us[STAGE_UI] + stage_us[STAGE_HISTORY] + stage_us[STAGE_LIPC];
+    double main_other_ms = main_ticks * ms_per_tick - main_stages_us / 1000.0;
+    fprintf(f, "stage.main_other.cpu_ms=%lld\n", (long long)(main_other_ms > 0 ? main_other_ms * scale : 0));
+
+    fprintf(f, "total.cpu_ms=%lld\n", (long long)(sum.cpu_ticks * ms_per_tick * scale));
+    fprintf(f, "total.wakeups=%lld\n", (long long)(sum.wakeups * scale));
+    fprintf(f, "total.preemptions=%lld\n", (long long)(sum.preemptions * scale));
+    fprintf(f, "total.disk_read_kb=%lld\n", (long long)(sum.disk_read_bytes * scale / 1024));
+    fprintf(f, "total.disk_write_kb=%lld\n", (long long)(sum.disk_write_bytes * scale / 1024));
+
+    if (fclose(f) != 0) {
+        remove(tmp_path.c_str());
+        return false;
+    }
+    return rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+EnergyProfiler& energy_profiler() {
+    static EnergyProfiler profiler;
+    return profiler;
+}
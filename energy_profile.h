@@ -0,0 +1,106 @@
+#ifndef ENERGY_PROFILE_H
+#define ENERGY_PROFILE_H
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <stdint.h>
+
+// Pieces of work whose CPU time is measured explicitly (thread CPU time
+// around the call). Everything else is only visible per thread.
+enum ProfileStage {
+    STAGE_READ = 0, // container reads (mp4read)
+    STAGE_DECODE,   // FAAD2
+    STAGE_EQ,       // speech EQ and fades
+    STAGE_OUTPUT,   // writes into the pipe towards GStreamer
+    STAGE_UI,       // periodic UI refresh (widget updates, not the drawing)
+    STAGE_LIPC,     // LIPC callbacks and calls into powerd
+    STAGE_HISTORY,  // position checkpoints
+    STAGE_STRETCH,  // playback speed (time-stretch)
+    STAGE_COUNT,
+};
+
+// Opt-in, read once from the environment: LARK_PROFILE=1
+bool energy_profile_enabled();
+
+// CPU time consumed by the calling thread, in microseconds
+uint64_t thread_cpu_us();
+
+// Name the calling thread (shown in the report and in top -H). Names are
+// truncated to 15 characters by the kernel.
+void energy_name_thread(const char* name);
+
+// --- EnergyProfiler Class ---
+// Attributes the player's resource use to threads and stages, normalized to
+// one hour of audio, so battery work (burst decoding, refresh scheduling...)
+// can be measured on the device.
+//
+// sample() reads /proc/self/task/*/{stat,status,io} for every thread: CPU
+// time, voluntary context switches (each one is a sleep and a wakeup),
+// involuntary ones (preemptions) and I/O bytes. Deltas are accumulated by
+// thread name, so restarted threads (the decoder after a seek) add up.
+// Threads that exit between two samples lose their last interval.
+//
+// Stage counters are atomics updated from any thread through ProfileScope;
+// sampling and the report are for the GTK main loop only.
+class EnergyProfiler {
+public:
+    EnergyProfiler();
+
+    void add_stage(ProfileStage stage, uint64_t cpu_us) {
+        stage_cpu_us[stage].fetch_add(cpu_us, std::memory_order_relaxed);
+    }
+
+    // Take a sample; the time since the previous one counts as audio time
+    // if playing.
+    void sample(bool playing);
+
+    // Rewrite the report atomically (key=value lines, like the stats file)
+    bool write_report(const std::string& path) const;
+
+private:
+    struct ThreadCounters {
+        uint64_t cpu_ticks;
+        uint64_t wakeups;     // voluntary context switches
+        uint64_t preemptions; // involuntary context switches
+        uint64_t read_bytes;  // read()/pread() bytes (page cache included)
+        uint64_t write_bytes;
+        uint64_t disk_read_bytes;
+        uint64_t disk_write_bytes;
+    };
+    struct ThreadState {
+        std::string name;
+        ThreadCounters counters;
+    };
+
+    std::atomic<uint64_t> stage_cpu_us[STAGE_COUNT];
+
+    std::map<int, ThreadState> threads;            // last sample, by tid
+    std::map<std::string, ThreadCounters> totals;  // accumulated, by name
+    uint64_t first_sample_us;
+    uint64_t last_sample_us;
+    uint64_t audio_us;
+    long ticks_per_second;
+
+    static bool read_thread(int tid, ThreadState* state);
+};
+
+EnergyProfiler& energy_profiler();
+
+// Adds the calling thread's CPU time spent in the enclosing scope to a
+// stage. Does nothing (not even a clock read) unless profiling is enabled.
+class ProfileScope {
+public:
+    explicit ProfileScope(ProfileStage stage)
+        : stage(stage), active(energy_profile_enabled()), start_us(active ? thread_cpu_us() : 0) {}
+    ~ProfileScope() {
+        if (active) energy_profiler().add_stage(stage, thread_cpu_us() - start_us);
+    }
+
+private:
+    ProfileStage stage;
+    bool active;
+    uint64_t start_us;
+};
+
+#endif // ENERGY_PROFILE_H
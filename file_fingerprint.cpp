@@ -0,0 +1,151 @@
+#include "file_fingerprint.h"
+#include "logger.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <vector>
+
+// Bytes hashed from the start of moov
+#define FP_MOOV_BYTES (128 * 1024)
+// Blocks sampled across mdat (or the whole file if it is not MP4)
+#define FP_SAMPLE_BLOCKS 4
+#define FP_SAMPLE_BYTES 4096
+// Give up looking for moov/mdat after this many top-level boxes
+#define FP_MAX_BOXES 64
+
+static const uint64_t FP_PRIME1 = 0x9E3779B97F4A7C15ULL;
+static const uint64_t FP_PRIME2 = 0x87C37B91114253D5ULL;
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t fingerprint_hash(const void* data, size_t len, uint64_t seed) {
+    const uint8_t* p = (const uint8_t*)data;
+    uint64_t h = seed ^ (len * FP_PRIME1);
+
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v;
+        memcpy(&v, p + i, 8);
+        h ^= rotl64(v * FP_PRIME2, 31) * FP_PRIME1;
+        h = rotl64(h, 27) * 5 + 0x52DCE729;
+    }
+    uint64_t tail = 0;
+    for (size_t k = 0; i + k < len; k++) {
+        tail |= (uint64_t)p[i + k] << (8 * k);
+    }
+    h ^= rotl64(tail * FP_PRIME2, 31) * FP_PRIME1;
+    return fmix64(h);
+}
+
+bool is_fingerprint_key(const std::string& key) {
+    return key.compare(0, sizeof(FINGERPRINT_PREFIX) - 1, FINGERPRINT_PREFIX) == 0;
+}
+
+static bool read_at(int fd, uint8_t* buf, size_t len, uint64_t offset, size_t* got) {
+    *got = 0;
+    while (*got < len) {
+        ssize_t n = pread(fd, buf + *got, len - *got, (off_t)(offset + *got));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) break;
+        *got += n;
+    }
+    return true;
+}
+
+static uint64_t get_be32(const uint8_t* p) {
+    return ((uint64_t)p[0] << 24) | ((uint64_t)p[1] << 16) | ((uint64_t)p[2] << 8) | p[3];
+}
+
+// Locate a top-level box by walking box headers only. Returns false if the
+// file does not look like MP4 or the box is absent.
+static bool find_box(int fd, uint64_t file_size, const char* type, uint64_t* start, uint64_t* size) {
+    uint64_t pos = 0;
+    for (int i = 0; i < FP_MAX_BOXES && pos + 8 <= file_size; i++) {
+        uint8_t hdr[16];
+        size_t got;
+        if (!read_at(fd, hdr, sizeof(hdr), pos, &got) || got < 8) return false;
+
+        uint64_t box_size = get_be32(hdr);
+        if (box_size == 1) {
+            if (got < 16) return false;
+            box_size = (get_be32(hdr + 8) << 32) | get_be32(hdr + 12);
+        } else if (box_size == 0) {
+            box_size = file_size - pos; // extends to end of file
+        }
+        if (box_size < 8) return false;
+
+        if (memcmp(hdr + 4, type, 4) == 0) {
+            *start = pos;
+            *size = pos + box_size > file_size ? file_size - pos : box_size;
+            return true;
+        }
+        pos += box_size;
+    }
+    return false;
+}
+
+bool file_fingerprint(const std::string& path, std::string* key) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+    uint64_t file_size = (uint64_t)st.st_size;
+
+    std::vector<uint8_t> buf(FP_MOOV_BYTES);
+    uint64_t hash = fingerprint_hash(&file_size, sizeof(file_size), 0);
+    size_t got;
+    bool ok = true;
+
+    uint64_t moov_start, moov_size;
+    if (find_box(fd, file_size, "moov", &moov_start, &moov_size)) {
+        size_t len = moov_size < FP_MOOV_BYTES ? (size_t)moov_size : FP_MOOV_BYTES;
+        ok = read_at(fd, &buf[0], len, moov_start, &got);
+        hash = fingerprint_hash(&buf[0], got, hash);
+    }
+
+    uint64_t region_start, region_size;
+    if (!find_box(fd, file_size, "mdat", &region_start, &region_size)) {
+        region_start = 0;
+        region_size = file_size;
+    }
+    for (int i = 1; ok && i <= FP_SAMPLE_BLOCKS; i++) {
+        uint64_t offset = region_start + region_size * i / (FP_SAMPLE_BLOCKS + 1);
+        ok = read_at(fd, &buf[0], FP_SAMPLE_BYTES, offset, &got);
+        hash = fingerprint_hash(&buf[0], got, hash);
+    }
+    int err = errno;
+    close(fd);
+
+    if (!ok) {
+        LOG_W("Fingerprint: Read error on %s: %s\n", path.c_str(), strerror(err));
+        return false;
+    }
+
+    char text[64];
+    snprintf(text, sizeof(text), FINGERPRINT_PREFIX "%llx:%016llx",
+             (unsigned long long)file_size, (unsigned long long)hash);
+    *key = text;
+    return true;
+}
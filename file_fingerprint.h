@@ -0,0 +1,27 @@
+#ifndef FILE_FINGERPRINT_H
+#define FILE_FINGERPRINT_H
+
+#include <string>
+#include <stdint.h>
+
+// Content identity of a book, independent of where it lives on disk.
+//
+// The fingerprint combines the file size with a fast 64-bit hash of the
+// start of the moov box (track layout, sample tables, metadata) and a few
+// blocks sampled evenly across mdat. Only ~150KB is read whatever the file
+// size, so identifying a book costs a few milliseconds. Files that are not
+// MP4 are sampled across their whole length instead.
+//
+// Keys look like "fp1:<size>:<hash>" (hex) and never start with '/', so
+// they can share maps with legacy path keys.
+#define FINGERPRINT_PREFIX "fp1:"
+
+// Returns false if the file cannot be read.
+bool file_fingerprint(const std::string& path, std::string* key);
+
+bool is_fingerprint_key(const std::string& key);
+
+// Fast non-cryptographic hash (8 bytes per step, murmur3 finalizer)
+uint64_t fingerprint_hash(const void* data, size_t len, uint64_t seed);
+
+#endif // FILE_FINGERPRINT_H
@@ -0,0 +1,605 @@
+#include "history_store.h"
+#include "file_fingerprint.h"
+#include "logger.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+
+// Journal layout:
+//   file header: "LARKHJ1\n"
+//   record:      u32 crc32 | u8 type | u8 reserved | u16 payload length | payload
+// The CRC covers type, reserved, length and payload. All integers are
+// little-endian.
+static const char JOURNAL_MAGIC[8] = { 'L', 'A', 'R', 'K', 'H', 'J', '1', '\n' };
+static const size_t RECORD_HEADER_SIZE = 8;
+
+// Compact once the journal is this large and 4x the live state
+static const uint64_t COMPACT_MIN_BYTES = 64 * 1024;
+
+static uint32_t crc32(const uint8_t* data, size_t len) {
+    static uint32_t table[256];
+    static bool table_ready = false;
+    if (!table_ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        table_ready = true;
+    }
+
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+static void put_u16(std::string& out, uint16_t v) {
+    out.push_back((char)(v & 0xFF));
+    out.push_back((char)(v >> 8));
+}
+
+static void put_u32(std::string& out, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back((char)((v >> (8 * i)) & 0xFF));
+    }
+}
+
+static uint16_t get_u16(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static std::string make_record(uint8_t type, const std::string& payload) {
+    std::string rec;
+    rec.reserve(RECORD_HEADER_SIZE + payload.size());
+    put_u32(rec, 0); // crc placeholder
+    rec.push_back((char)type);
+    rec.push_back(0);
+    put_u16(rec, (uint16_t)payload.size());
+    rec += payload;
+
+    uint32_t crc = crc32((const uint8_t*)rec.data() + 4, rec.size() - 4);
+    for (int i = 0; i < 4; i++) {
+        rec[i] = (char)((crc >> (8 * i)) & 0xFF);
+    }
+    return rec;
+}
+
+static bool write_all(int fd, const std::string& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+// =================================================================================
+// HistoryStore Implementation
+// =================================================================================
+
+HistoryStore::HistoryStore()
+    : fd(-1), journal_bytes(0), written_bytes(0), synced_bytes(0), syncs(0), next_compact_at(COMPACT_MIN_BYTES) {
+}
+
+HistoryStore::~HistoryStore() {
+    close();
+}
+
+bool HistoryStore::load(const std::string& journal_path, const std::string& legacy_path) {
+    close();
+    path = journal_path;
+    last_file.clear();
+    positions.clear();
+    bookmarks.clear();
+    speech_rates.clear();
+    book_statuses.clear();
+    file_ids.clear();
+    id_paths.clear();
+    resolved.clear();
+
+    fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd == -1) {
+        LOG_E("History: Failed to open %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close();
+        return false;
+    }
+
+    size_t valid_size = 0;
+    if (st.st_size > 0) {
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            LOG_E("History: Failed to map %s: %s\n", path.c_str(), strerror(errno));
+            close();
+            return false;
+        }
+        if (!replay((const uint8_t*)map, st.st_size, &valid_size)) {
+            LOG_W("History: Discarding %lu corrupt bytes at end of journal\n",
+                  (unsigned long)(st.st_size - valid_size));
+        }
+        munmap(map, st.st_size);
+    }
+
+    if (valid_size < sizeof(JOURNAL_MAGIC)) {
+        // New or unusable journal: start over with just the header
+        if (ftruncate(fd, 0) != 0 || !write_all(fd, std::string(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)))) {
+            close();
+            return false;
+        }
+        valid_size = sizeof(JOURNAL_MAGIC);
+    } else if ((off_t)valid_size < st.st_size) {
+        // Drop the torn tail so new records follow the last good one
+        if (ftruncate(fd, valid_size) != 0) {
+            close();
+            return false;
+        }
+    }
+    lseek(fd, valid_size, SEEK_SET);
+    journal_bytes = valid_size;
+
+    if (positions.empty() && last_file.empty() && !legacy_path.empty()) {
+        import_legacy(legacy_path);
+    }
+
+    maybe_compact();
+    return true;
+}
+
+void HistoryStore::close() {
+    if (fd != -1) {
+        fdatasync(fd);
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+bool HistoryStore::replay(const uint8_t* data, size_t size, size_t* valid_size) {
+    *valid_size = 0;
+    if (size < sizeof(JOURNAL_MAGIC) || memcmp(data, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0) {
+        return size == 0;
+    }
+
+    size_t pos = sizeof(JOURNAL_MAGIC);
+    while (pos + RECORD_HEADER_SIZE <= size) {
+        const uint8_t* rec = data + pos;
+        size_t len = get_u16(rec + 6);
+        if (pos + RECORD_HEADER_SIZE + len > size) break;
+        if (crc32(rec + 4, RECORD_HEADER_SIZE - 4 + len) != get_u32(rec)) break;
+
+        apply(rec[4], rec + RECORD_HEADER_SIZE, len);
+        pos += RECORD_HEADER_SIZE + len;
+    }
+    *valid_size = pos;
+    return pos == size;
+}
+
+void HistoryStore::apply(uint8_t type, const uint8_t* payload, size_t len) {
+    switch (type) {
+        case REC_POSITION:
+            if (len >= 4) {
+                positions[std::string((const char*)payload + 4, len - 4)] = (int32_t)get_u32(payload);
+            }
+            break;
+        case REC_LAST_FILE:
+            last_file.assign((const char*)payload, len);
+            break;
+        case REC_BOOKMARK_ADD:
+            if (len >= 6) {
+                size_t keylen = get_u16(payload + 4);
+                if (6 + keylen > len) break;
+                Bookmark b;
+                b.position = (int32_t)get_u32(payload);
+                b.name.assign((const char*)payload + 6 + keylen, len - 6 - keylen);
+                bookmarks[std::string((const char*)payload + 6, keylen)].push_back(b);
+            }
+            break;
+        case REC_BOOKMARK_DEL:
+            if (len >= 2) {
+                size_t keylen = get_u16(payload);
+                if (2 + keylen > len) break;
+                std::string key((const char*)payload + 2, keylen);
+                std::string name((const char*)payload + 2 + keylen, len - 2 - keylen);
+                std::vector<Bookmark>& list = bookmarks[key];
+                for (size_t i = 0; i < list.size(); i++) {
+                    if (list[i].name == name) {
+                        list.erase(list.begin() + i);
+                        break;
+                    }
+                }
+                if (list.empty()) bookmarks.erase(key);
+            }
+            break;
+        case REC_FILE_ID:
+            if (len >= 2) {
+                size_t keylen = get_u16(payload);
+                if (2 + keylen > len) break;
+                std::string key((const char*)payload + 2, keylen);
+                std::string file((const char*)payload + 2 + keylen, len - 2 - keylen);
+                file_ids[file] = key;
+                id_paths[key] = file;
+            }
+            break;
+        case REC_FORGET: {
+            std::string key((const char*)payload, len);
+            positions.erase(key);
+            bookmarks.erase(key);
+            speech_rates.erase(key);
+            book_statuses.erase(key);
+            break;
+        }
+        case REC_SPEECH_RATE:
+            if (len >= 4) {
+                speech_rates[std::string((const char*)payload + 4, len - 4)] = (int32_t)get_u32(payload);
+            }
+            break;
+        case REC_BOOK_STATUS:
+            if (len >= 8) {
+                BookStatus status;
+                status.health = (int32_t)get_u32(payload);
+                status.playable_seconds = (int32_t)get_u32(payload + 4);
+                book_statuses[std::string((const char*)payload + 8, len - 8)] = status;
+            }
+            break;
+        default:
+            // Unknown record from a newer version: skip
+            break;
+    }
+}
+
+bool HistoryStore::append(uint8_t type, const std::string& payload) {
+    if (payload.size() > 0xFFFF) return false;
+
+    // Apply first so the in-memory state is right even without a journal
+    apply(type, (const uint8_t*)payload.data(), payload.size());
+    if (fd == -1) return false;
+
+    std::string rec = make_record(type, payload);
+    if (!write_all(fd, rec)) {
+        LOG_E("History: Failed to append record: %s\n", strerror(errno));
+        // Cut off whatever part of the record made it to disk
+        if (ftruncate(fd, journal_bytes) == 0) {
+            lseek(fd, journal_bytes, SEEK_SET);
+        }
+        return false;
+    }
+    journal_bytes += rec.size();
+    written_bytes += rec.size();
+
+    maybe_compact();
+    return true;
+}
+
+void HistoryStore::set_position(const std::string& file, int seconds) {
+    if (file.empty()) return;
+    put_position(key_for(file), seconds);
+}
+
+void HistoryStore::put_position(const std::string& key, int seconds) {
+    std::map<std::string, int>::const_iterator it = positions.find(key);
+    if (it != positions.end() && it->second == seconds) return;
+
+    std::string payload;
+    put_u32(payload, (uint32_t)seconds);
+    payload += key;
+    append(REC_POSITION, payload);
+}
+
+void HistoryStore::set_last_file(const std::string& file) {
+    if (file == last_file) return;
+    append(REC_LAST_FILE, file);
+}
+
+void HistoryStore::add_bookmark(const std::string& file, int seconds, const std::string& name) {
+    if (file.empty()) return;
+    put_bookmark(key_for(file), seconds, name);
+}
+
+void HistoryStore::put_bookmark(const std::string& key, int seconds, const std::string& name) {
+    if (key.size() > 0xFFFF) return;
+    std::string payload;
+    put_u32(payload, (uint32_t)seconds);
+    put_u16(payload, (uint16_t)key.size());
+    payload += key;
+    payload += name;
+    append(REC_BOOKMARK_ADD, payload);
+}
+
+void HistoryStore::remove_bookmark(const std::string& file, const std::string& name) {
+    std::string key = key_for(file);
+    if (key.size() > 0xFFFF) return;
+    std::string payload;
+    put_u16(payload, (uint16_t)key.size());
+    payload += key;
+    payload += name;
+    append(REC_BOOKMARK_DEL, payload);
+}
+
+void HistoryStore::set_speech_rate(const std::string& file, double wpm) {
+    if (file.empty() || wpm <= 0) return;
+    put_speech_rate(key_for(file), (int)(wpm * 10 + 0.5));
+}
+
+void HistoryStore::put_speech_rate(const std::string& key, int tenths) {
+    std::map<std::string, int>::const_iterator it = speech_rates.find(key);
+    if (it != speech_rates.end() && it->second == tenths) return;
+
+    std::string payload;
+    put_u32(payload, (uint32_t)tenths);
+    payload += key;
+    append(REC_SPEECH_RATE, payload);
+}
+
+void HistoryStore::set_book_status(const std::string& file, const BookStatus& status) {
+    if (file.empty()) return;
+    put_book_status(key_for(file), status);
+}
+
+void HistoryStore::put_book_status(const std::string& key, const BookStatus& status) {
+    std::map<std::string, BookStatus>::const_iterator it = book_statuses.find(key);
+    if (it != book_statuses.end() && it->second.health == status.health &&
+        it->second.playable_seconds == status.playable_seconds) return;
+
+    std::string payload;
+    put_u32(payload, (uint32_t)status.health);
+    put_u32(payload, (uint32_t)status.playable_seconds);
+    payload += key;
+    append(REC_BOOK_STATUS, payload);
+}
+
+std::string HistoryStore::key_for(const std::string& file) const {
+    std::map<std::string, std::string>::const_iterator it = resolved.find(file);
+    if (it != resolved.end()) return it->second;
+    // Not resolved yet (or unreadable: card not mounted, file gone): last
+    // known identity
+    std::map<std::string, std::string>::const_iterator known = file_ids.find(file);
+    return known != file_ids.end() ? known->second : file;
+}
+
+bool HistoryStore::resolve(const std::string& file, const std::string& key) {
+    std::string before = key_for(file);
+    std::map<std::string, std::string>::const_iterator known = file_ids.find(file);
+    std::map<std::string, std::string>::const_iterator last_path = id_paths.find(key);
+    if (known == file_ids.end() || known->second != key ||
+        last_path == id_paths.end() || last_path->second != file) {
+        if (file.size() <= 0xFFFF && key.size() <= 0xFFFF) {
+            std::string payload;
+            put_u16(payload, (uint16_t)key.size());
+            payload += key;
+            payload += file;
+            std::string previous = known != file_ids.end() ? known->second : file;
+            append(REC_FILE_ID, payload);
+            // Entries still keyed by path (older journal), or by an earlier
+            // fingerprint of this path (file was still being copied,
+            // retagged): carry them over to the current identity.
+            if (previous != key) migrate(previous, key);
+        }
+    }
+
+    resolved[file] = key;
+    return key != before;
+}
+
+void HistoryStore::migrate(const std::string& from, const std::string& to) {
+    std::map<std::string, int>::const_iterator pos = positions.find(from);
+    std::map<std::string, std::vector<Bookmark> >::const_iterator marks = bookmarks.find(from);
+    std::map<std::string, int>::const_iterator rate = speech_rates.find(from);
+    if (pos == positions.end() && marks == bookmarks.end() && rate == speech_rates.end()) return;
+    // The book already has its own history under the new key: keep that
+    if (positions.count(to) || bookmarks.count(to) || speech_rates.count(to)) return;
+
+    if (pos != positions.end()) {
+        put_position(to, pos->second);
+    }
+    if (marks != bookmarks.end()) {
+        std::vector<Bookmark> list = marks->second;
+        for (size_t i = 0; i < list.size(); i++) {
+            put_bookmark(to, list[i].position, list[i].name);
+        }
+    }
+    if (rate != speech_rates.end()) {
+        put_speech_rate(to, rate->second);
+    }
+    append(REC_FORGET, from);
+    LOG_I("History: Moved entries of %s to %s\n", from.c_str(), to.c_str());
+}
+
+void HistoryStore::sync() {
+    // Nothing appended since the last sync: don't wake the storage
+    if (fd == -1 || synced_bytes == written_bytes) return;
+    fdatasync(fd);
+    synced_bytes = written_bytes;
+    syncs++;
+}
+
+bool HistoryStore::has_position(const std::string& file) const {
+    return positions.count(key_for(file)) > 0;
+}
+
+int HistoryStore::get_position(const std::string& file) const {
+    std::map<std::string, int>::const_iterator it = positions.find(key_for(file));
+    return it != positions.end() ? it->second : 0;
+}
+
+const std::string* HistoryStore::path_of(const std::string& key) const {
+    if (!is_fingerprint_key(key)) return &key;
+    std::map<std::string, std::string>::const_iterator path = id_paths.find(key);
+    return path != id_paths.end() ? &path->second : NULL;
+}
+
+std::map<std::string, int> HistoryStore::get_positions() const {
+    std::map<std::string, int> out;
+    for (std::map<std::string, int>::const_iterator it = positions.begin(); it != positions.end(); ++it) {
+        const std::string* path = path_of(it->first);
+        if (path) out[*path] = it->second;
+    }
+    return out;
+}
+
+std::map<std::string, BookStatus> HistoryStore::get_book_statuses() const {
+    std::map<std::string, BookStatus> out;
+    for (std::map<std::string, BookStatus>::const_iterator it = book_statuses.begin(); it != book_statuses.end(); ++it) {
+        const std::string* path = path_of(it->first);
+        if (path) out[*path] = it->second;
+    }
+    return out;
+}
+
+std::vector<Bookmark> HistoryStore::get_bookmarks(const std::string& file) const {
+    std::map<std::string, std::vector<Bookmark> >::const_iterator it = bookmarks.find(key_for(file));
+    return it != bookmarks.end() ? it->second : std::vector<Bookmark>();
+}
+
+double HistoryStore::get_speech_rate(const std::string& file) const {
+    std::map<std::string, int>::const_iterator it = speech_rates.find(key_for(file));
+    return it != speech_rates.end() ? it->second / 10.0 : 0.0;
+}
+
+bool HistoryStore::get_book_status(const std::string& file, BookStatus* status) const {
+    std::map<std::string, BookStatus>::const_iterator it = book_statuses.find(key_for(file));
+    if (it == book_statuses.end()) return false;
+    *status = it->second;
+    return true;
+}
+
+std::string HistoryStore::snapshot() const {
+    std::string out(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    if (!last_file.empty()) {
+        out += make_record(REC_LAST_FILE, last_file);
+    }
+    // Only the latest path of books that still have entries
+    for (std::map<std::string, std::string>::const_iterator it = id_paths.begin(); it != id_paths.end(); ++it) {
+        if (!positions.count(it->first) && !bookmarks.count(it->first) && !speech_rates.count(it->first) &&
+            !book_statuses.count(it->first)) continue;
+        std::string payload;
+        put_u16(payload, (uint16_t)it->first.size());
+        payload += it->first;
+        payload += it->second;
+        out += make_record(REC_FILE_ID, payload);
+    }
+    for (std::map<std::string, int>::const_iterator it = positions.begin(); it != positions.end(); ++it) {
+        std::string payload;
+        put_u32(payload, (uint32_t)it->second);
+        payload += it->first;
+        out += make_record(REC_POSITION, payload);
+    }
+    for (std::map<std::string, std::vector<Bookmark> >::const_iterator it = bookmarks.begin(); it != bookmarks.end(); ++it) {
+        for (size_t i = 0; i < it->second.size(); i++) {
+            std::string payload;
+            put_u32(payload, (uint32_t)it->second[i].position);
+            put_u16(payload, (uint16_t)it->first.size());
+            payload += it->first;
+            payload += it->second[i].name;
+            out += make_record(REC_BOOKMARK_ADD, payload);
+        }
+    }
+    for (std::map<std::string, int>::const_iterator it = speech_rates.begin(); it != speech_rates.end(); ++it) {
+        std::string payload;
+        put_u32(payload, (uint32_t)it->second);
+        payload += it->first;
+        out += make_record(REC_SPEECH_RATE, payload);
+    }
+    for (std::map<std::string, BookStatus>::const_iterator it = book_statuses.begin(); it != book_statuses.end(); ++it) {
+        std::string payload;
+        put_u32(payload, (uint32_t)it->second.health);
+        put_u32(payload, (uint32_t)it->second.playable_seconds);
+        payload += it->first;
+        out += make_record(REC_BOOK_STATUS, payload);
+    }
+    return out;
+}
+
+bool HistoryStore::compact() {
+    if (path.empty()) return false;
+
+    std::string data = snapshot();
+    std::string tmp_path = path + ".tmp";
+    int tmp_fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (tmp_fd == -1) return false;
+
+    if (!write_all(tmp_fd, data) || fdatasync(tmp_fd) != 0) {
+        ::close(tmp_fd);
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    ::close(tmp_fd);
+
+    if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+        unlink(tmp_path.c_str());
+        return false;
+    }
+
+    // Make the rename durable
+    std::string dir = path.substr(0, path.find_last_of('/') + 1);
+    int dir_fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+    if (dir_fd != -1) {
+        fsync(dir_fd);
+        ::close(dir_fd);
+    }
+
+    if (fd != -1) ::close(fd);
+    fd = open(path.c_str(), O_RDWR);
+    if (fd != -1) lseek(fd, 0, SEEK_END);
+
+    journal_bytes = data.size();
+    written_bytes += data.size();
+    synced_bytes = written_bytes;
+    next_compact_at = journal_bytes * 4 > COMPACT_MIN_BYTES ? journal_bytes * 4 : COMPACT_MIN_BYTES;
+    LOG_I("History: Compacted journal to %lu bytes\n", (unsigned long)journal_bytes);
+    return fd != -1;
+}
+
+void HistoryStore::maybe_compact() {
+    if (journal_bytes >= next_compact_at) {
+        compact();
+    }
+}
+
+void HistoryStore::import_legacy(const std::string& legacy_path) {
+    std::ifstream in(legacy_path.c_str());
+    if (!in.is_open()) return;
+
+    std::string line;
+    std::string legacy_last;
+    // First line is last played file
+    if (std::getline(in, line) && line != "NONE") {
+        legacy_last = line;
+    }
+
+    while (std::getline(in, line)) {
+        size_t delimiter = line.find('|');
+        if (delimiter == std::string::npos) continue;
+
+        const char* num = line.c_str() + delimiter + 1;
+        char* end = NULL;
+        long time = strtol(num, &end, 10);
+        if (end == num || time < 0) continue; // corrupt line
+        set_position(line.substr(0, delimiter), (int)time);
+    }
+    if (!legacy_last.empty()) {
+        set_last_file(legacy_last);
+    }
+    sync();
+    LOG_I("History: Imported %lu entries from %s\n", (unsigned long)positions.size(), legacy_path.c_str());
+}
@@ -0,0 +1,144 @@
+#ifndef HISTORY_STORE_H
+#define HISTORY_STORE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+struct Bookmark {
+    int position; // in seconds
+    std::string name;
+};
+
+// Result of the background validation of a book (see book_validator.h)
+struct BookStatus {
+    int health;           // BookHealth
+    int playable_seconds; // audio stored before the damage
+};
+
+// --- HistoryStore Class ---
+// Listening history (resume positions, last played file) and named bookmarks,
+// persisted as an append-only binary journal of checksummed records.
+//
+// Every update appends one small record with a single write(), so a crash or
+// power loss loses at most the record being written. On load the journal is
+// mmap'ed and replayed; a torn or corrupt tail is truncated away. The journal
+// is compacted into a snapshot (written to a temp file, then renamed) once it
+// grows well past the size of the live state.
+//
+// Entries are keyed by content fingerprint (see file_fingerprint.h), so
+// renaming or moving a book keeps its position and bookmarks. Callers still
+// pass paths. The store never reads the books itself: the caller
+// fingerprints a book off the main loop when it is opened and hands the key
+// to resolve(), and the path-to-fingerprint table is journaled alongside
+// the entries. Until a path is resolved its last journaled fingerprint is
+// used, or the path itself for a path never seen before. Entries from older
+// journals, keyed by path, are moved to the fingerprint when their file is
+// resolved.
+//
+// Not thread-safe: use from the GTK main loop only.
+class HistoryStore {
+public:
+    HistoryStore();
+    ~HistoryStore();
+
+    // Open (or create) the journal and replay it. If the journal is empty,
+    // entries from the legacy text history file are imported.
+    bool load(const std::string& journal_path, const std::string& legacy_path = "");
+    void close();
+
+    // Updates (each one appends a record)
+    void set_position(const std::string& file, int seconds);
+    void set_last_file(const std::string& file);
+    void add_bookmark(const std::string& file, int seconds, const std::string& name);
+    void remove_bookmark(const std::string& file, const std::string& name);
+    // Narrator speaking rate measured by the speech rate analysis
+    void set_speech_rate(const std::string& file, double wpm);
+    void set_book_status(const std::string& file, const BookStatus& status);
+
+    // Flush appended records to storage (one fdatasync, skipped if there is
+    // nothing new).
+    void sync();
+
+    // Rewrite the journal as a snapshot of the live state.
+    bool compact();
+
+    // Queries
+    bool has_position(const std::string& file) const;
+    int get_position(const std::string& file) const;
+    const std::string& get_last_file() const { return last_file; }
+    // Positions of all known books, keyed by the last path each was opened at
+    std::map<std::string, int> get_positions() const;
+    std::vector<Bookmark> get_bookmarks(const std::string& file) const;
+    // Words per minute, 0 if the book was not analysed yet
+    double get_speech_rate(const std::string& file) const;
+    // False if the book was not validated yet
+    bool get_book_status(const std::string& file, BookStatus* status) const;
+    // Statuses of all validated books, keyed like get_positions()
+    std::map<std::string, BookStatus> get_book_statuses() const;
+
+    // Identity key of a file, without reading it: the fingerprint resolved
+    // this session, else the last one journaled for the path, else the path
+    std::string key_for(const std::string& file) const;
+    // The fingerprint of a file (file_fingerprint(), computed by the
+    // caller): journals a new path or identity and moves the entries kept
+    // under the previous key. True if key_for() changed.
+    bool resolve(const std::string& file, const std::string& key);
+    bool is_resolved(const std::string& file) const { return resolved.count(file) > 0; }
+
+    // Journal size on disk, in bytes
+    uint64_t journal_size() const { return journal_bytes; }
+    // Total bytes written to storage (appends and compactions) since load
+    uint64_t bytes_written() const { return written_bytes; }
+    uint64_t sync_count() const { return syncs; }
+
+private:
+    enum RecordType {
+        REC_POSITION = 1,
+        REC_LAST_FILE = 2,
+        REC_BOOKMARK_ADD = 3,
+        REC_BOOKMARK_DEL = 4,
+        REC_FILE_ID = 5, // path -> fingerprint
+        REC_FORGET = 6,  // drop all entries of a key
+        REC_SPEECH_RATE = 7,
+        REC_BOOK_STATUS = 8,
+    };
+
+    std::string path;
+    int fd;
+    uint64_t journal_bytes;
+    uint64_t written_bytes;
+    uint64_t synced_bytes;
+    uint64_t syncs;
+    uint64_t next_compact_at;
+
+    std::string last_file;
+    std::map<std::string, int> positions;
+    std::map<std::string, std::vector<Bookmark> > bookmarks;
+    std::map<std::string, int> speech_rates; // tenths of words per minute
+    // Not carried over by migrate(): a new fingerprint is new content
+    std::map<std::string, BookStatus> book_statuses;
+
+    // Path <-> fingerprint tables (journaled) and the paths resolved this
+    // session
+    std::map<std::string, std::string> file_ids;
+    std::map<std::string, std::string> id_paths;
+    std::map<std::string, std::string> resolved;
+
+    bool append(uint8_t type, const std::string& payload);
+    void put_position(const std::string& key, int seconds);
+    void put_bookmark(const std::string& key, int seconds, const std::string& name);
+    void put_speech_rate(const std::string& key, int tenths);
+    void put_book_status(const std::string& key, const BookStatus& status);
+    // Path a key was last opened at (the key itself for legacy path keys)
+    const std::string* path_of(const std::string& key) const;
+    bool replay(const uint8_t* data, size_t size, size_t* valid_size);
+    void apply(uint8_t type, const uint8_t* payload, size_t len);
+    std::string snapshot() const;
+    void import_legacy(const std::string& legacy_path);
+    void migrate(const std::string& from, const std::string& to);
+    void maybe_compact();
+};
+
+#endif // HISTORY_STORE_H
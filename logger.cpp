@@ -0,0 +1,169 @@
+#include "logger.h"
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// Ring buffer geometry: 256 lines of up to 192 bytes (48 KB, allocated once)
+#define LOG_RING_SLOTS 256
+#define LOG_SLOT_SIZE 192
+// The on-disk log is rotated to <path>.old past this size
+#define LOG_FILE_MAX_BYTES (512 * 1024)
+
+struct LogSlot {
+    // 0 while being written, index + 1 once complete
+    std::atomic<uint32_t> seq;
+    char text[LOG_SLOT_SIZE];
+};
+
+static LogSlot log_ring[LOG_RING_SLOTS];
+static std::atomic<uint32_t> log_write_pos(0);
+static std::atomic<bool> log_flush_pending(false);
+static bool log_echo_stderr = false;
+
+// Flush state (only touched under log_flush_mutex)
+static std::mutex log_flush_mutex;
+static std::string log_path;
+static uint32_t log_flushed_pos = 0;
+
+int lark_log_min_level = LARK_LOG_INFO;
+
+static const char level_tag[] = { 'D', 'I', 'W', 'E' };
+
+static void monotonic_now(unsigned int* sec, unsigned int* msec) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    *sec = (unsigned int)ts.tv_sec;
+    *msec = (unsigned int)(ts.tv_nsec / 1000000);
+}
+
+static void ring_put(lark_log_level_t level, unsigned int sec, unsigned int msec,
+                     const char* fmt, va_list args) {
+    uint32_t idx = log_write_pos.fetch_add(1, std::memory_order_relaxed);
+    LogSlot& slot = log_ring[idx % LOG_RING_SLOTS];
+
+    slot.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    int n = snprintf(slot.text, LOG_SLOT_SIZE, "[%6u.%03u] %c ", sec, msec, level_tag[level]);
+    if (n < 0) n = 0;
+    if (n < LOG_SLOT_SIZE) {
+        vsnprintf(slot.text + n, LOG_SLOT_SIZE - n, fmt, args);
+    }
+
+    slot.seq.store(idx + 1, std::memory_order_release);
+
+    if (log_echo_stderr) {
+        fputs(slot.text, stderr);
+        size_t len = strlen(slot.text);
+        if (len == 0 || slot.text[len - 1] != '\n') fputc('\n', stderr);
+    }
+}
+
+static void ring_printf(lark_log_level_t level, unsigned int sec, unsigned int msec,
+                        const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    ring_put(level, sec, msec, fmt, args);
+    va_end(args);
+}
+
+void lark_log_init(const char* path) {
+    std::lock_guard<std::mutex> lock(log_flush_mutex);
+    log_path = path ? path : "";
+    log_echo_stderr = getenv("LARK_LOG_STDERR") != NULL;
+}
+
+void lark_log_set_level(lark_log_level_t level) {
+    lark_log_min_level = level;
+}
+
+void lark_log_write(lark_log_site_t* site, lark_log_level_t level, const char* fmt, ...) {
+    unsigned int sec, msec;
+    monotonic_now(&sec, &msec);
+
+    // Start a new one-second window for this call site, reporting what the
+    // previous window dropped.
+    unsigned int window = __atomic_load_n(&site->window, __ATOMIC_RELAXED);
+    if (window != sec &&
+        __atomic_compare_exchange_n(&site->window, &window, sec, false,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        unsigned int suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->count, 0, __ATOMIC_RELAXED);
+        if (suppressed > 0) {
+            ring_printf(level, sec, msec, "(%u similar messages suppressed)\n", suppressed);
+        }
+    }
+
+    if (__atomic_fetch_add(&site->count, 1, __ATOMIC_RELAXED) >= LARK_LOG_BURST) {
+        __atomic_fetch_add(&site->suppressed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    va_list args;
+    va_start(args, fmt);
+    ring_put(level, sec, msec, fmt, args);
+    va_end(args);
+
+    if (level >= LARK_LOG_ERROR) {
+        log_flush_pending.store(true, std::memory_order_relaxed);
+    }
+}
+
+void lark_log_flush(void) {
+    std::lock_guard<std::mutex> lock(log_flush_mutex);
+    log_flush_pending.store(false, std::memory_order_relaxed);
+    if (log_path.empty()) return;
+
+    uint32_t end = log_write_pos.load(std::memory_order_acquire);
+    if (end == log_flushed_pos) return;
+
+    struct stat st;
+    if (stat(log_path.c_str(), &st) == 0 && st.st_size > LOG_FILE_MAX_BYTES) {
+        std::string old_path = log_path + ".old";
+        rename(log_path.c_str(), old_path.c_str());
+    }
+
+    FILE* f = fopen(log_path.c_str(), "a");
+    if (!f) return;
+
+    time_t now = time(NULL);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    fprintf(f, "--- flush %s ---\n", stamp);
+
+    uint32_t pos = log_flushed_pos;
+    if (end - pos > LOG_RING_SLOTS) {
+        fprintf(f, "(%u messages lost)\n", end - pos - LOG_RING_SLOTS);
+        pos = end - LOG_RING_SLOTS;
+    }
+
+    char line[LOG_SLOT_SIZE];
+    for (; pos != end; pos++) {
+        LogSlot& slot = log_ring[pos % LOG_RING_SLOTS];
+        uint32_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq != pos + 1) continue; // still being written or overwritten
+        memcpy(line, slot.text, LOG_SLOT_SIZE);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != seq) continue;
+
+        line[LOG_SLOT_SIZE - 1] = 0;
+        size_t len = strlen(line);
+        fputs(line, f);
+        if (len == 0 || line[len - 1] != '\n') fputc('\n', f);
+    }
+    log_flushed_pos = end;
+    fclose(f);
+}
+
+void lark_log_poll(void) {
+    if (log_flush_pending.load(std::memory_order_relaxed)) {
+        lark_log_flush();
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+/*
+ * Leveled, rate-limited logger.
+ *
+ * Messages are formatted into a fixed in-memory ring buffer and only written
+ * to disk by lark_log_flush(): on request, on exit, or from lark_log_poll()
+ * after an error was logged. Each call site is rate-limited independently,
+ * so a corrupt file producing thousands of identical warnings per second
+ * costs a level check and an atomic increment per message.
+ *
+ * Usable from C (mpeg4/) and C++.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    LARK_LOG_DEBUG = 0,
+    LARK_LOG_INFO,
+    LARK_LOG_WARN,
+    LARK_LOG_ERROR,
+} lark_log_level_t;
+
+/* Per call site rate limiting state (zero-initialized static). */
+typedef struct {
+    unsigned int window;     /* second the current window started */
+    unsigned int count;      /* messages seen in the current window */
+    unsigned int suppressed; /* messages dropped in the current window */
+} lark_log_site_t;
+
+/* Maximum messages per call site per second; the rest are counted. */
+#define LARK_LOG_BURST 5
+
+extern int lark_log_min_level;
+
+/* Set the on-disk log file. Echoes to stderr too if LARK_LOG_STDERR is set. */
+void lark_log_init(const char *path);
+void lark_log_set_level(lark_log_level_t level);
+
+#if defined(__GNUC__)
+__attribute__((format(printf, 3, 4)))
+#endif
+void lark_log_write(lark_log_site_t *site, lark_log_level_t level, const char *fmt, ...);
+
+/* Append everything logged since the previous flush to the log file. */
+void lark_log_flush(void);
+/* Flush if an error was logged since the last call (call from the GUI loop). */
+void lark_log_poll(void);
+
+#define LARK_LOG(level, ...) \
+    do { \
+        if ((level) >= lark_log_min_level) { \
+            static lark_log_site_t lark_log_site_; \
+            lark_log_write(&lark_log_site_, (level), __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOG_D(...) LARK_LOG(LARK_LOG_DEBUG, __VA_ARGS__)
+#define LOG_I(...) LARK_LOG(LARK_LOG_INFO, __VA_ARGS__)
+#define LOG_W(...) LARK_LOG(LARK_LOG_WARN, __VA_ARGS__)
+#define LOG_E(...) LARK_LOG(LARK_LOG_ERROR, __VA_ARGS__)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOGGER_H */
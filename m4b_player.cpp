@@ -6,6 +6,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <pwd.h>
 #include <string>
 #include <fstream>
@@ -21,8 +22,19 @@ struct Chapter {
 };
 
 std::vector<Chapter> current_chapters;
+int current_chapter_index = -1;
 
 #include "music_backend.h"
+#include "book_validator.h"
+#include "cache_manager.h"
+#include "clip_export.h"
+#include "energy_profile.h"
+#include "file_fingerprint.h"
+#include "history_store.h"
+#include "logger.h"
+#include "preview_player.h"
+#include "speech_rate.h"
+#include "worker_pool.h"
 #include "openlipc/openlipc.h"
 
 // Assets
@@ -40,6 +52,14 @@ std::vector<Chapter> current_chapters;
 #define DESKTOP_W_SIZE 600
 #define DESKTOP_H_SIZE 800
 
+// Playback health counters, rewritten periodically (tmpfs, no flash wear)
+#define STATS_FILE_PATH "/tmp/lark_stats"
+#define STATS_INTERVAL_MS 10000
+// Energy profile report (LARK_PROFILE=1), refreshed with the stats
+#define ENERGY_REPORT_PATH "/tmp/lark_energy"
+// Memory pressure and cache budget checks (CacheManager)
+#define MEMORY_CHECK_INTERVAL_MS 5000
+
 MusicBackend backend;
 GtkWidget *window;
 GtkWidget *progress_bar;
@@ -49,13 +69,46 @@ GtkWidget *title_label;
 GtkWidget *artist_label;
 GtkWidget *album_label;
 GtkWidget *play_pause_btn;
+GtkWidget *ab_loop_btn;
+GtkWidget *sleep_btn;
+GtkWidget *speed_btn;
 
 bool user_is_seeking = false;
 std::string current_file;
 int last_timestamp = 0;
-std::map<std::string, int> playback_history;
+HistoryStore history;
 int flIntensity = 0;
 bool dispUpdate=true;
+// Point A of an A/B loop being set (-1 if none)
+gint64 ab_loop_start = -1;
+
+// Clips played from the history dialog; the open book is paused meanwhile
+#define RESPONSE_PREVIEW 1
+PreviewPlayer preview;
+bool preview_paused_book = false;
+
+// Sleep timer choices cycled by the Zz button; 0 minutes = end of chapter
+static const int sleep_choices[] = { 15, 30, 60, 0 };
+static const char* sleep_labels[] = { "Z15", "Z30", "Z60", "ZCH" };
+int sleep_choice = -1;
+
+// Playback speeds cycled by the speed button; 0 = target words per minute,
+// from the narrator's rate measured in the background
+static const float speed_choices[] = { 1.0f, 1.25f, 1.5f, 0.0f };
+static const char* speed_labels[] = { "1x", "1.25x", "1.5x", "WPM" };
+int speed_choice = 0;
+#define DEFAULT_TARGET_WPM 160
+int target_wpm = DEFAULT_TARGET_WPM;
+double narrator_wpm = 0; // open book, 0 until analysed
+
+// Holding a seek button cues/reviews: CUE_START_RATE after CUE_HOLD_MS,
+// doubling every CUE_STEP_MS up to CUE_MAX_RATE. A click still jumps 30 s.
+#define CUE_HOLD_MS 400
+#define CUE_STEP_MS 2000
+#define CUE_START_RATE 4
+guint cue_timer_id = 0;
+int cue_direction = 0;       // button held: 1 forward, -1 back
+int cue_hold_rate = 0;       // 0 until the hold delay passed
 
 static LIPC * lipcInstance = 0;
 
@@ -71,15 +124,143 @@ void closeLipcInstance() {
 	}
 }
 
+// LIPC hasharray getter for "stats": one hash with every playback counter
+LIPCcode stats_property_cb(LIPC *lipc, const char *property, void *value, void *data) {
+    ProfileScope scope(STAGE_LIPC);
+    (void)property;
+    (void)data;
+    LIPCha *ha = LipcHasharrayNew(lipc);
+    if (!ha) return LIPC_ERROR_OUT_OF_MEMORY;
+
+    size_t index = 0;
+    LipcHasharrayAddHash(ha, &index);
+    MetricsSnapshot stats = backend.metrics.snapshot();
+    for (size_t i = 0; i < stats.size(); i++) {
+        LipcHasharrayPutInt(ha, (int)index, stats[i].first, (int)stats[i].second);
+    }
+    *(LIPCha **)value = ha;
+    return LIPC_OK;
+}
+
+// LIPC int setter for "flushLog": write the in-memory log to disk
+LIPCcode flush_log_property_cb(LIPC *lipc, const char *property, void *value, void *data) {
+    ProfileScope scope(STAGE_LIPC);
+    (void)lipc;
+    (void)property;
+    (void)value;
+    (void)data;
+    lark_log_flush();
+    return LIPC_OK;
+}
+
+// LIPC int property "eqPreset": speech EQ preset (0 off, 1 speech, 2 strong)
+LIPCcode eq_preset_get_cb(LIPC *lipc, const char *property, void *value, void *data) {
+    ProfileScope scope(STAGE_LIPC);
+    (void)lipc;
+    (void)property;
+    (void)data;
+    *(int *)value = (int)backend.eq.get_preset();
+    return LIPC_OK;
+}
+
+LIPCcode eq_preset_set_cb(LIPC *lipc, const char *property, void *value, void *data) {
+    ProfileScope scope(STAGE_LIPC);
+    (void)lipc;
+    (void)property;
+    (void)data;
+    int preset = (int)LIPC_SETTER_VTOI(value);
+    if (preset < EQ_OFF || preset >= EQ_PRESET_COUNT) return LIPC_ERROR_INVALID_ARG;
+    backend.eq.set_preset((EqPreset)preset);
+    LOG_I("EQ preset set to %d\n", preset);
+    return LIPC_OK;
+}
+
+void apply_speed() {
+    float speed = speed_choices[speed_choice];
+    if (speed == 0.0f) speed = speed_for_target_wpm(narrator_wpm, target_wpm);
+    backend.set_speed(speed);
+}
+
+gboolean apply_speed_idle(gpointer data) {
+    (void)data;
+    apply_speed();
+    return FALSE;
+}
+
+// LIPC int property "targetWpm": words per minute of the WPM speed mode
+LIPCcode target_wpm_get_cb(LIPC *lipc, const char *property, void *value, void *data) {
+    ProfileScope scope(STAGE_LIPC);
+    (void)lipc;
+    (void)property;
+    (void)data;
+    *(int *)value = target_wpm;
+    return LIPC_OK;
+}
+
+LIPCcode target_wpm_set_cb(LIPC *lipc, const char *property, void *value, void *data) {
+    ProfileScope scope(STAGE_LIPC);
+    (void)lipc;
+    (void)property;
+    (void)data;
+    int wpm = (int)LIPC_SETTER_VTOI(value);
+    if (wpm < 60 || wpm > 400) return LIPC_ERROR_INVALID_ARG;
+    target_wpm = wpm;
+    LOG_I("Target speech rate set to %d wpm\n", wpm);
+    // Restarting the decoder is main loop work
+    g_idle_add(apply_speed_idle, NULL);
+    return LIPC_OK;
+}
+
+gboolean on_screensaver_idle(gpointer data) {
+    (void)data;
+    if (backend.is_playing) {
+        backend.checkpoints.request(CHECKPOINT_SCREENSAVER);
+    }
+    return FALSE;
+}
+
+// powerd event, delivered on the LIPC thread: hand over to the main loop
+LIPCcode screensaver_event_cb(LIPC *lipc, const char *name, LIPCevent *event, void *data) {
+    if (energy_profile_enabled()) energy_name_thread("lipc-events");
+    ProfileScope scope(STAGE_LIPC);
+    (void)lipc;
+    (void)name;
+    (void)event;
+    (void)data;
+    g_idle_add(on_screensaver_idle, NULL);
+    return LIPC_OK;
+}
+
+gboolean write_stats(gpointer data) {
+    (void)data;
+    if (backend.is_playing) {
+        backend.metrics.write_file(STATS_FILE_PATH);
+    }
+    if (energy_profile_enabled()) {
+        energy_profiler().sample(backend.is_playing && !backend.is_paused);
+        energy_profiler().write_report(ENERGY_REPORT_PATH);
+    }
+    return TRUE;
+}
+
+gboolean check_memory(gpointer data) {
+    (void)data;
+    cache_manager().maintain();
+    return TRUE;
+}
+
 void enableSleep() {
+    ProfileScope scope(STAGE_LIPC);
     LipcSetIntProperty(lipcInstance,"com.lab126.powerd","preventScreenSaver",0);
 }
 
 void disableSleep() {
+    ProfileScope scope(STAGE_LIPC);
     LipcSetIntProperty(lipcInstance,"com.lab126.powerd","preventScreenSaver",1);
 }
 
 void toggleFrontLight(){
+    ProfileScope scope(STAGE_LIPC);
     int intensity = 0;
     LipcGetIntProperty(lipcInstance,"com.lab126.powerd","flIntensity",&intensity);
     if(intensity == 0) {
@@ -114,64 +295,46 @@ void set_button_icon(GtkWidget *button, const unsigned char *icon_data) {
     gtk_widget_show(image); // Important to show the new image
 }
 
-// State file path
-std::string get_history_file_path() {
+// Path of a state file in the user's home directory
+std::string get_home_file_path(const char *name) {
     const char *home = getenv("HOME");
     if (!home) {
         struct passwd *pw = getpwuid(getuid());
         if (pw) home = pw->pw_dir;
     }
-    return std::string(home ? home : ".") + "/.lark_history";
+    return std::string(home ? home : ".") + "/" + name;
+}
+
+std::string get_history_file_path() {
+    return get_home_file_path(".lark_history");
+}
+
+std::string get_journal_file_path() {
+    return get_home_file_path(".lark_journal");
 }
 
 void save_history() {
-    // Update current file in history
+    // The exit checkpoint writes the current position now, and flush() any
+    // coalesced one when no book is open
+    backend.checkpoints.request(CHECKPOINT_EXIT);
+    backend.checkpoints.flush();
+
     if (!current_file.empty()) {
-        gint64 pos = backend.get_position() / GST_SECOND;
-        playback_history[current_file] = (int)pos;
-    }
-    g_print("Saving playback history to disk %s %d\n",current_file.c_str(), last_timestamp);
-    std::string path = get_history_file_path();
-    std::ofstream out(path);
-    if (out.is_open()) {
-        // Write the last played file first (as a simple convention or separate line?)
-        // Requirement: "reopen the last played file".
-        // Let's print the current_file name on the first line as a marker, then the list.
-        out << (current_file.empty() ? "NONE" : current_file) << "\n";
-        
-        for (auto const& item : playback_history) {
-            out << item.first << "|" << item.second << "\n";
-        }
-        out.close();
+        history.set_last_file(current_file);
     }
+    LOG_D("Saving playback history to disk %s %d\n",current_file.c_str(), last_timestamp);
+    history.sync();
 }
 
 void load_history() {
-    std::string path = get_history_file_path();
-    std::ifstream in(path);
-    if (in.is_open()) {
-        std::string line;
-        // First line is last played file
-        if (std::getline(in, line)) {
-            if (line != "NONE") {
-                current_file = line;
-            }
-        }
-        
-        while (std::getline(in, line)) {
-            size_t delimiter = line.find('|');
-            if (delimiter != std::string::npos) {
-                std::string file = line.substr(0, delimiter);
-                int time = std::stoi(line.substr(delimiter + 1));
-                playback_history[file] = time;
-            }
-        }
-        in.close();
-    }
-    
+    // The old text history is imported once into the journal
+    history.load(get_journal_file_path(), get_history_file_path());
+    current_file = history.get_last_file();
+    backend.checkpoints.attach(&history);
+
     // Set last_timestamp if current_file exists in history
-    if (!current_file.empty() && playback_history.count(current_file)) {
-        last_timestamp = playback_history[current_file];
+    if (!current_file.empty() && history.has_position(current_file)) {
+        last_timestamp = history.get_position(current_file);
     }
 }
 
@@ -183,6 +346,7 @@ int parse_time_to_seconds(const std::string& time_str) {
 
 void load_chapters(const std::string& audio_file) {
     current_chapters.clear();
+    current_chapter_index = -1;
     
     // Create chapter file path by replacing extension with .chapter.txt
     std::string chapter_file = audio_file;
@@ -209,8 +373,47 @@ void load_chapters(const std::string& audio_file) {
             }
         }
         in.close();
-        g_print("Loaded %zu chapters from %s\n", current_chapters.size(), chapter_file.c_str());
+        LOG_I("Loaded %zu chapters from %s\n", current_chapters.size(), chapter_file.c_str());
+    }
+}
+
+// Index of the chapter playing at the given time, -1 if none
+int chapter_index_at(int seconds) {
+    int index = -1;
+    for (size_t i = 0; i < current_chapters.size(); i++) {
+        if (current_chapters[i].start_time > seconds) break;
+        index = (int)i;
+    }
+    return index;
+}
+
+// Cover art decode and scale, on a worker
+struct CoverJob {
+    std::vector<unsigned char> data;
+    GdkPixbuf *scaled;
+};
+
+void decode_cover(void *data) {
+    CoverJob *job = (CoverJob *)data;
+    GdkPixbufLoader *loader = gdk_pixbuf_loader_new();
+    gdk_pixbuf_loader_write(loader, job->data.data(), job->data.size(), NULL);
+    gdk_pixbuf_loader_close(loader, NULL);
+    GdkPixbuf *pixbuf = gdk_pixbuf_loader_get_pixbuf(loader);
+    if (pixbuf && WorkerPool::checkpoint()) {
+        // Scale to fit nice and large
+        job->scaled = gdk_pixbuf_scale_simple(pixbuf, 350, 450, GDK_INTERP_BILINEAR);
     }
+    g_object_unref(loader);
+}
+
+void cover_decoded(void *data, bool cancelled) {
+    CoverJob *job = (CoverJob *)data;
+    // Cancelled: the book changed while it was decoding
+    if (job->scaled && !cancelled) {
+        gtk_image_set_from_pixbuf(GTK_IMAGE(cover_image), job->scaled);
+    }
+    if (job->scaled) g_object_unref(job->scaled);
+    delete job;
 }
 
 void update_metadata_ui() {
@@ -230,24 +433,377 @@ void update_metadata_ui() {
         gtk_label_set_text(GTK_LABEL(artist_label), "");
     }
 
+    // Decoded off the main thread; the old cover stays cleared meanwhile
+    gtk_image_clear(GTK_IMAGE(cover_image));
     if (!backend.cover_art.empty()) {
-        GdkPixbufLoader *loader = gdk_pixbuf_loader_new();
-        gdk_pixbuf_loader_write(loader, backend.cover_art.data(), backend.cover_art.size(), NULL);
-        gdk_pixbuf_loader_close(loader, NULL);
-        GdkPixbuf *pixbuf = gdk_pixbuf_loader_get_pixbuf(loader);
-        if (pixbuf) {
-            // Scale to fit nice and large
-            GdkPixbuf *scaled = gdk_pixbuf_scale_simple(pixbuf, 350, 450, GDK_INTERP_BILINEAR);
-            gtk_image_set_from_pixbuf(GTK_IMAGE(cover_image), scaled);
-            g_object_unref(scaled);
+        CoverJob *job = new CoverJob;
+        job->data = backend.cover_art;
+        job->scaled = NULL;
+        worker_pool().submit(WORK_USER, WORK_GROUP_BOOK, decode_cover, cover_decoded, job);
+    }
+}
+
+// Book identity for the history journal: the fingerprint reads ~150 KB of
+// the book, so it is computed on a worker when the book is opened. Until it
+// arrives the history answers with the identity last journaled for the path.
+struct FingerprintJob {
+    std::string path;
+    std::string key;
+    int opened_at;        // position looked up when the book was opened
+    uint64_t opened_us;   // metrics_now_us() then
+    bool ok;
+};
+
+void fingerprint_task(void *data) {
+    FingerprintJob *job = (FingerprintJob *)data;
+    job->ok = file_fingerprint(job->path, &job->key);
+}
+
+// Playback has not moved since the book was opened, other than by playing:
+// no seek, chapter jump, A/B loop or cue since then
+bool untouched_since_open(const FingerprintJob *job) {
+    if (!backend.is_playing || backend.has_ab_loop() || ab_loop_start >= 0 || backend.is_cueing()) return false;
+    if (last_timestamp != job->opened_at) return false;
+    double elapsed = (metrics_now_us() - job->opened_us) / 1e6;
+    double played = (double)(backend.get_position() / GST_SECOND) - job->opened_at;
+    return played >= -1.0 && played <= elapsed * backend.get_speed() + 2.0;
+}
+
+// Seek in the open book, staying paused if it was
+void seek_keep_pause(int seconds) {
+    bool was_paused = backend.is_paused;
+    last_timestamp = seconds;
+    backend.play_file(current_file.c_str(), seconds);
+    if (was_paused) backend.pause();
+}
+
+void book_fingerprinted(void *data, bool cancelled) {
+    FingerprintJob *job = (FingerprintJob *)data;
+    // A new identity for the open book (first open after a move or rename):
+    // pick up the history it has under its fingerprint, unless the user
+    // already took playback elsewhere
+    if (job->ok && history.resolve(job->path, job->key) && !cancelled && job->path == current_file) {
+        int position = history.get_position(job->path);
+        if (position != job->opened_at && untouched_since_open(job)) {
+            LOG_I("Resuming %s at %d seconds\n", job->path.c_str(), position);
+            seek_keep_pause(position);
+        }
+        double wpm = history.get_speech_rate(job->path);
+        if (wpm > 0) {
+            narrator_wpm = wpm;
+            if (speed_choices[speed_choice] == 0.0f) apply_speed();
+        }
+    }
+    delete job;
+}
+
+// Narrator speech rate, measured on a worker at idle priority and cached
+// in the history journal
+struct SpeechRateJob {
+    std::string path;
+    SpeechRate rate;
+    bool ok;
+};
+
+void analyze_speech_rate_task(void *data) {
+    SpeechRateJob *job = (SpeechRateJob *)data;
+    job->ok = analyze_speech_rate(job->path.c_str(), &job->rate);
+}
+
+void speech_rate_analyzed(void *data, bool cancelled) {
+    SpeechRateJob *job = (SpeechRateJob *)data;
+    if (job->ok) {
+        history.set_speech_rate(job->path, job->rate.wpm);
+        // Cancelled: the book changed after the analysis finished
+        if (!cancelled && job->path == current_file) {
+            narrator_wpm = job->rate.wpm;
+            if (speed_choices[speed_choice] == 0.0f) apply_speed();
+        }
+    }
+    delete job;
+}
+
+// Book validation: truncated or corrupt books are flagged in the history
+// journal by an idle worker, before the decoder runs into the damage
+struct ValidateJob {
+    std::string path;
+    BookCheck check;
+    bool finished;
+};
+
+void validate_book_task(void *data) {
+    ValidateJob *job = (ValidateJob *)data;
+    job->finished = validate_book(job->path.c_str(), &job->check);
+}
+
+// Tells the user before playback gets to the damage. False if the book is fine.
+bool warn_broken_book(const std::string& path, const BookStatus& status) {
+    char text[256];
+    int t = status.playable_seconds;
+    switch (status.health) {
+        case BOOK_TRUNCATED:
+            snprintf(text, sizeof(text),
+                     "This book is incomplete: only the first %02d:%02d:%02d are on the device. "
+                     "Copy it again to listen past that point.",
+                     t / 3600, (t % 3600) / 60, t % 60);
+            break;
+        case BOOK_CORRUPT:
+            snprintf(text, sizeof(text), "This book is damaged: some of its audio cannot be decoded.");
+            break;
+        case BOOK_UNREADABLE:
+            snprintf(text, sizeof(text), "This book has no readable audio track. Copy it again.");
+            break;
+        default:
+            return false;
+    }
+    LOG_W("%s: %s\n", path.c_str(), book_health_name(status.health));
+    GtkWidget *message_dialog = gtk_message_dialog_new(GTK_WINDOW(window),
+                                                       GTK_DIALOG_DESTROY_WITH_PARENT,
+                                                       GTK_MESSAGE_WARNING,
+                                                       GTK_BUTTONS_OK,
+                                                       "%s", text);
+    gtk_dialog_run(GTK_DIALOG(message_dialog));
+    gtk_widget_destroy(message_dialog);
+    return true;
+}
+
+void book_validated(void *data, bool cancelled) {
+    ValidateJob *job = (ValidateJob *)data;
+    struct stat st;
+    // Missing (card not mounted) or still growing: validated again later
+    if (job->finished && !cancelled && job->check.file_size > 0 &&
+        stat(job->path.c_str(), &st) == 0 && (uint64_t)st.st_size == job->check.file_size) {
+        BookStatus status;
+        status.health = job->check.health;
+        status.playable_seconds = (int)job->check.playable_seconds;
+        history.set_book_status(job->path, status);
+        if (job->path == current_file) warn_broken_book(job->path, status);
+    }
+    delete job;
+}
+
+void submit_validation(const std::string& path, int group) {
+    ValidateJob *job = new ValidateJob;
+    job->path = path;
+    job->finished = false;
+    worker_pool().submit(WORK_IDLE, group, validate_book_task, book_validated, job);
+}
+
+// Every book of the history not validated yet
+void validate_library() {
+    std::map<std::string, BookStatus> statuses = history.get_book_statuses();
+    std::map<std::string, int> books = history.get_positions();
+    for (std::map<std::string, int>::const_iterator it = books.begin(); it != books.end(); ++it) {
+        if (it->first == current_file || statuses.count(it->first)) continue;
+        submit_validation(it->first, WORK_GROUP_NONE);
+    }
+}
+
+// Clip export to WAV next to the book, on a worker. Requested over LIPC
+// (exportClip): "chapter" (the one playing), "ab" (the active loop) or
+// "bookmark:<name>" (up to the next bookmark, or the end of its chapter).
+struct ExportJob {
+    std::string book;
+    std::string out_path;
+    gint64 start_ns;
+    gint64 end_ns;
+    ExportResult result;
+    bool ok;
+};
+
+void export_clip_task(void *data) {
+    ExportJob *job = (ExportJob *)data;
+    job->ok = export_wav(job->book.c_str(), job->start_ns, job->end_ns, job->out_path.c_str(), &job->result);
+}
+
+void clip_exported(void *data, bool cancelled) {
+    ExportJob *job = (ExportJob *)data;
+    // Cancelled only when the player quits
+    if (!cancelled) {
+        char text[512];
+        int t = (int)job->result.seconds;
+        if (job->ok) {
+            snprintf(text, sizeof(text), "Exported %02d:%02d:%02d of audio to %s",
+                     t / 3600, (t % 3600) / 60, t % 60, job->out_path.c_str());
+        } else {
+            snprintf(text, sizeof(text), "Could not export to %s", job->out_path.c_str());
+        }
+        GtkWidget *message_dialog = gtk_message_dialog_new(GTK_WINDOW(window),
+                                                           GTK_DIALOG_DESTROY_WITH_PARENT,
+                                                           job->ok ? GTK_MESSAGE_INFO : GTK_MESSAGE_WARNING,
+                                                           GTK_BUTTONS_OK,
+                                                           "%s", text);
+        gtk_dialog_run(GTK_DIALOG(message_dialog));
+        gtk_widget_destroy(message_dialog);
+    }
+    delete job;
+}
+
+// Range of a clip of the open book; label names the file
+bool export_range(const std::string& what, gint64 *start_ns, gint64 *end_ns, std::string *label) {
+    gint64 duration = backend.get_duration();
+    if (what == "ab") {
+        *label = "A-B";
+        return backend.get_ab_loop(start_ns, end_ns);
+    }
+
+    int start = -1;
+    int end = -1;
+    if (what == "chapter") {
+        int chapter = chapter_index_at(backend.get_position() / GST_SECOND);
+        if (chapter < 0) return false;
+        start = current_chapters[chapter].start_time;
+        *label = current_chapters[chapter].name;
+    } else if (what.compare(0, 9, "bookmark:") == 0) {
+        *label = what.substr(9);
+        std::vector<Bookmark> marks = history.get_bookmarks(current_file);
+        for (size_t i = 0; i < marks.size(); i++) {
+            if (marks[i].name == *label) start = marks[i].position;
+        }
+        if (start < 0) return false;
+        for (size_t i = 0; i < marks.size(); i++) {
+            if (marks[i].position > start && (end < 0 || marks[i].position < end)) end = marks[i].position;
         }
-        g_object_unref(loader);
     } else {
-        gtk_image_clear(GTK_IMAGE(cover_image));
+        return false;
+    }
+    if (end < 0) {
+        int chapter = chapter_index_at(start);
+        if (chapter >= 0 && chapter + 1 < (int)current_chapters.size()) {
+            end = current_chapters[chapter + 1].start_time;
+        }
+    }
+    *start_ns = (gint64)start * GST_SECOND;
+    *end_ns = end >= 0 ? (gint64)end * GST_SECOND : duration;
+    return *end_ns > *start_ns;
+}
+
+// "<book without extension> - <label>.wav"
+std::string export_path(const std::string& book, const std::string& label) {
+    size_t slash = book.rfind('/');
+    size_t dot = book.rfind('.');
+    std::string path = book.substr(0, dot != std::string::npos && (slash == std::string::npos || dot > slash) ? dot : book.size());
+    std::string name = label.empty() ? "clip" : label;
+    for (size_t i = 0; i < name.size(); i++) {
+        if (name[i] == '/' || (unsigned char)name[i] < 0x20) name[i] = '_';
+    }
+    return path + " - " + name + ".wav";
+}
+
+gboolean export_clip_idle(gpointer data) {
+    char *what = (char *)data;
+    ExportJob *job = new ExportJob;
+    std::string label;
+    if (current_file.empty() || !export_range(what, &job->start_ns, &job->end_ns, &label)) {
+        LOG_W("Export: nothing to export for \"%s\"\n", what);
+        delete job;
+        g_free(what);
+        return FALSE;
+    }
+    job->book = current_file;
+    job->out_path = export_path(current_file, label);
+    job->ok = false;
+    LOG_I("Export: %s, %lld-%lld s\n", job->out_path.c_str(),
+          (long long)(job->start_ns / GST_SECOND), (long long)(job->end_ns / GST_SECOND));
+    // Not tied to the book: switching books does not cancel it
+    worker_pool().submit(WORK_BACKGROUND, WORK_GROUP_NONE, export_clip_task, clip_exported, job);
+    g_free(what);
+    return FALSE;
+}
+
+LIPCcode export_clip_set_cb(LIPC *lipc, const char *property, void *value, void *data) {
+    ProfileScope scope(STAGE_LIPC);
+    (void)lipc;
+    (void)property;
+    (void)data;
+    const char *what = (const char *)value;
+    if (!what || !*what) return LIPC_ERROR_INVALID_ARG;
+    // The history and the chapters belong to the main loop
+    g_idle_add(export_clip_idle, g_strdup(what));
+    return LIPC_OK;
+}
+
+// Bookmarks of the open book, over LIPC: addBookmark marks the current
+// position under a name (moving a bookmark of the same name),
+// removeBookmark drops one. Named bookmarks are exportClip sources.
+bool has_bookmark(const std::string& name) {
+    std::vector<Bookmark> marks = history.get_bookmarks(current_file);
+    for (size_t i = 0; i < marks.size(); i++) {
+        if (marks[i].name == name) return true;
+    }
+    return false;
+}
+
+gboolean add_bookmark_idle(gpointer data) {
+    char *name = (char *)data;
+    if (current_file.empty()) {
+        LOG_W("Bookmark: no book open for \"%s\"\n", name);
+    } else {
+        int position = (int)(backend.get_position() / GST_SECOND);
+        if (has_bookmark(name)) history.remove_bookmark(current_file, name);
+        history.add_bookmark(current_file, position, name);
+        LOG_I("Bookmark: \"%s\" at %d s\n", name, position);
+    }
+    g_free(name);
+    return FALSE;
+}
+
+gboolean remove_bookmark_idle(gpointer data) {
+    char *name = (char *)data;
+    if (current_file.empty() || !has_bookmark(name)) {
+        LOG_W("Bookmark: no bookmark \"%s\"\n", name);
+    } else {
+        history.remove_bookmark(current_file, name);
+        LOG_I("Bookmark: \"%s\" removed\n", name);
+    }
+    g_free(name);
+    return FALSE;
+}
+
+LIPCcode add_bookmark_set_cb(LIPC *lipc, const char *property, void *value, void *data) {
+    ProfileScope scope(STAGE_LIPC);
+    (void)lipc;
+    (void)property;
+    (void)data;
+    const char *name = (const char *)value;
+    if (!name || !*name) return LIPC_ERROR_INVALID_ARG;
+    // The history belongs to the main loop
+    g_idle_add(add_bookmark_idle, g_strdup(name));
+    return LIPC_OK;
+}
+
+LIPCcode remove_bookmark_set_cb(LIPC *lipc, const char *property, void *value, void *data) {
+    ProfileScope scope(STAGE_LIPC);
+    (void)lipc;
+    (void)property;
+    (void)data;
+    const char *name = (const char *)value;
+    if (!name || !*name) return LIPC_ERROR_INVALID_ARG;
+    g_idle_add(remove_bookmark_idle, g_strdup(name));
+    return LIPC_OK;
+}
+
+// Seeking or opening a file ends the loop in the backend, so the label is
+// refreshed from the backend state on every UI tick
+void update_ab_loop_label() {
+    const char* label = backend.has_ab_loop() ? "A-B*" : (ab_loop_start >= 0 ? "A-" : "A-B");
+    if (strcmp(gtk_button_get_label(GTK_BUTTON(ab_loop_btn)), label) != 0) {
+        gtk_button_set_label(GTK_BUTTON(ab_loop_btn), label);
+    }
+}
+
+void update_sleep_label() {
+    // The timer disarms itself on expiry or when playback stops
+    if (!backend.sleep_timer.is_armed()) sleep_choice = -1;
+    const char* label = sleep_choice >= 0 ? sleep_labels[sleep_choice] : "Zz";
+    if (strcmp(gtk_button_get_label(GTK_BUTTON(sleep_btn)), label) != 0) {
+        gtk_button_set_label(GTK_BUTTON(sleep_btn), label);
     }
 }
 
 gboolean update_ui(gpointer data) {
+    ProfileScope scope(STAGE_UI);
+    lark_log_poll();
     if (!backend.is_playing && !backend.is_paused) return TRUE;
 
     gint64 pos = backend.get_position();
@@ -256,11 +812,24 @@ gboolean update_ui(gpointer data) {
     // Format: 00:01:23 / 02:10:20
     int pos_sec = pos / GST_SECOND;
     int len_sec = len / GST_SECOND;
+
+    // Checkpoint the position when playback crosses into a new chapter
+    int chapter = chapter_index_at(pos_sec);
+    if (chapter != current_chapter_index) {
+        if (current_chapter_index != -1 && !backend.is_paused) {
+            backend.checkpoints.request(CHECKPOINT_CHAPTER);
+        }
+        current_chapter_index = chapter;
+    }
+
     char buf[64];
     snprintf(buf, sizeof(buf), "%02d:%02d:%02d / %02d:%02d:%02d", 
              pos_sec / 3600, (pos_sec % 3600) / 60, pos_sec % 60,
              len_sec / 3600, (len_sec % 3600) / 60, len_sec % 60);
     
+    update_ab_loop_label();
+    update_sleep_label();
+
     // Update the label inside the frame
     if(dispUpdate)
         gtk_label_set_text(GTK_LABEL(time_label), buf);
@@ -280,6 +849,8 @@ void on_play_pause_clicked(GtkWidget *widget, gpointer data) {
             if (backend.is_paused) {
                 backend.pause(); // Resume
             } else {
+                // The sleep timer may have handed the screensaver back
+                disableSleep();
                 backend.play_file(current_file.c_str(), last_timestamp);
             }
         }
@@ -311,6 +882,81 @@ void jump_relative(int seconds) {
     backend.play_file(current_file.c_str(), new_pos);
 }
 
+// First press marks A, second marks B and starts looping, third clears
+void on_ab_loop_clicked(GtkWidget *widget, gpointer data) {
+    (void)widget;
+    (void)data;
+    if (!backend.is_playing && !backend.is_paused) return;
+
+    if (backend.has_ab_loop()) {
+        backend.clear_ab_loop();
+        ab_loop_start = -1;
+    } else if (ab_loop_start < 0) {
+        ab_loop_start = backend.get_position();
+    } else {
+        gint64 end = backend.get_position();
+        if (!backend.set_ab_loop(ab_loop_start, end)) {
+            LOG_W("A/B loop rejected (%lld-%lld ms)\n",
+                  (long long)(ab_loop_start / GST_MSECOND), (long long)(end / GST_MSECOND));
+        }
+        ab_loop_start = -1;
+    }
+    update_ab_loop_label();
+}
+
+// Each press selects the next sleep timer choice, then back to off
+void on_sleep_clicked(GtkWidget *widget, gpointer data) {
+    (void)widget;
+    (void)data;
+    if (!backend.is_playing && !backend.is_paused) return;
+
+    int count = sizeof(sleep_choices) / sizeof(sleep_choices[0]);
+    sleep_choice++;
+    if (sleep_choice < count && sleep_choices[sleep_choice] == 0) {
+        // End of the current chapter: start of the next one, or end of book
+        int pos_sec = backend.get_position() / GST_SECOND;
+        int chapter = chapter_index_at(pos_sec);
+        gint64 end = backend.get_duration();
+        if (chapter + 1 < (int)current_chapters.size()) {
+            end = (gint64)current_chapters[chapter + 1].start_time * GST_SECOND;
+        }
+        if (current_chapters.empty() || end <= 0) {
+            sleep_choice++; // No chapter index: skip this choice
+        } else {
+            backend.sleep_timer.arm_at_position(end);
+        }
+    } else if (sleep_choice < count) {
+        backend.sleep_timer.arm_minutes(sleep_choices[sleep_choice]);
+    }
+
+    if (sleep_choice >= count) {
+        backend.sleep_timer.cancel();
+        sleep_choice = -1;
+    }
+    update_sleep_label();
+}
+
+// Each press selects the next speed, then back to 1x
+void on_speed_clicked(GtkWidget *widget, gpointer data) {
+    (void)widget;
+    (void)data;
+    int count = sizeof(speed_choices) / sizeof(speed_choices[0]);
+    speed_choice = (speed_choice + 1) % count;
+    gtk_button_set_label(GTK_BUTTON(speed_btn), speed_labels[speed_choice]);
+    if (speed_choices[speed_choice] == 0.0f && narrator_wpm <= 0) {
+        LOG_I("Speech rate of the book not measured yet, playing at 1x\n");
+    }
+    apply_speed();
+}
+
+// Playback stopped by the sleep timer (position already checkpointed)
+void on_sleep_expired(void* data) {
+    (void)data;
+    last_timestamp = backend.get_position() / GST_SECOND;
+    enableSleep();
+    update_sleep_label();
+}
+
 void on_fl_clicked(GtkWidget *widget, gpointer data) {
     (void)widget;
     (void)data;
@@ -330,20 +976,86 @@ void on_displayUpdate_clicked(GtkWidget *widget, gpointer data) {
     dispUpdate = !(dispUpdate);
 }
 
+// End of a hold: stops the hold timer and, if cueing had started, returns
+// to playback from the last snippet heard. True in that case.
+bool end_cue() {
+    if (cue_timer_id > 0) {
+        g_source_remove(cue_timer_id);
+        cue_timer_id = 0;
+    }
+    bool cued = cue_hold_rate > 0;
+    if (cued) {
+        backend.set_cue(0);
+        last_timestamp = backend.get_position() / GST_SECOND;
+    }
+    cue_hold_rate = 0;
+    return cued;
+}
+
+// GTK emits "clicked" from the default handler of "released", before
+// on_seek_released(): the release of a hold ends the cue here, no jump
 void on_rewind_clicked(GtkWidget *widget, gpointer data) {
+    if (end_cue()) return;
     jump_relative(-30);
 }
 
 void on_ff_clicked(GtkWidget *widget, gpointer data) {
+    if (end_cue()) return;
     jump_relative(30);
 }
 
+// Hold delay passed: start cueing, then double the rate every step
+gboolean cue_hold_cb(gpointer data) {
+    (void)data;
+    int rate = cue_hold_rate == 0 ? CUE_START_RATE : cue_hold_rate * 2;
+    if (rate > CUE_MAX_RATE) rate = CUE_MAX_RATE;
+    if (!backend.set_cue(cue_direction * rate)) {
+        // Paused, looping or stopped: the click jumps instead
+        cue_timer_id = 0;
+        return FALSE;
+    }
+    bool first = cue_hold_rate == 0;
+    cue_hold_rate = rate;
+    if (first) {
+        cue_timer_id = g_timeout_add(CUE_STEP_MS, cue_hold_cb, NULL);
+        return FALSE;
+    }
+    if (rate == CUE_MAX_RATE) {
+        cue_timer_id = 0;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void on_seek_pressed(GtkWidget *widget, gpointer data) {
+    (void)widget;
+    cue_direction = GPOINTER_TO_INT(data);
+    cue_hold_rate = 0;
+    if (cue_timer_id > 0) g_source_remove(cue_timer_id);
+    cue_timer_id = g_timeout_add(CUE_HOLD_MS, cue_hold_cb, NULL);
+}
+
+// Released off the button (no "clicked"), or after a click that was
+// already handled
+void on_seek_released(GtkWidget *widget, gpointer data) {
+    (void)widget;
+    (void)data;
+    end_cue();
+}
+
 void on_destroy(GtkWidget *widget, gpointer data) {
+    preview.stop();
     LipcSetIntProperty(lipcInstance,"com.lab126.powerd","flIntensity",flIntensity);
     LipcSetIntProperty(lipcInstance,"com.lab126.btfd","ensureBTconnection",0);
     enableSleep();
     closeLipcInstance();
+    worker_pool().shutdown();
     save_history();
+    if (energy_profile_enabled()) {
+        energy_profiler().sample(backend.is_playing && !backend.is_paused);
+        energy_profiler().write_report(ENERGY_REPORT_PATH);
+    }
+    lark_log_flush();
     gtk_main_quit();
 }
 
@@ -358,26 +1070,49 @@ void on_file_open(const char* filepath) {
     // Only save if we were actually playing/paused, to avoid overwriting history with 0 on startup
     if (!current_file.empty() && (backend.is_playing || backend.is_paused)) {
         gint64 pos = backend.get_position() / GST_SECOND;
-        playback_history[current_file] = (int)pos;
-        // Optionally save to disk immediately?
-        // save_history(); 
+        history.set_position(current_file, (int)pos);
     }
 
     // Stop playback first to release the global mp4read lock
+    backend.sleep_timer.cancel();
     backend.stop();
+    worker_pool().cancel_group(WORK_GROUP_BOOK);
     
     current_file = filepath;
+    history.set_last_file(current_file);
+    ab_loop_start = -1;
     
     // Look up in history
-    if (playback_history.count(filepath)) {
-        last_timestamp = playback_history[filepath];
+    last_timestamp = history.get_position(filepath);
+    if (!history.is_resolved(filepath)) {
+        FingerprintJob *job = new FingerprintJob;
+        job->path = filepath;
+        job->opened_at = last_timestamp;
+        job->opened_us = metrics_now_us();
+        job->ok = false;
+        worker_pool().submit(WORK_USER, WORK_GROUP_BOOK, fingerprint_task, book_fingerprinted, job);
+    }
+
+    // The speed of WPM mode needs the narrator's rate: measured once per book
+    narrator_wpm = history.get_speech_rate(filepath);
+    if (narrator_wpm <= 0) {
+        SpeechRateJob *job = new SpeechRateJob;
+        job->path = filepath;
+        job->ok = false;
+        worker_pool().submit(WORK_IDLE, WORK_GROUP_BOOK, analyze_speech_rate_task, speech_rate_analyzed, job);
+    }
+    apply_speed();
+
+    BookStatus status;
+    if (!history.get_book_status(filepath, &status)) {
+        submit_validation(filepath, WORK_GROUP_BOOK);
     } else {
-        last_timestamp = 0;
+        warn_broken_book(filepath, status);
     }
 
-    g_print("Reading metadata for %s\n", filepath);
+    LOG_I("Reading metadata for %s\n", filepath);
     backend.read_metadata(filepath);
-    g_print("Metadata read: Title='%s', Artist='%s', Album='%s'\n",
+    LOG_I("Metadata read: Title='%s', Artist='%s', Album='%s'\n",
             backend.meta_title.c_str(),
             backend.meta_artist.c_str(),
             backend.meta_album.c_str());
@@ -386,7 +1121,7 @@ void on_file_open(const char* filepath) {
     // Load chapters for this audio file
     load_chapters(filepath);
     
-    g_print("Starting playback for %s at %d seconds\n", filepath, last_timestamp);
+    LOG_I("Starting playback for %s at %d seconds\n", filepath, last_timestamp);
     backend.play_file(filepath, last_timestamp);
 }
 
@@ -409,22 +1144,49 @@ void on_open_dialog_clicked(GtkWidget *widget, gpointer data) {
     gtk_widget_destroy(dialog);
 }
 
+// Resume the book paused for a preview
+void on_preview_done(void* data) {
+    (void)data;
+    if (preview_paused_book && backend.is_paused) {
+        backend.pause();
+    }
+    preview_paused_book = false;
+}
+
+void start_preview(const char* filepath) {
+    if (backend.is_playing && !backend.is_paused) {
+        backend.pause();
+        preview_paused_book = true;
+    }
+    if (!preview.start(filepath)) {
+        on_preview_done(NULL);
+    }
+}
+
 void on_history_clicked(GtkWidget *widget, gpointer data) {
     GtkWidget *dialog = gtk_dialog_new_with_buttons("L:A_N:application_PC:TS_ID:com.kbarni.m4bplayer",
                                                      GTK_WINDOW(window),
                                                      GTK_DIALOG_DESTROY_WITH_PARENT,
+                                                     "Preview", RESPONSE_PREVIEW,
                                                      GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
                                                      GTK_STOCK_OPEN, GTK_RESPONSE_ACCEPT,
                                                      NULL);
     
     GtkWidget *content_area = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
     GtkWidget *tree_view = gtk_tree_view_new();
-    GtkListStore *store = gtk_list_store_new(2, G_TYPE_STRING, G_TYPE_INT); // File, Timestamp
+    GtkListStore *store = gtk_list_store_new(3, G_TYPE_STRING, G_TYPE_INT, G_TYPE_STRING); // File, Timestamp, Status
     
-    for (auto const& item : playback_history) {
+    std::map<std::string, BookStatus> statuses = history.get_book_statuses();
+    for (auto const& item : history.get_positions()) {
+        // Books found broken by the validator are flagged
+        std::map<std::string, BookStatus>::const_iterator status = statuses.find(item.first);
+        const char* flag = "";
+        if (status != statuses.end() && status->second.health != BOOK_OK) {
+            flag = book_health_name(status->second.health);
+        }
         GtkTreeIter iter;
         gtk_list_store_append(store, &iter);
-        gtk_list_store_set(store, &iter, 0, item.first.c_str(), 1, item.second, -1);
+        gtk_list_store_set(store, &iter, 0, item.first.c_str(), 1, item.second, 2, flag, -1);
     }
     
     gtk_tree_view_set_model(GTK_TREE_VIEW(tree_view), GTK_TREE_MODEL(store));
@@ -432,6 +1194,8 @@ void on_history_clicked(GtkWidget *widget, gpointer data) {
     GtkCellRenderer *renderer = gtk_cell_renderer_text_new();
     GtkTreeViewColumn *column = gtk_tree_view_column_new_with_attributes("File", renderer, "text", 0, NULL);
     gtk_tree_view_append_column(GTK_TREE_VIEW(tree_view), column);
+    column = gtk_tree_view_column_new_with_attributes("Status", renderer, "text", 2, NULL);
+    gtk_tree_view_append_column(GTK_TREE_VIEW(tree_view), column);
     
     // Time column
     // Ideally format it, but raw int for now is fine or use cell data func
@@ -439,17 +1203,34 @@ void on_history_clicked(GtkWidget *widget, gpointer data) {
     gtk_container_add(GTK_CONTAINER(content_area), tree_view);
     gtk_widget_show_all(dialog);
 
-    if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
+    // Preview plays the selected book and keeps the dialog open
+    gint response;
+    while ((response = gtk_dialog_run(GTK_DIALOG(dialog))) == RESPONSE_PREVIEW) {
         GtkTreeSelection *selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(tree_view));
         GtkTreeIter iter;
         GtkTreeModel *model;
         if (gtk_tree_selection_get_selected(selection, &model, &iter)) {
             char *file;
             gtk_tree_model_get(model, &iter, 0, &file, -1);
+            start_preview(file);
+            g_free(file);
+        }
+    }
+    preview.stop();
+
+    if (response == GTK_RESPONSE_ACCEPT) {
+        GtkTreeSelection *selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(tree_view));
+        GtkTreeIter iter;
+        GtkTreeModel *model;
+        if (gtk_tree_selection_get_selected(selection, &model, &iter)) {
+            char *file;
+            gtk_tree_model_get(model, &iter, 0, &file, -1);
+            preview_paused_book = false; // replaced, not resumed
             on_file_open(file);
             g_free(file);
         }
     }
+    on_preview_done(NULL);
     
     gtk_widget_destroy(dialog);
 }
@@ -516,7 +1297,7 @@ void on_chapters_clicked(GtkWidget *widget, gpointer data) {
             if (!current_file.empty()) {
                 last_timestamp = seek_time;
                 backend.play_file(current_file.c_str(), seek_time);
-                g_print("Seeking to chapter at %d seconds (%s)\n", seek_time, time_str);
+                LOG_I("Seeking to chapter at %d seconds (%s)\n", seek_time, time_str);
             }
             
             g_free(time_str);
@@ -528,6 +1309,7 @@ void on_chapters_clicked(GtkWidget *widget, gpointer data) {
 
 int main(int argc, char *argv[]) {
     gtk_init(&argc, &argv);
+    lark_log_init(get_home_file_path(".lark_log").c_str());
 
     load_history();
     if (argc > 1) {
@@ -537,7 +1319,17 @@ int main(int argc, char *argv[]) {
 
     openLipcInstance();
     disableSleep();
+    backend.sleep_timer.set_callback(on_sleep_expired, NULL);
+    preview.set_done_callback(on_preview_done, NULL);
     LipcGetIntProperty(lipcInstance,"com.lab126.powerd","flIntensity",&flIntensity);
+    LipcRegisterHasharrayProperty(lipcInstance, "stats", stats_property_cb, NULL);
+    LipcRegisterIntProperty(lipcInstance, "flushLog", NULL, flush_log_property_cb, NULL);
+    LipcRegisterIntProperty(lipcInstance, "eqPreset", eq_preset_get_cb, eq_preset_set_cb, NULL);
+    LipcRegisterIntProperty(lipcInstance, "targetWpm", target_wpm_get_cb, target_wpm_set_cb, NULL);
+    LipcRegisterStringProperty(lipcInstance, "exportClip", NULL, export_clip_set_cb, NULL);
+    LipcRegisterStringProperty(lipcInstance, "addBookmark", NULL, add_bookmark_set_cb, NULL);
+    LipcRegisterStringProperty(lipcInstance, "removeBookmark", NULL, remove_bookmark_set_cb, NULL);
+    LipcSubscribeExt(lipcInstance, "com.lab126.powerd", "goingToScreenSaver", screensaver_event_cb, NULL);
 
     LipcSetIntProperty(lipcInstance,"com.lab126.btfd","ensureBTconnection",1);
     LipcSetStringProperty(lipcInstance,"com.lab126.btfd","BTenable","1:1");
@@ -609,15 +1401,22 @@ int main(int argc, char *argv[]) {
     pango_font_description_free(time_font);
 
 
-    // Playback Controls (RW, Play/Pause, FF)
+    // Playback Controls (A-B, RW, Play/Pause, FF, Sleep, Speed)
     GtkWidget *controls_hbox = gtk_hbox_new(FALSE, 20);
     GtkWidget *controls_align = gtk_alignment_new(0.5, 0, 0, 0);
     gtk_container_add(GTK_CONTAINER(controls_align), controls_hbox);
     gtk_box_pack_start(GTK_BOX(mid_vbox), controls_align, FALSE, FALSE, 0);
 
+    ab_loop_btn = gtk_button_new_with_label("A-B");
+    gtk_widget_set_size_request(ab_loop_btn, 80, 80);
+    g_signal_connect(ab_loop_btn, "clicked", G_CALLBACK(on_ab_loop_clicked), NULL);
+    gtk_box_pack_start(GTK_BOX(controls_hbox), ab_loop_btn, FALSE, FALSE, 0);
+
     GtkWidget *rw_btn = create_button_from_icon(fast_rewind_icon, 10);
     gtk_widget_set_size_request(rw_btn, 80, 80);
     g_signal_connect(rw_btn, "clicked", G_CALLBACK(on_rewind_clicked), NULL);
+    g_signal_connect(rw_btn, "pressed", G_CALLBACK(on_seek_pressed), GINT_TO_POINTER(-1));
+    g_signal_connect(rw_btn, "released", G_CALLBACK(on_seek_released), NULL);
     gtk_box_pack_start(GTK_BOX(controls_hbox), rw_btn, FALSE, FALSE, 0);
 
     play_pause_btn = create_button_from_icon(play_pause_icon, 10);
@@ -628,8 +1427,20 @@ int main(int argc, char *argv[]) {
     GtkWidget *ff_btn = create_button_from_icon(fast_forward_icon, 10);
     gtk_widget_set_size_request(ff_btn, 80, 80);
     g_signal_connect(ff_btn, "clicked", G_CALLBACK(on_ff_clicked), NULL);
+    g_signal_connect(ff_btn, "pressed", G_CALLBACK(on_seek_pressed), GINT_TO_POINTER(1));
+    g_signal_connect(ff_btn, "released", G_CALLBACK(on_seek_released), NULL);
     gtk_box_pack_start(GTK_BOX(controls_hbox), ff_btn, FALSE, FALSE, 0);
 
+    sleep_btn = gtk_button_new_with_label("Zz");
+    gtk_widget_set_size_request(sleep_btn, 80, 80);
+    g_signal_connect(sleep_btn, "clicked", G_CALLBACK(on_sleep_clicked), NULL);
+    gtk_box_pack_start(GTK_BOX(controls_hbox), sleep_btn, FALSE, FALSE, 0);
+
+    speed_btn = gtk_button_new_with_label(speed_labels[speed_choice]);
+    gtk_widget_set_size_request(speed_btn, 80, 80);
+    g_signal_connect(speed_btn, "clicked", G_CALLBACK(on_speed_clicked), NULL);
+    gtk_box_pack_start(GTK_BOX(controls_hbox), speed_btn, FALSE, FALSE, 0);
+
 
     // --- BOTTOM BUTTONS ---
     GtkWidget *bot_hbox = gtk_hbox_new(FALSE, 10);
@@ -680,12 +1491,18 @@ int main(int argc, char *argv[]) {
 
     gtk_widget_show_all(window);
 
+    worker_pool().start(&backend.metrics);
+
     // Initial load
     if (!current_file.empty()) {
         on_file_open(current_file.c_str());
     }
+    validate_library();
 
     g_timeout_add(1000, update_ui, NULL);
+    g_timeout_add(STATS_INTERVAL_MS, write_stats, NULL);
+    cache_manager().set_metrics(&backend.metrics);
+    g_timeout_add(MEMORY_CHECK_INTERVAL_MS, check_memory, NULL);
 
     gtk_main();
 
@@ -0,0 +1,382 @@
+#include "mp4_index.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+// Box nesting deeper than this is not an audio book
+#define MP4_INDEX_MAX_DEPTH 8
+// Largest stsc/esds read into memory
+#define MP4_INDEX_MAX_TABLE_BYTES (4 * 1024 * 1024)
+
+static inline uint32_t get_u16(const uint8_t* p) {
+    return ((uint32_t)p[0] << 8) | p[1];
+}
+
+static inline uint32_t get_u32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline uint64_t get_u64(const uint8_t* p) {
+    return ((uint64_t)get_u32(p) << 32) | get_u32(p + 4);
+}
+
+// esds descriptor tag and its variable-length size; false when out of bytes
+static bool read_descriptor(const std::vector<uint8_t>& body, size_t* pos, uint8_t tag, uint32_t* length) {
+    if (*pos >= body.size() || body[*pos] != tag) return false;
+    (*pos)++;
+    *length = 0;
+    for (int i = 0; i < 4; i++) {
+        if (*pos >= body.size()) return false;
+        uint8_t byte = body[(*pos)++];
+        *length = (*length << 7) | (byte & 0x7f);
+        if (!(byte & 0x80)) break;
+    }
+    return true;
+}
+
+// =================================================================================
+// Mp4Index Implementation
+// =================================================================================
+
+Mp4Index::Mp4Index()
+    : fd(-1), error_text(NULL), size_bytes(0), rate(0), channel_count(0), asc_length(0), frames(0), duration(0),
+      sound_track(false), chunk_count(0), chunk_table(0), chunk_offsets_64(false), size_table(0), uniform_size(0),
+      sizes_first(0), last_frame(0), last_chunk(UINT32_MAX), last_offset(0), last_size(0) {
+    memset(asc_data, 0, sizeof(asc_data));
+}
+
+Mp4Index::~Mp4Index() {
+    close();
+}
+
+void Mp4Index::close() {
+    if (fd != -1) {
+        ::close(fd);
+        fd = -1;
+    }
+    rate = 0;
+    channel_count = 0;
+    asc_length = 0;
+    frames = 0;
+    duration = 0;
+    runs.clear();
+    chunk_count = 0;
+    sizes.clear();
+    last_chunk = UINT32_MAX;
+}
+
+bool Mp4Index::fail(const char* text) {
+    error_text = text;
+    return false;
+}
+
+bool Mp4Index::read_at(uint64_t offset, void* buffer, size_t bytes) {
+    size_t done = 0;
+    while (done < bytes) {
+        ssize_t n = pread(fd, (uint8_t*)buffer + done, bytes - done, (off_t)(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return fail(n == 0 ? "unexpected end of file" : "read error");
+        done += (size_t)n;
+    }
+    return true;
+}
+
+bool Mp4Index::open(const char* path) {
+    close();
+    error_text = NULL;
+    fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return fail("cannot open file");
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close();
+        return fail("cannot stat file");
+    }
+    size_bytes = (uint64_t)st.st_size;
+    // Frames are read a few at a time, far apart: no read-ahead
+    posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+
+    bool found = false;
+    if (!parse_boxes(0, size_bytes, 0, &found) || !found) {
+        const char* text = error_text ? error_text : "no AAC audio track";
+        close();
+        return fail(text);
+    }
+    return true;
+}
+
+uint32_t Mp4Index::samples_per_frame() const {
+    if (frames == 0 || duration == 0) return 1024;
+    uint64_t per_frame = duration / frames;
+    return per_frame > 0 ? (uint32_t)per_frame : 1024;
+}
+
+// Walks boxes in [begin, end); descends into moov and picks the first
+// AAC sound track
+bool Mp4Index::parse_boxes(uint64_t begin, uint64_t end, int depth, bool* found) {
+    if (depth > MP4_INDEX_MAX_DEPTH) return fail("boxes nested too deep");
+    uint64_t pos = begin;
+    while (pos + 8 <= end && !*found) {
+        uint8_t header[16];
+        if (!read_at(pos, header, 8)) return false;
+        uint64_t box_size = get_u32(header);
+        uint64_t header_size = 8;
+        if (box_size == 1) {
+            if (!read_at(pos + 8, header + 8, 8)) return false;
+            box_size = get_u64(header + 8);
+            header_size = 16;
+        } else if (box_size == 0) {
+            box_size = end - pos;
+        }
+        if (box_size < header_size) return fail("corrupt box header");
+        uint64_t box_end = pos + box_size;
+        // A truncated copy cuts the last top-level box (mdat) short; the
+        // sample table is what tells how much is missing
+        if (box_end > end) {
+            if (depth > 0) return fail("box runs past its parent");
+            box_end = end;
+        }
+
+        if (memcmp(header + 4, "moov", 4) == 0) {
+            if (!parse_boxes(pos + header_size, box_end, depth + 1, found)) return false;
+        } else if (depth > 0 && memcmp(header + 4, "trak", 4) == 0) {
+            sound_track = false;
+            asc_length = 0;
+            frames = 0;
+            chunk_count = 0;
+            runs.clear();
+            if (!parse_track(pos + header_size, box_end, depth + 1)) return false;
+            if (sound_track && asc_length > 0) {
+                if (frames == 0 || chunk_count == 0) return fail("fragmented file, no sample table");
+                // Expand the stsc runs and check they cover every frame
+                uint64_t first_frame = 0;
+                for (size_t i = 0; i < runs.size(); i++) {
+                    uint32_t next_chunk = i + 1 < runs.size() ? runs[i + 1].first_chunk : chunk_count;
+                    if (runs[i].first_chunk >= chunk_count || next_chunk <= runs[i].first_chunk) {
+                        return fail("corrupt sample-to-chunk table");
+                    }
+                    runs[i].first_frame = first_frame > UINT32_MAX ? UINT32_MAX : (uint32_t)first_frame;
+                    first_frame += (uint64_t)(next_chunk - runs[i].first_chunk) * runs[i].samples_per_chunk;
+                }
+                if (runs.empty() || first_frame < frames) return fail("sample table needs more chunks than it has");
+                *found = true;
+            }
+        }
+        pos += box_size;
+    }
+    return true;
+}
+
+bool Mp4Index::parse_track(uint64_t begin, uint64_t end, int depth) {
+    if (depth > MP4_INDEX_MAX_DEPTH) return fail("boxes nested too deep");
+    uint64_t pos = begin;
+    while (pos + 8 <= end) {
+        uint8_t header[8];
+        if (!read_at(pos, header, 8)) return false;
+        uint64_t box_size = get_u32(header);
+        if (box_size < 8 || pos + box_size > end) return fail("corrupt track box");
+        uint64_t body = pos + 8;
+        uint64_t body_size = box_size - 8;
+        const char* type = (const char*)header + 4;
+
+        if (memcmp(type, "mdia", 4) == 0 || memcmp(type, "minf", 4) == 0 || memcmp(type, "stbl", 4) == 0) {
+            if (!parse_track(body, pos + box_size, depth + 1)) return false;
+        } else if (memcmp(type, "mdhd", 4) == 0) {
+            uint8_t mdhd[32];
+            if (body_size < 24 || !read_at(body, mdhd, body_size < 32 ? 24 : 32)) return fail("corrupt mdhd");
+            if (mdhd[0] == 1) {
+                if (body_size < 32) return fail("corrupt mdhd");
+                rate = get_u32(mdhd + 20);
+                duration = get_u64(mdhd + 24);
+            } else {
+                rate = get_u32(mdhd + 12);
+                duration = get_u32(mdhd + 16);
+            }
+        } else if (memcmp(type, "hdlr", 4) == 0) {
+            uint8_t hdlr[12];
+            if (body_size < 12 || !read_at(body, hdlr, 12)) return fail("corrupt hdlr");
+            sound_track = memcmp(hdlr + 8, "soun", 4) == 0;
+        } else if (memcmp(type, "stsd", 4) == 0) {
+            if (sound_track && !parse_stsd(body, pos + box_size)) return false;
+        } else if (memcmp(type, "stsc", 4) == 0) {
+            uint8_t head[8];
+            if (body_size < 8 || !read_at(body, head, 8)) return fail("corrupt stsc");
+            uint32_t count = get_u32(head + 4);
+            if ((uint64_t)count * 12 > body_size - 8 || (uint64_t)count * 12 > MP4_INDEX_MAX_TABLE_BYTES) {
+                return fail("corrupt stsc");
+            }
+            std::vector<uint8_t> table(count * 12);
+            if (count > 0 && !read_at(body + 8, &table[0], table.size())) return false;
+            runs.resize(count);
+            for (uint32_t i = 0; i < count; i++) {
+                uint32_t first_chunk = get_u32(&table[i * 12]);
+                uint32_t per_chunk = get_u32(&table[i * 12 + 4]);
+                if (first_chunk < 1 || per_chunk < 1 || (i > 0 && first_chunk - 1 <= runs[i - 1].first_chunk)) {
+                    return fail("corrupt sample-to-chunk table");
+                }
+                runs[i].first_chunk = first_chunk - 1;
+                runs[i].samples_per_chunk = per_chunk;
+                runs[i].first_frame = 0;
+            }
+        } else if (memcmp(type, "stsz", 4) == 0) {
+            uint8_t head[12];
+            if (body_size < 12 || !read_at(body, head, 12)) return fail("corrupt stsz");
+            uniform_size = get_u32(head + 4);
+            frames = get_u32(head + 8);
+            size_table = body + 12;
+            if (uniform_size == 0 && (uint64_t)frames * 4 > body_size - 12) return fail("sample size table is cut short");
+        } else if (memcmp(type, "stco", 4) == 0 || memcmp(type, "co64", 4) == 0) {
+            uint8_t head[8];
+            if (body_size < 8 || !read_at(body, head, 8)) return fail("corrupt chunk offsets");
+            chunk_offsets_64 = type[0] == 'c';
+            chunk_count = get_u32(head + 4);
+            chunk_table = body + 8;
+            if ((uint64_t)chunk_count * (chunk_offsets_64 ? 8 : 4) > body_size - 8) {
+                return fail("chunk offset table is cut short");
+            }
+        }
+        pos += box_size;
+    }
+    return true;
+}
+
+// First sample entry: mp4a with its esds
+bool Mp4Index::parse_stsd(uint64_t begin, uint64_t end) {
+    uint8_t head[16];
+    if (begin + 16 > end || !read_at(begin, head, 16)) return fail("corrupt stsd");
+    uint64_t entry = begin + 8;
+    uint64_t entry_size = get_u32(head + 8);
+    if (memcmp(head + 12, "mp4a", 4) != 0) return true; // not AAC, try the next track
+    if (entry_size < 36 || entry + entry_size > end) return fail("corrupt mp4a entry");
+
+    uint8_t mp4a[28];
+    if (!read_at(entry + 8, mp4a, sizeof(mp4a))) return false;
+    channel_count = get_u16(mp4a + 16);
+
+    uint64_t pos = entry + 36;
+    uint64_t entry_end = entry + entry_size;
+    while (pos + 8 <= entry_end) {
+        uint8_t header[8];
+        if (!read_at(pos, header, 8)) return false;
+        uint64_t box_size = get_u32(header);
+        if (box_size < 8 || pos + box_size > entry_end) return fail("corrupt mp4a entry");
+        if (memcmp(header + 4, "esds", 4) == 0) {
+            if (box_size - 8 > 1024) return fail("corrupt esds");
+            std::vector<uint8_t> body(box_size - 8);
+            if (!body.empty() && !read_at(pos + 8, &body[0], body.size())) return false;
+            return parse_esds(body);
+        }
+        pos += box_size;
+    }
+    return fail("no esds in mp4a entry");
+}
+
+// ES_Descriptor > DecoderConfigDescriptor > DecoderSpecificInfo (the
+// AudioSpecificConfig), like mp4read's esdsin()
+bool Mp4Index::parse_esds(const std::vector<uint8_t>& body) {
+    size_t pos = 4; // version/flags
+    uint32_t length = 0;
+
+    if (!read_descriptor(body, &pos, 3, &length) || pos + 3 > body.size()) return fail("corrupt esds");
+    uint8_t flags = body[pos + 2];
+    pos += 3;
+    if (flags & 0x80) pos += 2;                                   // depends on ES_ID
+    if ((flags & 0x40) && pos < body.size()) pos += 1 + body[pos]; // URL
+    if (flags & 0x20) pos += 2;                                   // OCR ES_ID
+
+    if (!read_descriptor(body, &pos, 4, &length) || pos + 13 > body.size()) return fail("corrupt esds");
+    if (body[pos] != 0x40) return fail("not MPEG-4 audio");
+    pos += 13;
+
+    if (!read_descriptor(body, &pos, 5, &length)) return fail("corrupt esds");
+    if (length == 0 || length > sizeof(asc_data) || pos + length > body.size()) return fail("corrupt AudioSpecificConfig");
+    memcpy(asc_data, &body[pos], length);
+    asc_length = length;
+    return true;
+}
+
+bool Mp4Index::frame_size(uint32_t frame, uint32_t* size) {
+    if (uniform_size > 0) {
+        *size = uniform_size;
+        return true;
+    }
+    if (sizes.empty() || frame < sizes_first || frame - sizes_first >= sizes.size()) {
+        uint32_t first = frame - frame % MP4_INDEX_SIZE_WINDOW;
+        uint32_t count = std::min<uint32_t>(MP4_INDEX_SIZE_WINDOW, frames - first);
+        uint8_t raw[MP4_INDEX_SIZE_WINDOW * 4];
+        sizes.clear();
+        if (!read_at(size_table + (uint64_t)first * 4, raw, count * 4)) return false;
+        sizes.resize(count);
+        for (uint32_t i = 0; i < count; i++) sizes[i] = get_u32(raw + i * 4);
+        sizes_first = first;
+    }
+    *size = sizes[frame - sizes_first];
+    if (*size == 0 || *size > MP4_INDEX_MAX_FRAME_BYTES) return fail("corrupt sample size");
+    return true;
+}
+
+bool Mp4Index::chunk_offset(uint32_t chunk, uint64_t* offset) {
+    uint8_t raw[8];
+    if (chunk_offsets_64) {
+        if (!read_at(chunk_table + (uint64_t)chunk * 8, raw, 8)) return false;
+        *offset = get_u64(raw);
+    } else {
+        if (!read_at(chunk_table + (uint64_t)chunk * 4, raw, 4)) return false;
+        *offset = get_u32(raw);
+    }
+    return true;
+}
+
+bool Mp4Index::locate(uint32_t frame, uint64_t* offset, uint32_t* size) {
+    if (fd == -1 || frame >= frames) return fail("frame out of range");
+
+    // Run holding the frame, then its chunk
+    size_t run = 0;
+    size_t lo = 0, hi = runs.size();
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (runs[mid].first_frame <= frame) lo = mid;
+        else hi = mid;
+    }
+    run = lo;
+    uint32_t in_run = frame - runs[run].first_frame;
+    uint32_t chunk = runs[run].first_chunk + in_run / runs[run].samples_per_chunk;
+    uint32_t chunk_first = frame - in_run % runs[run].samples_per_chunk;
+
+    uint64_t pos;
+    uint32_t from;
+    if (chunk == last_chunk && last_frame < frame) {
+        pos = last_offset + last_size;
+        from = last_frame + 1;
+    } else {
+        if (!chunk_offset(chunk, &pos)) return false;
+        from = chunk_first;
+    }
+    for (uint32_t f = from; f < frame; f++) {
+        uint32_t skipped;
+        if (!frame_size(f, &skipped)) return false;
+        pos += skipped;
+    }
+    uint32_t bytes;
+    if (!frame_size(frame, &bytes)) return false;
+
+    last_frame = frame;
+    last_chunk = chunk;
+    last_offset = pos;
+    last_size = bytes;
+    *offset = pos;
+    *size = bytes;
+    return true;
+}
+
+bool Mp4Index::read_frame(uint32_t frame, std::vector<uint8_t>* buffer, uint32_t* size) {
+    uint64_t offset;
+    if (!locate(frame, &offset, size)) return false;
+    if (offset + *size > size_bytes) return fail("frame beyond the end of the file");
+    if (buffer->size() < *size) buffer->resize(*size);
+    return read_at(offset, &(*buffer)[0], *size);
+}
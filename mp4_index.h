@@ -0,0 +1,98 @@
+#ifndef MP4_INDEX_H
+#define MP4_INDEX_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Sample-size entries read per pread() (4 bytes each)
+#define MP4_INDEX_SIZE_WINDOW 1024
+// Larger frames mean a corrupt table (AAC: 6144 bits per channel)
+#define MP4_INDEX_MAX_FRAME_BYTES 65536
+
+// --- Mp4Index Class ---
+// Reentrant, read-only view of the audio track of an MP4 file, for work
+// that must not wait for mp4_mutex (held by the playing book): previews,
+// validation and analysis. open() walks the box headers and reads the
+// small tables (stsc, esds); sample sizes and chunk offsets stay in the
+// file and are read on demand with pread(), a window at a time, so opening
+// a 20-hour book costs a few kilobytes of reads.
+// Fragmented files have empty sample tables and are refused.
+// One instance per thread.
+class Mp4Index {
+public:
+    Mp4Index();
+    ~Mp4Index();
+
+    bool open(const char* path);
+    void close();
+    bool is_open() const { return fd != -1; }
+    // Why open() or the last read failed
+    const char* error() const { return error_text; }
+
+    uint32_t samplerate() const { return rate; }
+    uint32_t channels() const { return channel_count; }
+    const uint8_t* asc() const { return asc_data; }
+    uint32_t asc_size() const { return asc_length; }
+    uint32_t frame_count() const { return frames; }
+    // Duration in samples per channel (mdhd)
+    uint64_t total_samples() const { return duration; }
+    uint32_t samples_per_frame() const;
+    uint64_t file_size() const { return size_bytes; }
+
+    // Byte range of a frame. Sequential calls within a chunk cost no
+    // reads beyond the next sample-size window.
+    bool locate(uint32_t frame, uint64_t* offset, uint32_t* size);
+    // Read a frame; false past the end, on a frame beyond the end of the
+    // file (truncated) or on a read error. buffer only grows.
+    bool read_frame(uint32_t frame, std::vector<uint8_t>* buffer, uint32_t* size);
+
+private:
+    // stsc entry, expanded: chunks [first_chunk, next run) hold
+    // samples_per_chunk frames each, starting at first_frame
+    struct ChunkRun {
+        uint32_t first_chunk;
+        uint32_t samples_per_chunk;
+        uint32_t first_frame;
+    };
+
+    int fd;
+    const char* error_text;
+    uint64_t size_bytes;
+
+    uint32_t rate;
+    uint32_t channel_count;
+    uint8_t asc_data[16];
+    uint32_t asc_length;
+    uint32_t frames;
+    uint64_t duration;
+    bool sound_track; // hdlr of the track being parsed
+
+    std::vector<ChunkRun> runs;
+    uint32_t chunk_count;
+    uint64_t chunk_table;    // file offset of the first stco/co64 entry
+    bool chunk_offsets_64;
+    uint64_t size_table;     // file offset of the first stsz entry
+    uint32_t uniform_size;   // stsz sample_size, 0 if per sample
+
+    // Sample-size window
+    std::vector<uint32_t> sizes;
+    uint32_t sizes_first;
+
+    // Last located frame, to continue within its chunk
+    uint32_t last_frame;
+    uint32_t last_chunk;
+    uint64_t last_offset;
+    uint32_t last_size;
+
+    bool fail(const char* text);
+    bool read_at(uint64_t offset, void* buffer, size_t bytes);
+    bool parse_boxes(uint64_t begin, uint64_t end, int depth, bool* found);
+    bool parse_track(uint64_t begin, uint64_t end, int depth);
+    bool parse_stsd(uint64_t begin, uint64_t end);
+    bool parse_esds(const std::vector<uint8_t>& body);
+    bool frame_size(uint32_t frame, uint32_t* size);
+    bool chunk_offset(uint32_t chunk, uint64_t* offset);
+};
+
+#endif // MP4_INDEX_H
@@ -35,12 +35,22 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <math.h>
-#include <neaacdec.h>
+#include <faad/neaacdec.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "unicode_support.h"
 #include "audio.h"
 
+/* stdio buffer of the output file: large writes, few syscalls */
+#define AUDIO_FILE_BUFFER (256 * 1024)
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define AUDIO_HOST_LE 1
+#else
+#define AUDIO_HOST_LE 0
+#endif
+
 static size_t write_wav_header(audio_file *aufile);
 static size_t write_wav_extensible_header(audio_file *aufile, long channelMask);
 static size_t write_audio_16bit(audio_file *aufile, void *sample_buffer,
@@ -52,12 +62,42 @@ static size_t write_audio_32bit(audio_file *aufile, void *sample_buffer,
 static size_t write_audio_float(audio_file *aufile, void *sample_buffer,
                                 unsigned int samples);
 
-audio_file *open_audio_file(char *infile, int samplerate, int channels,
+/* The conversion buffer for size bytes: reallocated only when a larger
+ * block than ever before comes in */
+static unsigned char *reserve_buffer(audio_file *aufile, size_t size)
+{
+    if (size > aufile->buffer_size)
+    {
+        unsigned char *buffer = realloc(aufile->buffer, size);
+        if (buffer == NULL)
+            return NULL;
+        aufile->buffer = buffer;
+        aufile->buffer_size = size;
+    }
+    return aufile->buffer;
+}
+
+static size_t write_samples(audio_file *aufile, const void *data,
+                            unsigned int samples)
+{
+    size_t ret = fwrite(data, aufile->bits_per_sample/8, samples, aufile->sndfile);
+    if (ret != samples)
+        aufile->error = 1;
+    return ret;
+}
+
+audio_file *open_audio_file(const char *infile, int samplerate, int channels,
                             int outputFormat, int fileType, long channelMask)
 {
     audio_file *aufile = malloc(sizeof(audio_file));
 
+    if (aufile == NULL)
+        return NULL;
+
     aufile->outputFormat = outputFormat;
+    aufile->error = 0;
+    aufile->buffer = NULL;
+    aufile->buffer_size = 0;
 
     aufile->samplerate = samplerate;
     aufile->channels = channels;
@@ -99,6 +139,8 @@ audio_file *open_audio_file(char *infile, int samplerate, int channels,
         if (aufile) free(aufile);
         return NULL;
     }
+    if (!aufile->toStdio)
+        setvbuf(aufile->sndfile, NULL, _IOFBF, AUDIO_FILE_BUFFER);
 
     if (aufile->fileType == OUTPUT_WAV)
     {
@@ -130,22 +172,28 @@ size_t write_audio_file(audio_file *aufile, void *sample_buffer, int samples)
     // return 0;
 }
 
-void close_audio_file(audio_file *aufile)
+int close_audio_file(audio_file *aufile)
 {
+    int error = aufile->error;
+
     if ((aufile->fileType == OUTPUT_WAV) && (aufile->toStdio == 0))
     {
-        fseek(aufile->sndfile, 0, SEEK_SET);
-
-        if (aufile->channelMask)
-            write_wav_extensible_header(aufile, aufile->channelMask);
+        if (fseek(aufile->sndfile, 0, SEEK_SET) != 0)
+            error = 1;
+        else if (aufile->channelMask)
+            error |= write_wav_extensible_header(aufile, aufile->channelMask) != 1;
         else
-            write_wav_header(aufile);
+            error |= write_wav_header(aufile) != 1;
     }
 
     if (aufile->toStdio == 0)
-        fclose(aufile->sndfile);
+        error |= fclose(aufile->sndfile) != 0;
+    else
+        error |= fflush(aufile->sndfile) != 0;
 
-    if (aufile) free(aufile);
+    free(aufile->buffer);
+    free(aufile);
+    return error ? -1 : 0;
 }
 
 static size_t write_wav_header(audio_file *aufile)
@@ -153,12 +201,12 @@ static size_t write_wav_header(audio_file *aufile)
     unsigned char header[44];
     unsigned char* p = header;
     unsigned int bytes = (aufile->bits_per_sample + 7) / 8;
-    float data_size = (float)bytes * aufile->total_samples;
+    double data_size = (double)bytes * aufile->total_samples;
     unsigned long word32;
 
     *p++ = 'R'; *p++ = 'I'; *p++ = 'F'; *p++ = 'F';
 
-    word32 = (data_size + (44 - 8) < (float)MAXWAVESIZE) ?
+    word32 = (data_size + (44 - 8) < (double)MAXWAVESIZE) ?
         (unsigned long)data_size + (44 - 8)  :  (unsigned long)MAXWAVESIZE;
     *p++ = (unsigned char)(word32 >>  0);
     *p++ = (unsigned char)(word32 >>  8);
@@ -217,12 +265,12 @@ static size_t write_wav_extensible_header(audio_file *aufile, long channelMask)
     unsigned char header[68];
     unsigned char* p = header;
     unsigned int bytes = (aufile->bits_per_sample + 7) / 8;
-    float data_size = (float)bytes * aufile->total_samples;
+    double data_size = (double)bytes * aufile->total_samples;
     unsigned long word32;
 
     *p++ = 'R'; *p++ = 'I'; *p++ = 'F'; *p++ = 'F';
 
-    word32 = (data_size + (68 - 8) < (float)MAXWAVESIZE) ?
+    word32 = (data_size + (68 - 8) < (double)MAXWAVESIZE) ?
         (unsigned long)data_size + (68 - 8)  :  (unsigned long)MAXWAVESIZE;
     *p++ = (unsigned char)(word32 >>  0);
     *p++ = (unsigned char)(word32 >>  8);
@@ -314,10 +362,9 @@ static size_t write_wav_extensible_header(audio_file *aufile, long channelMask)
 static size_t write_audio_16bit(audio_file *aufile, void *sample_buffer,
                                 unsigned int samples)
 {
-    size_t ret;
     unsigned int i;
     short *sample_buffer16 = (short*)sample_buffer;
-    char *data = malloc(samples*aufile->bits_per_sample*sizeof(char)/8);
+    unsigned char *data;
 
     aufile->total_samples += samples;
 
@@ -341,28 +388,38 @@ static size_t write_audio_16bit(audio_file *aufile, void *sample_buffer,
         }
     }
 
+    /* WAV is little-endian: the samples are written as they are */
+    if (AUDIO_HOST_LE)
+        return write_samples(aufile, sample_buffer16, samples);
+
+    data = reserve_buffer(aufile, (size_t)samples * 2);
+    if (data == NULL)
+    {
+        aufile->error = 1;
+        return 0;
+    }
     for (i = 0; i < samples; i++)
     {
-        data[i*2] = (char)(sample_buffer16[i] & 0xFF);
-        data[i*2+1] = (char)((sample_buffer16[i] >> 8) & 0xFF);
+        data[i*2] = (unsigned char)(sample_buffer16[i] & 0xFF);
+        data[i*2+1] = (unsigned char)((sample_buffer16[i] >> 8) & 0xFF);
     }
 
-    ret = fwrite(data, samples, aufile->bits_per_sample/8, aufile->sndfile);
-
-    if (data) free(data);
-
-    return ret;
+    return write_samples(aufile, data, samples);
 }
 
 static size_t write_audio_24bit(audio_file *aufile, void *sample_buffer,
                                 unsigned int samples)
 {
-    size_t ret;
     unsigned int i;
     int32_t *sample_buffer24 = (int32_t*)sample_buffer;
-    char *data = malloc(samples*aufile->bits_per_sample*sizeof(char)/8);
+    unsigned char *data = reserve_buffer(aufile, (size_t)samples*aufile->bits_per_sample/8);
 
     aufile->total_samples += samples;
+    if (data == NULL)
+    {
+        aufile->error = 1;
+        return 0;
+    }
 
     if (aufile->channels == 6 && aufile->channelMask)
     {
@@ -391,20 +448,15 @@ static size_t write_audio_24bit(audio_file *aufile, void *sample_buffer,
         data[i*3+2] = (char)((sample_buffer24[i] >> 16) & 0xFF);
     }
 
-    ret = fwrite(data, samples, aufile->bits_per_sample/8, aufile->sndfile);
-
-    if (data) free(data);
-
-    return ret;
+    return write_samples(aufile, data, samples);
 }
 
 static size_t write_audio_32bit(audio_file *aufile, void *sample_buffer,
                                 unsigned int samples)
 {
-    size_t ret;
     unsigned int i;
     int32_t *sample_buffer32 = (int32_t*)sample_buffer;
-    char *data = malloc(samples*aufile->bits_per_sample*sizeof(char)/8);
+    unsigned char *data;
 
     aufile->total_samples += samples;
 
@@ -428,6 +480,15 @@ static size_t write_audio_32bit(audio_file *aufile, void *sample_buffer,
         }
     }
 
+    if (AUDIO_HOST_LE)
+        return write_samples(aufile, sample_buffer32, samples);
+
+    data = reserve_buffer(aufile, (size_t)samples * 4);
+    if (data == NULL)
+    {
+        aufile->error = 1;
+        return 0;
+    }
     for (i = 0; i < samples; i++)
     {
         data[i*4] = (char)(sample_buffer32[i] & 0xFF);
@@ -436,20 +497,15 @@ static size_t write_audio_32bit(audio_file *aufile, void *sample_buffer,
         data[i*4+3] = (char)((sample_buffer32[i] >> 24) & 0xFF);
     }
 
-    ret = fwrite(data, samples, aufile->bits_per_sample/8, aufile->sndfile);
-
-    if (data) free(data);
-
-    return ret;
+    return write_samples(aufile, data, samples);
 }
 
 static size_t write_audio_float(audio_file *aufile, void *sample_buffer,
                                 unsigned int samples)
 {
-    size_t ret;
     unsigned int i;
     float *sample_buffer_f = (float*)sample_buffer;
-    unsigned char *data = malloc(samples*aufile->bits_per_sample*sizeof(char)/8);
+    unsigned char *data;
 
     aufile->total_samples += samples;
 
@@ -473,6 +529,16 @@ static size_t write_audio_float(audio_file *aufile, void *sample_buffer,
         }
     }
 
+    /* IEEE 754 single precision, like the file */
+    if (AUDIO_HOST_LE)
+        return write_samples(aufile, sample_buffer_f, samples);
+
+    data = reserve_buffer(aufile, (size_t)samples * 4);
+    if (data == NULL)
+    {
+        aufile->error = 1;
+        return 0;
+    }
     for (i = 0; i < samples; i++)
     {
         int exponent, mantissa, negative = 0 ;
@@ -504,9 +570,5 @@ static size_t write_audio_float(audio_file *aufile, void *sample_buffer,
         data[i*4+3] |= (exponent >> 1) & 0x7F;
     }
 
-    ret = fwrite(data, samples, aufile->bits_per_sample/8, aufile->sndfile);
-
-    if (data) free(data);
-
-    return ret;
+    return write_samples(aufile, data, samples);
 }
@@ -51,12 +51,18 @@ typedef struct
     unsigned int channels;
     unsigned long total_samples;
     long channelMask;
+    int error;
+    /* Conversion buffer, kept between calls and only ever grown */
+    unsigned char *buffer;
+    size_t buffer_size;
 } audio_file;
 
-audio_file *open_audio_file(char *infile, int samplerate, int channels,
+audio_file *open_audio_file(const char *infile, int samplerate, int channels,
                             int outputFormat, int fileType, long channelMask);
+/* Returns the number of samples written */
 size_t write_audio_file(audio_file *aufile, void *sample_buffer, int samples);
-void close_audio_file(audio_file *aufile);
+/* Returns 0, or -1 if a write failed */
+int close_audio_file(audio_file *aufile);
 
 #ifdef __cplusplus
 }
@@ -25,9 +25,12 @@
 #include <string.h>
 #include <time.h>
 #include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "unicode_support.h"
 #include "mp4read.h"
+#include "../logger.h"
 
 enum ATOM_TYPE
 {
@@ -57,9 +60,114 @@ mp4config_t mp4config = { 0 };
 
 static FILE *g_fin = NULL;
 
-enum {ERR_OK = 0, ERR_FAIL = -1, ERR_UNSUPPORTED = -2};
+enum {ERR_OK = 0, ERR_FAIL = -1, ERR_UNSUPPORTED = -2, ERR_AGAIN = MP4READ_AGAIN};
 
-#define freeMem(A) if (*(A)) {free(*(A)); *(A) = NULL;}
+/*
+ * Per-open arena: every allocation made while parsing a file (frame table,
+ * chunk map, tag strings, chapters, cover art, frame buffer) is bumped out of
+ * a few large blocks, and mp4read_close() drops them all at once. The first
+ * block is kept for the next open, so switching books does not churn the heap.
+ */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+
+typedef struct arena_block
+{
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    int locked;
+} arena_block_t;
+
+#define ARENA_HEADER ((sizeof(arena_block_t) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+static arena_block_t *g_arena = NULL;
+static int g_arena_lock = 0;
+
+static void arena_block_lock(arena_block_t *block)
+{
+    if (!block->locked && mlock(block, ARENA_HEADER + block->size) == 0)
+        block->locked = 1;
+}
+
+static void arena_block_free(arena_block_t *block)
+{
+    if (block->locked)
+        munlock(block, ARENA_HEADER + block->size);
+    free(block);
+}
+
+static arena_block_t *arena_block_new(size_t size)
+{
+    arena_block_t *block = (arena_block_t*)malloc(ARENA_HEADER + size);
+    if (!block)
+        return NULL;
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    block->locked = 0;
+    if (g_arena_lock)
+        arena_block_lock(block);
+    return block;
+}
+
+static void *arena_alloc(size_t size)
+{
+    arena_block_t *block;
+    size_t need = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    if (need < size)
+        return NULL;
+
+    if (g_arena && g_arena->size - g_arena->used >= need)
+    {
+        block = g_arena;
+    }
+    else if (need > ARENA_BLOCK_SIZE / 4 && g_arena)
+    {
+        /* Large request (frame table, cover): dedicated block behind the
+         * current one, which keeps serving the small allocations */
+        block = arena_block_new(need);
+        if (!block)
+            return NULL;
+        block->next = g_arena->next;
+        g_arena->next = block;
+    }
+    else
+    {
+        block = arena_block_new(need > ARENA_BLOCK_SIZE ? need : ARENA_BLOCK_SIZE);
+        if (!block)
+            return NULL;
+        block->next = g_arena;
+        g_arena = block;
+    }
+
+    void *p = (uint8_t*)block + ARENA_HEADER + block->used;
+    block->used += need;
+    return p;
+}
+
+static void arena_reset(void)
+{
+    arena_block_t *keep = NULL;
+
+    while (g_arena)
+    {
+        arena_block_t *next = g_arena->next;
+        if (!keep && g_arena->size == ARENA_BLOCK_SIZE)
+        {
+            keep = g_arena;
+            keep->used = 0;
+            keep->next = NULL;
+        }
+        else
+        {
+            arena_block_free(g_arena);
+        }
+        g_arena = next;
+    }
+    g_arena = keep;
+}
 
 static size_t datain(void *data, size_t size)
 {
@@ -325,8 +433,9 @@ static int sttsin(int size)
     u32in();
     ntts = u32in();
 
+    // Empty in fragmented files: samples are described by the fragments
     if (ntts < 1)
-        return ERR_FAIL;
+        return size;
 
     /* 2 x uint32_t per entry */
     if (((size - 8u) / 8u) < ntts)
@@ -348,12 +457,12 @@ static int stscin(int size)
     mp4config.frame.nsclices = u32in();
 
     if (!mp4config.frame.nsclices)
-        return ERR_FAIL;
+        return size; // fragmented
 
     tmp = sizeof(slice_info_t) * mp4config.frame.nsclices;
     if (tmp < mp4config.frame.nsclices)
         return ERR_FAIL;
-    mp4config.frame.map = malloc(tmp);
+    mp4config.frame.map = arena_alloc(tmp);
     if (!mp4config.frame.map)
         return ERR_FAIL;
 
@@ -394,12 +503,12 @@ static int stszin(int size)
     mp4config.frame.nsamples = u32in();
 
     if (!mp4config.frame.nsamples)
-        return ERR_FAIL;
+        return size; // fragmented
 
     tmp = sizeof(frame_info_t) * mp4config.frame.nsamples;
     if (tmp < mp4config.frame.nsamples)
         return ERR_FAIL;
-    mp4config.frame.info = malloc(tmp);
+    mp4config.frame.info = arena_alloc(tmp);
     if (!mp4config.frame.info)
         return ERR_FAIL;
 
@@ -430,6 +539,8 @@ static int stcoin(int size)
 
     // Number of entries
     numchunks = u32in();
+    if (numchunks < 1 && mp4config.frame.nsamples == 0)
+        return size; // fragmented
     if ((numchunks < 1) || ((numchunks + 1) == 0))
         return ERR_FAIL;
 
@@ -463,7 +574,8 @@ static int stcoin(int size)
         samplesleft--;
     }
 
-    freeMem(&mp4config.frame.map);
+    /* Only needed to build the offsets; released with the arena */
+    mp4config.frame.map = NULL;
 
     return size;
 }
@@ -519,28 +631,26 @@ static int chplin(int size)
     count = u8in();
     
     if (count > 0) {
-        mp4config.chapters = (mp4chapter_t*)malloc(sizeof(mp4chapter_t) * count);
+        mp4config.chapters = (mp4chapter_t*)arena_alloc(sizeof(mp4chapter_t) * count);
         if (mp4config.chapters) {
             mp4config.chapter_count = count;
             
             for (i = 0; i < count; i++) {
                 uint64_t time = (uint64_t)u32in() << 32 | u32in();
                 int len = u8in();
-                char *title = (char*)malloc(len + 1);
+                char *title = (char*)arena_alloc(len + 1);
                 if (title) {
                     datain(title, len);
                     title[len] = 0;
                     mp4config.chapters[i].title = title;
                 } else {
-                    // Skip title data if malloc fails
+                    // Skip title data if allocation fails
                     while(len--) u8in();
                     mp4config.chapters[i].title = NULL;
                 }
                 mp4config.chapters[i].timestamp = time;
                 
-                if (mp4config.verbose.tags) {
-                    fprintf(stderr, "Chapter %d: %s at %lu\n", i+1, title ? title : "NULL", (unsigned long)(time/10000000));
-                }
+                LOG_D("Chapter %d: %s at %lu\n", i+1, title ? title : "NULL", (unsigned long)(time/10000000));
             }
         }
     }
@@ -656,7 +766,6 @@ static int ilstin(int size)
         "Unknown",
     };
 
-    fprintf(stderr, "----------tag list-------------\n");
     while(read < size)
     {
         int asize, dsize;
@@ -681,13 +790,8 @@ static int ilstin(int size)
                 break;
         }
 
-        if (tags[cnt].name)
-            fprintf(stderr, "%s :   ", tags[cnt].name);
-        else
-        {
-            if (tags[cnt].flag != EXTAG)
-                fprintf(stderr, "'%s'       :   ", tagid);
-        }
+        if (tags[cnt].flag != EXTAG)
+            LOG_D("tag '%s' (%s)\n", tagid, tags[cnt].name ? tags[cnt].name : "unknown");
 
         dsize = u32in();
         asize -= 4;
@@ -702,8 +806,6 @@ static int ilstin(int size)
         }
         else
         {
-            int spc;
-
             if (memcmp(id, "mean", 4))
                 goto skip;
             dsize -= 8;
@@ -726,17 +828,13 @@ static int ilstin(int size)
                 asize -= 4;
                 dsize -= 4;
             }
-            spc = 13 - dsize;
-            if (spc < 0) spc = 0;
+            // extended tag name
             while (dsize > 0)
             {
-                fprintf(stderr, "%c",u8in());
+                u8in();
                 asize--;
                 dsize--;
             }
-            while (spc--)
-                fprintf(stderr, " ");
-            fprintf(stderr, ":   ");
             if (asize >= 8)
             {
                 dsize = u32in() - 8;
@@ -750,13 +848,13 @@ static int ilstin(int size)
                 asize -= 4;
                 dsize -= 4;
             }
+            // extended tag value
             while (dsize > 0)
             {
-                fprintf(stderr, "%c",u8in());
+                u8in();
                 asize--;
                 dsize--;
             }
-            fprintf(stderr, "\n");
 
             goto skip;
         }
@@ -764,13 +862,12 @@ static int ilstin(int size)
         asize -= 4;
         u32in();
         asize -= 4;
-        fprintf(stderr, "[type %02x] ", type);
         switch(type)
         {
         case 1:
             if (!memcmp(tagid, tags[0].id, 4) || !memcmp(tagid, tags[2].id, 4) || !memcmp(tagid, tags[12].id, 4))
             {
-                char *val = (char*)malloc(asize + 1);
+                char *val = (char*)arena_alloc(asize + 1);
                 if (val)
                 {
                     int k;
@@ -778,16 +875,13 @@ static int ilstin(int size)
                     val[asize] = 0;
 
                     if (!memcmp(tagid, tags[12].id, 4)) {
-                        freeMem(&mp4config.meta_title);
-                        fprintf(stderr, "Title %s\n", val);
+                        LOG_D("Title %s\n", val);
                         mp4config.meta_title = val;
                     } else if (!memcmp(tagid, tags[2].id, 4)) {
-                        freeMem(&mp4config.meta_artist);
-                        fprintf(stderr, "Artist %s\n", val);
+                        LOG_D("Artist %s\n", val);
                         mp4config.meta_artist = val;
                     } else if (!memcmp(tagid, tags[0].id, 4)) {
-                        freeMem(&mp4config.meta_album);
-                        fprintf(stderr, "Album %s\n", val);
+                        LOG_D("Album %s\n", val);
                         mp4config.meta_album = val;
                     }
                     asize = 0;
@@ -796,7 +890,7 @@ static int ilstin(int size)
                 {
                      while (asize > 0)
                     {
-                        fprintf(stderr, "%c",u8in());
+                        u8in();
                         asize--;
                     }
                 }
@@ -805,7 +899,7 @@ static int ilstin(int size)
             {
                 while (asize > 0)
                 {
-                    fprintf(stderr, "%c",u8in());
+                    u8in();
                     asize--;
                 }
             }
@@ -814,13 +908,17 @@ static int ilstin(int size)
             switch(tags[cnt].flag)
             {
             case NUMSET:
-                u16in();
-                asize -= 2;
+                {
+                    int num, total;
+                    u16in();
+                    asize -= 2;
 
-                fprintf(stderr, "%d", u16in());
-                asize -= 2;
-                fprintf(stderr, "/%d", u16in());
-                asize -= 2;
+                    num = u16in();
+                    asize -= 2;
+                    total = u16in();
+                    asize -= 2;
+                    LOG_D("%d/%d\n", num, total);
+                }
                 break;
             case GENRE:
                 {
@@ -831,14 +929,13 @@ static int ilstin(int size)
                     gnum--;
                     if (gnum >= 147)
                         gnum = 147;
-                    fprintf(stderr, "%s", genres[gnum]);
+                    LOG_D("Genre %s\n", genres[gnum]);
                 }
                 break;
             default:
                  if (!memcmp(tagid, "covr", 4))
                 {
-                    freeMem(&mp4config.cover_art.data);
-                    mp4config.cover_art.data = (uint8_t*)malloc(asize);
+                    mp4config.cover_art.data = (uint8_t*)arena_alloc(asize);
                     if (mp4config.cover_art.data)
                     {
                         mp4config.cover_art.size = asize;
@@ -850,7 +947,7 @@ static int ilstin(int size)
                 {
                     while(asize > 0)
                     {
-                        fprintf(stderr, "%d/", u16in());
+                        u16in();
                         asize-=2;
                     }
                 }
@@ -860,17 +957,14 @@ static int ilstin(int size)
             //fprintf(stderr, "(8bit data)");
             while(asize > 0)
             {
-                fprintf(stderr, "%d", u8in());
+                u8in();
                 asize--;
-                if (asize)
-                    fprintf(stderr, "/");
             }
             break;
         default:
-            fprintf(stderr, "(unknown data type)");
+            LOG_D("(unknown data type %02x)\n", type);
             break;
         }
-        fprintf(stderr, "\n");
 
     skip:
         // skip to the end of atom
@@ -880,11 +974,280 @@ static int ilstin(int size)
             asize--;
         }
     }
-    fprintf(stderr, "-------------------------------\n");
-
     return size;
 }
 
+/*
+ * Fragmented MP4 (moof/traf/trun) and files still being written.
+ *
+ * In a fragmented file the moov sample tables are empty and every moof
+ * describes the samples of the mdat that follows it. The top-level boxes are
+ * scanned once, in order; scan_pos remembers where the scan stopped (end of
+ * file or an incomplete box), so when the file grows only the new part is
+ * indexed. The frame table grows in the arena by doubling.
+ */
+#define FRAG_MIN_CAPACITY 4096
+// A file modified this recently may still be copied
+#define GROW_TIMEOUT_SECONDS 10
+
+static struct
+{
+    int fragmented;
+    long scan_pos;
+    long file_size;
+    time_t grown_at;
+    uint32_t capacity;      // frame.info entries allocated
+    uint32_t bitbuf_size;   // bytes allocated for bitbuf
+    uint32_t trex_duration; // defaults from moov/mvex/trex
+    uint32_t trex_size;
+    uint64_t duration;      // sum of fragment sample durations
+} g_frag;
+
+static long file_size(void)
+{
+    struct stat st;
+    if (fstat(fileno(g_fin), &st) != 0)
+        return 0;
+    if ((long)st.st_size != g_frag.file_size)
+    {
+        // The first call (at open) only records the size
+        if (g_frag.file_size)
+            g_frag.grown_at = time(NULL);
+        g_frag.file_size = (long)st.st_size;
+    }
+    if (st.st_mtime > g_frag.grown_at)
+        g_frag.grown_at = st.st_mtime;
+    return g_frag.file_size;
+}
+
+static int file_growing(void)
+{
+    file_size();
+    return time(NULL) - g_frag.grown_at < GROW_TIMEOUT_SECONDS;
+}
+
+// Read a box header at pos; size 0 means "to the end of the file"
+static int box_header(long pos, uint64_t *size, char name[4], long *hdrsize)
+{
+    uint32_t size32;
+
+    if (fseek(g_fin, pos, SEEK_SET))
+        return ERR_FAIL;
+    size32 = u32in();
+    if (datain(name, 4) != 4)
+        return ERR_FAIL;
+    *hdrsize = 8;
+    *size = size32;
+    if (size32 == 1)
+    {
+        uint64_t hi = u32in();
+        *size = (hi << 32) | u32in();
+        *hdrsize = 16;
+    }
+    if (*size != 0 && *size < (uint64_t)*hdrsize)
+        return ERR_FAIL;
+    return ERR_OK;
+}
+
+static int bitbuf_reserve(uint32_t size)
+{
+    uint8_t *buf;
+
+    if (size <= g_frag.bitbuf_size && mp4config.bitbuf.data)
+        return ERR_OK;
+    buf = arena_alloc(size ? size : 1);
+    if (!buf)
+        return ERR_FAIL;
+    mp4config.bitbuf.data = buf;
+    g_frag.bitbuf_size = size;
+    return ERR_OK;
+}
+
+static int frame_append(uint32_t len, uint64_t offset)
+{
+    uint32_t n = mp4config.frame.nsamples;
+
+    if (offset + len > UINT32_MAX)
+        return ERR_FAIL;
+    if (n >= g_frag.capacity)
+    {
+        uint32_t capacity = g_frag.capacity ? g_frag.capacity * 2 : FRAG_MIN_CAPACITY;
+        frame_info_t *info = arena_alloc(sizeof(frame_info_t) * (size_t)capacity);
+        if (!info)
+            return ERR_FAIL;
+        if (n)
+            memcpy(info, mp4config.frame.info, sizeof(frame_info_t) * n);
+        mp4config.frame.info = info;
+        g_frag.capacity = capacity;
+    }
+    mp4config.frame.info[n].len = len;
+    mp4config.frame.info[n].offset = (uint32_t)offset;
+    if (mp4config.frame.maxsize < len)
+        mp4config.frame.maxsize = len;
+    mp4config.frame.nsamples = n + 1;
+    return ERR_OK;
+}
+
+static void trex_scan(long pos, long end)
+{
+    while (pos + 8 <= end)
+    {
+        uint64_t size;
+        char name[4];
+        long hdr;
+
+        if (box_header(pos, &size, name, &hdr) || size == 0)
+            return;
+        if (!memcmp(name, "mvex", 4))
+        {
+            trex_scan(pos + hdr, pos + (long)size);
+        }
+        else if (!memcmp(name, "trex", 4))
+        {
+            // version/flags, track_ID, default_sample_description_index
+            u32in();
+            u32in();
+            u32in();
+            g_frag.trex_duration = u32in();
+            g_frag.trex_size = u32in();
+        }
+        pos += (long)size;
+    }
+}
+
+static int traf_scan(long moof_pos, long pos, long end)
+{
+    uint32_t tfhd_flags = 0;
+    uint64_t base = (uint64_t)moof_pos;
+    uint64_t next_data = base;
+    uint32_t default_duration = g_frag.trex_duration;
+    uint32_t default_size = g_frag.trex_size;
+
+    while (pos + 8 <= end)
+    {
+        uint64_t size;
+        char name[4];
+        long hdr;
+
+        if (box_header(pos, &size, name, &hdr) || size == 0)
+            return ERR_FAIL;
+
+        if (!memcmp(name, "tfhd", 4))
+        {
+            tfhd_flags = u32in() & 0xffffff;
+            // track_ID (single audio track)
+            u32in();
+            if (tfhd_flags & 0x01)
+            {
+                uint64_t hi = u32in();
+                base = (hi << 32) | u32in();
+            }
+            if (tfhd_flags & 0x02)
+                u32in(); // sample_description_index
+            if (tfhd_flags & 0x08)
+                default_duration = u32in();
+            if (tfhd_flags & 0x10)
+                default_size = u32in();
+            next_data = base;
+        }
+        else if (!memcmp(name, "trun", 4))
+        {
+            uint32_t flags = u32in() & 0xffffff;
+            uint32_t count = u32in();
+            uint32_t i;
+
+            if (flags & 0x01)
+                next_data = base + (int32_t)u32in();
+            if (flags & 0x04)
+                u32in(); // first_sample_flags
+            for (i = 0; i < count; i++)
+            {
+                uint32_t duration = default_duration;
+                uint32_t len = default_size;
+                if (flags & 0x100)
+                    duration = u32in();
+                if (flags & 0x200)
+                    len = u32in();
+                if (flags & 0x400)
+                    u32in(); // sample_flags
+                if (flags & 0x800)
+                    u32in(); // composition time offset
+                if (frame_append(len, next_data))
+                    return ERR_FAIL;
+                next_data += len;
+                g_frag.duration += duration ? duration : 1024;
+            }
+        }
+        pos += (long)size;
+    }
+    return ERR_OK;
+}
+
+// Index the boxes added since the last scan
+static int frag_scan(void)
+{
+    long end = file_size();
+    uint32_t before = mp4config.frame.nsamples;
+    long resume = ftell(g_fin);
+
+    while (g_frag.scan_pos + 8 <= end)
+    {
+        uint64_t size;
+        char name[4];
+        long hdr;
+        long pos = g_frag.scan_pos;
+
+        if (box_header(pos, &size, name, &hdr))
+            break;
+        // Open-ended or incomplete box: wait for the rest
+        if (size == 0 || pos + (long)size > end || pos + (long)size < pos)
+            break;
+
+        if (!memcmp(name, "moov", 4))
+        {
+            trex_scan(pos + hdr, pos + (long)size);
+        }
+        else if (!memcmp(name, "moof", 4))
+        {
+            long child = pos + hdr;
+            while (child + 8 <= pos + (long)size)
+            {
+                uint64_t csize;
+                char cname[4];
+                long chdr;
+                if (box_header(child, &csize, cname, &chdr) || csize == 0)
+                    break;
+                if (!memcmp(cname, "traf", 4) &&
+                    traf_scan(pos, child + chdr, child + (long)csize))
+                {
+                    LOG_W("bad fragment @%lx\n", pos);
+                    break;
+                }
+                child += (long)csize;
+            }
+        }
+        g_frag.scan_pos = pos + (long)size;
+    }
+
+    fseek(g_fin, resume, SEEK_SET);
+
+    if (mp4config.frame.nsamples != before)
+    {
+        mp4config.samples = (uint32_t)g_frag.duration;
+        if (bitbuf_reserve(mp4config.frame.maxsize))
+            return ERR_FAIL;
+        LOG_D("fragments: %u frames indexed\n", mp4config.frame.nsamples);
+    }
+    return ERR_OK;
+}
+
+int mp4read_refresh(void)
+{
+    if (!g_fin || !g_frag.fragmented)
+        return ERR_OK;
+    return frag_scan();
+}
+
 static creator_t *g_atom = 0;
 static int parse(uint32_t *sizemax)
 {
@@ -894,7 +1257,7 @@ static int parse(uint32_t *sizemax)
 
     if (g_atom->opcode != ATOM_NAME)
     {
-        fprintf(stderr, "parse error: root is not a 'name' opcode\n");
+        LOG_E("parse error: root is not a 'name' opcode\n");
         return ERR_FAIL;
     }
     //fprintf(stderr, "looking for '%s'\n", (char *)g_atom->name);
@@ -908,12 +1271,12 @@ static int parse(uint32_t *sizemax)
         apos = ftell(g_fin);
         if (apos >= (aposmax - 8))
         {
-            fprintf(stderr, "parse error: atom '%s' not found\n", g_atom->name);
+            LOG_W("parse error: atom '%s' not found\n", g_atom->name);
             return ERR_FAIL;
         }
         if ((tmp = u32in()) < 8)
         {
-            fprintf(stderr, "invalid atom size %x @%lx\n", tmp, ftell(g_fin));
+            LOG_W("invalid atom size %x @%lx\n", tmp, ftell(g_fin));
             return ERR_FAIL;
         }
 
@@ -921,7 +1284,7 @@ static int parse(uint32_t *sizemax)
         if (datain(name, 4) != 4)
         {
             // EOF
-            fprintf(stderr, "can't read atom name @%lx\n", ftell(g_fin));
+            LOG_W("can't read atom name @%lx\n", ftell(g_fin));
             return ERR_FAIL;
         }
 
@@ -1095,7 +1458,13 @@ static creator_t g_meta2[] = {
 int mp4read_frame(void)
 {
     if (mp4config.frame.current >= mp4config.frame.nsamples)
-        return ERR_FAIL;
+    {
+        // More fragments may have landed since the last scan
+        if (g_frag.fragmented)
+            frag_scan();
+        if (mp4config.frame.current >= mp4config.frame.nsamples)
+            return (g_frag.fragmented && file_growing()) ? ERR_AGAIN : ERR_FAIL;
+    }
 
     // TODO(eustas): avoid no-op seeks
     mp4read_seek(mp4config.frame.current);
@@ -1105,7 +1474,11 @@ int mp4read_frame(void)
     if (fread(mp4config.bitbuf.data, 1, mp4config.bitbuf.size, g_fin)
         != mp4config.bitbuf.size)
     {
-        fprintf(stderr, "can't read frame data(frame %d@0x%x)\n",
+        // Frame not fully copied yet: retry the same frame later
+        clearerr(g_fin);
+        if (file_growing())
+            return ERR_AGAIN;
+        LOG_E("can't read frame data(frame %d@0x%x)\n",
                mp4config.frame.current,
                mp4config.frame.info[mp4config.frame.current].offset);
 
@@ -1119,8 +1492,15 @@ int mp4read_frame(void)
 
 int mp4read_seek(uint32_t framenum)
 {
-    if (framenum > mp4config.frame.nsamples)
-        return ERR_FAIL;
+    if (framenum >= mp4config.frame.nsamples)
+    {
+        // The frame may be in a fragment still to come
+        if (!g_frag.fragmented)
+            return ERR_FAIL;
+        frag_scan();
+        if (framenum >= mp4config.frame.nsamples)
+            return file_growing() ? ERR_AGAIN : ERR_FAIL;
+    }
     if (fseek(g_fin, mp4config.frame.info[framenum].offset, SEEK_SET))
         return ERR_FAIL;
 
@@ -1146,26 +1526,58 @@ static void mp4info(void)
         fprintf(stderr, "Data offset:\t%x\n", mp4config.frame.info[0].offset);
 }
 
-int mp4read_close(void)
+int mp4read_lock_memory(int lock)
 {
-    freeMem(&mp4config.frame.info);
-    freeMem(&mp4config.frame.map);
-    freeMem(&mp4config.bitbuf.data);
-
-    freeMem(&mp4config.meta_title);
-    freeMem(&mp4config.meta_artist);
-    freeMem(&mp4config.meta_album);
-    freeMem(&mp4config.cover_art.data);
-    mp4config.cover_art.size = 0;
-    
-    if (mp4config.chapters) {
-        for (uint32_t i = 0; i < mp4config.chapter_count; i++) {
-            freeMem(&mp4config.chapters[i].title);
+    arena_block_t *block;
+    int ok = 1;
+
+    g_arena_lock = lock;
+    for (block = g_arena; block; block = block->next)
+    {
+        if (lock)
+        {
+            arena_block_lock(block);
+            ok &= block->locked;
+        }
+        else if (block->locked)
+        {
+            munlock(block, ARENA_HEADER + block->size);
+            block->locked = 0;
         }
-        freeMem(&mp4config.chapters);
     }
+    return ok ? ERR_OK : ERR_FAIL;
+}
+
+int mp4read_close(void)
+{
+    if (g_fin)
+    {
+        fclose(g_fin);
+        g_fin = NULL;
+    }
+
+    // Everything below lives in the arena
+    mp4config.frame.info = NULL;
+    mp4config.frame.map = NULL;
+    mp4config.bitbuf.data = NULL;
+
+    mp4config.meta_title = NULL;
+    mp4config.meta_artist = NULL;
+    mp4config.meta_album = NULL;
+    mp4config.cover_art.data = NULL;
+    mp4config.cover_art.size = 0;
+
+    mp4config.chapters = NULL;
     mp4config.chapter_count = 0;
 
+    mp4config.frame.nsamples = 0;
+    mp4config.frame.nsclices = 0;
+    mp4config.frame.current = 0;
+    mp4config.frame.maxsize = 0;
+    memset(&g_frag, 0, sizeof(g_frag));
+
+    arena_reset();
+
     return ERR_OK;
 }
 
@@ -1179,6 +1591,7 @@ int mp4read_open(char *name)
     g_fin = faad_fopen(name, "rb");
     if (!g_fin)
         return ERR_FAIL;
+    file_size();
 
     if (mp4config.verbose.header)
         fprintf(stderr, "**** MP4 header ****\n");
@@ -1191,14 +1604,25 @@ int mp4read_open(char *name)
     rewind(g_fin);
     if ((ret = parse(&atomsize)) < 0)
     {
-        fprintf(stderr, "parse:%d\n", ret);
+        LOG_E("parse:%d\n", ret);
         goto err;
     }
 
-    // alloc frame buffer
-    mp4config.bitbuf.data = malloc(mp4config.frame.maxsize);
+    if (!mp4config.frame.nsamples)
+    {
+        // Empty sample tables: fragmented file, index the fragments
+        g_frag.fragmented = 1;
+        g_frag.scan_pos = 0;
+        if (frag_scan() || !mp4config.frame.nsamples)
+        {
+            LOG_E("no playable fragments\n");
+            goto err;
+        }
+        LOG_I("fragmented MP4: %u frames in the first fragments\n", mp4config.frame.nsamples);
+    }
 
-    if (!mp4config.bitbuf.data)
+    // alloc frame buffer
+    if (bitbuf_reserve(mp4config.frame.maxsize))
         goto err;
 
     if (mp4config.verbose.header)
@@ -90,7 +90,16 @@ typedef struct
 
 extern mp4config_t mp4config;
 
+/* mp4read_frame(), mp4read_seek(): the frame is not in the file yet, but
+ * the file is still being written (copied, or more fragments expected);
+ * retry later. */
+#define MP4READ_AGAIN (-3)
+
 int mp4read_open(char *name);
 int mp4read_seek(uint32_t framenum);
 int mp4read_frame(void);
 int mp4read_close(void);
+/* Index fragments appended to a growing fragmented file */
+int mp4read_refresh(void);
+/* Keep the parser state (frame table, frame buffer, ...) locked in RAM */
+int mp4read_lock_memory(int lock);
@@ -1,4 +1,9 @@
 #include "music_backend.h"
+#include "cache_manager.h"
+#include "energy_profile.h"
+#include "history_store.h"
+#include "logger.h"
+#include "realtime.h"
 #include <glib.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -18,177 +23,229 @@ extern "C" {
 #include "mpeg4/mp4read.h"
 }
 
-// Global mutex to protect the non-reentrant mp4read library
-static std::mutex mp4_mutex;
-
-const char* PIPE_PATH = "/tmp/kinamp_audio_pipe";
+// Requests arriving within this window are merged into one write
+#define CHECKPOINT_COALESCE_MS 3000
+#define CHECKPOINT_DEFAULT_MINUTES 5
 
 // =================================================================================
-// Decoder Implementation
+// CheckpointScheduler Implementation
 // =================================================================================
 
-Decoder::Decoder() : stop_flag(false), running(false), thread_id(0) {
-    // Ensure pipe exists
-    unlink(PIPE_PATH);
-    if (mkfifo(PIPE_PATH, 0666) == -1) {
-        perror("Decoder: Failed to create named pipe");
+CheckpointScheduler::CheckpointScheduler(MusicBackend* backend, PlaybackMetrics* metrics)
+    : backend(backend), metrics(metrics), store(NULL), store_bytes_base(0), store_syncs_base(0),
+      interval_minutes(CHECKPOINT_DEFAULT_MINUTES), periodic_id(0), coalesce_id(0),
+      pending(false), pending_position(0), playing(false), playing_since_us(0)
+{
+}
+
+CheckpointScheduler::~CheckpointScheduler() {
+    if (periodic_id > 0) g_source_remove(periodic_id);
+    if (coalesce_id > 0) g_source_remove(coalesce_id);
+}
+
+void CheckpointScheduler::attach(HistoryStore* store) {
+    this->store = store;
+    if (store) {
+        store_bytes_base = store->bytes_written();
+        store_syncs_base = store->sync_count();
     }
 }
 
-Decoder::~Decoder() {
-    stop();
-    unlink(PIPE_PATH);
+void CheckpointScheduler::set_interval(int minutes) {
+    interval_minutes = minutes > 0 ? minutes : CHECKPOINT_DEFAULT_MINUTES;
+    if (periodic_id > 0) {
+        g_source_remove(periodic_id);
+        periodic_id = g_timeout_add_seconds(interval_minutes * 60, periodic_cb, this);
+    }
 }
 
-bool Decoder::start(const char* filepath, int start_time) {
-    if (running) {
-        stop();
+void CheckpointScheduler::request(CheckpointReason reason) {
+    const char* file = backend->get_current_filepath();
+    if (!store || !file || !file[0]) return;
+
+    // A different book: write the previous one's position first
+    if (pending && pending_file != file) {
+        flush();
     }
 
-    current_filepath = filepath;
-    this->start_time = start_time;
-    stop_flag = false;
-    running = true;
+    pending = true;
+    pending_file = file;
+    pending_position = (int)(backend->get_position() / GST_SECOND);
 
-    if (pthread_create(&thread_id, NULL, thread_func, this) != 0) {
-        perror("Decoder: Failed to create thread");
-        running = false;
-        return false;
+    if (reason == CHECKPOINT_SCREENSAVER || reason == CHECKPOINT_EXIT ||
+        reason == CHECKPOINT_PERIODIC || reason == CHECKPOINT_SLEEP) {
+        // The device may suspend right after screensaver entry
+        flush();
+    } else if (coalesce_id == 0) {
+        coalesce_id = g_timeout_add(CHECKPOINT_COALESCE_MS, coalesce_cb, this);
     }
-    return true;
 }
 
-void Decoder::stop() {
-    if (!running) return;
-
-    // Signal stop
-    stop_flag = true;
+void CheckpointScheduler::flush() {
+    if (coalesce_id > 0) {
+        g_source_remove(coalesce_id);
+        coalesce_id = 0;
+    }
+    update_listen_time();
+    if (!pending || !store) return;
+    pending = false;
+    ProfileScope scope(STAGE_HISTORY);
+
+    store->set_position(pending_file, pending_position);
+    store->sync();
+
+    PlaybackMetrics::add(metrics->checkpoint_writes, 1);
+    metrics->checkpoint_bytes.store(store->bytes_written() - store_bytes_base, std::memory_order_relaxed);
+    metrics->checkpoint_syncs.store(store->sync_count() - store_syncs_base, std::memory_order_relaxed);
+    LOG_D("Checkpoint: %s at %d\n", pending_file.c_str(), pending_position);
+}
 
-    // We assume the caller (MusicBackend) has already broken the pipe 
-    // by setting GStreamer state to NULL. This unblocks the write().
-    
-    // Wait for thread
-    if (thread_id != 0) {
-        pthread_join(thread_id, NULL);
-        thread_id = 0;
+void CheckpointScheduler::set_playing(bool playing) {
+    update_listen_time();
+    this->playing = playing;
+    if (playing) {
+        playing_since_us = metrics_now_us();
+        if (periodic_id == 0) {
+            periodic_id = g_timeout_add_seconds(interval_minutes * 60, periodic_cb, this);
+        }
+    } else if (periodic_id > 0) {
+        g_source_remove(periodic_id);
+        periodic_id = 0;
     }
+}
 
-    running = false;
+void CheckpointScheduler::update_listen_time() {
+    if (!playing) return;
+    uint64_t now = metrics_now_us();
+    PlaybackMetrics::add(metrics->listen_ms, (now - playing_since_us) / 1000);
+    playing_since_us = now;
 }
 
-bool Decoder::is_running() const {
-    return running;
+gboolean CheckpointScheduler::periodic_cb(gpointer data) {
+    CheckpointScheduler* self = static_cast<CheckpointScheduler*>(data);
+    self->request(CHECKPOINT_PERIODIC);
+    return TRUE;
 }
 
-void* Decoder::thread_func(void* arg) {
-    Decoder* self = static_cast<Decoder*>(arg);
-    self->decode_loop();
-    return NULL;
+gboolean CheckpointScheduler::coalesce_cb(gpointer data) {
+    CheckpointScheduler* self = static_cast<CheckpointScheduler*>(data);
+    self->coalesce_id = 0;
+    self->flush();
+    return FALSE;
 }
 
-void Decoder::decode_loop() {
-    g_print("Decoder: Starting for %s\n", current_filepath.c_str());
+// =================================================================================
+// SleepTimer Implementation
+// =================================================================================
 
-    std::lock_guard<std::mutex> lock(mp4_mutex);
+SleepTimer::SleepTimer(MusicBackend* backend)
+    : backend(backend), on_sleep_callback(NULL), sleep_user_data(NULL),
+      tick_id(0), remaining_ms(0), target_position(-1), last_tick_us(0)
+{
+}
 
-    // Initialize MP4 reader (parses atoms, seeks, etc.)
-    if (mp4read_open(const_cast<char*>(current_filepath.c_str())) != 0) {
-        g_printerr("Decoder: Failed to open file with mp4read: %s\n", current_filepath.c_str());
-        return;
-    }
+SleepTimer::~SleepTimer() {
+    if (tick_id > 0) g_source_remove(tick_id);
+}
 
-    // Initialize FAAD2
-    NeAACDecHandle hDecoder = NeAACDecOpen();
-    if (!hDecoder) {
-        g_printerr("Decoder: Failed to open FAAD2 decoder\n");
-        mp4read_close();
-        return;
-    }
+void SleepTimer::set_callback(SleepCallback callback, void* user_data) {
+    on_sleep_callback = callback;
+    sleep_user_data = user_data;
+}
 
-    // Configure FAAD2
-    NeAACDecConfigurationPtr config = NeAACDecGetCurrentConfiguration(hDecoder);
-    config->outputFormat = FAAD_FMT_16BIT; // 16-bit signed integers
-    config->downMatrix = 1;                // Downmix 5.1 to Stereo
-    NeAACDecSetConfiguration(hDecoder, config);
+void SleepTimer::arm_minutes(int minutes) {
+    cancel();
+    if (minutes <= 0) return;
+    remaining_ms = (gint64)minutes * 60 * 1000;
+    target_position = -1;
+    LOG_I("SleepTimer: stopping in %d minutes\n", minutes);
+    start_ticking();
+}
 
-    // Initialize Decoder with AudioSpecificConfig from MP4
-    unsigned long samplerate;
-    unsigned char channels;
-    if (NeAACDecInit2(hDecoder, mp4config.asc.buf, mp4config.asc.size, &samplerate, &channels) < 0) {
-        g_printerr("Decoder: Failed to initialize FAAD2 with ASC\n");
-        NeAACDecClose(hDecoder);
-        mp4read_close();
-        return;
+void SleepTimer::arm_at_position(gint64 position_ns) {
+    cancel();
+    if (position_ns <= 0) return;
+    target_position = position_ns;
+    LOG_I("SleepTimer: stopping at %lld s\n", (long long)(position_ns / GST_SECOND));
+    start_ticking();
+}
+
+void SleepTimer::cancel() {
+    if (tick_id > 0) {
+        g_source_remove(tick_id);
+        tick_id = 0;
+        if (backend->is_fading()) backend->cancel_fade();
     }
-    g_print("Decoder: Starting for %d %d\n", samplerate, channels);
+    target_position = -1;
+    remaining_ms = 0;
+}
 
-    // Seek if requested
-    if (this->start_time > 0) {
-        unsigned long samples_per_frame = 1024;
-        if (mp4config.frame.nsamples > 0 && mp4config.samples > 0) {
-             samples_per_frame = mp4config.samples / mp4config.frame.nsamples;
-        }
-        
-        unsigned long target_frame = (unsigned long)((double)this->start_time * samplerate / samples_per_frame);
-        
-        if (target_frame < mp4config.frame.nsamples) {
-             if (mp4read_seek(target_frame) == 0) {
-                 g_print("Decoder: Seeked to %d seconds (frame %lu)\n", this->start_time, target_frame);
-             } else {
-                 g_printerr("Decoder: Failed to seek to frame %lu\n", target_frame);
-             }
-        }
-    } else {
-        mp4read_seek(0); // Start from beginning
+int SleepTimer::remaining_seconds() const {
+    if (tick_id == 0) return -1;
+    gint64 ms = remaining_ms;
+    if (target_position >= 0) {
+        ms = (target_position - backend->get_position()) / GST_MSECOND;
     }
+    return ms > 0 ? (int)((ms + 999) / 1000) : 0;
+}
 
-    int fd = open(PIPE_PATH, O_WRONLY);
-    if (fd == -1) {
-        perror("Decoder: Failed to open pipe");
-        NeAACDecClose(hDecoder);
-        mp4read_close();
-        return;
+void SleepTimer::start_ticking() {
+    last_tick_us = metrics_now_us();
+    tick_id = g_timeout_add(1000, tick_cb, this);
+}
+
+void SleepTimer::expire() {
+    LOG_I("SleepTimer: expired, stopping playback\n");
+    tick_id = 0;
+    target_position = -1;
+    remaining_ms = 0;
+
+    // Record where the listener drifted off, then release the decoder
+    // thread, the audio pipeline and the pipe instead of idling paused
+    backend->checkpoints.request(CHECKPOINT_SLEEP);
+    backend->stop();
+
+    if (on_sleep_callback) {
+        on_sleep_callback(sleep_user_data);
     }
+}
 
-    while (!stop_flag) {
-        // Read next frame from MP4 container
-        if (mp4read_frame() != 0) {
-            // End of file or error
-            break;
-        }
+gboolean SleepTimer::tick_cb(gpointer data) {
+    SleepTimer* self = static_cast<SleepTimer*>(data);
+    MusicBackend* backend = self->backend;
 
-        NeAACDecFrameInfo frameInfo;
-        void* sample_buffer = NeAACDecDecode(hDecoder, &frameInfo, 
-                                             mp4config.bitbuf.data, 
-                                             mp4config.bitbuf.size);
+    uint64_t now = metrics_now_us();
+    gint64 elapsed_ms = (gint64)((now - self->last_tick_us) / 1000);
+    self->last_tick_us = now;
 
-        if (frameInfo.error > 0) {
-             g_printerr("Decoder: FAAD Warning: %s\n", NeAACDecGetErrorMessage(frameInfo.error));
-             continue;
-        }
+    bool playing = backend->is_playing && !backend->is_paused;
+    if (!backend->is_playing && !backend->is_paused) {
+        // Playback stopped by other means: nothing left to put to sleep
+        self->tick_id = 0;
+        self->target_position = -1;
+        return FALSE;
+    }
+    if (!playing) return TRUE;
 
-        if (frameInfo.samples > 0) {
-            // frameInfo.samples is the total number of samples (channels * samples_per_channel)
-            // We configured FAAD_FMT_16BIT, so each sample is 2 bytes (int16_t).
-            ssize_t to_write = frameInfo.samples * 2; 
-            
-            ssize_t written = write(fd, sample_buffer, to_write);
+    gint64 remaining;
+    if (self->target_position >= 0) {
+        remaining = (self->target_position - backend->get_position()) / GST_MSECOND;
+    } else {
+        self->remaining_ms -= elapsed_ms;
+        remaining = self->remaining_ms;
+    }
 
-            if (written == -1) {
-                if (errno == EPIPE) {
-                    // Reader closed pipe, expected during stop
-                    break;
-                }
-                perror("Decoder: write error");
-                break;
-            }
-        }
+    if (remaining <= 0) {
+        self->expire();
+        return FALSE;
     }
 
-    close(fd);
-    NeAACDecClose(hDecoder);
-    mp4read_close();
-    g_print("Decoder: Thread exiting.\n");
+    // Start (or restart, after a seek reset the decoder) the fade
+    if (remaining <= SLEEP_FADE_SECONDS * 1000 && !backend->is_fading()) {
+        gint64 fade_ms = remaining - SLEEP_FADE_MARGIN_SECONDS * 1000;
+        backend->start_fade(fade_ms > 0 ? (int)fade_ms : 1);
+    }
+    return TRUE;
 }
 
 
@@ -197,18 +254,32 @@ void Decoder::decode_loop() {
 // =================================================================================
 
 MusicBackend::MusicBackend() 
-    : is_playing(false), is_paused(false), pipeline(NULL), bus(NULL), bus_watch_id(0),
-      stopping(false), on_eos_callback(NULL), eos_user_data(NULL), last_position(0), current_samplerate(44100), total_duration(0)
+    : is_playing(false), is_paused(false), current_samplerate(44100), total_duration(0),
+      checkpoints(this, &metrics), sleep_timer(this), pipeline(NULL), bus(NULL), bus_watch_id(0),
+      stopping(false), on_eos_callback(NULL), eos_user_data(NULL), last_position(0), speed(1.0f), loop_a(0), loop_b(0),
+      watchdog_id(0), watchdog_bytes(0), watchdog_progress_us(0), heal_window_start_us(0), heals_in_window(0)
 {
     // Ignore SIGPIPE globally for this process
     signal(SIGPIPE, SIG_IGN);
     
     gst_init(NULL, NULL);
-    decoder = std::unique_ptr<Decoder>(new Decoder());
+    decoder = std::unique_ptr<Decoder>(new Decoder(&metrics, &eq));
+    cover_cache_id = cache_manager().add_cache("cover_art", CACHE_PRIORITY_LOW, 1, shrink_cover_art, this);
 }
 
 MusicBackend::~MusicBackend() {
     stop();
+    cache_manager().remove_cache(cover_cache_id);
+}
+
+size_t MusicBackend::shrink_cover_art(size_t bytes, void* user_data) {
+    (void)bytes;
+    // Main loop only, like every reader of cover_art; the widget keeps its
+    // own scaled copy
+    MusicBackend* self = static_cast<MusicBackend*>(user_data);
+    size_t freed = self->cover_art.size();
+    std::vector<unsigned char>().swap(self->cover_art);
+    return freed;
 }
 
 bool MusicBackend::is_shutting_down() const {
@@ -250,20 +321,133 @@ gint64 MusicBackend::get_position() {
             gst_object_unref(clock);
 
             if (GST_CLOCK_TIME_IS_VALID(base_time) && current_time > base_time) {
-                return (gint64)(current_time - base_time) + last_position;
+                // After cue/review the output no longer follows the book
+                // from the start position: map it through the snippets
+                gint64 cued;
+                uint64_t played = (current_time - base_time) * decoder->sample_rate() / GST_SECOND;
+                if (decoder->cue_position(played, &cued)) return cued;
+
+                gint64 position = (gint64)((current_time - base_time) * speed) + last_position;
+                if (has_ab_loop() && position > loop_a) {
+                    // Each pass after the first plays B - A minus the crossfade
+                    gint64 xfade = (gint64)AB_LOOP_CROSSFADE_MS * GST_MSECOND;
+                    gint64 period = loop_b - loop_a;
+                    if (period >= 2 * xfade) period -= xfade;
+                    position = loop_a + (position - loop_a) % period;
+                }
+                return position;
             }
         }
     }
     return last_position;
 }
 
+bool MusicBackend::set_ab_loop(gint64 a_ns, gint64 b_ns) {
+    if (current_filepath_str.empty() || stopping) return false;
+    if (a_ns < 0 || b_ns <= a_ns) return false;
+    if (b_ns - a_ns > (gint64)AB_LOOP_MAX_SECONDS * GST_SECOND) {
+        LOG_W("Backend: A/B loop longer than %d seconds rejected\n", AB_LOOP_MAX_SECONDS);
+        return false;
+    }
+    gint64 duration = get_duration();
+    if (duration > 0 && b_ns > duration) b_ns = duration;
+    if (b_ns <= a_ns) return false;
+
+    LOG_I("Backend: A/B loop %lld-%lld ms\n", (long long)(a_ns / GST_MSECOND), (long long)(b_ns / GST_MSECOND));
+    std::string filepath = current_filepath_str;
+    stop();
+    loop_a = a_ns;
+    loop_b = b_ns;
+    decoder->set_ab_loop(a_ns, b_ns);
+    start_playback(filepath.c_str(), a_ns);
+    return is_playing;
+}
+
+void MusicBackend::start_fade(int duration_ms) {
+    decoder->start_fade(duration_ms);
+}
+
+void MusicBackend::cancel_fade() {
+    decoder->cancel_fade();
+}
+
+bool MusicBackend::is_fading() const {
+    return decoder->is_fading();
+}
+
+void MusicBackend::clear_ab_loop() {
+    if (!has_ab_loop()) return;
+
+    gint64 position = get_position();
+    bool was_paused = is_paused;
+    bool was_playing = is_playing;
+    // The decoder reads its loop when a run starts: end the old run first
+    if (was_playing) stop();
+    loop_a = 0;
+    loop_b = 0;
+    decoder->clear_ab_loop();
+
+    if (was_playing && !stopping) {
+        std::string filepath = current_filepath_str;
+        start_playback(filepath.c_str(), position);
+        if (was_paused) pause();
+    }
+}
+
+bool MusicBackend::get_ab_loop(gint64* a_ns, gint64* b_ns) const {
+    if (!has_ab_loop()) return false;
+    *a_ns = loop_a;
+    *b_ns = loop_b;
+    return true;
+}
+
+void MusicBackend::set_speed(float speed) {
+    if (speed < STRETCH_MIN_SPEED) speed = STRETCH_MIN_SPEED;
+    if (speed > STRETCH_MAX_SPEED) speed = STRETCH_MAX_SPEED;
+    if (speed == this->speed) return;
+
+    gint64 position = has_ab_loop() ? loop_a : get_position();
+    bool was_paused = is_paused;
+    bool was_playing = is_playing;
+    LOG_I("Backend: speed %.2fx\n", speed);
+    this->speed = speed;
+
+    // The pipe holds PCM stretched for the old speed: start over. The
+    // decoder takes the speed only while stopped.
+    if (was_playing) stop();
+    decoder->set_speed(speed);
+    if (was_playing && !stopping) {
+        std::string filepath = current_filepath_str;
+        start_playback(filepath.c_str(), position);
+        if (was_paused) pause();
+    }
+}
+
+bool MusicBackend::set_cue(int rate) {
+    bool cueing = is_cueing();
+    if (rate == 0) {
+        if (!cueing) return true;
+        decoder->set_cue(0);
+        LOG_I("Backend: cue/review released\n");
+        checkpoints.request(CHECKPOINT_SEEK);
+        return true;
+    }
+    if (!is_playing || is_paused || stopping || has_ab_loop()) return false;
+
+    decoder->set_cue(rate);
+    int applied = decoder->cue_rate();
+    LOG_I("Backend: %s at %dx\n", applied > 0 ? "cue" : "review", applied > 0 ? applied : -applied);
+    return true;
+}
+
 void MusicBackend::read_metadata(const char* filepath) {
     std::lock_guard<std::mutex> lock(mp4_mutex);
     // Reset fields
     meta_title.clear();
     meta_artist.clear();
     meta_album.clear();
-    cover_art.clear();
+    cache_manager().release(cover_cache_id, cover_art.size());
+    std::vector<unsigned char>().swap(cover_art);
     if (filepath == nullptr) return;
 
     // Enable tag parsing in mp4read
@@ -273,7 +457,8 @@ void MusicBackend::read_metadata(const char* filepath) {
         if (mp4config.meta_title) meta_title = mp4config.meta_title;
         if (mp4config.meta_artist) meta_artist = mp4config.meta_artist;
         if (mp4config.meta_album) meta_album = mp4config.meta_album;
-        if (mp4config.cover_art.data && mp4config.cover_art.size > 0) {
+        if (mp4config.cover_art.data && mp4config.cover_art.size > 0 &&
+            cache_manager().reserve(cover_cache_id, mp4config.cover_art.size)) {
             cover_art.assign(mp4config.cover_art.data, mp4config.cover_art.data + mp4config.cover_art.size);
         }
         
@@ -302,7 +487,7 @@ void MusicBackend::read_metadata(const char* filepath) {
 
         mp4read_close();
     } else {
-        g_printerr("Backend: Failed to read metadata for %s\n", filepath);
+        LOG_E("Backend: Failed to read metadata for %s\n", filepath);
     }
     
     // Disable tag parsing to avoid overhead during playback
@@ -312,6 +497,16 @@ void MusicBackend::read_metadata(const char* filepath) {
 void MusicBackend::play_file(const char* filepath, int start_time) {
     if (stopping) return; // Prevent play if busy stopping
 
+    // Opening a file or seeking ends any A/B loop, once the old run that
+    // reads it has stopped
+    if (is_playing || is_paused) stop();
+    loop_a = 0;
+    loop_b = 0;
+    decoder->clear_ab_loop();
+    start_playback(filepath, (gint64)start_time * GST_SECOND);
+}
+
+void MusicBackend::start_playback(const char* filepath, gint64 start_ns) {
     // If already playing, stop first.
     // Note: This calls our synchronous stop(), which waits for the decoder thread.
     // If this takes too long, it might freeze UI briefly.
@@ -319,11 +514,13 @@ void MusicBackend::play_file(const char* filepath, int start_time) {
         stop();
     }
 
-    g_print("Backend: Playing %s from %d\n", filepath, start_time);
+    int start_time = (int)(start_ns / GST_SECOND);
+    LOG_I("Backend: Playing %s from %d\n", filepath, start_time);
+    PlaybackMetrics::add(metrics.seeks, 1);
     current_filepath_str = filepath;
     is_playing = true;
     is_paused = false;
-    last_position = start_time * GST_SECOND;
+    last_position = start_ns;
 
     int rate = (current_samplerate > 0) ? current_samplerate : 44100;
 
@@ -337,7 +534,7 @@ void MusicBackend::play_file(const char* filepath, int start_time) {
     g_free(pipeline_desc);
 
     if (!pipeline) {
-        g_printerr("Backend: Failed to create pipeline\n");
+        LOG_E("Backend: Failed to create pipeline\n");
         is_playing = false;
         return;
     }
@@ -345,16 +542,28 @@ void MusicBackend::play_file(const char* filepath, int start_time) {
     // 2. Setup Bus
     bus = gst_element_get_bus(pipeline);
     bus_watch_id = gst_bus_add_watch(bus, bus_callback_func, this);
+    if (realtime_config().enabled || energy_profile_enabled()) {
+        gst_bus_set_sync_handler(bus, bus_sync_func, this);
+    }
     gst_object_unref(bus);
 
     // 3. Start Decoder Thread
-    if (!decoder->start(filepath, start_time)) {
+    if (!decoder->start(filepath, start_ns)) {
         cleanup_pipeline();
         return;
     }
 
     // 4. Start Pipeline
     gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    watchdog_bytes = 0;
+    watchdog_progress_us = metrics_now_us();
+    if (watchdog_id == 0) {
+        watchdog_id = g_timeout_add(WATCHDOG_INTERVAL_MS, watchdog_cb, this);
+    }
+
+    checkpoints.set_playing(true);
+    checkpoints.request(CHECKPOINT_SEEK);
 }
 
 void MusicBackend::pause() {
@@ -363,7 +572,7 @@ void MusicBackend::pause() {
     if (is_paused) {
         // Resuming: Adjust last_position to be relative offset again
         // last_position currently holds the absolute position.
-        // We need to subtract the running time so that (running_time + last_position) == absolute_position.
+        // We need to subtract the running time so that (running_time * speed + last_position) == absolute_position.
         
         GstClock *clock = gst_element_get_clock(pipeline);
         if (clock) {
@@ -373,23 +582,36 @@ void MusicBackend::pause() {
 
             if (GST_CLOCK_TIME_IS_VALID(base_time) && current_time > base_time) {
                 gint64 running_time = (gint64)(current_time - base_time);
-                last_position -= running_time;
+                last_position -= (gint64)(running_time * speed);
             }
         }
         
         gst_element_set_state(pipeline, GST_STATE_PLAYING);
         is_paused = false;
+        checkpoints.set_playing(true);
     } else {
         last_position = get_position();
         gst_element_set_state(pipeline, GST_STATE_PAUSED);
         is_paused = true;
+        checkpoints.set_playing(false);
+        checkpoints.request(CHECKPOINT_PAUSE);
     }
 }
 
 void MusicBackend::stop() {
     if (stopping) return;
+
+    // Keep reporting the stop position afterwards
+    if (is_playing && !is_paused) {
+        last_position = get_position();
+    }
     stopping = true;
 
+    if (watchdog_id > 0) {
+        g_source_remove(watchdog_id);
+        watchdog_id = 0;
+    }
+
     // 1. Break the pipe connection.
     // Setting pipeline to NULL closes the file descriptor in filesrc.
     // This causes the writer (Decoder) to receive EPIPE on next write.
@@ -407,6 +629,88 @@ void MusicBackend::stop() {
     stopping = false;
     is_playing = false;
     is_paused = false;
+    checkpoints.set_playing(false);
+}
+
+gint64 MusicBackend::resume_position() {
+    if (has_ab_loop()) return loop_a;
+
+    // The clock keeps running when the sink wedges, so it can be ahead of
+    // what was heard; the decoder's output position minus what is still
+    // queued in the pipe cannot be.
+    gint64 position = get_position();
+    gint64 written = decoder->written_position();
+    unsigned long rate = decoder->sample_rate();
+    if (written >= 0 && rate > 0) {
+        uint64_t queued = metrics.buffer_fill.load(std::memory_order_relaxed);
+        gint64 queued_ns = (gint64)(queued / (2 * sizeof(int16_t)) * GST_SECOND / rate * speed);
+        gint64 estimate = written - queued_ns;
+        if (estimate >= 0 && estimate < position) position = estimate;
+    }
+    return position > 0 ? position : 0;
+}
+
+bool MusicBackend::heal(const char* stage) {
+    uint64_t now = metrics_now_us();
+    if (now - heal_window_start_us > (uint64_t)WATCHDOG_HEAL_WINDOW_SECONDS * 1000000) {
+        heal_window_start_us = now;
+        heals_in_window = 0;
+    }
+    if (++heals_in_window > WATCHDOG_MAX_HEALS) {
+        LOG_E("Backend: %s keeps failing, giving up\n", stage);
+        stop();
+        return false;
+    }
+
+    gint64 resume = resume_position();
+    std::string filepath = current_filepath_str;
+    LOG_W("Backend: %s stalled, restarting at %lld ms\n", stage, (long long)(resume / GST_MSECOND));
+    PlaybackMetrics::add(metrics.watchdog_heals, 1);
+
+    stop();
+    start_playback(filepath.c_str(), resume);
+    return is_playing;
+}
+
+gboolean MusicBackend::watchdog_cb(gpointer data) {
+    MusicBackend* self = static_cast<MusicBackend*>(data);
+    if (!self->is_playing || self->stopping) {
+        self->watchdog_id = 0;
+        return FALSE;
+    }
+
+    uint64_t now = metrics_now_us();
+    if (self->is_paused) {
+        // A paused sink legitimately stops consuming
+        self->watchdog_progress_us = now;
+        return TRUE;
+    }
+
+    Decoder::ExitState state = self->decoder->exit_state();
+    if (state == Decoder::EXIT_FAILED) {
+        self->heal("decoder");
+        return FALSE;
+    }
+    if (state == Decoder::EXIT_END_OF_FILE) {
+        return TRUE; // Pipe drains, EOS follows
+    }
+
+    uint64_t bytes = self->decoder->bytes_written();
+    if (bytes != self->watchdog_bytes || self->decoder->waiting_for_data()) {
+        self->watchdog_bytes = bytes;
+        self->watchdog_progress_us = now;
+        return TRUE;
+    }
+
+    // Opening a long book parses the whole frame table first
+    uint64_t limit_ms = bytes == 0 ? WATCHDOG_STARTUP_MS : WATCHDOG_STALL_MS;
+    if (now - self->watchdog_progress_us < limit_ms * 1000) {
+        return TRUE;
+    }
+
+    // Blocked in write(): the pipe is full, so the sink stopped consuming
+    self->heal(self->decoder->in_write() ? "sink" : "decoder");
+    return FALSE;
 }
 
 void MusicBackend::cleanup_pipeline() {
@@ -421,12 +725,44 @@ void MusicBackend::cleanup_pipeline() {
     }
 }
 
+// Runs in the thread posting the message: streaming threads announce
+// themselves with STREAM_STATUS/ENTER, which is where they get elevated
+GstBusSyncReply MusicBackend::bus_sync_func(GstBus *bus, GstMessage *msg, gpointer data) {
+    (void)bus;
+    MusicBackend* self = static_cast<MusicBackend*>(data);
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_STREAM_STATUS) {
+        GstStreamStatusType type;
+        GstElement *owner = NULL;
+        gst_message_parse_stream_status(msg, &type, &owner);
+        if (type == GST_STREAM_STATUS_TYPE_ENTER) {
+            // Runs in the streaming thread that is starting
+            if (energy_profile_enabled() && owner) {
+                gchar *name = gst_element_get_name(owner);
+                gchar *thread_name = g_strdup_printf("gst-%s", name);
+                energy_name_thread(thread_name);
+                g_free(thread_name);
+                g_free(name);
+            }
+            if (realtime_config().enabled) {
+                RealtimeMode mode = realtime_enter_thread("output");
+                self->metrics.realtime_mode.store(mode, std::memory_order_relaxed);
+            }
+        }
+    }
+    return GST_BUS_PASS;
+}
+
 gboolean MusicBackend::bus_callback_func(GstBus *bus, GstMessage *msg, gpointer data) {
     MusicBackend* self = static_cast<MusicBackend*>(data);
 
     switch (GST_MESSAGE_TYPE(msg)) {
         case GST_MESSAGE_EOS:
-            g_print("Backend: EOS reached.\n");
+            if (self->decoder->exit_state() == Decoder::EXIT_FAILED) {
+                // The decoder died and closed the pipe: not the end of the book
+                self->heal("decoder");
+                break;
+            }
+            LOG_I("Backend: EOS reached.\n");
             // Important: Don't call stop() directly here if it joins threads,
             // as we are in the GMainLoop context (UI thread usually).
             // Actually, we are fine to call callbacks.
@@ -444,10 +780,14 @@ gboolean MusicBackend::bus_callback_func(GstBus *bus, GstMessage *msg, gpointer
             GError *err;
             gchar *debug;
             gst_message_parse_error(msg, &err, &debug);
-            g_printerr("Backend: Error: %s\n", err->message);
+            LOG_E("Backend: Error: %s\n", err->message);
             g_error_free(err);
             g_free(debug);
-            self->stop();
+            if (self->is_playing && !self->is_paused) {
+                self->heal("pipeline");
+            } else {
+                self->stop();
+            }
             break;
         }
         default:
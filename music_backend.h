@@ -8,35 +8,133 @@
 #include <pthread.h>
 #include <memory>
 
+#include "decoder.h"
+#include "playback_metrics.h"
+#include "speech_eq.h"
+
+class HistoryStore;
+class MusicBackend;
+
 // Callback type for End of Stream (song finished)
 typedef void (*EosCallback)(void* user_data);
 
-// --- Decoder Class ---
-class Decoder {
+// Callback type for the sleep timer stopping playback
+typedef void (*SleepCallback)(void* user_data);
+
+// Events that record the playback position
+enum CheckpointReason {
+    CHECKPOINT_PAUSE,
+    CHECKPOINT_SEEK,
+    CHECKPOINT_CHAPTER,
+    CHECKPOINT_SCREENSAVER,
+    CHECKPOINT_PERIODIC,
+    CHECKPOINT_EXIT,
+    CHECKPOINT_SLEEP,
+};
+
+// Playback watchdog: the pipe must keep accepting PCM. A stall longer than
+// this (or the decoder dying) rebuilds the decoder and pipeline at the last
+// audible position, at most WATCHDOG_MAX_HEALS times per window.
+#define WATCHDOG_INTERVAL_MS 1000
+#define WATCHDOG_STALL_MS 4000
+#define WATCHDOG_STARTUP_MS 15000
+#define WATCHDOG_MAX_HEALS 3
+#define WATCHDOG_HEAL_WINDOW_SECONDS 60
+
+// Sleep timer: volume ramp over the final seconds before stopping. The pipe
+// and GStreamer queue run ahead of what is audible, so the ramp ends this
+// much earlier than the stop.
+#define SLEEP_FADE_SECONDS 10
+#define SLEEP_FADE_MARGIN_SECONDS 2
+
+// --- CheckpointScheduler Class ---
+// Records the playback position in the history journal on pause, seek,
+// chapter change, screensaver entry and every few minutes of playback.
+// Requests are coalesced: only the latest position is kept, and it is written
+// together with any other pending journal records under a single fdatasync,
+// so a burst of seeks costs one small write.
+// Runs in the GLib main loop.
+class CheckpointScheduler {
 public:
-    Decoder();
-    ~Decoder();
+    CheckpointScheduler(MusicBackend* backend, PlaybackMetrics* metrics);
+    ~CheckpointScheduler();
 
-    // Start decoding the specified file in a separate thread.
-    // Returns true if thread started successfully.
-    bool start(const char* filepath, int start_time = 0);
+    void attach(HistoryStore* store);
+    void set_interval(int minutes);
 
-    // Stop the decoding thread.
-    // This sets the stop flag and waits for the thread to join.
-    void stop();
+    // Capture the current position; it is written after a short delay
+    // (immediately for screensaver entry and exit).
+    void request(CheckpointReason reason);
+    // Write the pending checkpoint now.
+    void flush();
 
-    // Check if the decoder thread is currently running.
-    bool is_running() const;
+    // Playback started/paused/stopped: drives the periodic timer and the
+    // listening time used for the bytes-per-hour budget.
+    void set_playing(bool playing);
 
 private:
-    std::atomic<bool> stop_flag;
-    std::atomic<bool> running;
-    pthread_t thread_id;
-    std::string current_filepath;
-    int start_time;
-
-    static void* thread_func(void* arg);
-    void decode_loop();
+    MusicBackend* backend;
+    PlaybackMetrics* metrics;
+    HistoryStore* store;
+    uint64_t store_bytes_base;
+    uint64_t store_syncs_base;
+
+    int interval_minutes;
+    guint periodic_id;
+    guint coalesce_id;
+
+    bool pending;
+    std::string pending_file;
+    int pending_position;
+
+    bool playing;
+    uint64_t playing_since_us;
+
+    void update_listen_time();
+
+    static gboolean periodic_cb(gpointer data);
+    static gboolean coalesce_cb(gpointer data);
+};
+
+// --- SleepTimer Class ---
+// Stops playback after a fixed amount of listening time, or when playback
+// reaches a given position (the end of the current chapter). Over the final
+// seconds the decoder fades the audio out; at expiry the position is
+// checkpointed, the decoder and pipeline are stopped and the callback lets
+// the GUI re-enable the screensaver.
+// Runs in the GLib main loop.
+class SleepTimer {
+public:
+    explicit SleepTimer(MusicBackend* backend);
+    ~SleepTimer();
+
+    void set_callback(SleepCallback callback, void* user_data);
+
+    // Stop after this many minutes of playback (paused time does not count)
+    void arm_minutes(int minutes);
+    // Stop when the playback position reaches position_ns
+    void arm_at_position(gint64 position_ns);
+    void cancel();
+
+    bool is_armed() const { return tick_id != 0; }
+    bool is_chapter_mode() const { return target_position >= 0; }
+    // Seconds of playback left, -1 if not armed
+    int remaining_seconds() const;
+
+private:
+    MusicBackend* backend;
+    SleepCallback on_sleep_callback;
+    void* sleep_user_data;
+
+    guint tick_id;
+    gint64 remaining_ms;     // minutes mode
+    gint64 target_position;  // chapter mode, -1 otherwise
+    uint64_t last_tick_us;
+
+    void start_ticking();
+    void expire();
+
+    static gboolean tick_cb(gpointer data);
 };
 
 // --- MusicBackend Class ---
@@ -58,6 +156,32 @@ public:
     // (used to prevent UI race conditions)
     bool is_shutting_down() const;
 
+    // A/B repeat. set_ab_loop() restarts playback at a_ns and loops the
+    // region (at most AB_LOOP_MAX_SECONDS) until cleared or another
+    // play_file(). clear_ab_loop() continues from the current position.
+    bool set_ab_loop(gint64 a_ns, gint64 b_ns);
+    void clear_ab_loop();
+    bool has_ab_loop() const { return loop_b > loop_a; }
+    // Bounds of the active loop; false when there is none
+    bool get_ab_loop(gint64* a_ns, gint64* b_ns) const;
+
+    // Playback speed, pitch kept (STRETCH_MIN_SPEED..STRETCH_MAX_SPEED).
+    // Restarts the decoder at the current position when it changes.
+    void set_speed(float speed);
+    float get_speed() const { return speed; }
+
+    // Cue (rate > 0) or review (rate < 0) while a seek button is held:
+    // CUE_SNIPPET_MS snippets every |rate| snippets of book time, up to
+    // CUE_MAX_RATE. 0 releases it and playback carries on from the last
+    // snippet without a restart. Not while paused or looping.
+    bool set_cue(int rate);
+    bool is_cueing() const { return decoder->cue_rate() != 0; }
+
+    // Decoder volume ramp used by the sleep timer
+    void start_fade(int duration_ms);
+    void cancel_fade();
+    bool is_fading() const;
+
     gint64 get_duration();
     gint64 get_position();
     const char* get_current_filepath();
@@ -69,10 +193,22 @@ public:
     std::string meta_title;
     std::string meta_artist;
     std::string meta_album;
-    std::vector<unsigned char> cover_art;
+    std::vector<unsigned char> cover_art; // LOW priority cache, may be shed once shown
     int current_samplerate;
     gint64 total_duration;
 
+    // Playback health counters (updated lock-free by the decoder thread)
+    PlaybackMetrics metrics;
+
+    // Speech clarity EQ applied by the decoder; set_preset() is lock-free
+    // and takes effect on the next written block
+    SpeechEq eq;
+
+    // Position checkpoints into the history journal
+    CheckpointScheduler checkpoints;
+
+    SleepTimer sleep_timer;
+
 private:
     std::unique_ptr<Decoder> decoder;
     
@@ -87,12 +223,35 @@ private:
     void* eos_user_data;
     
     gint64 last_position;
+    float speed; // book time per unit of running time
+
+    // Active A/B loop in nanoseconds (loop_b == 0 when off)
+    gint64 loop_a;
+    gint64 loop_b;
+
+    void start_playback(const char* filepath, gint64 start_ns);
+
+    int cover_cache_id;
+    static size_t shrink_cover_art(size_t bytes, void* user_data);
+
+    // Watchdog state
+    guint watchdog_id;
+    uint64_t watchdog_bytes;
+    uint64_t watchdog_progress_us;
+    uint64_t heal_window_start_us;
+    int heals_in_window;
+
+    // Restart decoder and pipeline at the last audible position
+    bool heal(const char* stage);
+    gint64 resume_position();
+    static gboolean watchdog_cb(gpointer data);
 
     // Helper to cleanup GStreamer resources
     void cleanup_pipeline();
 
     // GStreamer bus callback
     static gboolean bus_callback_func(GstBus *bus, GstMessage *msg, gpointer data);
+    static GstBusSyncReply bus_sync_func(GstBus *bus, GstMessage *msg, gpointer data);
 };
 
 #endif // MUSIC_BACKEND_H
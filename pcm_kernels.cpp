@@ -0,0 +1,248 @@
+#include "pcm_kernels.h"
+#include "pcm_kernels_impl.h"
+#include "logger.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#if defined(__arm__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+// =================================================================================
+// Scalar reference
+// =================================================================================
+
+static void s16_to_float_scalar(const int16_t* in, float* out, size_t samples) {
+    for (size_t i = 0; i < samples; i++) {
+        out[i] = (float)in[i] * (1.0f / 32768.0f);
+    }
+}
+
+static void float_to_s16_scalar(const float* in, int16_t* out, size_t samples) {
+    for (size_t i = 0; i < samples; i++) {
+        out[i] = pcm_round_s16(in[i] * 32768.0f);
+    }
+}
+
+void pcm_gain_ramp_scalar(int16_t* pcm, size_t first, size_t frames, unsigned int channels,
+                          float from, float step) {
+    for (size_t i = first; i < frames; i++) {
+        float g = from + step * (float)i;
+        for (unsigned int c = 0; c < channels; c++) {
+            pcm[i * channels + c] = pcm_round_s16((float)pcm[i * channels + c] * g);
+        }
+    }
+}
+
+static void gain_ramp_scalar(int16_t* pcm, size_t frames, unsigned int channels, float from, float to) {
+    pcm_gain_ramp_scalar(pcm, 0, frames, channels, from, pcm_ramp_step(frames, from, to));
+}
+
+void pcm_mix_scalar(const int16_t* a, const int16_t* b, int16_t* out, size_t first, size_t frames,
+                    unsigned int channels, float from, float step) {
+    for (size_t i = first; i < frames; i++) {
+        float g = from + step * (float)i;
+        float h = 1.0f - g;
+        for (unsigned int c = 0; c < channels; c++) {
+            size_t k = i * channels + c;
+            out[k] = pcm_round_s16((float)a[k] * h + (float)b[k] * g);
+        }
+    }
+}
+
+static void mix_scalar(const int16_t* a, const int16_t* b, int16_t* out, size_t frames,
+                       unsigned int channels, float from, float to) {
+    pcm_mix_scalar(a, b, out, 0, frames, channels, from, pcm_ramp_step(frames, from, to));
+}
+
+void pcm_downmix_scalar(const int16_t* in, int16_t* out, size_t first, size_t frames,
+                        unsigned int in_channels, unsigned int out_channels, const float* matrix) {
+    for (size_t i = first; i < frames; i++) {
+        const int16_t* frame = in + i * in_channels;
+        for (unsigned int c = 0; c < out_channels; c++) {
+            const float* row = matrix + c * in_channels;
+            float acc = 0.0f;
+            for (unsigned int k = 0; k < in_channels; k++) {
+                acc = acc + (float)frame[k] * row[k];
+            }
+            out[i * out_channels + c] = pcm_round_s16(acc);
+        }
+    }
+}
+
+static void downmix_scalar(const int16_t* in, int16_t* out, size_t frames, unsigned int in_channels,
+                           unsigned int out_channels, const float* matrix) {
+    pcm_downmix_scalar(in, out, 0, frames, in_channels, out_channels, matrix);
+}
+
+static void measure_scalar(const int16_t* pcm, size_t samples, PcmLevel* level) {
+    uint64_t sum = 0;
+    int32_t peak = level->peak;
+    for (size_t i = 0; i < samples; i++) {
+        int32_t x = pcm[i];
+        sum += (uint32_t)(x * x);
+        if (x < 0) x = -x;
+        if (x > peak) peak = x;
+    }
+    level->sum_squares += sum;
+    level->samples += samples;
+    level->peak = peak;
+}
+
+static void deinterleave_scalar(const int16_t* in, int16_t* left, int16_t* right, size_t frames) {
+    for (size_t i = 0; i < frames; i++) {
+        left[i] = in[i * 2];
+        right[i] = in[i * 2 + 1];
+    }
+}
+
+static void interleave_scalar(const int16_t* left, const int16_t* right, int16_t* out, size_t frames) {
+    for (size_t i = 0; i < frames; i++) {
+        out[i * 2] = left[i];
+        out[i * 2 + 1] = right[i];
+    }
+}
+
+static const PcmKernels scalar_kernels = {
+    PCM_ISA_SCALAR,
+    "scalar",
+    s16_to_float_scalar,
+    float_to_s16_scalar,
+    gain_ramp_scalar,
+    mix_scalar,
+    downmix_scalar,
+    measure_scalar,
+    deinterleave_scalar,
+    interleave_scalar,
+};
+
+const PcmKernels* pcm_kernels_scalar() {
+    return &scalar_kernels;
+}
+
+// =================================================================================
+// Runtime dispatch
+// =================================================================================
+
+static bool cpu_has(PcmIsa isa) {
+    switch (isa) {
+        case PCM_ISA_SCALAR:
+            return true;
+        case PCM_ISA_SSE2: {
+#if defined(__x86_64__) || defined(__i386__)
+            unsigned int eax, ebx, ecx, edx;
+            return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (edx & bit_SSE2);
+#else
+            return false;
+#endif
+        }
+        case PCM_ISA_NEON:
+#if defined(__aarch64__)
+            return true;
+#elif defined(__arm__) && defined(__linux__)
+            return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#else
+            return false;
+#endif
+        default:
+            return false;
+    }
+}
+
+const PcmKernels* pcm_kernel_table(PcmIsa isa) {
+    const PcmKernels* table = NULL;
+    switch (isa) {
+        case PCM_ISA_SCALAR: table = pcm_kernels_scalar(); break;
+        case PCM_ISA_SSE2: table = pcm_kernels_sse2(); break;
+        case PCM_ISA_NEON: table = pcm_kernels_neon(); break;
+        default: break;
+    }
+    return table && cpu_has(isa) ? table : NULL;
+}
+
+static const PcmKernels* select_kernels() {
+    const PcmKernels* table = NULL;
+    const char* forced = getenv("LARK_SIMD");
+    if (forced && forced[0]) {
+        for (int isa = 0; isa < PCM_ISA_COUNT && !table; isa++) {
+            const PcmKernels* candidate = pcm_kernel_table((PcmIsa)isa);
+            if (candidate && strcmp(candidate->name, forced) == 0) table = candidate;
+        }
+        if (!table) LOG_W("PcmKernels: LARK_SIMD=%s not available\n", forced);
+    }
+    for (int isa = PCM_ISA_COUNT - 1; isa >= 0 && !table; isa--) {
+        table = pcm_kernel_table((PcmIsa)isa);
+    }
+    LOG_I("PcmKernels: using %s\n", table->name);
+    return table;
+}
+
+const PcmKernels& pcm_kernels() {
+    static const PcmKernels* table = select_kernels();
+    return *table;
+}
+
+// =================================================================================
+// Helpers
+// =================================================================================
+
+// FAAD2 channel positions (neaacdec.h); kept here so that the kernels do
+// not depend on the FAAD2 headers
+enum {
+    POS_FRONT_CENTER = 1,
+    POS_FRONT_LEFT = 2,
+    POS_FRONT_RIGHT = 3,
+    POS_SIDE_LEFT = 4,
+    POS_SIDE_RIGHT = 5,
+    POS_BACK_LEFT = 6,
+    POS_BACK_RIGHT = 7,
+    POS_BACK_CENTER = 8,
+    POS_LFE = 9,
+};
+
+void pcm_stereo_downmix_matrix(const unsigned char* positions, unsigned int in_channels, float* matrix) {
+    const float m3db = 0.70710678f;
+    float* left = matrix;
+    float* right = matrix + in_channels;
+    for (unsigned int k = 0; k < in_channels; k++) {
+        float l = 0.0f, r = 0.0f;
+        switch (positions ? positions[k] : 0) {
+            case POS_FRONT_LEFT: l = 1.0f; break;
+            case POS_FRONT_RIGHT: r = 1.0f; break;
+            case POS_SIDE_LEFT:
+            case POS_BACK_LEFT: l = m3db; break;
+            case POS_SIDE_RIGHT:
+            case POS_BACK_RIGHT: r = m3db; break;
+            case POS_FRONT_CENTER:
+            case POS_BACK_CENTER: l = r = m3db; break;
+            case POS_LFE: break;
+            default:
+                // Unknown layout: first two channels are left and right
+                if (k == 0) l = 1.0f;
+                else if (k == 1) r = 1.0f;
+                break;
+        }
+        left[k] = l;
+        right[k] = r;
+    }
+
+    float sum_l = 0.0f, sum_r = 0.0f;
+    for (unsigned int k = 0; k < in_channels; k++) {
+        sum_l += left[k];
+        sum_r += right[k];
+    }
+    float sum = sum_l > sum_r ? sum_l : sum_r;
+    if (sum > 1.0f) {
+        for (unsigned int k = 0; k < in_channels * 2; k++) matrix[k] /= sum;
+    }
+}
+
+double pcm_level_rms(const PcmLevel& level) {
+    if (level.samples == 0) return 0.0;
+    return sqrt((double)level.sum_squares / (double)level.samples) / 32768.0;
+}
@@ -0,0 +1,81 @@
+#ifndef PCM_KERNELS_H
+#define PCM_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Instruction set of a kernel table
+enum PcmIsa {
+    PCM_ISA_SCALAR = 0,
+    PCM_ISA_SSE2,
+    PCM_ISA_NEON,
+    PCM_ISA_COUNT,
+};
+
+// Sum of squares and peak magnitude of a run of samples
+struct PcmLevel {
+    uint64_t sum_squares;
+    uint64_t samples;
+    int32_t peak; // 0..32768
+};
+
+// --- PCM kernels ---
+// Conversion, gain, downmix, mixing, level and (de)interleave primitives
+// on interleaved 16-bit PCM. Every table produces bit-identical output:
+//   - float to int16 clamps to [-32768, 32767], then rounds half away
+//     from zero (x + 0.5 or x - 0.5, truncated)
+//   - float expressions are evaluated in the same order in every table,
+//     and the kernels are built without FP contraction (no fused
+//     multiply-add in the scalar code)
+// Kernels work in place where in == out. Gains are linear; a ramp goes
+// from `from` at frame 0 towards `to`, reached one frame past the end
+// (gain of frame i: from + (to - from) / frames * i), so consecutive
+// calls join without a repeated step.
+struct PcmKernels {
+    PcmIsa isa;
+    const char* name;
+
+    // int16 <-> float in [-1.0, 1.0)
+    void (*s16_to_float)(const int16_t* in, float* out, size_t samples);
+    void (*float_to_s16)(const float* in, int16_t* out, size_t samples);
+
+    // Gain ramp applied in place
+    void (*gain_ramp)(int16_t* pcm, size_t frames, unsigned int channels, float from, float to);
+
+    // out = a * (1 - g) + b * g, g ramping from..to (crossfade from a to b;
+    // a constant g mixes). out may alias a or b.
+    void (*mix)(const int16_t* a, const int16_t* b, int16_t* out, size_t frames,
+                unsigned int channels, float from, float to);
+
+    // out[c] = sum over k of in[k] * matrix[c * in_channels + k]
+    void (*downmix)(const int16_t* in, int16_t* out, size_t frames, unsigned int in_channels,
+                    unsigned int out_channels, const float* matrix);
+
+    // Accumulates into *level (zero it first)
+    void (*measure)(const int16_t* pcm, size_t samples, PcmLevel* level);
+
+    // Stereo <-> planar
+    void (*deinterleave)(const int16_t* in, int16_t* left, int16_t* right, size_t frames);
+    void (*interleave)(const int16_t* left, const int16_t* right, int16_t* out, size_t frames);
+};
+
+// Best table for this CPU, chosen on first use. LARK_SIMD=scalar|sse2|neon
+// forces one (ignored if not available).
+const PcmKernels& pcm_kernels();
+
+// A specific table, or NULL if it is not built in or the CPU lacks it
+const PcmKernels* pcm_kernel_table(PcmIsa isa);
+
+// Downmix matrix (2 x in_channels) for FAAD2 channel positions
+// (frameInfo.channel_position): centre and surrounds at -3 dB, LFE
+// dropped, rows scaled so full scale on every channel cannot clip.
+void pcm_stereo_downmix_matrix(const unsigned char* positions, unsigned int in_channels, float* matrix);
+
+double pcm_level_rms(const PcmLevel& level); // 0..1 of full scale
+
+// Per-ISA tables (pcm_kernels_sse2.cpp, pcm_kernels_neon.cpp); NULL when
+// not compiled for this target
+const PcmKernels* pcm_kernels_sse2();
+const PcmKernels* pcm_kernels_neon();
+
+#endif // PCM_KERNELS_H
@@ -0,0 +1,30 @@
+#ifndef PCM_KERNELS_IMPL_H
+#define PCM_KERNELS_IMPL_H
+
+// Shared by the kernel tables: the scalar reference, also used by the SIMD
+// tables for the frames left over after their last full vector.
+
+#include "pcm_kernels.h"
+
+// Clamp and round half away from zero (the rounding every table uses)
+static inline int16_t pcm_round_s16(float v) {
+    if (v > 32767.0f) v = 32767.0f;
+    if (v < -32768.0f) v = -32768.0f;
+    return (int16_t)(int32_t)(v >= 0.0f ? v + 0.5f : v - 0.5f);
+}
+
+static inline float pcm_ramp_step(size_t frames, float from, float to) {
+    return frames > 0 ? (to - from) / (float)frames : 0.0f;
+}
+
+// Ramps as frames [first, frames) of a ramp with this step
+void pcm_gain_ramp_scalar(int16_t* pcm, size_t first, size_t frames, unsigned int channels,
+                          float from, float step);
+void pcm_mix_scalar(const int16_t* a, const int16_t* b, int16_t* out, size_t first, size_t frames,
+                    unsigned int channels, float from, float step);
+void pcm_downmix_scalar(const int16_t* in, int16_t* out, size_t first, size_t frames,
+                        unsigned int in_channels, unsigned int out_channels, const float* matrix);
+
+const PcmKernels* pcm_kernels_scalar();
+
+#endif // PCM_KERNELS_IMPL_H
@@ -0,0 +1,231 @@
+#include "pcm_kernels.h"
+#include "pcm_kernels_impl.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+
+// Largest channel count the vector downmix handles (7.1); more falls back
+// to the scalar kernel
+#define NEON_DOWNMIX_MAX_CHANNELS 8
+
+// Clamp and round half away from zero, like pcm_round_s16(). vcvtq_s32_f32
+// truncates; multiply and add are kept separate (vmlaq may be fused).
+static inline int32x4_t round4(float32x4_t v) {
+    v = vminq_f32(vmaxq_f32(v, vdupq_n_f32(-32768.0f)), vdupq_n_f32(32767.0f));
+    uint32x4_t sign = vandq_u32(vreinterpretq_u32_f32(v), vdupq_n_u32(0x80000000u));
+    float32x4_t half = vreinterpretq_f32_u32(vorrq_u32(sign, vreinterpretq_u32_f32(vdupq_n_f32(0.5f))));
+    return vcvtq_s32_f32(vaddq_f32(v, half));
+}
+
+static inline float32x4_t widen_lo(int16x8_t x) {
+    return vcvtq_f32_s32(vmovl_s16(vget_low_s16(x)));
+}
+
+static inline float32x4_t widen_hi(int16x8_t x) {
+    return vcvtq_f32_s32(vmovl_s16(vget_high_s16(x)));
+}
+
+static inline int16x8_t narrow(int32x4_t lo, int32x4_t hi) {
+    return vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi));
+}
+
+// from + step * i for frames i .. i + 3
+static inline float32x4_t ramp4(float32x4_t from, float32x4_t step, size_t i) {
+    static const int32_t offsets[4] = { 0, 1, 2, 3 };
+    int32x4_t idx = vaddq_s32(vdupq_n_s32((int32_t)i), vld1q_s32(offsets));
+    return vaddq_f32(from, vmulq_f32(step, vcvtq_f32_s32(idx)));
+}
+
+static void s16_to_float_neon(const int16_t* in, float* out, size_t samples) {
+    const float32x4_t scale = vdupq_n_f32(1.0f / 32768.0f);
+    size_t i = 0;
+    for (; i + 8 <= samples; i += 8) {
+        int16x8_t x = vld1q_s16(in + i);
+        vst1q_f32(out + i, vmulq_f32(widen_lo(x), scale));
+        vst1q_f32(out + i + 4, vmulq_f32(widen_hi(x), scale));
+    }
+    for (; i < samples; i++) {
+        out[i] = (float)in[i] * (1.0f / 32768.0f);
+    }
+}
+
+static void float_to_s16_neon(const float* in, int16_t* out, size_t samples) {
+    const float32x4_t scale = vdupq_n_f32(32768.0f);
+    size_t i = 0;
+    for (; i + 8 <= samples; i += 8) {
+        int32x4_t lo = round4(vmulq_f32(vld1q_f32(in + i), scale));
+        int32x4_t hi = round4(vmulq_f32(vld1q_f32(in + i + 4), scale));
+        vst1q_s16(out + i, narrow(lo, hi));
+    }
+    for (; i < samples; i++) {
+        out[i] = pcm_round_s16(in[i] * 32768.0f);
+    }
+}
+
+// Per-sample gains for 8 samples starting at frame i (mono or stereo)
+static inline void gains8(float32x4_t from, float32x4_t step, size_t i, unsigned int channels,
+                          float32x4_t* g_lo, float32x4_t* g_hi) {
+    if (channels == 1) {
+        *g_lo = ramp4(from, step, i);
+        *g_hi = ramp4(from, step, i + 4);
+    } else {
+        float32x4x2_t g = vzipq_f32(ramp4(from, step, i), ramp4(from, step, i));
+        *g_lo = g.val[0];
+        *g_hi = g.val[1];
+    }
+}
+
+static void gain_ramp_neon(int16_t* pcm, size_t frames, unsigned int channels, float from, float to) {
+    float step = pcm_ramp_step(frames, from, to);
+    size_t i = 0;
+    if (channels == 1 || channels == 2) {
+        const size_t per_vector = 8 / channels;
+        const float32x4_t vfrom = vdupq_n_f32(from);
+        const float32x4_t vstep = vdupq_n_f32(step);
+        for (; i + per_vector <= frames; i += per_vector) {
+            float32x4_t g_lo, g_hi;
+            gains8(vfrom, vstep, i, channels, &g_lo, &g_hi);
+            int16_t* p = pcm + i * channels;
+            int16x8_t x = vld1q_s16(p);
+            int32x4_t lo = round4(vmulq_f32(widen_lo(x), g_lo));
+            int32x4_t hi = round4(vmulq_f32(widen_hi(x), g_hi));
+            vst1q_s16(p, narrow(lo, hi));
+        }
+    }
+    pcm_gain_ramp_scalar(pcm, i, frames, channels, from, step);
+}
+
+static void mix_neon(const int16_t* a, const int16_t* b, int16_t* out, size_t frames,
+                     unsigned int channels, float from, float to) {
+    float step = pcm_ramp_step(frames, from, to);
+    size_t i = 0;
+    if (channels == 1 || channels == 2) {
+        const size_t per_vector = 8 / channels;
+        const float32x4_t vfrom = vdupq_n_f32(from);
+        const float32x4_t vstep = vdupq_n_f32(step);
+        const float32x4_t one = vdupq_n_f32(1.0f);
+        for (; i + per_vector <= frames; i += per_vector) {
+            float32x4_t g_lo, g_hi;
+            gains8(vfrom, vstep, i, channels, &g_lo, &g_hi);
+            int16x8_t xa = vld1q_s16(a + i * channels);
+            int16x8_t xb = vld1q_s16(b + i * channels);
+            float32x4_t lo = vaddq_f32(vmulq_f32(widen_lo(xa), vsubq_f32(one, g_lo)), vmulq_f32(widen_lo(xb), g_lo));
+            float32x4_t hi = vaddq_f32(vmulq_f32(widen_hi(xa), vsubq_f32(one, g_hi)), vmulq_f32(widen_hi(xb), g_hi));
+            vst1q_s16(out + i * channels, narrow(round4(lo), round4(hi)));
+        }
+    }
+    pcm_mix_scalar(a, b, out, i, frames, channels, from, step);
+}
+
+// Four frames per iteration: each output channel is one vector of four
+// accumulators, summed over the input channels in matrix order
+static void downmix_neon(const int16_t* in, int16_t* out, size_t frames, unsigned int in_channels,
+                         unsigned int out_channels, const float* matrix) {
+    size_t i = 0;
+    if (in_channels <= NEON_DOWNMIX_MAX_CHANNELS) {
+        for (; i + 4 <= frames; i += 4) {
+            const int16_t* f = in + i * in_channels;
+            float32x4_t x[NEON_DOWNMIX_MAX_CHANNELS];
+            for (unsigned int k = 0; k < in_channels; k++) {
+                int16x4_t s = vdup_n_s16(0);
+                s = vld1_lane_s16(f + k, s, 0);
+                s = vld1_lane_s16(f + in_channels + k, s, 1);
+                s = vld1_lane_s16(f + 2 * in_channels + k, s, 2);
+                s = vld1_lane_s16(f + 3 * in_channels + k, s, 3);
+                x[k] = vcvtq_f32_s32(vmovl_s16(s));
+            }
+            for (unsigned int c = 0; c < out_channels; c++) {
+                const float* row = matrix + c * in_channels;
+                float32x4_t acc = vdupq_n_f32(0.0f);
+                for (unsigned int k = 0; k < in_channels; k++) {
+                    acc = vaddq_f32(acc, vmulq_n_f32(x[k], row[k]));
+                }
+                int16x4_t v = vqmovn_s32(round4(acc));
+                int16_t* o = out + i * out_channels + c;
+                vst1_lane_s16(o, v, 0);
+                vst1_lane_s16(o + out_channels, v, 1);
+                vst1_lane_s16(o + 2 * out_channels, v, 2);
+                vst1_lane_s16(o + 3 * out_channels, v, 3);
+            }
+        }
+    }
+    pcm_downmix_scalar(in, out, i, frames, in_channels, out_channels, matrix);
+}
+
+static void measure_neon(const int16_t* pcm, size_t samples, PcmLevel* level) {
+    uint64x2_t sum = vdupq_n_u64(0);
+    int16x8_t max = vdupq_n_s16(0);
+    int16x8_t min = vdupq_n_s16(0);
+    size_t i = 0;
+    for (; i + 8 <= samples; i += 8) {
+        int16x8_t x = vld1q_s16(pcm + i);
+        // Single squares fit in 31 bits; pairs are widened to 64
+        int32x4_t sq_lo = vmull_s16(vget_low_s16(x), vget_low_s16(x));
+        int32x4_t sq_hi = vmull_s16(vget_high_s16(x), vget_high_s16(x));
+        sum = vpadalq_u32(sum, vreinterpretq_u32_s32(sq_lo));
+        sum = vpadalq_u32(sum, vreinterpretq_u32_s32(sq_hi));
+        max = vmaxq_s16(max, x);
+        min = vminq_s16(min, x);
+    }
+
+    uint64_t sums[2];
+    int16_t maxs[8], mins[8];
+    vst1q_u64(sums, sum);
+    vst1q_s16(maxs, max);
+    vst1q_s16(mins, min);
+    int32_t peak = level->peak;
+    for (int j = 0; j < 8; j++) {
+        if (maxs[j] > peak) peak = maxs[j];
+        if (-(int32_t)mins[j] > peak) peak = -(int32_t)mins[j];
+    }
+    level->sum_squares += sums[0] + sums[1];
+    level->samples += i;
+    level->peak = peak;
+    pcm_kernels_scalar()->measure(pcm + i, samples - i, level);
+}
+
+static void deinterleave_neon(const int16_t* in, int16_t* left, int16_t* right, size_t frames) {
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        int16x8x2_t x = vld2q_s16(in + i * 2);
+        vst1q_s16(left + i, x.val[0]);
+        vst1q_s16(right + i, x.val[1]);
+    }
+    pcm_kernels_scalar()->deinterleave(in + i * 2, left + i, right + i, frames - i);
+}
+
+static void interleave_neon(const int16_t* left, const int16_t* right, int16_t* out, size_t frames) {
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        int16x8x2_t x;
+        x.val[0] = vld1q_s16(left + i);
+        x.val[1] = vld1q_s16(right + i);
+        vst2q_s16(out + i * 2, x);
+    }
+    pcm_kernels_scalar()->interleave(left + i, right + i, out + i * 2, frames - i);
+}
+
+static const PcmKernels neon_kernels = {
+    PCM_ISA_NEON,
+    "neon",
+    s16_to_float_neon,
+    float_to_s16_neon,
+    gain_ramp_neon,
+    mix_neon,
+    downmix_neon,
+    measure_neon,
+    deinterleave_neon,
+    interleave_neon,
+};
+
+const PcmKernels* pcm_kernels_neon() {
+    return &neon_kernels;
+}
+
+#else
+
+const PcmKernels* pcm_kernels_neon() {
+    return NULL;
+}
+
+#endif
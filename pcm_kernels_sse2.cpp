@@ -0,0 +1,222 @@
+#include "pcm_kernels.h"
+#include "pcm_kernels_impl.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+// Largest channel count the vector downmix handles (7.1); more falls back
+// to the scalar kernel
+#define SSE2_DOWNMIX_MAX_CHANNELS 8
+
+// Clamp and round half away from zero, like pcm_round_s16()
+static inline __m128i round4(__m128 v) {
+    v = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-32768.0f)), _mm_set1_ps(32767.0f));
+    __m128 sign = _mm_and_ps(v, _mm_castsi128_ps(_mm_set1_epi32((int)0x80000000u)));
+    __m128 half = _mm_or_ps(sign, _mm_set1_ps(0.5f));
+    return _mm_cvttps_epi32(_mm_add_ps(v, half));
+}
+
+static inline __m128 widen_lo(__m128i x) {
+    return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+}
+
+static inline __m128 widen_hi(__m128i x) {
+    return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+}
+
+// from + step * i for frames i .. i + 3
+static inline __m128 ramp4(__m128 from, __m128 step, size_t i) {
+    __m128 idx = _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32((int)i), _mm_set_epi32(3, 2, 1, 0)));
+    return _mm_add_ps(from, _mm_mul_ps(step, idx));
+}
+
+static void s16_to_float_sse2(const int16_t* in, float* out, size_t samples) {
+    const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+    size_t i = 0;
+    for (; i + 8 <= samples; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(in + i));
+        _mm_storeu_ps(out + i, _mm_mul_ps(widen_lo(x), scale));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(widen_hi(x), scale));
+    }
+    for (; i < samples; i++) {
+        out[i] = (float)in[i] * (1.0f / 32768.0f);
+    }
+}
+
+static void float_to_s16_sse2(const float* in, int16_t* out, size_t samples) {
+    const __m128 scale = _mm_set1_ps(32768.0f);
+    size_t i = 0;
+    for (; i + 8 <= samples; i += 8) {
+        __m128i lo = round4(_mm_mul_ps(_mm_loadu_ps(in + i), scale));
+        __m128i hi = round4(_mm_mul_ps(_mm_loadu_ps(in + i + 4), scale));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(lo, hi));
+    }
+    for (; i < samples; i++) {
+        out[i] = pcm_round_s16(in[i] * 32768.0f);
+    }
+}
+
+// Per-sample gains for 8 samples starting at frame i (mono or stereo)
+static inline void gains8(__m128 from, __m128 step, size_t i, unsigned int channels,
+                          __m128* g_lo, __m128* g_hi) {
+    if (channels == 1) {
+        *g_lo = ramp4(from, step, i);
+        *g_hi = ramp4(from, step, i + 4);
+    } else {
+        __m128 g = ramp4(from, step, i);
+        *g_lo = _mm_unpacklo_ps(g, g);
+        *g_hi = _mm_unpackhi_ps(g, g);
+    }
+}
+
+static void gain_ramp_sse2(int16_t* pcm, size_t frames, unsigned int channels, float from, float to) {
+    float step = pcm_ramp_step(frames, from, to);
+    size_t i = 0;
+    if (channels == 1 || channels == 2) {
+        const size_t per_vector = 8 / channels;
+        const __m128 vfrom = _mm_set1_ps(from);
+        const __m128 vstep = _mm_set1_ps(step);
+        for (; i + per_vector <= frames; i += per_vector) {
+            __m128 g_lo, g_hi;
+            gains8(vfrom, vstep, i, channels, &g_lo, &g_hi);
+            __m128i* p = (__m128i*)(pcm + i * channels);
+            __m128i x = _mm_loadu_si128(p);
+            __m128i lo = round4(_mm_mul_ps(widen_lo(x), g_lo));
+            __m128i hi = round4(_mm_mul_ps(widen_hi(x), g_hi));
+            _mm_storeu_si128(p, _mm_packs_epi32(lo, hi));
+        }
+    }
+    pcm_gain_ramp_scalar(pcm, i, frames, channels, from, step);
+}
+
+static void mix_sse2(const int16_t* a, const int16_t* b, int16_t* out, size_t frames,
+                     unsigned int channels, float from, float to) {
+    float step = pcm_ramp_step(frames, from, to);
+    size_t i = 0;
+    if (channels == 1 || channels == 2) {
+        const size_t per_vector = 8 / channels;
+        const __m128 vfrom = _mm_set1_ps(from);
+        const __m128 vstep = _mm_set1_ps(step);
+        const __m128 one = _mm_set1_ps(1.0f);
+        for (; i + per_vector <= frames; i += per_vector) {
+            __m128 g_lo, g_hi;
+            gains8(vfrom, vstep, i, channels, &g_lo, &g_hi);
+            __m128i xa = _mm_loadu_si128((const __m128i*)(a + i * channels));
+            __m128i xb = _mm_loadu_si128((const __m128i*)(b + i * channels));
+            __m128 lo = _mm_add_ps(_mm_mul_ps(widen_lo(xa), _mm_sub_ps(one, g_lo)), _mm_mul_ps(widen_lo(xb), g_lo));
+            __m128 hi = _mm_add_ps(_mm_mul_ps(widen_hi(xa), _mm_sub_ps(one, g_hi)), _mm_mul_ps(widen_hi(xb), g_hi));
+            _mm_storeu_si128((__m128i*)(out + i * channels), _mm_packs_epi32(round4(lo), round4(hi)));
+        }
+    }
+    pcm_mix_scalar(a, b, out, i, frames, channels, from, step);
+}
+
+// Four frames per iteration: each output channel is one vector of four
+// accumulators, summed over the input channels in matrix order
+static void downmix_sse2(const int16_t* in, int16_t* out, size_t frames, unsigned int in_channels,
+                         unsigned int out_channels, const float* matrix) {
+    size_t i = 0;
+    if (in_channels <= SSE2_DOWNMIX_MAX_CHANNELS) {
+        for (; i + 4 <= frames; i += 4) {
+            const int16_t* f = in + i * in_channels;
+            __m128 x[SSE2_DOWNMIX_MAX_CHANNELS];
+            for (unsigned int k = 0; k < in_channels; k++) {
+                x[k] = _mm_set_ps((float)f[3 * in_channels + k], (float)f[2 * in_channels + k],
+                                  (float)f[in_channels + k], (float)f[k]);
+            }
+            for (unsigned int c = 0; c < out_channels; c++) {
+                const float* row = matrix + c * in_channels;
+                __m128 acc = _mm_setzero_ps();
+                for (unsigned int k = 0; k < in_channels; k++) {
+                    acc = _mm_add_ps(acc, _mm_mul_ps(x[k], _mm_set1_ps(row[k])));
+                }
+                int32_t v[4] __attribute__((aligned(16)));
+                _mm_store_si128((__m128i*)v, round4(acc));
+                for (int j = 0; j < 4; j++) out[(i + j) * out_channels + c] = (int16_t)v[j];
+            }
+        }
+    }
+    pcm_downmix_scalar(in, out, i, frames, in_channels, out_channels, matrix);
+}
+
+static void measure_sse2(const int16_t* pcm, size_t samples, PcmLevel* level) {
+    __m128i sum = _mm_setzero_si128();
+    __m128i max = _mm_setzero_si128();
+    __m128i min = _mm_setzero_si128();
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= samples; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(pcm + i));
+        // Pairs of squares: up to 2^31, so widened as unsigned
+        __m128i sq = _mm_madd_epi16(x, x);
+        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(sq, zero));
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(sq, zero));
+        max = _mm_max_epi16(max, x);
+        min = _mm_min_epi16(min, x);
+    }
+
+    uint64_t sums[2];
+    int16_t maxs[8], mins[8];
+    _mm_storeu_si128((__m128i*)sums, sum);
+    _mm_storeu_si128((__m128i*)maxs, max);
+    _mm_storeu_si128((__m128i*)mins, min);
+    int32_t peak = level->peak;
+    for (int j = 0; j < 8; j++) {
+        if (maxs[j] > peak) peak = maxs[j];
+        if (-(int32_t)mins[j] > peak) peak = -(int32_t)mins[j];
+    }
+    level->sum_squares += sums[0] + sums[1];
+    level->samples += i;
+    level->peak = peak;
+    pcm_kernels_scalar()->measure(pcm + i, samples - i, level);
+}
+
+static void deinterleave_sse2(const int16_t* in, int16_t* left, int16_t* right, size_t frames) {
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m128i x0 = _mm_loadu_si128((const __m128i*)(in + i * 2));
+        __m128i x1 = _mm_loadu_si128((const __m128i*)(in + i * 2 + 8));
+        __m128i l = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(x0, 16), 16),
+                                    _mm_srai_epi32(_mm_slli_epi32(x1, 16), 16));
+        __m128i r = _mm_packs_epi32(_mm_srai_epi32(x0, 16), _mm_srai_epi32(x1, 16));
+        _mm_storeu_si128((__m128i*)(left + i), l);
+        _mm_storeu_si128((__m128i*)(right + i), r);
+    }
+    pcm_kernels_scalar()->deinterleave(in + i * 2, left + i, right + i, frames - i);
+}
+
+static void interleave_sse2(const int16_t* left, const int16_t* right, int16_t* out, size_t frames) {
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m128i l = _mm_loadu_si128((const __m128i*)(left + i));
+        __m128i r = _mm_loadu_si128((const __m128i*)(right + i));
+        _mm_storeu_si128((__m128i*)(out + i * 2), _mm_unpacklo_epi16(l, r));
+        _mm_storeu_si128((__m128i*)(out + i * 2 + 8), _mm_unpackhi_epi16(l, r));
+    }
+    pcm_kernels_scalar()->interleave(left + i, right + i, out + i * 2, frames - i);
+}
+
+static const PcmKernels sse2_kernels = {
+    PCM_ISA_SSE2,
+    "sse2",
+    s16_to_float_sse2,
+    float_to_s16_sse2,
+    gain_ramp_sse2,
+    mix_sse2,
+    downmix_sse2,
+    measure_sse2,
+    deinterleave_sse2,
+    interleave_sse2,
+};
+
+const PcmKernels* pcm_kernels_sse2() {
+    return &sse2_kernels;
+}
+
+#else
+
+const PcmKernels* pcm_kernels_sse2() {
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,190 @@
+#include "playback_metrics.h"
+#include <stdio.h>
+#include <time.h>
+
+uint64_t metrics_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// =================================================================================
+// LatencyHistogram Implementation
+// =================================================================================
+
+LatencyHistogram::LatencyHistogram() {
+    reset();
+}
+
+void LatencyHistogram::record(uint64_t usec) {
+    // Bucket i holds durations in [2^(i-1), 2^i)
+    int bucket = 0;
+    while (bucket < NUM_BUCKETS - 1 && usec >= (1ULL << bucket)) {
+        bucket++;
+    }
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t prev = max_usec.load(std::memory_order_relaxed);
+    while (usec > prev && !max_usec.compare_exchange_weak(prev, usec, std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::reset() {
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        buckets[i].store(0, std::memory_order_relaxed);
+    }
+    max_usec.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::count() const {
+    uint64_t total = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        total += buckets[i].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t LatencyHistogram::max() const {
+    return max_usec.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+    uint64_t total = count();
+    if (total == 0) return 0;
+
+    uint64_t rank = (uint64_t)(p * total);
+    if (rank >= total) rank = total - 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen > rank) {
+            uint64_t upper = (1ULL << i);
+            uint64_t m = max();
+            return (m > 0 && m < upper) ? m : upper;
+        }
+    }
+    return max();
+}
+
+// =================================================================================
+// PlaybackMetrics Implementation
+// =================================================================================
+
+PlaybackMetrics::PlaybackMetrics() {
+    reset();
+}
+
+void PlaybackMetrics::reset() {
+    frames_decoded.store(0, std::memory_order_relaxed);
+    faad_errors.store(0, std::memory_order_relaxed);
+    decode_time.reset();
+    eq_time_us.store(0, std::memory_order_relaxed);
+    eq_audio_us.store(0, std::memory_order_relaxed);
+    buffer_fill.store(0, std::memory_order_relaxed);
+    buffer_capacity.store(0, std::memory_order_relaxed);
+    last_write_us.store(0, std::memory_order_relaxed);
+    underruns.store(0, std::memory_order_relaxed);
+    realtime_mode.store(0, std::memory_order_relaxed);
+    read_time_us.store(0, std::memory_order_relaxed);
+    read_stalls.store(0, std::memory_order_relaxed);
+    read_stall_us.store(0, std::memory_order_relaxed);
+    watchdog_heals.store(0, std::memory_order_relaxed);
+    seeks.store(0, std::memory_order_relaxed);
+    seek_latency.reset();
+    checkpoint_writes.store(0, std::memory_order_relaxed);
+    checkpoint_syncs.store(0, std::memory_order_relaxed);
+    checkpoint_bytes.store(0, std::memory_order_relaxed);
+    listen_ms.store(0, std::memory_order_relaxed);
+    cache_bytes.store(0, std::memory_order_relaxed);
+    cache_sheds.store(0, std::memory_order_relaxed);
+    cache_shed_bytes.store(0, std::memory_order_relaxed);
+    rss_kb.store(0, std::memory_order_relaxed);
+    pipeline_threads.store(0, std::memory_order_relaxed);
+    pipeline_us.store(0, std::memory_order_relaxed);
+    for (int i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+        stage_cpu_us[i].store(0, std::memory_order_relaxed);
+    }
+    for (int i = 0; i < PIPELINE_QUEUE_COUNT; i++) {
+        queue_depth[i].store(0, std::memory_order_relaxed);
+    }
+    worker_tasks.store(0, std::memory_order_relaxed);
+    worker_throttle_ms.store(0, std::memory_order_relaxed);
+}
+
+MetricsSnapshot PlaybackMetrics::snapshot() const {
+    MetricsSnapshot s;
+    s.push_back(std::make_pair("frames_decoded", (long long)frames_decoded.load(std::memory_order_relaxed)));
+    s.push_back(std::make_pair("decode_us_p50", (long long)decode_time.percentile(0.50)));
+    s.push_back(std::make_pair("decode_us_p90", (long long)decode_time.percentile(0.90)));
+    s.push_back(std::make_pair("decode_us_p99", (long long)decode_time.percentile(0.99)));
+    s.push_back(std::make_pair("decode_us_max", (long long)decode_time.max()));
+    s.push_back(std::make_pair("buffer_fill", (long long)buffer_fill.load(std::memory_order_relaxed)));
+    s.push_back(std::make_pair("buffer_capacity", (long long)buffer_capacity.load(std::memory_order_relaxed)));
+    s.push_back(std::make_pair("underruns", (long long)underruns.load(std::memory_order_relaxed)));
+    s.push_back(std::make_pair("realtime_mode", (long long)realtime_mode.load(std::memory_order_relaxed)));
+    s.push_back(std::make_pair("read_time_us", (long long)read_time_us.load(std::memory_order_relaxed)));
+    s.push_back(std::make_pair("read_stalls", (long long)read_stalls.load(std::memory_order_relaxed)));
+    s.push_back(std::make_pair("read_stall_us", (long long)read_stall_us.load(std::memory_order_relaxed)));
+    s.push_back(std::make_pair("watchdog_heals", (long long)watchdog_heals.load(std::memory_order_relaxed)));
+    s.push_back(std::make_pair("seeks", (long long)seeks.load(std::memory_order_relaxed)));
+    s.push_back(std::make_pair("seek_us_p50", (long long)seek_latency.percentile(0.50)));
+    s.push_back(std::make_pair("seek_us_p90", (long long)seek_latency.percentile(0.90)));
+    s.push_back(std::make_pair("seek_us_max", (long long)seek_latency.max()));
+    s.push_back(std::make_pair("faad_errors", (long long)faad_errors.load(std::memory_order_relaxed)));
+
+    // Microseconds of CPU per second of filtered audio
+    uint64_t eq_audio = eq_audio_us.load(std::memory_order_relaxed);
+    uint64_t eq_time = eq_time_us.load(std::memory_order_relaxed);
+    s.push_back(std::make_pair("eq_us_per_sec", eq_audio > 0 ? (long long)(eq_time * 1000000ULL / eq_audio) : 0LL));
+
+    uint64_t bytes = checkpoint_bytes.load(std::memory_order_relaxed);
+    uint64_t listened = listen_ms.load(std::memory_order_relaxed);
+    s.push_back(std::make_pair("checkpoint_writes", (long long)checkpoint_writes.load(std::memory_order_relaxed)));
+    s.push_back(std::make_pair("checkpoint_syncs", (long long)checkpoint_syncs.load(std::memory_order_relaxed)));
+    s.push_back(std::make_pair("checkpoint_bytes", (long long)bytes));
+    s.push_back(std::make_pair("listen_seconds", (long long)(listened / 1000)));
+    s.push_back(std::make_pair("checkpoint_bytes_per_hour", listened > 0 ? (long long)(bytes * 3600000ULL / listened) : 0LL));
+
+    s.push_back(std::make_pair("cache_kb", (long long)(cache_bytes.load(std::memory_order_relaxed) >> 10)));
+    s.push_back(std::make_pair("cache_sheds", (long long)cache_sheds.load(std::memory_order_relaxed)));
+    s.push_back(std::make_pair("cache_shed_kb", (long long)(cache_shed_bytes.load(std::memory_order_relaxed) >> 10)));
+    s.push_back(std::make_pair("rss_kb", (long long)rss_kb.load(std::memory_order_relaxed)));
+
+    static const char* occupancy_keys[PIPELINE_STAGE_COUNT] = {
+        "stage_read_pct", "stage_decode_pct", "stage_dsp_pct", "stage_output_pct",
+    };
+    static const char* depth_keys[PIPELINE_QUEUE_COUNT] = {
+        "queue_packets", "queue_pcm", "queue_filtered",
+    };
+    uint64_t wall = pipeline_us.load(std::memory_order_relaxed);
+    s.push_back(std::make_pair("pipeline_threads", (long long)pipeline_threads.load(std::memory_order_relaxed)));
+    for (int i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+        uint64_t cpu = stage_cpu_us[i].load(std::memory_order_relaxed);
+        s.push_back(std::make_pair(occupancy_keys[i], wall > 0 ? (long long)(cpu * 100 / wall) : 0LL));
+    }
+    for (int i = 0; i < PIPELINE_QUEUE_COUNT; i++) {
+        s.push_back(std::make_pair(depth_keys[i], (long long)queue_depth[i].load(std::memory_order_relaxed)));
+    }
+
+    s.push_back(std::make_pair("worker_tasks", (long long)worker_tasks.load(std::memory_order_relaxed)));
+    s.push_back(std::make_pair("worker_throttle_ms", (long long)worker_throttle_ms.load(std::memory_order_relaxed)));
+    return s;
+}
+
+bool PlaybackMetrics::write_file(const std::string& path) const {
+    std::string tmp_path = path + ".tmp";
+    FILE* f = fopen(tmp_path.c_str(), "w");
+    if (!f) return false;
+
+    MetricsSnapshot s = snapshot();
+    for (size_t i = 0; i < s.size(); i++) {
+        fprintf(f, "%s=%lld\n", s[i].first, s[i].second);
+    }
+
+    if (fclose(f) != 0) {
+        remove(tmp_path.c_str());
+        return false;
+    }
+    return rename(tmp_path.c_str(), path.c_str()) == 0;
+}
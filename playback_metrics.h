@@ -0,0 +1,128 @@
+#ifndef PLAYBACK_METRICS_H
+#define PLAYBACK_METRICS_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Monotonic clock in microseconds, used for all timing in the metrics code.
+uint64_t metrics_now_us();
+
+// --- LatencyHistogram ---
+// Lock-free histogram of durations (microseconds) with power-of-two buckets.
+// record() is wait-free and safe to call from the decoder thread; readers
+// get approximate percentiles (bucket upper bound).
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    void record(uint64_t usec);
+    void reset();
+
+    uint64_t count() const;
+    uint64_t max() const;
+    // p in [0, 1]
+    uint64_t percentile(double p) const;
+
+private:
+    static const int NUM_BUCKETS = 32;
+    std::atomic<uint32_t> buckets[NUM_BUCKETS];
+    std::atomic<uint64_t> max_usec;
+};
+
+// Stages of the audio path and the queues between them (Decoder)
+enum PipelineStage {
+    PIPELINE_READ = 0,
+    PIPELINE_DECODE,
+    PIPELINE_DSP,
+    PIPELINE_OUTPUT,
+    PIPELINE_STAGE_COUNT,
+};
+enum PipelineQueue {
+    QUEUE_PACKETS = 0, // read -> decode
+    QUEUE_PCM,         // decode -> DSP
+    QUEUE_FILTERED,    // DSP -> output
+    PIPELINE_QUEUE_COUNT,
+};
+
+// Plain copy of the counters, taken from the GUI thread for reporting.
+typedef std::vector<std::pair<const char*, long long> > MetricsSnapshot;
+
+// --- PlaybackMetrics ---
+// Playback health counters shared by MusicBackend and Decoder.
+// All updates use relaxed atomics: the decode loop never takes a lock and
+// readers only need an eventually consistent view.
+class PlaybackMetrics {
+public:
+    PlaybackMetrics();
+
+    // Decoder
+    std::atomic<uint64_t> frames_decoded;
+    std::atomic<uint64_t> faad_errors;
+    LatencyHistogram decode_time;
+
+    // Speech EQ cost: processing time per amount of audio filtered
+    std::atomic<uint64_t> eq_time_us;
+    std::atomic<uint64_t> eq_audio_us;
+
+    // Output buffer (named pipe towards GStreamer)
+    std::atomic<uint32_t> buffer_fill;      // bytes queued before last write
+    std::atomic<uint32_t> buffer_capacity;  // pipe size in bytes
+    std::atomic<uint64_t> last_write_us;    // metrics_now_us() of last write, 0 = none
+    std::atomic<uint64_t> underruns;
+
+    // Scheduling obtained by the last audio thread started (RealtimeMode)
+    std::atomic<uint32_t> realtime_mode;
+
+    // Container reads
+    std::atomic<uint64_t> read_time_us;
+    std::atomic<uint64_t> read_stalls;
+    std::atomic<uint64_t> read_stall_us;
+
+    // Decoder/pipeline restarts by the watchdog
+    std::atomic<uint64_t> watchdog_heals;
+
+    // Seeks (every decoder start is a seek to the resume position)
+    std::atomic<uint64_t> seeks;
+    LatencyHistogram seek_latency;          // request -> first PCM written
+
+    // Position checkpoints (flash write budget)
+    std::atomic<uint64_t> checkpoint_writes;
+    std::atomic<uint64_t> checkpoint_syncs;
+    std::atomic<uint64_t> checkpoint_bytes;
+    std::atomic<uint64_t> listen_ms;
+
+    // Memory (CacheManager)
+    std::atomic<uint64_t> cache_bytes;      // all registered caches
+    std::atomic<uint64_t> cache_sheds;
+    std::atomic<uint64_t> cache_shed_bytes;
+    std::atomic<uint32_t> rss_kb;           // at the last maintain()
+
+    // Audio path: threads running it (1 when collapsed), CPU time per
+    // stage against the decoder's wall time (occupancy), queue fill
+    std::atomic<uint32_t> pipeline_threads;
+    std::atomic<uint64_t> pipeline_us;
+    std::atomic<uint64_t> stage_cpu_us[PIPELINE_STAGE_COUNT];
+    std::atomic<uint32_t> queue_depth[PIPELINE_QUEUE_COUNT];
+
+    // Background work (WorkerPool): tasks run, time spent paused for playback
+    std::atomic<uint64_t> worker_tasks;
+    std::atomic<uint64_t> worker_throttle_ms;
+
+    // Reads slower than this count as a stall.
+    static const uint64_t READ_STALL_US = 50000;
+
+    static void add(std::atomic<uint64_t>& counter, uint64_t value) {
+        counter.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    void reset();
+    MetricsSnapshot snapshot() const;
+
+    // Rewrite the stats file atomically (write to temp file, then rename).
+    bool write_file(const std::string& path) const;
+};
+
+#endif // PLAYBACK_METRICS_H
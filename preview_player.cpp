@@ -0,0 +1,224 @@
+#include "preview_player.h"
+#include "energy_profile.h"
+#include "logger.h"
+#include "pcm_kernels.h"
+#include "playback_metrics.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <vector>
+
+const char* PREVIEW_PIPE_PATH = "/tmp/kinamp_preview_pipe";
+
+// Gain at a position of the clip: fades in at the start and out at the end
+static float preview_gain(uint64_t position, uint64_t length, uint64_t fade) {
+    if (fade == 0) return 1.0f;
+    uint64_t left = length > position ? length - position : 0;
+    uint64_t edge = position < left ? position : left;
+    return edge >= fade ? 1.0f : (float)edge / (float)fade;
+}
+
+// =================================================================================
+// PreviewPlayer Implementation
+// =================================================================================
+
+PreviewPlayer::PreviewPlayer()
+    : pipeline(NULL), bus_watch_id(0), done_id(0), thread_id(0), thread_started(false), stop_flag(false),
+      rate(0), start_request_us(0), on_done(NULL), done_user_data(NULL) {
+    unlink(PREVIEW_PIPE_PATH);
+    if (mkfifo(PREVIEW_PIPE_PATH, 0666) == -1) {
+        LOG_E("Preview: Failed to create named pipe: %s\n", strerror(errno));
+    }
+}
+
+PreviewPlayer::~PreviewPlayer() {
+    stop();
+    unlink(PREVIEW_PIPE_PATH);
+}
+
+void PreviewPlayer::set_done_callback(PreviewDoneCallback callback, void* user_data) {
+    on_done = callback;
+    done_user_data = user_data;
+}
+
+bool PreviewPlayer::start(const char* filepath) {
+    stop();
+    start_request_us = metrics_now_us();
+
+    if (!clip.open(filepath)) {
+        LOG_W("Preview: cannot read %s\n", filepath);
+        return false;
+    }
+    rate = clip.samplerate() > 0 ? clip.samplerate() : 44100;
+
+    gchar *pipeline_desc = g_strdup_printf(
+        "filesrc location=\"%s\" ! audio/x-raw-int, endianness=1234, signed=true, width=16, depth=16, rate=%lu, channels=2 ! queue ! mixersink",
+        PREVIEW_PIPE_PATH, rate
+    );
+    pipeline = gst_parse_launch(pipeline_desc, NULL);
+    g_free(pipeline_desc);
+    if (!pipeline) {
+        LOG_E("Preview: Failed to create pipeline\n");
+        clip.close();
+        return false;
+    }
+
+    GstBus *bus = gst_element_get_bus(pipeline);
+    bus_watch_id = gst_bus_add_watch(bus, bus_callback_func, this);
+    gst_object_unref(bus);
+
+    stop_flag = false;
+    if (pthread_create(&thread_id, NULL, thread_func, this) != 0) {
+        LOG_E("Preview: Failed to create thread: %s\n", strerror(errno));
+        stop();
+        return false;
+    }
+    thread_started = true;
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    LOG_I("Preview: %s at %d%%\n", filepath, PREVIEW_POSITION_PERCENT);
+    return true;
+}
+
+void PreviewPlayer::stop() {
+    if (done_id > 0) {
+        g_source_remove(done_id);
+        done_id = 0;
+    }
+
+    // Closing the pipe (pipeline to NULL) unblocks the writer; the flag
+    // stops it while it still waits for the sink to open the pipe
+    stop_flag = true;
+    if (pipeline) {
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+    }
+    if (thread_started) {
+        pthread_join(thread_id, NULL);
+        thread_started = false;
+    }
+
+    if (bus_watch_id > 0) {
+        g_source_remove(bus_watch_id);
+        bus_watch_id = 0;
+    }
+    if (pipeline) {
+        gst_object_unref(pipeline);
+        pipeline = NULL;
+    }
+    clip.close();
+}
+
+void* PreviewPlayer::thread_func(void* arg) {
+    static_cast<PreviewPlayer*>(arg)->run();
+    return NULL;
+}
+
+// Opened non-blocking so that a sink that never comes up cannot hang stop()
+int PreviewPlayer::open_pipe() {
+    while (!stop_flag) {
+        int fd = open(PREVIEW_PIPE_PATH, O_WRONLY | O_NONBLOCK);
+        if (fd != -1) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+            return fd;
+        }
+        if (errno != ENXIO && errno != EINTR) {
+            LOG_E("Preview: Failed to open pipe: %s\n", strerror(errno));
+            return -1;
+        }
+        usleep(PREVIEW_PIPE_POLL_MS * 1000);
+    }
+    return -1;
+}
+
+void PreviewPlayer::run() {
+    energy_name_thread("lark-preview");
+
+    // Seek (index lookups and one priming frame) while the sink starts up
+    uint32_t start_frame = (uint32_t)((uint64_t)clip.index().frame_count() * PREVIEW_POSITION_PERCENT / 100);
+    bool ok = clip.seek(start_frame);
+    if (!ok) {
+        LOG_W("Preview: cannot seek to frame %u: %s\n", start_frame,
+              clip.index().error() ? clip.index().error() : "decoder error");
+    }
+
+    int fd = open_pipe();
+    if (fd == -1) return;
+
+    const uint64_t length = (uint64_t)PREVIEW_SECONDS * rate;
+    const uint64_t fade = (uint64_t)PREVIEW_FADE_MS * rate / 1000;
+    std::vector<int16_t> block;
+    uint64_t position = 0;
+
+    while (ok && !stop_flag && position < length) {
+        const int16_t* pcm;
+        size_t frames;
+        if (!clip.decode(&pcm, &frames)) break;
+        if (frames == 0) continue;
+        if (frames > length - position) frames = (size_t)(length - position);
+
+        // The decoder's buffer is reused on the next frame: fade a copy
+        block.assign(pcm, pcm + frames * 2);
+        pcm_kernels().gain_ramp(&block[0], frames, 2, preview_gain(position, length, fade),
+                                preview_gain(position + frames, length, fade));
+
+        ProfileScope scope(STAGE_OUTPUT);
+        const char* data = (const char*)&block[0];
+        size_t to_write = frames * 2 * sizeof(int16_t);
+        while (to_write > 0) {
+            ssize_t written = write(fd, data, to_write);
+            if (written == -1) {
+                if (errno == EINTR) continue;
+                // EPIPE: the clip was stopped
+                ok = false;
+                break;
+            }
+            data += written;
+            to_write -= written;
+        }
+        if (position == 0 && ok) {
+            LOG_I("Preview: audio %llu ms after the request\n",
+                  (unsigned long long)((metrics_now_us() - start_request_us) / 1000));
+        }
+        position += frames;
+    }
+
+    // The sink sees end of stream once the pipe drains
+    close(fd);
+}
+
+gboolean PreviewPlayer::done_idle(gpointer data) {
+    PreviewPlayer* self = static_cast<PreviewPlayer*>(data);
+    self->done_id = 0;
+    self->stop();
+    if (self->on_done) self->on_done(self->done_user_data);
+    return FALSE;
+}
+
+gboolean PreviewPlayer::bus_callback_func(GstBus *bus, GstMessage *msg, gpointer data) {
+    (void)bus;
+    PreviewPlayer* self = static_cast<PreviewPlayer*>(data);
+
+    switch (GST_MESSAGE_TYPE(msg)) {
+        case GST_MESSAGE_EOS:
+            LOG_I("Preview: finished\n");
+            break;
+        case GST_MESSAGE_ERROR: {
+            GError *err;
+            gchar *debug;
+            gst_message_parse_error(msg, &err, &debug);
+            LOG_E("Preview: Error: %s\n", err->message);
+            g_error_free(err);
+            g_free(debug);
+            break;
+        }
+        default:
+            return TRUE;
+    }
+
+    // Tear down outside the bus watch
+    if (self->done_id == 0) self->done_id = g_idle_add(done_idle, self);
+    return TRUE;
+}
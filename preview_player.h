@@ -0,0 +1,68 @@
+#ifndef PREVIEW_PLAYER_H
+#define PREVIEW_PLAYER_H
+
+#include <gst/gst.h>
+#include <atomic>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "clip_decoder.h"
+
+// Book preview from the library: a short clip from the middle of the book,
+// faded in and out
+#define PREVIEW_SECONDS 8
+#define PREVIEW_POSITION_PERCENT 50
+#define PREVIEW_FADE_MS 300
+// Wait for the sink to open the pipe, polled so that stop() never hangs
+#define PREVIEW_PIPE_POLL_MS 5
+
+// Named pipe of the preview pipeline (the book keeps PIPE_PATH)
+extern const char* PREVIEW_PIPE_PATH;
+
+// Called on the GTK main loop when a clip finished playing
+typedef void (*PreviewDoneCallback)(void* user_data);
+
+// --- PreviewPlayer Class ---
+// Plays a clip of any book through its own ClipDecoder (Mp4Index, not
+// mp4read), pipe and GStreamer pipeline, so the open book's decoder,
+// position and A/B loop are left exactly as they are; the GUI only pauses
+// it for the length of the clip. Opening the index takes a few small
+// reads, so the clip starts as fast as the sink does.
+// Runs in the GLib main loop; the clip is decoded on its own thread.
+class PreviewPlayer {
+public:
+    PreviewPlayer();
+    ~PreviewPlayer();
+
+    void set_done_callback(PreviewDoneCallback callback, void* user_data);
+
+    // Replaces a clip still playing. False if the book cannot be read.
+    bool start(const char* filepath);
+    // Cut the clip short (no done callback)
+    void stop();
+    bool is_active() const { return pipeline != NULL; }
+
+private:
+    GstElement* pipeline;
+    guint bus_watch_id;
+    guint done_id;
+    pthread_t thread_id;
+    bool thread_started;
+    std::atomic<bool> stop_flag;
+
+    ClipDecoder clip; // opened by start(), then owned by the thread
+    unsigned long rate;
+    uint64_t start_request_us;
+
+    PreviewDoneCallback on_done;
+    void* done_user_data;
+
+    static void* thread_func(void* arg);
+    void run();
+    int open_pipe();
+
+    static gboolean bus_callback_func(GstBus* bus, GstMessage* msg, gpointer data);
+    static gboolean done_idle(gpointer data);
+};
+
+#endif // PREVIEW_PLAYER_H
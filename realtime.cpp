@@ -0,0 +1,95 @@
+#include "realtime.h"
+#include "logger.h"
+#include <atomic>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define REALTIME_DEFAULT_PRIORITY 10
+#define REALTIME_DEFAULT_NICE -10
+
+static int env_int(const char* name, int fallback) {
+    const char* value = getenv(name);
+    if (!value || !value[0]) return fallback;
+    char* end = NULL;
+    long n = strtol(value, &end, 10);
+    return (end && *end == '\0') ? (int)n : fallback;
+}
+
+static RealtimeConfig load_config() {
+    RealtimeConfig config;
+    config.enabled = env_int("LARK_RT", 0) != 0;
+    config.priority = env_int("LARK_RT_PRIORITY", REALTIME_DEFAULT_PRIORITY);
+    config.nice_value = env_int("LARK_RT_NICE", REALTIME_DEFAULT_NICE);
+    config.cpu = env_int("LARK_RT_CPU", -1);
+    config.lock_memory = config.enabled && env_int("LARK_RT_MLOCK", 1) != 0;
+
+    int min = sched_get_priority_min(SCHED_FIFO);
+    int max = sched_get_priority_max(SCHED_FIFO);
+    if (config.priority < min) config.priority = min;
+    if (config.priority > max) config.priority = max;
+    return config;
+}
+
+const RealtimeConfig& realtime_config() {
+    static const RealtimeConfig config = load_config();
+    return config;
+}
+
+RealtimeMode realtime_enter_thread(const char* name) {
+    const RealtimeConfig& config = realtime_config();
+    if (!config.enabled) return REALTIME_OFF;
+
+    if (config.cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(config.cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            LOG_W("Realtime: %s: cannot pin to CPU %d: %s\n", name, config.cpu, strerror(errno));
+        }
+    }
+
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = config.priority;
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err == 0) {
+        LOG_I("Realtime: %s: SCHED_FIFO priority %d\n", name, config.priority);
+        return REALTIME_FIFO;
+    }
+
+    // No CAP_SYS_NICE / RLIMIT_RTPRIO: a raised nice value still helps
+    // against the framework and indexer. On Linux nice is per thread.
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    if (setpriority(PRIO_PROCESS, tid, config.nice_value) == 0) {
+        LOG_I("Realtime: %s: SCHED_FIFO unavailable (%s), nice %d\n",
+              name, strerror(err), config.nice_value);
+        return REALTIME_NICE;
+    }
+
+    LOG_W("Realtime: %s: cannot raise priority: %s\n", name, strerror(errno));
+    return REALTIME_OFF;
+}
+
+bool realtime_lock(const void* addr, size_t len) {
+    if (!realtime_config().lock_memory || !addr || len == 0) return false;
+    if (mlock(addr, len) != 0) {
+        static std::atomic<bool> warned(false);
+        if (!warned.exchange(true)) {
+            LOG_W("Realtime: mlock of %lu bytes failed: %s\n", (unsigned long)len, strerror(errno));
+        }
+        return false;
+    }
+    return true;
+}
+
+void realtime_unlock(const void* addr, size_t len) {
+    if (!realtime_config().lock_memory || !addr || len == 0) return;
+    munlock(addr, len);
+}
@@ -0,0 +1,38 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <stddef.h>
+
+// Scheduling mode actually obtained by the audio threads
+enum RealtimeMode {
+    REALTIME_OFF = 0,
+    REALTIME_NICE,  // SCHED_OTHER with raised priority (negative nice)
+    REALTIME_FIFO,  // SCHED_FIFO
+};
+
+// Opt-in audio path tuning, read once from the environment:
+//   LARK_RT=1          enable (SCHED_FIFO, falling back to nice)
+//   LARK_RT_PRIORITY=n SCHED_FIFO priority (default 10)
+//   LARK_RT_NICE=n     nice value for the fallback (default -10)
+//   LARK_RT_CPU=n      pin the audio threads to this core (default: no pinning)
+//   LARK_RT_MLOCK=0    do not lock decoder buffers in memory (default: lock)
+struct RealtimeConfig {
+    bool enabled;
+    int priority;
+    int nice_value;
+    int cpu;
+    bool lock_memory;
+};
+
+const RealtimeConfig& realtime_config();
+
+// Apply the configuration to the calling thread. Returns the mode obtained;
+// failures (missing privileges) are logged once and degrade gracefully.
+RealtimeMode realtime_enter_thread(const char* name);
+
+// Lock a buffer in RAM if memory locking is enabled; false if it could not
+// be locked (or locking is disabled).
+bool realtime_lock(const void* addr, size_t len);
+void realtime_unlock(const void* addr, size_t len);
+
+#endif // REALTIME_H
@@ -0,0 +1,898 @@
+// Desktop simulation of the LIPC library (openlipc/openlipc.h), in-process.
+//
+// - Every property access and event is recorded (counted per call and
+//   logged), and the counts are logged when the last handle is closed.
+// - Properties of other services are kept in a table seeded with the
+//   powerd and btfd properties the player uses; properties registered by
+//   the application are served through its callbacks, like on the device.
+// - Events are delivered to subscribers on a separate "LIPC thread".
+//   powerd sends goingToScreenSaver after LARK_SIM_SCREENSAVER seconds
+//   while preventScreenSaver is 0 (off by default).
+// - Commands written to the control FIFO (LARK_SIM_LIPC, default
+//   /tmp/larkplayer-sim-lipc), one per line:
+//     get <service> <property>
+//     set <service> <property> <value>
+//     event <service> <name> [params...]
+//     calls
+//   e.g. echo "get com.kbarni.lark stats" > /tmp/larkplayer-sim-lipc
+
+#include "openlipc/openlipc.h"
+#include "logger.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define SIM_LIPC_CONTROL_PATH "/tmp/larkplayer-sim-lipc"
+#define SIM_LIPC_POLL_MS 500
+#define SIM_LIPC_TIMEOUT_MS 10000
+#define SIM_LIPC_STRING_BUFFER 256
+#define SIM_POWERD_FL_MAX 24
+
+int g_lab126_log_mask = 0;
+
+// =================================================================================
+// Handles, hash-arrays and events
+// =================================================================================
+
+struct SimLipc {
+    std::string service; // empty for LipcOpenNoName()
+    LipcEventCallback default_callback;
+};
+
+struct HaValue {
+    LIPCHasharrayType type;
+    int int_value;
+    std::string string_value; // string or blob bytes
+};
+
+struct SimHasharray {
+    std::vector<std::map<std::string, HaValue> > hashes;
+};
+
+struct EventParam {
+    bool is_string;
+    int int_value;
+    std::string string_value;
+};
+
+struct SimEvent {
+    std::string source;
+    std::string name;
+    std::vector<EventParam> params;
+    size_t next_param;
+};
+
+// =================================================================================
+// Simulated system
+// =================================================================================
+
+struct SimProperty {
+    bool is_string;
+    int int_value;
+    std::string string_value;
+};
+
+struct Registration {
+    enum Kind { INT, STRING, HASHARRAY } kind;
+    SimLipc* lipc;
+    LipcPropCallback getter;
+    LipcPropCallback setter;
+    void* data;
+};
+
+struct Subscription {
+    SimLipc* lipc;
+    std::string service;
+    std::string name; // empty: every event of the service
+    LipcEventCallback callback;
+    void* data;
+};
+
+static std::mutex sim_lock;
+static std::map<std::string, SimProperty> properties;      // "service property"
+static std::map<std::string, Registration> registrations;  // "service property"
+static std::vector<Subscription> subscriptions;
+static std::map<std::string, unsigned long> call_counts;
+static int open_handles = 0;
+
+static pthread_t event_thread;
+static bool event_thread_running = false;
+static volatile bool event_thread_stop = false;
+
+// powerd screensaver simulation, under sim_lock
+static time_t idle_since = 0;
+static bool in_screensaver = false;
+
+static std::string key_of(const char* service, const char* property) {
+    return std::string(service ? service : "") + " " + (property ? property : "");
+}
+
+static void record(const char* call, const char* service, const char* property) {
+    std::lock_guard<std::mutex> guard(sim_lock);
+    call_counts[std::string(call) + " " + key_of(service, property)]++;
+}
+
+static void seed_int(const char* service, const char* property, int value) {
+    SimProperty p;
+    p.is_string = false;
+    p.int_value = value;
+    properties[key_of(service, property)] = p;
+}
+
+static void seed_string(const char* service, const char* property, const char* value) {
+    SimProperty p;
+    p.is_string = true;
+    p.int_value = 0;
+    p.string_value = value;
+    properties[key_of(service, property)] = p;
+}
+
+static void seed_properties() {
+    seed_int("com.lab126.powerd", "flIntensity", 10);
+    seed_int("com.lab126.powerd", "preventScreenSaver", 0);
+    seed_string("com.lab126.powerd", "status", "Powerd state: Active");
+    seed_int("com.lab126.powerd", "battLevel", 80);
+    seed_int("com.lab126.btfd", "ensureBTconnection", 0);
+    seed_string("com.lab126.btfd", "BTenable", "0:0");
+    seed_string("com.lab126.btfd", "BTstate", "disconnected");
+    seed_string("com.lab126.pillow", "customDialog", "");
+}
+
+// Side effects of property writes on the simulated services, under sim_lock
+static void simulate_set(const std::string& key, SimProperty* p) {
+    if (key == "com.lab126.powerd flIntensity") {
+        if (p->int_value < 0) p->int_value = 0;
+        if (p->int_value > SIM_POWERD_FL_MAX) p->int_value = SIM_POWERD_FL_MAX;
+    } else if (key == "com.lab126.powerd preventScreenSaver") {
+        idle_since = time(NULL);
+        if (p->int_value) in_screensaver = false;
+    } else if (key == "com.lab126.btfd BTenable") {
+        properties["com.lab126.btfd BTstate"].is_string = true;
+        properties["com.lab126.btfd BTstate"].string_value =
+            p->string_value.compare(0, 1, "1") == 0 ? "connected" : "disconnected";
+    }
+}
+
+static SimEvent* new_event(const char* source, const char* name) {
+    SimEvent* event = new SimEvent;
+    event->source = source ? source : "";
+    event->name = name ? name : "";
+    event->next_param = 0;
+    return event;
+}
+
+// Calls the subscribers of event->source outside the lock
+static void dispatch(SimEvent* event) {
+    std::vector<Subscription> targets;
+    {
+        std::lock_guard<std::mutex> guard(sim_lock);
+        call_counts["event " + event->source + " " + event->name]++;
+        for (size_t i = 0; i < subscriptions.size(); i++) {
+            const Subscription& s = subscriptions[i];
+            if (s.service == event->source && (s.name.empty() || s.name == event->name)) {
+                targets.push_back(s);
+            }
+        }
+    }
+    LOG_I("LIPC sim: event %s %s (%lu subscriber(s))\n", event->source.c_str(), event->name.c_str(),
+          (unsigned long)targets.size());
+    for (size_t i = 0; i < targets.size(); i++) {
+        event->next_param = 0;
+        LipcEventCallback callback = targets[i].callback ? targets[i].callback : targets[i].lipc->default_callback;
+        if (callback) callback(targets[i].lipc, event->name.c_str(), event, targets[i].data);
+    }
+}
+
+// =================================================================================
+// LIPC thread: control FIFO and powerd events
+// =================================================================================
+
+static LIPC* control_handle = NULL;
+
+static void run_command(const std::string& line) {
+    std::istringstream in(line);
+    std::string command, service, name;
+    in >> command >> service >> name;
+
+    if (command == "calls") {
+        std::lock_guard<std::mutex> guard(sim_lock);
+        for (std::map<std::string, unsigned long>::const_iterator it = call_counts.begin(); it != call_counts.end(); ++it) {
+            printf("%8lu %s\n", it->second, it->first.c_str());
+        }
+        fflush(stdout);
+    } else if (command == "get") {
+        int value = 0;
+        char* string = NULL;
+        LIPCha* ha = NULL;
+        if (LipcGetIntProperty(control_handle, service.c_str(), name.c_str(), &value) == LIPC_OK) {
+            printf("%s %s = %d\n", service.c_str(), name.c_str(), value);
+        } else if (LipcGetStringProperty(control_handle, service.c_str(), name.c_str(), &string) == LIPC_OK) {
+            printf("%s %s = \"%s\"\n", service.c_str(), name.c_str(), string);
+            LipcFreeString(string);
+        } else if (LipcAccessHasharrayProperty(control_handle, service.c_str(), name.c_str(), NULL, &ha) == LIPC_OK && ha) {
+            std::vector<char> text(65536);
+            size_t size = text.size();
+            LipcHasharrayToString(ha, &text[0], &size);
+            printf("%s %s = %s\n", service.c_str(), name.c_str(), &text[0]);
+            LipcHasharrayFree(ha, 1);
+        } else {
+            printf("%s %s: no such property\n", service.c_str(), name.c_str());
+        }
+        fflush(stdout);
+    } else if (command == "set") {
+        std::string value;
+        std::getline(in >> std::ws, value);
+        char* end = NULL;
+        long n = strtol(value.c_str(), &end, 10);
+        LIPCcode code = (!value.empty() && end && *end == '\0')
+            ? LipcSetIntProperty(control_handle, service.c_str(), name.c_str(), (int)n)
+            : LipcSetStringProperty(control_handle, service.c_str(), name.c_str(), value.c_str());
+        printf("set %s %s: %s\n", service.c_str(), name.c_str(), LipcGetErrorString(code));
+        fflush(stdout);
+    } else if (command == "event") {
+        SimEvent* event = new_event(service.c_str(), name.c_str());
+        std::string param;
+        while (in >> param) {
+            EventParam p;
+            char* end = NULL;
+            p.int_value = (int)strtol(param.c_str(), &end, 10);
+            p.is_string = !(end && *end == '\0');
+            p.string_value = param;
+            event->params.push_back(p);
+        }
+        if (service == "com.lab126.powerd" && name == "outOfScreenSaver") {
+            std::lock_guard<std::mutex> guard(sim_lock);
+            in_screensaver = false;
+            idle_since = time(NULL);
+        }
+        dispatch(event);
+        delete event;
+    } else if (!command.empty()) {
+        LOG_W("LIPC sim: unknown command \"%s\"\n", command.c_str());
+    }
+}
+
+static void* event_thread_func(void* arg) {
+    (void)arg;
+    const char* path = getenv("LARK_SIM_LIPC");
+    if (!path || !path[0]) path = SIM_LIPC_CONTROL_PATH;
+    const char* screensaver = getenv("LARK_SIM_SCREENSAVER");
+    int screensaver_seconds = screensaver ? atoi(screensaver) : 0;
+
+    // Opened read-write so that writers coming and going never read as EOF
+    unlink(path);
+    int fd = -1;
+    if (mkfifo(path, 0666) == 0) fd = open(path, O_RDWR | O_NONBLOCK);
+    if (fd == -1) LOG_W("LIPC sim: no control FIFO at %s: %s\n", path, strerror(errno));
+    else LOG_I("LIPC sim: control FIFO %s\n", path);
+
+    std::string pending;
+    while (!event_thread_stop) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (fd == -1) usleep(SIM_LIPC_POLL_MS * 1000);
+        else if (poll(&pfd, 1, SIM_LIPC_POLL_MS) > 0 && (pfd.revents & POLLIN)) {
+            char buf[512];
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n > 0) pending.append(buf, (size_t)n);
+            size_t eol;
+            while ((eol = pending.find('\n')) != std::string::npos) {
+                std::string line = pending.substr(0, eol);
+                pending.erase(0, eol + 1);
+                run_command(line);
+            }
+        }
+
+        bool sleep_now = false;
+        if (screensaver_seconds > 0) {
+            std::lock_guard<std::mutex> guard(sim_lock);
+            const SimProperty& prevent = properties["com.lab126.powerd preventScreenSaver"];
+            if (!prevent.int_value && !in_screensaver && time(NULL) - idle_since >= screensaver_seconds) {
+                in_screensaver = true;
+                sleep_now = true;
+            }
+        }
+        if (sleep_now) {
+            SimEvent* event = new_event("com.lab126.powerd", "goingToScreenSaver");
+            dispatch(event);
+            delete event;
+        }
+    }
+
+    if (fd != -1) {
+        close(fd);
+        unlink(path);
+    }
+    return NULL;
+}
+
+// =================================================================================
+// Initialization
+// =================================================================================
+
+LIPC* LipcOpenEx(const char* service, LIPCcode* code) {
+    SimLipc* lipc = new SimLipc;
+    lipc->service = service ? service : "";
+    lipc->default_callback = NULL;
+
+    bool start_thread = false;
+    {
+        std::lock_guard<std::mutex> guard(sim_lock);
+        if (open_handles++ == 0) {
+            seed_properties();
+            idle_since = time(NULL);
+            in_screensaver = false;
+            start_thread = !event_thread_running;
+        }
+    }
+    if (start_thread) {
+        control_handle = lipc;
+        event_thread_stop = false;
+        event_thread_running = pthread_create(&event_thread, NULL, event_thread_func, NULL) == 0;
+    }
+    LOG_I("LIPC sim: opened %s\n", service ? service : "(no name)");
+    if (code) *code = LIPC_OK;
+    return lipc;
+}
+
+LIPC* LipcOpen(const char* service) {
+    return LipcOpenEx(service, NULL);
+}
+
+LIPC* LipcOpenNoName(void) {
+    return LipcOpenEx(NULL, NULL);
+}
+
+void LipcClose(LIPC* handle) {
+    SimLipc* lipc = static_cast<SimLipc*>(handle);
+    if (!lipc) return;
+
+    bool last;
+    {
+        std::lock_guard<std::mutex> guard(sim_lock);
+        last = --open_handles == 0;
+        for (std::map<std::string, Registration>::iterator it = registrations.begin(); it != registrations.end();) {
+            if (it->second.lipc == lipc) registrations.erase(it++);
+            else ++it;
+        }
+        for (size_t i = subscriptions.size(); i-- > 0;) {
+            if (subscriptions[i].lipc == lipc) subscriptions.erase(subscriptions.begin() + i);
+        }
+    }
+    if (last && event_thread_running) {
+        event_thread_stop = true;
+        pthread_join(event_thread, NULL);
+        event_thread_running = false;
+        control_handle = NULL;
+    }
+    if (last) {
+        std::lock_guard<std::mutex> guard(sim_lock);
+        for (std::map<std::string, unsigned long>::const_iterator it = call_counts.begin(); it != call_counts.end(); ++it) {
+            LOG_I("LIPC sim: %lu x %s\n", it->second, it->first.c_str());
+        }
+    }
+    delete lipc;
+}
+
+const char* LipcGetServiceName(LIPC* handle) {
+    SimLipc* lipc = static_cast<SimLipc*>(handle);
+    return lipc && !lipc->service.empty() ? lipc->service.c_str() : NULL;
+}
+
+const char* LipcGetErrorString(LIPCcode code) {
+    switch (code) {
+        case LIPC_OK: return "lipcErrNone";
+        case LIPC_ERROR_UNKNOWN: return "lipcErrUnknown";
+        case LIPC_ERROR_INTERNAL: return "lipcErrInternal";
+        case LIPC_ERROR_NO_SUCH_SOURCE: return "lipcErrNoSuchSource";
+        case LIPC_ERROR_OPERATION_NOT_SUPPORTED: return "lipcErrOperationNotSupported";
+        case LIPC_ERROR_OUT_OF_MEMORY: return "lipcErrOutOfMemory";
+        case LIPC_ERROR_NO_SUCH_PROPERTY: return "lipcErrNoSuchProperty";
+        case LIPC_ERROR_ACCESS_NOT_ALLOWED: return "lipcErrAccessNotAllowed";
+        case LIPC_ERROR_BUFFER_TOO_SMALL: return "lipcErrBufferTooSmall";
+        case LIPC_ERROR_INVALID_HANDLE: return "lipcErrInvalidHandle";
+        case LIPC_ERROR_INVALID_ARG: return "lipcErrInvalidArg";
+        default: return "lipcErrOther";
+    }
+}
+
+void LipcSetLlog(int mask) {
+    g_lab126_log_mask = mask;
+}
+
+// =================================================================================
+// Properties
+// =================================================================================
+
+int LipcGetPropAccessTimeout(LIPC* lipc) {
+    (void)lipc;
+    return SIM_LIPC_TIMEOUT_MS;
+}
+
+// Registered by the application itself (any handle may access them)
+static bool find_registration(const char* service, const char* property, Registration* out) {
+    std::lock_guard<std::mutex> guard(sim_lock);
+    std::map<std::string, Registration>::const_iterator it = registrations.find(key_of(service, property));
+    if (it == registrations.end()) return false;
+    *out = it->second;
+    return true;
+}
+
+LIPCcode LipcGetIntProperty(LIPC* lipc, const char* service, const char* property, int* value) {
+    if (!lipc || !value) return LIPC_ERROR_INVALID_ARG;
+    record("getInt", service, property);
+    Registration reg;
+    if (find_registration(service, property, &reg)) {
+        if (reg.kind != Registration::INT) return LIPC_ERROR_NO_SUCH_PROPERTY;
+        if (!reg.getter) return LIPC_ERROR_ACCESS_NOT_ALLOWED;
+        return reg.getter(reg.lipc, property, value, reg.data);
+    }
+
+    std::lock_guard<std::mutex> guard(sim_lock);
+    std::map<std::string, SimProperty>::const_iterator it = properties.find(key_of(service, property));
+    if (it == properties.end() || it->second.is_string) return LIPC_ERROR_NO_SUCH_PROPERTY;
+    *value = it->second.int_value;
+    return LIPC_OK;
+}
+
+LIPCcode LipcSetIntProperty(LIPC* lipc, const char* service, const char* property, int value) {
+    if (!lipc) return LIPC_ERROR_INVALID_ARG;
+    record("setInt", service, property);
+    Registration reg;
+    if (find_registration(service, property, &reg)) {
+        if (reg.kind != Registration::INT) return LIPC_ERROR_NO_SUCH_PROPERTY;
+        if (!reg.setter) return LIPC_ERROR_ACCESS_NOT_ALLOWED;
+        return reg.setter(reg.lipc, property, (void*)(long)value, reg.data);
+    }
+
+    LOG_I("LIPC sim: %s %s = %d\n", service, property, value);
+    std::string key = key_of(service, property);
+    std::lock_guard<std::mutex> guard(sim_lock);
+    SimProperty& p = properties[key];
+    p.is_string = false;
+    p.int_value = value;
+    simulate_set(key, &p);
+    return LIPC_OK;
+}
+
+LIPCcode LipcGetStringProperty(LIPC* lipc, const char* service, const char* property, char** value) {
+    if (!lipc || !value) return LIPC_ERROR_INVALID_ARG;
+    record("getString", service, property);
+    Registration reg;
+    if (find_registration(service, property, &reg)) {
+        if (reg.kind != Registration::STRING) return LIPC_ERROR_NO_SUCH_PROPERTY;
+        if (!reg.getter) return LIPC_ERROR_ACCESS_NOT_ALLOWED;
+        // The getter gets the buffer size in data and asks for more with
+        // LIPC_ERROR_BUFFER_TOO_SMALL
+        size_t size = SIM_LIPC_STRING_BUFFER;
+        while (true) {
+            char* buffer = (char*)calloc(1, size);
+            if (!buffer) return LIPC_ERROR_OUT_OF_MEMORY;
+            size_t requested = size;
+            LIPCcode code = reg.getter(reg.lipc, property, buffer, &requested);
+            if (code == LIPC_ERROR_BUFFER_TOO_SMALL && requested > size) {
+                free(buffer);
+                size = requested;
+                continue;
+            }
+            if (code != LIPC_OK) {
+                free(buffer);
+                return code;
+            }
+            *value = buffer;
+            return LIPC_OK;
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(sim_lock);
+    std::map<std::string, SimProperty>::const_iterator it = properties.find(key_of(service, property));
+    if (it == properties.end() || !it->second.is_string) return LIPC_ERROR_NO_SUCH_PROPERTY;
+    *value = strdup(it->second.string_value.c_str());
+    return *value ? LIPC_OK : LIPC_ERROR_OUT_OF_MEMORY;
+}
+
+LIPCcode LipcSetStringProperty(LIPC* lipc, const char* service, const char* property, const char* value) {
+    if (!lipc || !value) return LIPC_ERROR_INVALID_ARG;
+    record("setString", service, property);
+    Registration reg;
+    if (find_registration(service, property, &reg)) {
+        if (reg.kind != Registration::STRING) return LIPC_ERROR_NO_SUCH_PROPERTY;
+        if (!reg.setter) return LIPC_ERROR_ACCESS_NOT_ALLOWED;
+        return reg.setter(reg.lipc, property, (void*)value, reg.data);
+    }
+
+    LOG_I("LIPC sim: %s %s = \"%s\"\n", service, property, value);
+    std::string key = key_of(service, property);
+    std::lock_guard<std::mutex> guard(sim_lock);
+    SimProperty& p = properties[key];
+    p.is_string = true;
+    p.string_value = value;
+    simulate_set(key, &p);
+    return LIPC_OK;
+}
+
+LIPCcode LipcAccessHasharrayProperty(LIPC* lipc, const char* service, const char* property,
+                                     const LIPCha* ha, LIPCha** ha_out) {
+    if (!lipc) return LIPC_ERROR_INVALID_ARG;
+    record("accessHasharray", service, property);
+    Registration reg;
+    if (!find_registration(service, property, &reg) || reg.kind != Registration::HASHARRAY) {
+        return LIPC_ERROR_NO_SUCH_PROPERTY;
+    }
+    // The callback replaces the input with its output
+    LIPCha* value = ha ? LipcHasharrayClone(ha) : NULL;
+    LIPCcode code = reg.getter(reg.lipc, property, &value, reg.data);
+    if (ha_out) *ha_out = value;
+    else if (value) LipcHasharrayFree(value, 1);
+    return code;
+}
+
+void LipcFreeString(char* string) {
+    free(string);
+}
+
+static LIPCcode register_property(LIPC* handle, const char* property, Registration::Kind kind,
+                                  LipcPropCallback getter, LipcPropCallback setter, void* data) {
+    SimLipc* lipc = static_cast<SimLipc*>(handle);
+    if (!lipc || !property) return LIPC_ERROR_INVALID_ARG;
+    if (lipc->service.empty()) return LIPC_ERROR_OPERATION_NOT_ALLOWED;
+    Registration reg;
+    reg.kind = kind;
+    reg.lipc = lipc;
+    reg.getter = getter;
+    reg.setter = setter;
+    reg.data = data;
+    std::lock_guard<std::mutex> guard(sim_lock);
+    registrations[key_of(lipc->service.c_str(), property)] = reg;
+    return LIPC_OK;
+}
+
+LIPCcode LipcRegisterIntProperty(LIPC* lipc, const char* property, LipcPropCallback getter,
+                                 LipcPropCallback setter, void* data) {
+    return register_property(lipc, property, Registration::INT, getter, setter, data);
+}
+
+LIPCcode LipcRegisterStringProperty(LIPC* lipc, const char* property, LipcPropCallback getter,
+                                    LipcPropCallback setter, void* data) {
+    return register_property(lipc, property, Registration::STRING, getter, setter, data);
+}
+
+LIPCcode LipcRegisterHasharrayProperty(LIPC* lipc, const char* property, LipcPropCallback callback, void* data) {
+    return register_property(lipc, property, Registration::HASHARRAY, callback, callback, data);
+}
+
+LIPCcode LipcUnregisterProperty(LIPC* handle, const char* property, void** data) {
+    SimLipc* lipc = static_cast<SimLipc*>(handle);
+    if (!lipc || !property) return LIPC_ERROR_INVALID_ARG;
+    std::lock_guard<std::mutex> guard(sim_lock);
+    std::map<std::string, Registration>::iterator it = registrations.find(key_of(lipc->service.c_str(), property));
+    if (it == registrations.end()) return LIPC_ERROR_NO_SUCH_PROPERTY;
+    if (data) *data = it->second.data;
+    registrations.erase(it);
+    return LIPC_OK;
+}
+
+// =================================================================================
+// Hash-arrays
+// =================================================================================
+
+static SimHasharray* as_ha(LIPCha* ha) {
+    return static_cast<SimHasharray*>(ha);
+}
+
+static HaValue* ha_find(LIPCha* ha, int index, const char* key) {
+    SimHasharray* h = as_ha(ha);
+    if (!h || index < 0 || (size_t)index >= h->hashes.size() || !key) return NULL;
+    std::map<std::string, HaValue>::iterator it = h->hashes[index].find(key);
+    return it == h->hashes[index].end() ? NULL : &it->second;
+}
+
+static LIPCcode ha_put(LIPCha* ha, int index, const char* key, const HaValue& value) {
+    SimHasharray* h = as_ha(ha);
+    if (!h || index < 0 || (size_t)index >= h->hashes.size() || !key) return LIPC_ERROR_INVALID_ARG;
+    h->hashes[index][key] = value;
+    return LIPC_OK;
+}
+
+LIPCha* LipcHasharrayNew(LIPC* lipc) {
+    (void)lipc;
+    return new SimHasharray;
+}
+
+LIPCcode LipcHasharrayFree(LIPCha* ha, int destroy) {
+    (void)destroy;
+    delete as_ha(ha);
+    return LIPC_OK;
+}
+
+LIPCcode LipcHasharrayDestroy(LIPCha* ha) {
+    return LipcHasharrayFree(ha, 1);
+}
+
+int LipcHasharrayGetHashCount(LIPCha* ha) {
+    return ha ? (int)as_ha(ha)->hashes.size() : -1;
+}
+
+LIPCcode LipcHasharrayAddHash(LIPCha* ha, size_t* index) {
+    if (!ha) return LIPC_ERROR_INVALID_ARG;
+    as_ha(ha)->hashes.push_back(std::map<std::string, HaValue>());
+    if (index) *index = as_ha(ha)->hashes.size() - 1;
+    return LIPC_OK;
+}
+
+LIPCcode LipcHasharrayKeys(LIPCha* ha, int index, const char* keys[], size_t* count) {
+    SimHasharray* h = as_ha(ha);
+    if (!h || index < 0 || (size_t)index >= h->hashes.size() || !count) return LIPC_ERROR_INVALID_ARG;
+    size_t wanted = *count;
+    size_t i = 0;
+    for (std::map<std::string, HaValue>::const_iterator it = h->hashes[index].begin();
+         it != h->hashes[index].end() && i < wanted && keys; ++it, ++i) {
+        keys[i] = it->first.c_str();
+    }
+    *count = h->hashes[index].size();
+    return LIPC_OK;
+}
+
+LIPCcode LipcHasharrayCheckKey(LIPCha* ha, int index, const char* key, LIPCHasharrayType* type, size_t* size) {
+    HaValue* v = ha_find(ha, index, key);
+    if (!v) return LIPC_ERROR_NO_SUCH_PARAM;
+    if (type) *type = v->type;
+    if (size) *size = v->type == LIPC_HASHARRAY_INT ? sizeof(int) : v->string_value.size();
+    return LIPC_OK;
+}
+
+LIPCcode LipcHasharrayGetInt(LIPCha* ha, int index, const char* key, int* value) {
+    HaValue* v = ha_find(ha, index, key);
+    if (!v || v->type != LIPC_HASHARRAY_INT) return LIPC_ERROR_NO_SUCH_PARAM;
+    *value = v->int_value;
+    return LIPC_OK;
+}
+
+LIPCcode LipcHasharrayPutInt(LIPCha* ha, int index, const char* key, int value) {
+    HaValue v;
+    v.type = LIPC_HASHARRAY_INT;
+    v.int_value = value;
+    return ha_put(ha, index, key, v);
+}
+
+LIPCcode LipcHasharrayGetString(LIPCha* ha, int index, const char* key, char** value) {
+    HaValue* v = ha_find(ha, index, key);
+    if (!v || v->type != LIPC_HASHARRAY_STRING) return LIPC_ERROR_NO_SUCH_PARAM;
+    // Owned by the hash-array
+    *value = const_cast<char*>(v->string_value.c_str());
+    return LIPC_OK;
+}
+
+LIPCcode LipcHasharrayPutString(LIPCha* ha, int index, const char* key, const char* value) {
+    HaValue v;
+    v.type = LIPC_HASHARRAY_STRING;
+    v.int_value = 0;
+    v.string_value = value ? value : "";
+    return ha_put(ha, index, key, v);
+}
+
+LIPCcode LipcHasharrayGetBlob(LIPCha* ha, int index, const char* key, unsigned char* data[], size_t* size) {
+    HaValue* v = ha_find(ha, index, key);
+    if (!v || v->type != LIPC_HASHARRAY_BLOB) return LIPC_ERROR_NO_SUCH_PARAM;
+    *data = (unsigned char*)&v->string_value[0];
+    *size = v->string_value.size();
+    return LIPC_OK;
+}
+
+LIPCcode LipcHasharrayPutBlob(LIPCha* ha, int index, const char* key, const unsigned char* data, size_t size) {
+    HaValue v;
+    v.type = LIPC_HASHARRAY_BLOB;
+    v.int_value = 0;
+    v.string_value.assign((const char*)data, size);
+    return ha_put(ha, index, key, v);
+}
+
+LIPCcode LipcHasharrayCopy(LIPCha* dest, const LIPCha* src) {
+    if (!dest || !src) return LIPC_ERROR_INVALID_ARG;
+    *as_ha(dest) = *static_cast<const SimHasharray*>(src);
+    return LIPC_OK;
+}
+
+LIPCcode LipcHasharrayCopyHash(LIPCha* dest, int dest_index, const LIPCha* src, int src_index) {
+    const SimHasharray* s = static_cast<const SimHasharray*>(src);
+    SimHasharray* d = as_ha(dest);
+    if (!s || !d || src_index < 0 || (size_t)src_index >= s->hashes.size()) return LIPC_ERROR_INVALID_ARG;
+    if (dest_index < 0) {
+        d->hashes.push_back(s->hashes[src_index]);
+    } else if ((size_t)dest_index < d->hashes.size()) {
+        d->hashes[dest_index] = s->hashes[src_index];
+    } else {
+        return LIPC_ERROR_INVALID_ARG;
+    }
+    return LIPC_OK;
+}
+
+LIPCha* LipcHasharrayClone(const LIPCha* ha) {
+    if (!ha) return NULL;
+    return new SimHasharray(*static_cast<const SimHasharray*>(ha));
+}
+
+LIPCcode LipcHasharraySave(const LIPCha* ha, int fd) {
+    (void)ha;
+    (void)fd;
+    return LIPC_ERROR_OPERATION_NOT_SUPPORTED;
+}
+
+LIPCha* LipcHasharrayRestore(LIPC* lipc, int fd) {
+    (void)lipc;
+    (void)fd;
+    return NULL;
+}
+
+LIPCcode LipcHasharrayToString(const LIPCha* ha, char* str, size_t* size) {
+    const SimHasharray* h = static_cast<const SimHasharray*>(ha);
+    if (!h || !size) return LIPC_ERROR_INVALID_ARG;
+    std::ostringstream out;
+    for (size_t i = 0; i < h->hashes.size(); i++) {
+        out << "{ ";
+        for (std::map<std::string, HaValue>::const_iterator it = h->hashes[i].begin(); it != h->hashes[i].end(); ++it) {
+            out << it->first << " = ";
+            if (it->second.type == LIPC_HASHARRAY_INT) out << it->second.int_value;
+            else if (it->second.type == LIPC_HASHARRAY_STRING) out << '"' << it->second.string_value << '"';
+            else out << "<blob " << it->second.string_value.size() << ">";
+            out << ", ";
+        }
+        out << "} ";
+    }
+    std::string text = out.str();
+    if (!str || *size < text.size() + 1) {
+        *size = text.size() + 1;
+        return LIPC_ERROR_BUFFER_TOO_SMALL;
+    }
+    memcpy(str, text.c_str(), text.size() + 1);
+    *size = text.size() + 1;
+    return LIPC_OK;
+}
+
+// =================================================================================
+// Events
+// =================================================================================
+
+LIPCevent* LipcNewEvent(LIPC* handle, const char* name) {
+    SimLipc* lipc = static_cast<SimLipc*>(handle);
+    if (!lipc || lipc->service.empty() || !name) return NULL;
+    return new_event(lipc->service.c_str(), name);
+}
+
+void LipcEventFree(LIPCevent* event) {
+    delete static_cast<SimEvent*>(event);
+}
+
+LIPCcode LipcSendEvent(LIPC* lipc, LIPCevent* event) {
+    if (!lipc || !event) return LIPC_ERROR_INVALID_ARG;
+    dispatch(static_cast<SimEvent*>(event));
+    return LIPC_OK;
+}
+
+LIPCcode LipcCreateAndSendEvent(LIPC* lipc, const char* name) {
+    return LipcCreateAndSendEventWithParameters(lipc, name, "");
+}
+
+LIPCcode LipcCreateAndSendEventWithVAListParameters(LIPC* lipc, const char* name, const char* format, va_list ap) {
+    SimEvent* event = static_cast<SimEvent*>(LipcNewEvent(lipc, name));
+    if (!event) return LIPC_ERROR_INVALID_ARG;
+    for (const char* p = format; p && *p; p++) {
+        if (*p != '%') continue;
+        if (strncmp(p + 1, ".0", 2) == 0) p += 2;
+        if (p[1] == 'd') LipcAddIntParam(event, va_arg(ap, int));
+        else if (p[1] == 's') LipcAddStringParam(event, va_arg(ap, const char*));
+    }
+    LIPCcode code = LipcSendEvent(lipc, event);
+    LipcEventFree(event);
+    return code;
+}
+
+LIPCcode LipcCreateAndSendEventWithParameters(LIPC* lipc, const char* name, const char* format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    LIPCcode code = LipcCreateAndSendEventWithVAListParameters(lipc, name, format, ap);
+    va_end(ap);
+    return code;
+}
+
+const char* LipcGetEventSource(LIPCevent* event) {
+    return static_cast<SimEvent*>(event)->source.c_str();
+}
+
+const char* LipcGetEventName(LIPCevent* event) {
+    return static_cast<SimEvent*>(event)->name.c_str();
+}
+
+LIPCcode LipcGetIntParam(LIPCevent* handle, int* value) {
+    SimEvent* event = static_cast<SimEvent*>(handle);
+    if (event->next_param >= event->params.size() || event->params[event->next_param].is_string) {
+        return LIPC_ERROR_NO_SUCH_PARAM;
+    }
+    *value = event->params[event->next_param++].int_value;
+    return LIPC_OK;
+}
+
+LIPCcode LipcAddIntParam(LIPCevent* handle, int value) {
+    EventParam p;
+    p.is_string = false;
+    p.int_value = value;
+    static_cast<SimEvent*>(handle)->params.push_back(p);
+    return LIPC_OK;
+}
+
+LIPCcode LipcGetStringParam(LIPCevent* handle, char** value) {
+    SimEvent* event = static_cast<SimEvent*>(handle);
+    if (event->next_param >= event->params.size()) return LIPC_ERROR_NO_SUCH_PARAM;
+    *value = const_cast<char*>(event->params[event->next_param++].string_value.c_str());
+    return LIPC_OK;
+}
+
+LIPCcode LipcAddStringParam(LIPCevent* handle, const char* value) {
+    EventParam p;
+    p.is_string = true;
+    p.int_value = 0;
+    p.string_value = value ? value : "";
+    static_cast<SimEvent*>(handle)->params.push_back(p);
+    return LIPC_OK;
+}
+
+LIPCcode LipcRewindParams(LIPCevent* event) {
+    static_cast<SimEvent*>(event)->next_param = 0;
+    return LIPC_OK;
+}
+
+LIPCcode LipcSetEventCallback(LIPC* handle, LipcEventCallback callback) {
+    SimLipc* lipc = static_cast<SimLipc*>(handle);
+    if (!lipc) return LIPC_ERROR_INVALID_ARG;
+    lipc->default_callback = callback;
+    return LIPC_OK;
+}
+
+LIPCcode LipcSubscribe(LIPC* lipc, const char* service) {
+    return LipcSubscribeExt(lipc, service, NULL, NULL, NULL);
+}
+
+LIPCcode LipcSubscribeExt(LIPC* handle, const char* service, const char* name,
+                          LipcEventCallback callback, void* data) {
+    SimLipc* lipc = static_cast<SimLipc*>(handle);
+    if (!lipc || !service) return LIPC_ERROR_INVALID_ARG;
+    Subscription s;
+    s.lipc = lipc;
+    s.service = service;
+    s.name = name ? name : "";
+    s.callback = callback;
+    s.data = data;
+    record("subscribe", service, name);
+    std::lock_guard<std::mutex> guard(sim_lock);
+    subscriptions.push_back(s);
+    return LIPC_OK;
+}
+
+LIPCcode LipcUnsubscribeExt(LIPC* handle, const char* service, const char* name, void** data) {
+    SimLipc* lipc = static_cast<SimLipc*>(handle);
+    if (!lipc || !service) return LIPC_ERROR_INVALID_ARG;
+    std::lock_guard<std::mutex> guard(sim_lock);
+    for (size_t i = 0; i < subscriptions.size(); i++) {
+        const Subscription& s = subscriptions[i];
+        bool match = s.lipc == lipc && s.service == service &&
+                     (name ? s.name == name : s.callback == NULL);
+        if (match) {
+            if (data) *data = s.data;
+            subscriptions.erase(subscriptions.begin() + i);
+            return LIPC_OK;
+        }
+    }
+    return LIPC_ERROR_NO_SUCH_SOURCE;
+}
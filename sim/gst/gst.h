@@ -0,0 +1,112 @@
+#ifndef SIM_GST_H
+#define SIM_GST_H
+
+/*
+ * Desktop simulation: the subset of the GStreamer 0.10 API used by
+ * music_backend.cpp, implemented in-process by sim/sim_gst.cpp.
+ *
+ * gst_parse_launch() understands the backend's own pipeline only: a filesrc
+ * reading the PCM pipe, the raw caps (rate, channels) and a sink. The sink
+ * is a thread that drains the pipe at the real-time rate, optionally copying
+ * the PCM to LARK_SIM_PCM (a file or a FIFO read by e.g. aplay), so the
+ * decoder sees the same back-pressure as with mixersink on the device.
+ *
+ * Not a general GStreamer replacement; only built into larkplayer-sim.
+ */
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef guint64 GstClockTime;
+
+#define GST_CLOCK_TIME_NONE ((GstClockTime)-1)
+#define GST_CLOCK_TIME_IS_VALID(time) (((GstClockTime)(time)) != GST_CLOCK_TIME_NONE)
+
+#define GST_SECOND ((GstClockTime)G_USEC_PER_SEC * G_GINT64_CONSTANT(1000))
+#define GST_MSECOND (GST_SECOND / G_GINT64_CONSTANT(1000))
+#define GST_USECOND (GST_SECOND / G_GINT64_CONSTANT(1000000))
+
+typedef struct _GstElement GstElement;
+typedef struct _GstBus GstBus;
+typedef struct _GstClock GstClock;
+typedef struct _GstMessage GstMessage;
+
+typedef enum {
+    GST_STATE_VOID_PENDING = 0,
+    GST_STATE_NULL = 1,
+    GST_STATE_READY = 2,
+    GST_STATE_PAUSED = 3,
+    GST_STATE_PLAYING = 4,
+} GstState;
+
+typedef enum {
+    GST_STATE_CHANGE_FAILURE = 0,
+    GST_STATE_CHANGE_SUCCESS = 1,
+    GST_STATE_CHANGE_ASYNC = 2,
+    GST_STATE_CHANGE_NO_PREROLL = 3,
+} GstStateChangeReturn;
+
+typedef enum {
+    GST_FORMAT_UNDEFINED = 0,
+    GST_FORMAT_DEFAULT = 1,
+    GST_FORMAT_BYTES = 2,
+    GST_FORMAT_TIME = 3,
+} GstFormat;
+
+typedef enum {
+    GST_MESSAGE_UNKNOWN = 0,
+    GST_MESSAGE_EOS = (1 << 0),
+    GST_MESSAGE_ERROR = (1 << 1),
+    GST_MESSAGE_STREAM_STATUS = (1 << 13),
+} GstMessageType;
+
+typedef enum {
+    GST_STREAM_STATUS_TYPE_CREATE = 0,
+    GST_STREAM_STATUS_TYPE_ENTER = 1,
+    GST_STREAM_STATUS_TYPE_LEAVE = 2,
+    GST_STREAM_STATUS_TYPE_DESTROY = 3,
+} GstStreamStatusType;
+
+typedef enum {
+    GST_BUS_DROP = 0,
+    GST_BUS_PASS = 1,
+    GST_BUS_ASYNC = 2,
+} GstBusSyncReply;
+
+struct _GstMessage {
+    GstMessageType type;
+    GstStreamStatusType status;
+    GstElement *owner;
+    GError *error;
+};
+
+#define GST_MESSAGE_TYPE(message) (((GstMessage *)(message))->type)
+
+typedef gboolean (*GstBusFunc)(GstBus *bus, GstMessage *message, gpointer data);
+typedef GstBusSyncReply (*GstBusSyncHandler)(GstBus *bus, GstMessage *message, gpointer data);
+
+void gst_init(int *argc, char **argv[]);
+
+GstElement *gst_parse_launch(const gchar *pipeline_description, GError **error);
+
+GstStateChangeReturn gst_element_set_state(GstElement *element, GstState state);
+GstBus *gst_element_get_bus(GstElement *element);
+GstClock *gst_element_get_clock(GstElement *element);
+GstClockTime gst_element_get_base_time(GstElement *element);
+gboolean gst_element_query_duration(GstElement *element, GstFormat *format, gint64 *duration);
+gchar *gst_element_get_name(GstElement *element);
+
+GstClockTime gst_clock_get_time(GstClock *clock);
+
+guint gst_bus_add_watch(GstBus *bus, GstBusFunc func, gpointer user_data);
+void gst_bus_set_sync_handler(GstBus *bus, GstBusSyncHandler func, gpointer data);
+
+void gst_message_parse_error(GstMessage *message, GError **gerror, gchar **debug);
+void gst_message_parse_stream_status(GstMessage *message, GstStreamStatusType *type, GstElement **owner);
+
+void gst_object_unref(gpointer object);
+
+G_END_DECLS
+
+#endif /* SIM_GST_H */
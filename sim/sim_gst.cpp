@@ -0,0 +1,426 @@
+// Desktop simulation of the GStreamer 0.10 subset declared in sim/gst/gst.h.
+//
+// The pipeline is "filesrc location=<pipe> ! caps ! ... ! <sink>": a sink
+// thread drains the PCM pipe at the real-time byte rate of the caps, with
+// SIM_SINK_BUFFER_MS of audio read ahead like the device's queue. Clock and
+// base time follow GStreamer: the base time is set when the first data
+// arrives (preroll) and moved on resume so that running time excludes
+// pauses. EOS is posted when the writer closes the pipe.
+
+#include <gst/gst.h>
+#include "logger.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+
+// Audio read ahead of the clock (the device pipeline has a queue)
+#define SIM_SINK_BUFFER_MS 200
+#define SIM_SINK_POLL_MS 100
+#define SIM_SINK_IDLE_US 5000
+#define SIM_BUS_DISPATCH_MS 20
+
+enum SimObjectKind { SIM_CLOCK, SIM_BUS, SIM_ELEMENT };
+
+struct SimObject {
+    SimObjectKind kind;
+    std::atomic<int> refs;
+};
+
+struct _GstClock {
+    SimObject object;
+};
+
+struct _GstBus {
+    SimObject object;
+    std::mutex lock;
+    std::deque<GstMessage*> queue;
+    GstBusSyncHandler sync_handler;
+    gpointer sync_data;
+};
+
+struct _GstElement {
+    SimObject object;
+    std::string name;
+    std::string location;
+    int rate;
+    int channels;
+    GstBus* bus;
+
+    // Timing, under lock
+    std::mutex lock;
+    bool playing;
+    bool prerolled;
+    GstClockTime base_time;       // GST_CLOCK_TIME_NONE until prerolled and playing
+    GstClockTime paused_running;  // running time when last paused
+
+    pthread_t thread;
+    bool thread_started;
+    std::atomic<bool> stop;
+};
+
+static GstClock system_clock;
+
+static GstClockTime now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (GstClockTime)ts.tv_sec * GST_SECOND + (GstClockTime)ts.tv_nsec;
+}
+
+static void sim_object_init(SimObject* object, SimObjectKind kind) {
+    object->kind = kind;
+    object->refs = 1;
+}
+
+// =================================================================================
+// Bus
+// =================================================================================
+
+static GstBus* bus_new() {
+    GstBus* bus = new GstBus;
+    sim_object_init(&bus->object, SIM_BUS);
+    bus->sync_handler = NULL;
+    bus->sync_data = NULL;
+    return bus;
+}
+
+static void message_free(GstMessage* message) {
+    if (message->error) g_error_free(message->error);
+    delete message;
+}
+
+static void bus_free(GstBus* bus) {
+    for (size_t i = 0; i < bus->queue.size(); i++) message_free(bus->queue[i]);
+    delete bus;
+}
+
+// Any thread: the sync handler runs in the caller, the watch on the main loop
+static void bus_post(GstBus* bus, GstMessage* message) {
+    GstBusSyncReply reply = GST_BUS_PASS;
+    if (bus->sync_handler) reply = bus->sync_handler(bus, message, bus->sync_data);
+    if (reply == GST_BUS_DROP) {
+        message_free(message);
+        return;
+    }
+    std::lock_guard<std::mutex> guard(bus->lock);
+    bus->queue.push_back(message);
+}
+
+static GstMessage* message_new(GstMessageType type, GstElement* owner) {
+    GstMessage* message = new GstMessage;
+    message->type = type;
+    message->status = GST_STREAM_STATUS_TYPE_CREATE;
+    message->owner = owner;
+    message->error = NULL;
+    return message;
+}
+
+struct BusWatch {
+    GstBus* bus;
+    GstBusFunc func;
+    gpointer data;
+};
+
+static gboolean bus_dispatch_cb(gpointer data) {
+    BusWatch* watch = static_cast<BusWatch*>(data);
+    while (true) {
+        GstMessage* message = NULL;
+        {
+            std::lock_guard<std::mutex> guard(watch->bus->lock);
+            if (watch->bus->queue.empty()) break;
+            message = watch->bus->queue.front();
+            watch->bus->queue.pop_front();
+        }
+        gboolean keep = watch->func(watch->bus, message, watch->data);
+        message_free(message);
+        if (!keep) return FALSE;
+    }
+    return TRUE;
+}
+
+static void bus_watch_free(gpointer data) {
+    BusWatch* watch = static_cast<BusWatch*>(data);
+    gst_object_unref(watch->bus);
+    delete watch;
+}
+
+guint gst_bus_add_watch(GstBus* bus, GstBusFunc func, gpointer user_data) {
+    BusWatch* watch = new BusWatch;
+    watch->bus = bus;
+    watch->func = func;
+    watch->data = user_data;
+    bus->object.refs++;
+    return g_timeout_add_full(G_PRIORITY_DEFAULT, SIM_BUS_DISPATCH_MS, bus_dispatch_cb, watch, bus_watch_free);
+}
+
+void gst_bus_set_sync_handler(GstBus* bus, GstBusSyncHandler func, gpointer data) {
+    std::lock_guard<std::mutex> guard(bus->lock);
+    bus->sync_handler = func;
+    bus->sync_data = data;
+}
+
+void gst_message_parse_error(GstMessage* message, GError** gerror, gchar** debug) {
+    if (gerror) *gerror = message->error ? g_error_copy(message->error) : NULL;
+    if (debug) *debug = NULL;
+}
+
+void gst_message_parse_stream_status(GstMessage* message, GstStreamStatusType* type, GstElement** owner) {
+    if (type) *type = message->status;
+    if (owner) *owner = message->owner;
+}
+
+// =================================================================================
+// Sink
+// =================================================================================
+
+static GstClockTime running_time(GstElement* element) {
+    std::lock_guard<std::mutex> guard(element->lock);
+    if (element->playing && GST_CLOCK_TIME_IS_VALID(element->base_time)) {
+        return now_ns() - element->base_time;
+    }
+    return element->paused_running;
+}
+
+static void post_error(GstElement* element, const char* text) {
+    GstMessage* message = message_new(GST_MESSAGE_ERROR, element);
+    message->error = g_error_new_literal(g_quark_from_static_string("sim-gst"), 1, text);
+    bus_post(element->bus, message);
+}
+
+static void* sink_thread_func(void* arg) {
+    GstElement* element = static_cast<GstElement*>(arg);
+
+    GstMessage* status = message_new(GST_MESSAGE_STREAM_STATUS, element);
+    status->status = GST_STREAM_STATUS_TYPE_ENTER;
+    bus_post(element->bus, status);
+
+    // Non-blocking: no writer yet reads as empty, not as the end
+    int fd = open(element->location.c_str(), O_RDONLY | O_NONBLOCK);
+    if (fd == -1) {
+        LOG_E("SimGst: cannot open %s: %s\n", element->location.c_str(), strerror(errno));
+        post_error(element, "Could not open resource for reading.");
+        return NULL;
+    }
+
+    int tee = -1;
+    const char* tee_path = getenv("LARK_SIM_PCM");
+    if (tee_path && tee_path[0]) {
+        tee = open(tee_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (tee == -1) LOG_W("SimGst: cannot open LARK_SIM_PCM %s: %s\n", tee_path, strerror(errno));
+    }
+
+    const uint64_t byte_rate = (uint64_t)element->rate * element->channels * sizeof(int16_t);
+    const uint64_t ahead = byte_rate * SIM_SINK_BUFFER_MS / 1000;
+    uint64_t consumed = 0;
+    char buf[16384];
+
+    while (!element->stop) {
+        uint64_t allowed = running_time(element) * byte_rate / GST_SECOND + ahead;
+        bool paused;
+        {
+            std::lock_guard<std::mutex> guard(element->lock);
+            paused = element->prerolled && !element->playing;
+        }
+        if (paused || consumed >= allowed) {
+            usleep(SIM_SINK_IDLE_US);
+            continue;
+        }
+
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, SIM_SINK_POLL_MS);
+        if (ready <= 0) continue;
+        if (pfd.revents & POLLIN) {
+            size_t want = allowed - consumed < sizeof(buf) ? (size_t)(allowed - consumed) : sizeof(buf);
+            ssize_t n = read(fd, buf, want);
+            if (n > 0) {
+                consumed += (uint64_t)n;
+                if (tee != -1 && write(tee, buf, (size_t)n) != n) {
+                    close(tee);
+                    tee = -1;
+                }
+                std::lock_guard<std::mutex> guard(element->lock);
+                if (!element->prerolled) {
+                    element->prerolled = true;
+                    if (element->playing) element->base_time = now_ns() - element->paused_running;
+                }
+                continue;
+            }
+            if (n == -1 && (errno == EINTR || errno == EAGAIN)) continue;
+        } else if (!(pfd.revents & POLLHUP)) {
+            continue;
+        }
+
+        // The writer closed the pipe and everything was read: EOS once the
+        // read-ahead has played
+        while (!element->stop && running_time(element) * byte_rate / GST_SECOND < consumed) {
+            usleep(SIM_SINK_IDLE_US);
+        }
+        if (!element->stop) bus_post(element->bus, message_new(GST_MESSAGE_EOS, element));
+        break;
+    }
+
+    close(fd);
+    if (tee != -1) close(tee);
+    return NULL;
+}
+
+static void sink_stop(GstElement* element) {
+    if (!element->thread_started) return;
+    element->stop = true;
+    pthread_join(element->thread, NULL);
+    element->thread_started = false;
+}
+
+// =================================================================================
+// Element and pipeline
+// =================================================================================
+
+void gst_init(int* argc, char** argv[]) {
+    (void)argc;
+    (void)argv;
+    sim_object_init(&system_clock.object, SIM_CLOCK);
+}
+
+static bool parse_int(const std::string& desc, const char* key, int* value) {
+    size_t pos = desc.find(key);
+    if (pos == std::string::npos) return false;
+    *value = atoi(desc.c_str() + pos + strlen(key));
+    return *value > 0;
+}
+
+GstElement* gst_parse_launch(const gchar* pipeline_description, GError** error) {
+    std::string desc = pipeline_description;
+    GstElement* element = new GstElement;
+    sim_object_init(&element->object, SIM_ELEMENT);
+
+    size_t pos = desc.find("location=\"");
+    if (pos != std::string::npos) {
+        size_t start = pos + strlen("location=\"");
+        size_t end = desc.find('"', start);
+        if (end != std::string::npos) element->location = desc.substr(start, end - start);
+    }
+    if (!parse_int(desc, "rate=", &element->rate)) element->rate = 44100;
+    if (!parse_int(desc, "channels=", &element->channels)) element->channels = 2;
+
+    // The sink is the last element of the chain
+    size_t bang = desc.rfind('!');
+    std::string sink = desc.substr(bang == std::string::npos ? 0 : bang + 1);
+    sink.erase(0, sink.find_first_not_of(' '));
+    sink = sink.substr(0, sink.find(' '));
+    element->name = sink + "0";
+
+    if (element->location.empty()) {
+        if (error) *error = g_error_new_literal(g_quark_from_static_string("sim-gst"), 1, "no filesrc location");
+        delete element;
+        return NULL;
+    }
+
+    element->bus = bus_new();
+    element->playing = false;
+    element->prerolled = false;
+    element->base_time = GST_CLOCK_TIME_NONE;
+    element->paused_running = 0;
+    element->thread_started = false;
+    element->stop = false;
+    LOG_I("SimGst: %s reading %s at %d Hz, %d channels\n", element->name.c_str(),
+          element->location.c_str(), element->rate, element->channels);
+    return element;
+}
+
+GstStateChangeReturn gst_element_set_state(GstElement* element, GstState state) {
+    if (state == GST_STATE_NULL || state == GST_STATE_READY) {
+        // Closes the pipe: the decoder's next write fails with EPIPE
+        sink_stop(element);
+        std::lock_guard<std::mutex> guard(element->lock);
+        element->playing = false;
+        element->prerolled = false;
+        element->base_time = GST_CLOCK_TIME_NONE;
+        element->paused_running = 0;
+        return GST_STATE_CHANGE_SUCCESS;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(element->lock);
+        GstClockTime now = now_ns();
+        if (state == GST_STATE_PLAYING && !element->playing) {
+            element->playing = true;
+            if (element->prerolled) element->base_time = now - element->paused_running;
+        } else if (state == GST_STATE_PAUSED && element->playing) {
+            if (GST_CLOCK_TIME_IS_VALID(element->base_time)) {
+                element->paused_running = now - element->base_time;
+            }
+            element->playing = false;
+        }
+    }
+
+    if (!element->thread_started) {
+        element->stop = false;
+        if (pthread_create(&element->thread, NULL, sink_thread_func, element) != 0) {
+            LOG_E("SimGst: cannot start the sink thread: %s\n", strerror(errno));
+            return GST_STATE_CHANGE_FAILURE;
+        }
+        element->thread_started = true;
+    }
+    return GST_STATE_CHANGE_ASYNC;
+}
+
+GstBus* gst_element_get_bus(GstElement* element) {
+    element->bus->object.refs++;
+    return element->bus;
+}
+
+GstClock* gst_element_get_clock(GstElement* element) {
+    (void)element;
+    system_clock.object.refs++;
+    return &system_clock;
+}
+
+GstClockTime gst_element_get_base_time(GstElement* element) {
+    std::lock_guard<std::mutex> guard(element->lock);
+    return element->base_time;
+}
+
+gboolean gst_element_query_duration(GstElement* element, GstFormat* format, gint64* duration) {
+    // A raw stream from a pipe has no known duration
+    (void)element;
+    (void)format;
+    (void)duration;
+    return FALSE;
+}
+
+gchar* gst_element_get_name(GstElement* element) {
+    return g_strdup(element->name.c_str());
+}
+
+GstClockTime gst_clock_get_time(GstClock* clock) {
+    (void)clock;
+    return now_ns();
+}
+
+void gst_object_unref(gpointer object) {
+    SimObject* sim = static_cast<SimObject*>(object);
+    if (--sim->refs > 0) return;
+    switch (sim->kind) {
+        case SIM_CLOCK:
+            break; // static
+        case SIM_BUS:
+            bus_free(reinterpret_cast<GstBus*>(sim));
+            break;
+        case SIM_ELEMENT: {
+            GstElement* element = reinterpret_cast<GstElement*>(sim);
+            sink_stop(element);
+            gst_object_unref(element->bus);
+            delete element;
+            break;
+        }
+    }
+}
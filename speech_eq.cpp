@@ -0,0 +1,136 @@
+#include "speech_eq.h"
+#include "pcm_kernels.h"
+#include <math.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Filter state below this is flushed to zero (avoids denormals in silence)
+#define EQ_DENORMAL_LIMIT 1e-15f
+
+// RBJ audio EQ cookbook designs
+static BiquadCoeffs highpass(double freq, double q, double rate) {
+    double w0 = 2.0 * M_PI * freq / rate;
+    double cosw = cos(w0);
+    double alpha = sin(w0) / (2.0 * q);
+    double a0 = 1.0 + alpha;
+
+    BiquadCoeffs c;
+    c.b0 = (float)((1.0 + cosw) / 2.0 / a0);
+    c.b1 = (float)(-(1.0 + cosw) / a0);
+    c.b2 = c.b0;
+    c.a1 = (float)(-2.0 * cosw / a0);
+    c.a2 = (float)((1.0 - alpha) / a0);
+    return c;
+}
+
+static BiquadCoeffs peaking(double freq, double q, double gain_db, double rate) {
+    double A = pow(10.0, gain_db / 40.0);
+    double w0 = 2.0 * M_PI * freq / rate;
+    double cosw = cos(w0);
+    double alpha = sin(w0) / (2.0 * q);
+    double a0 = 1.0 + alpha / A;
+
+    BiquadCoeffs c;
+    c.b0 = (float)((1.0 + alpha * A) / a0);
+    c.b1 = (float)(-2.0 * cosw / a0);
+    c.b2 = (float)((1.0 - alpha * A) / a0);
+    c.a1 = c.b1;
+    c.a2 = (float)((1.0 - alpha / A) / a0);
+    return c;
+}
+
+// =================================================================================
+// SpeechEq Implementation
+// =================================================================================
+
+SpeechEq::SpeechEq()
+    : requested(EQ_OFF), active(EQ_OFF), active_rate(0), num_stages(0), output_gain(1.0f), neon(false) {
+    reset_state();
+}
+
+void SpeechEq::set_preset(EqPreset preset) {
+    if (preset < EQ_OFF || preset >= EQ_PRESET_COUNT) preset = EQ_OFF;
+    requested.store(preset, std::memory_order_relaxed);
+}
+
+EqPreset SpeechEq::get_preset() const {
+    return (EqPreset)requested.load(std::memory_order_relaxed);
+}
+
+int SpeechEq::design(EqPreset preset, unsigned long samplerate,
+                     BiquadCoeffs* stages, float* output_gain) {
+    double rate = samplerate > 0 ? (double)samplerate : 44100.0;
+    // Presence band must stay below Nyquist for low-rate audiobooks
+    double presence = rate > 12000.0 ? 3000.0 : rate / 4.0;
+
+    switch (preset) {
+        case EQ_SPEECH:
+            stages[0] = highpass(80.0, 0.707, rate);
+            stages[1] = peaking(250.0, 1.0, -2.0, rate);
+            stages[2] = peaking(presence, 0.9, 4.0, rate);
+            *output_gain = 0.79f; // -2 dB headroom for the boost
+            return 3;
+        case EQ_SPEECH_STRONG:
+            stages[0] = highpass(120.0, 0.707, rate);
+            stages[1] = highpass(120.0, 0.707, rate);
+            stages[2] = peaking(300.0, 1.0, -4.0, rate);
+            stages[3] = peaking(presence, 0.8, 6.0, rate);
+            *output_gain = 0.63f; // -4 dB
+            return 4;
+        default:
+            *output_gain = 1.0f;
+            return 0;
+    }
+}
+
+void SpeechEq::reset_state() {
+    memset(z1, 0, sizeof(z1));
+    memset(z2, 0, sizeof(z2));
+}
+
+bool SpeechEq::process(int16_t* pcm, size_t frames, unsigned int channels, unsigned long samplerate) {
+    int preset = requested.load(std::memory_order_relaxed);
+    if (preset != active || samplerate != active_rate) {
+        active = preset;
+        active_rate = samplerate;
+        num_stages = design((EqPreset)preset, samplerate, stages, &output_gain);
+        reset_state();
+        neon = pcm_kernels().isa == PCM_ISA_NEON;
+    }
+    if (num_stages == 0 || channels == 0 || channels > 2) return false;
+
+    if (channels != 2 || !neon || !process_neon_stereo(pcm, frames)) {
+        process_scalar(pcm, frames, channels);
+    }
+
+    for (int s = 0; s < num_stages; s++) {
+        for (int c = 0; c < 2; c++) {
+            if (fabsf(z1[s][c]) < EQ_DENORMAL_LIMIT) z1[s][c] = 0.0f;
+            if (fabsf(z2[s][c]) < EQ_DENORMAL_LIMIT) z2[s][c] = 0.0f;
+        }
+    }
+    return true;
+}
+
+void SpeechEq::process_scalar(int16_t* pcm, size_t frames, unsigned int channels) {
+    for (unsigned int c = 0; c < channels; c++) {
+        int16_t* p = pcm + c;
+        for (size_t i = 0; i < frames; i++, p += channels) {
+            float x = *p;
+            for (int s = 0; s < num_stages; s++) {
+                const BiquadCoeffs& k = stages[s];
+                float y = k.b0 * x + z1[s][c];
+                z1[s][c] = k.b1 * x - k.a1 * y + z2[s][c];
+                z2[s][c] = k.b2 * x - k.a2 * y;
+                x = y;
+            }
+            x *= output_gain;
+            if (x > 32767.0f) x = 32767.0f;
+            if (x < -32768.0f) x = -32768.0f;
+            *p = (int16_t)x;
+        }
+    }
+}
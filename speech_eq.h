@@ -0,0 +1,69 @@
+#ifndef SPEECH_EQ_H
+#define SPEECH_EQ_H
+
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+
+// Speech clarity presets
+enum EqPreset {
+    EQ_OFF = 0,
+    EQ_SPEECH,        // rumble cut, light mud cut, presence boost
+    EQ_SPEECH_STRONG, // for small speakers: steeper low cut, more presence
+    EQ_PRESET_COUNT,
+};
+
+// Transposed direct form II biquad, normalized (a0 == 1)
+struct BiquadCoeffs {
+    float b0, b1, b2;
+    float a1, a2;
+};
+
+// --- SpeechEq Class ---
+// Cascade of biquads applied in place to interleaved 16-bit PCM (mono or
+// stereo). Uses NEON when pcm_kernels() picked the NEON table (so the CPU
+// has it and LARK_SIMD applies), with a scalar fallback.
+//
+// The preset is selected from any thread with set_preset(): it only stores
+// an atomic. The audio thread notices the change at the start of the next
+// process() call and rebuilds its coefficients locally, so the filter never
+// shares mutable state with the GUI.
+class SpeechEq {
+public:
+    static const int MAX_STAGES = 4;
+
+    SpeechEq();
+
+    void set_preset(EqPreset preset);
+    EqPreset get_preset() const;
+    bool enabled() const { return get_preset() != EQ_OFF; }
+
+    // Audio thread only. Returns false (and leaves the PCM untouched) when
+    // the EQ is off.
+    bool process(int16_t* pcm, size_t frames, unsigned int channels, unsigned long samplerate);
+
+    // Design the coefficients of a preset; returns the number of stages.
+    static int design(EqPreset preset, unsigned long samplerate,
+                      BiquadCoeffs* stages, float* output_gain);
+
+private:
+    std::atomic<int> requested;
+
+    // Audio thread state
+    int active;
+    unsigned long active_rate;
+    int num_stages;
+    float output_gain;
+    BiquadCoeffs stages[MAX_STAGES];
+    float z1[MAX_STAGES][2];
+    float z2[MAX_STAGES][2];
+
+    bool neon;
+
+    void reset_state();
+    void process_scalar(int16_t* pcm, size_t frames, unsigned int channels);
+    // speech_eq_neon.cpp, built with NEON enabled; false when it is not
+    bool process_neon_stereo(int16_t* pcm, size_t frames);
+};
+
+#endif // SPEECH_EQ_H
@@ -0,0 +1,64 @@
+#include "speech_eq.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+
+// Both channels of a frame share one float32x2_t, so every stage is a
+// handful of two-lane multiply-accumulates. Two frames are loaded, converted
+// and stored per iteration.
+bool SpeechEq::process_neon_stereo(int16_t* pcm, size_t frames) {
+    float32x2_t s1[MAX_STAGES], s2[MAX_STAGES];
+    for (int s = 0; s < num_stages; s++) {
+        s1[s] = vld1_f32(z1[s]);
+        s2[s] = vld1_f32(z2[s]);
+    }
+    const int n = num_stages;
+    const BiquadCoeffs* k = stages;
+
+#define EQ_CASCADE(x) \
+    for (int s = 0; s < n; s++) { \
+        float32x2_t y = vmla_n_f32(s1[s], x, k[s].b0); \
+        s1[s] = vmla_n_f32(vmls_n_f32(s2[s], y, k[s].a1), x, k[s].b1); \
+        s2[s] = vmls_n_f32(vmul_n_f32(x, k[s].b2), y, k[s].a2); \
+        x = y; \
+    }
+
+    size_t i = 0;
+    for (; i + 2 <= frames; i += 2) {
+        float32x4_t in = vcvtq_f32_s32(vmovl_s16(vld1_s16(pcm + i * 2)));
+        float32x2_t x0 = vget_low_f32(in);
+        float32x2_t x1 = vget_high_f32(in);
+        EQ_CASCADE(x0)
+        EQ_CASCADE(x1)
+        float32x4_t out = vmulq_n_f32(vcombine_f32(x0, x1), output_gain);
+        vst1_s16(pcm + i * 2, vqmovn_s32(vcvtq_s32_f32(out)));
+    }
+    if (i < frames) {
+        int16x4_t last = vdup_n_s16(0);
+        last = vld1_lane_s16(pcm + i * 2, last, 0);
+        last = vld1_lane_s16(pcm + i * 2 + 1, last, 1);
+        float32x2_t x0 = vget_low_f32(vcvtq_f32_s32(vmovl_s16(last)));
+        EQ_CASCADE(x0)
+        float32x4_t out = vmulq_n_f32(vcombine_f32(x0, x0), output_gain);
+        int16x4_t o = vqmovn_s32(vcvtq_s32_f32(out));
+        vst1_lane_s16(pcm + i * 2, o, 0);
+        vst1_lane_s16(pcm + i * 2 + 1, o, 1);
+    }
+#undef EQ_CASCADE
+
+    for (int s = 0; s < num_stages; s++) {
+        vst1_f32(z1[s], s1[s]);
+        vst1_f32(z2[s], s2[s]);
+    }
+    return true;
+}
+
+#else
+
+bool SpeechEq::process_neon_stereo(int16_t* pcm, size_t frames) {
+    (void)pcm;
+    (void)frames;
+    return false;
+}
+
+#endif
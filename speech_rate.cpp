@@ -0,0 +1,181 @@
+#include "speech_rate.h"
+#include "clip_decoder.h"
+#include "logger.h"
+#include "playback_metrics.h"
+#include "worker_pool.h"
+#include <math.h>
+
+#include <algorithm>
+
+// Vowel formant band (F1 and the lower F2): centre and Q of the band-pass
+#define SPEECH_RATE_BAND_HZ 950.0
+#define SPEECH_RATE_BAND_Q 0.5
+
+// =================================================================================
+// SpeechRateMeter Implementation
+// =================================================================================
+
+SpeechRateMeter::SpeechRateMeter(unsigned long rate)
+    : rate(rate > 0 ? rate : 44100), x1(0), x2(0), y1(0), y2(0), hop_energy(0), hop_fill(0),
+      syllable_count(0), speech_hops(0) {
+    hop_frames = this->rate * SPEECH_RATE_HOP_MS / 1000;
+    if (hop_frames < 1) hop_frames = 1;
+
+    // RBJ band-pass, 0 dB peak gain
+    double w0 = 2.0 * M_PI * SPEECH_RATE_BAND_HZ / this->rate;
+    double alpha = sin(w0) / (2.0 * SPEECH_RATE_BAND_Q);
+    double a0 = 1.0 + alpha;
+    b0 = (float)(alpha / a0);
+    b2 = (float)(-alpha / a0);
+    a1 = (float)(-2.0 * cos(w0) / a0);
+    a2 = (float)((1.0 - alpha) / a0);
+}
+
+void SpeechRateMeter::feed(const int16_t* pcm, size_t frames) {
+    for (size_t i = 0; i < frames; i++) {
+        float x = (pcm[2 * i] + pcm[2 * i + 1]) * (0.5f / 32768.0f);
+        float y = b0 * x + b2 * x2 - a1 * y1 - a2 * y2;
+        x2 = x1;
+        x1 = x;
+        y2 = y1;
+        y1 = y;
+        hop_energy += y * y;
+        if (++hop_fill == hop_frames) {
+            envelope.push_back(10.0f * log10f((float)(hop_energy / hop_frames) + 1e-10f));
+            hop_energy = 0;
+            hop_fill = 0;
+        }
+    }
+}
+
+void SpeechRateMeter::finish_region() {
+    size_t n = envelope.size();
+    x1 = x2 = y1 = y2 = 0;
+    hop_energy = 0;
+    hop_fill = 0;
+    if (n < 3) {
+        envelope.clear();
+        return;
+    }
+
+    // Moving average: one peak per syllable, not per pitch period
+    smoothed.resize(n);
+    const size_t half = SPEECH_RATE_SMOOTH_HOPS / 2;
+    for (size_t i = 0; i < n; i++) {
+        size_t from = i > half ? i - half : 0;
+        size_t to = i + half + 1 < n ? i + half + 1 : n;
+        float sum = 0;
+        for (size_t k = from; k < to; k++) sum += envelope[k];
+        smoothed[i] = sum / (to - from);
+    }
+
+    // Gate relative to the loud speech of the region (95th percentile),
+    // so that the recording level does not matter
+    envelope.assign(smoothed.begin(), smoothed.end());
+    std::nth_element(envelope.begin(), envelope.begin() + n * 95 / 100, envelope.end());
+    float gate = envelope[n * 95 / 100] - SPEECH_RATE_GATE_DB;
+
+    const size_t spacing = SPEECH_RATE_MIN_SPACING_MS / SPEECH_RATE_HOP_MS;
+    const size_t pause = SPEECH_RATE_PAUSE_MS / SPEECH_RATE_HOP_MS;
+    float dip = smoothed[0];
+    long last_peak = -1;
+    float last_value = 0;
+    long last_speech = -1;
+    for (size_t i = 1; i + 1 < n; i++) {
+        float v = smoothed[i];
+        if (v < dip) dip = v;
+
+        // Speech time: voiced hops and the short gaps between them
+        if (v > gate) {
+            if (last_speech >= 0 && i - (size_t)last_speech <= pause) speech_hops += i - last_speech;
+            else speech_hops++;
+            last_speech = (long)i;
+        }
+
+        if (v <= gate || v < smoothed[i - 1] || v <= smoothed[i + 1]) continue;
+        if (last_peak >= 0 && i - (size_t)last_peak < spacing) {
+            // Same nucleus: keep the higher peak
+            if (v > last_value) {
+                last_peak = (long)i;
+                last_value = v;
+            }
+            continue;
+        }
+        if (v - dip < SPEECH_RATE_PROMINENCE_DB) continue;
+        syllable_count++;
+        last_peak = (long)i;
+        last_value = v;
+        dip = v;
+    }
+    envelope.clear();
+}
+
+double SpeechRateMeter::words_per_minute() const {
+    double seconds = speech_seconds();
+    if (seconds <= 0 || syllable_count == 0) return 0.0;
+    return syllable_count * 60.0 / seconds / SPEECH_RATE_SYLLABLES_PER_WORD;
+}
+
+// =================================================================================
+// Book analysis
+// =================================================================================
+
+bool analyze_speech_rate(const char* path, SpeechRate* result) {
+    uint64_t start_us = metrics_now_us();
+    ClipDecoder clip;
+    if (!clip.open(path)) return false;
+
+    Mp4Index& index = clip.index();
+    unsigned long rate = clip.samplerate() > 0 ? clip.samplerate() : index.samplerate();
+    uint32_t spf = index.samples_per_frame();
+    if (rate == 0 || spf == 0 || index.frame_count() == 0) return false;
+
+    // Regions spread evenly over the book minus its edges; short books are
+    // analysed whole
+    uint32_t region = (uint32_t)((uint64_t)SPEECH_RATE_REGION_SECONDS * rate / spf);
+    uint32_t first = (uint32_t)((uint64_t)index.frame_count() * SPEECH_RATE_EDGE_PERCENT / 100);
+    uint32_t last = index.frame_count() - first;
+    uint32_t span = last - first;
+    int regions = SPEECH_RATE_REGIONS;
+    if ((uint64_t)region * regions >= span) {
+        regions = 1;
+        region = span;
+    }
+
+    SpeechRateMeter meter(rate);
+    uint64_t decoded = 0;
+    for (int r = 0; r < regions; r++) {
+        uint32_t start = first + (regions > 1 ? (uint32_t)((uint64_t)(span - region) * r / (regions - 1)) : 0);
+        if (!WorkerPool::checkpoint()) return false;
+        if (!clip.seek(start)) break;
+        for (uint32_t f = 0; f < region; f++) {
+            const int16_t* pcm;
+            size_t frames;
+            if (!clip.decode(&pcm, &frames)) break;
+            meter.feed(pcm, frames);
+            decoded += frames;
+            if ((f & 63) == 63 && !WorkerPool::checkpoint()) return false;
+        }
+        meter.finish_region();
+    }
+
+    double elapsed = (metrics_now_us() - start_us) / 1e6;
+    result->wpm = meter.words_per_minute();
+    result->speech_seconds = meter.speech_seconds();
+    result->audio_seconds = (double)decoded / rate;
+    result->realtime_factor = elapsed > 0 ? result->audio_seconds / elapsed : 0.0;
+    LOG_I("SpeechRate: %s: %.0f wpm over %.0f s of speech (%lu syllables, %.0fx realtime)\n",
+          path, result->wpm, result->speech_seconds, meter.syllables(), result->realtime_factor);
+    if (clip.errors() > 0) {
+        LOG_W("SpeechRate: %lu frames failed to decode\n", clip.errors());
+    }
+    return result->wpm > 0;
+}
+
+float speed_for_target_wpm(double narrator_wpm, int target_wpm) {
+    if (narrator_wpm <= 0 || target_wpm <= 0) return 1.0f;
+    float speed = (float)(target_wpm / narrator_wpm);
+    if (speed < SPEECH_RATE_MIN_SPEED) speed = SPEECH_RATE_MIN_SPEED;
+    if (speed > SPEECH_RATE_MAX_SPEED) speed = SPEECH_RATE_MAX_SPEED;
+    return speed;
+}
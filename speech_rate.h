@@ -0,0 +1,81 @@
+#ifndef SPEECH_RATE_H
+#define SPEECH_RATE_H
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+// Regions decoded across the book, skipping the credits at both ends
+#define SPEECH_RATE_REGIONS 12
+#define SPEECH_RATE_REGION_SECONDS 20
+#define SPEECH_RATE_EDGE_PERCENT 5
+
+// Syllable nuclei: peaks of the vowel band energy envelope
+#define SPEECH_RATE_HOP_MS 10
+#define SPEECH_RATE_SMOOTH_HOPS 5
+#define SPEECH_RATE_MIN_SPACING_MS 100
+#define SPEECH_RATE_PROMINENCE_DB 3.0f
+// Peaks this far below the loud speech of a region are noise or breaths
+#define SPEECH_RATE_GATE_DB 20.0f
+// Silences longer than this (paragraphs, chapter breaks) are not speech time
+#define SPEECH_RATE_PAUSE_MS 600
+// English narration averages about 1.5 syllables per word
+#define SPEECH_RATE_SYLLABLES_PER_WORD 1.5
+
+// Target words per minute mode: the speed is clamped to this range
+#define SPEECH_RATE_MIN_SPEED 0.75f
+#define SPEECH_RATE_MAX_SPEED 2.0f
+
+// --- SpeechRateMeter Class ---
+// Counts syllable nuclei in speech. The mono mix is band-passed to the
+// vowel formant band, its energy taken every SPEECH_RATE_HOP_MS and
+// smoothed; a nucleus is an envelope peak above the region's gate that
+// rises SPEECH_RATE_PROMINENCE_DB over the dip before it, at least
+// SPEECH_RATE_MIN_SPACING_MS after the previous one.
+class SpeechRateMeter {
+public:
+    explicit SpeechRateMeter(unsigned long rate);
+
+    // Interleaved stereo of the current region
+    void feed(const int16_t* pcm, size_t frames);
+    // Count the region's nuclei; the next feed() starts a new region
+    void finish_region();
+
+    unsigned long syllables() const { return syllable_count; }
+    double speech_seconds() const { return speech_hops * SPEECH_RATE_HOP_MS / 1000.0; }
+    double words_per_minute() const;
+
+private:
+    unsigned long rate;
+    size_t hop_frames;
+    // Band-pass biquad (direct form I) and its state
+    float b0, b2, a1, a2;
+    float x1, x2, y1, y2;
+    double hop_energy;
+    size_t hop_fill;
+    std::vector<float> envelope; // dB per hop of the current region
+    std::vector<float> smoothed;
+
+    unsigned long syllable_count;
+    unsigned long speech_hops;
+};
+
+// Result of the analysis of a book
+struct SpeechRate {
+    double wpm;              // 0 if no speech was found
+    double speech_seconds;   // speech time the rate was measured on
+    double audio_seconds;    // audio decoded
+    double realtime_factor;  // audio seconds analysed per second of wall time
+};
+
+// Decode SPEECH_RATE_REGIONS regions of the book with a ClipDecoder and
+// measure the narrator's rate. For worker tasks: calls
+// WorkerPool::checkpoint() between frames and returns false when
+// cancelled, or when the book cannot be read.
+bool analyze_speech_rate(const char* path, SpeechRate* result);
+
+// Playback speed bringing a narrator to the target rate, within
+// SPEECH_RATE_MIN_SPEED..SPEECH_RATE_MAX_SPEED (1 if the rate is unknown)
+float speed_for_target_wpm(double narrator_wpm, int target_wpm);
+
+#endif // SPEECH_RATE_H
@@ -0,0 +1,64 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <stddef.h>
+
+// --- SpscQueue Class ---
+// Bounded lock-free ring for exactly one producer thread and one consumer
+// thread. push()/pop() never block or allocate; the capacity is rounded up
+// to a power of two.
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity) : head(0), tail(0) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    // Producer only. False if full.
+    bool push(const T& value) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) > mask) return false;
+        slots[t & mask] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. False if empty.
+    bool pop(T* value) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        *value = slots[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Approximate from any other thread
+    size_t size() const {
+        return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_relaxed);
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+    // Only while neither side is running
+    void clear() {
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+    // Written by different threads: keep them on separate cache lines
+    // (padding rather than alignas, which C++11 new does not honor)
+    char pad_head[64];
+    std::atomic<size_t> head;
+    char pad_tail[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail;
+};
+
+#endif // SPSC_QUEUE_H
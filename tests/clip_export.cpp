@@ -0,0 +1,134 @@
+// Tests for the WAV export: a clip decoded in parallel segments must match
+// a serial ClipDecoder decode of the same range sample for sample (apart
+// from the fades at its ends), the WAV header must describe the data, the
+// range is clamped to the book, and a failed export leaves no file behind.
+
+#include "clip_decoder.h"
+#include "clip_export.h"
+#include "reference_m4b.h"
+#include "test_check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#define NS_PER_SECOND 1000000000LL
+
+// Several segments of EXPORT_SEGMENT_FRAMES, so that the joins are tested
+static const ReferenceBook book = { "export_44k", 44100, 2, 2, 300 };
+
+static uint32_t le32(const unsigned char* p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// Serial decode of samples [from, to) as interleaved stereo
+static std::vector<int16_t> decode_range(const std::string& path, uint64_t from, uint64_t to) {
+    std::vector<int16_t> out;
+    ClipDecoder clip;
+    if (!clip.open(path.c_str())) return out;
+    uint32_t spf = clip.index().samples_per_frame();
+    uint64_t pos = from / spf * spf;
+    if (!clip.seek((uint32_t)(from / spf))) return out;
+    while (pos < to) {
+        const int16_t* pcm;
+        size_t frames;
+        if (!clip.decode(&pcm, &frames)) break;
+        for (size_t i = 0; i < frames; i++) {
+            if (pos + i >= from && pos + i < to) {
+                out.push_back(pcm[2 * i]);
+                out.push_back(pcm[2 * i + 1]);
+            }
+        }
+        pos += frames;
+    }
+    return out;
+}
+
+// WAV data, empty if the header does not describe a 16-bit stereo file of
+// the given rate whose data fills the rest of the file
+static std::vector<int16_t> read_wav(const std::string& path, unsigned long rate) {
+    std::vector<int16_t> pcm;
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return pcm;
+    unsigned char header[44];
+    bool ok = fread(header, 1, sizeof(header), f) == sizeof(header) &&
+              memcmp(header, "RIFF", 4) == 0 && memcmp(header + 8, "WAVEfmt ", 8) == 0 &&
+              header[22] == 2 && le32(header + 24) == rate && header[34] == 16 &&
+              memcmp(header + 36, "data", 4) == 0;
+    uint32_t bytes = le32(header + 40);
+    if (ok) {
+        pcm.resize(bytes / 2);
+        ok = fread(&pcm[0], 1, bytes, f) == bytes && fgetc(f) == EOF && le32(header + 4) == bytes + 36;
+    }
+    fclose(f);
+    if (!ok) pcm.clear();
+    return pcm;
+}
+
+static void check_export(const std::string& path, const std::string& wav, double from_s, double to_s) {
+    unsigned long rate = book.samplerate;
+    uint64_t total = (uint64_t)book.chapters * book.chapter_frames * REFERENCE_FRAME_SAMPLES;
+    uint64_t from = (uint64_t)(from_s * rate);
+    uint64_t to = (uint64_t)(to_s * rate);
+    if (to > total) to = total;
+
+    ExportResult result;
+    bool ok = export_wav(path.c_str(), (int64_t)(from_s * NS_PER_SECOND), (int64_t)(to_s * NS_PER_SECOND),
+                         wav.c_str(), &result);
+    CHECK(ok, "export %.1f-%.1f s failed", from_s, to_s);
+    if (!ok) return;
+
+    std::vector<int16_t> expected = decode_range(path, from, to);
+    std::vector<int16_t> out = read_wav(wav, rate);
+    CHECK(expected.size() == (to - from) * 2, "reference decode: %zu samples", expected.size());
+    CHECK(out.size() == expected.size(), "%.1f-%.1f s: %zu samples in the WAV, expected %zu",
+          from_s, to_s, out.size(), expected.size());
+    CHECK(result.bytes == 44 + out.size() * sizeof(int16_t), "result: %llu bytes", (unsigned long long)result.bytes);
+
+    // Exact between the fades
+    size_t fade = rate * EXPORT_FADE_MS / 1000 * 2;
+    size_t mismatches = 0;
+    for (size_t i = fade; i + fade < out.size() && i < expected.size(); i++) {
+        if (out[i] != expected[i]) mismatches++;
+    }
+    CHECK(mismatches == 0, "%.1f-%.1f s: %zu samples differ from a serial decode", from_s, to_s, mismatches);
+    CHECK(out.empty() || (out[0] == 0 && out[1] == 0), "clip does not start from silence");
+    printf("export %.1f-%.1f s: %.2f s of audio, %d thread(s), %.3f s\n", from_s, to_s, result.seconds,
+           result.threads, result.elapsed);
+    unlink(wav.c_str());
+}
+
+int main() {
+    char work_dir[] = "/tmp/lark-export-XXXXXX";
+    if (!mkdtemp(work_dir)) {
+        perror("mkdtemp");
+        return 2;
+    }
+    std::string path = std::string(work_dir) + "/" + book.name + ".m4b";
+    std::string wav = std::string(work_dir) + "/clip.wav";
+    if (!write_reference_m4b(path, book)) {
+        printf("FAIL cannot write %s\n", path.c_str());
+        return 2;
+    }
+
+    // Across chapters and segment joins, then clamped at the end of the book
+    check_export(path, wav, 1.5, 12.25);
+    check_export(path, wav, 0.0, 0.5);
+    check_export(path, wav, 10.0, 3600.0);
+
+    ExportResult result;
+    CHECK(!export_wav(path.c_str(), 5 * NS_PER_SECOND, 5 * NS_PER_SECOND, wav.c_str(), &result),
+          "empty range exported");
+    CHECK(!export_wav((path + ".missing").c_str(), 0, NS_PER_SECOND, wav.c_str(), &result),
+          "missing book exported");
+    CHECK(access(wav.c_str(), F_OK) != 0, "failed export left %s", wav.c_str());
+
+    unlink(wav.c_str());
+    unlink(path.c_str());
+    rmdir(work_dir);
+    printf("%d failure(s)\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,410 @@
+// Golden-PCM regression suite for the decode path and the DSP stages.
+//
+// Generates reference books (tests/reference_m4b.cpp), plays them through
+// the real Decoder into a null sink (a reader draining the PCM pipe) and
+// checks:
+//   - per-frame PCM hashes of a full decode against the stored goldens
+//     (exact: the decode path must not change a single sample)
+//   - that each chapter carries its own tone (analytic, no golden needed)
+//   - seek landing: a decode started at any position must be sample-exact
+//     against the full decode from that sample on
+//   - chapter table parsing and landing on every chapter start
+//   - the speech EQ output against goldens, per-frame RMS and peak within a
+//     tolerance (float and NEON paths may round differently)
+//
+// Runs on desktop Linux; needs FAAD2 and GLib only.
+//
+//   golden_pcm <golden dir>
+//   golden_pcm --update <output dir>
+//
+// A missing golden is a failure. --update records all of them into the
+// given directory instead of checking; review them and copy them to
+// tests/golden. Goldens depend on the FAAD2 build (floating point) they
+// were recorded with.
+
+#include "decoder.h"
+#include "file_fingerprint.h"
+#include "reference_m4b.h"
+#include "test_check.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "mpeg4/mp4read.h"
+}
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Speech EQ output: allowed per-frame deviation from the golden
+#define EQ_RMS_TOLERANCE 0.01    // relative
+#define EQ_PEAK_TOLERANCE 2      // LSB, on top of EQ_RMS_TOLERANCE
+// Own tone must beat every other chapter tone by this power ratio (20 dB)
+#define TONE_MIN_RATIO 100.0
+#define TONE_WINDOW 2048
+
+static const ReferenceBook books[] = {
+    { "mono_44k", 44100, 1, 4, 40 },
+    { "stereo_22k", 22050, 2, 3, 30 },
+};
+
+// =================================================================================
+// Null sink
+// =================================================================================
+
+// Play a file through the decoder and collect everything it writes to the
+// pipe. Returns false unless the decoder reached the end of the file.
+static bool capture(Decoder& decoder, const std::string& pipe_path, const std::string& file,
+                    gint64 start_ns, std::vector<int16_t>* pcm) {
+    pcm->clear();
+    if (!decoder.start(file.c_str(), start_ns)) return false;
+
+    // Non-blocking, so a decoder failing before it opens the pipe cannot
+    // hang the test. read() returns 0 both before the writer opens and
+    // after it closes; the decoder publishes its exit state before closing.
+    int fd = open(pipe_path.c_str(), O_RDONLY | O_NONBLOCK);
+    if (fd == -1) {
+        decoder.stop();
+        return false;
+    }
+
+    std::vector<char> bytes;
+    char buf[16384];
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n > 0) {
+            bytes.insert(bytes.end(), buf, buf + n);
+        } else if (n == 0) {
+            if (decoder.exit_state() != Decoder::EXIT_NONE) break;
+            usleep(1000);
+        } else if (errno == EAGAIN) {
+            struct pollfd pfd = { fd, POLLIN, 0 };
+            poll(&pfd, 1, 100);
+        } else if (errno != EINTR) {
+            break;
+        }
+    }
+    close(fd);
+    decoder.stop();
+
+    pcm->resize(bytes.size() / sizeof(int16_t));
+    if (!pcm->empty()) memcpy(&(*pcm)[0], &bytes[0], pcm->size() * sizeof(int16_t));
+    return decoder.exit_state() == Decoder::EXIT_END_OF_FILE;
+}
+
+// =================================================================================
+// Goldens
+// =================================================================================
+
+struct FrameLevel {
+    double rms;
+    int peak;
+};
+
+struct Golden {
+    uint64_t samples;
+    std::vector<uint64_t> hashes;
+    std::vector<FrameLevel> eq_levels;
+};
+
+static size_t frame_count(const std::vector<int16_t>& pcm, unsigned int channels) {
+    size_t frame = (size_t)REFERENCE_FRAME_SAMPLES * channels;
+    return (pcm.size() + frame - 1) / frame;
+}
+
+static std::vector<uint64_t> frame_hashes(const std::vector<int16_t>& pcm, unsigned int channels) {
+    std::vector<uint64_t> hashes;
+    size_t frame = (size_t)REFERENCE_FRAME_SAMPLES * channels;
+    for (size_t i = 0; i < frame_count(pcm, channels); i++) {
+        size_t len = pcm.size() - i * frame < frame ? pcm.size() - i * frame : frame;
+        hashes.push_back(fingerprint_hash(&pcm[i * frame], len * sizeof(int16_t), 0));
+    }
+    return hashes;
+}
+
+static std::vector<FrameLevel> frame_levels(const std::vector<int16_t>& pcm, unsigned int channels) {
+    std::vector<FrameLevel> levels;
+    size_t frame = (size_t)REFERENCE_FRAME_SAMPLES * channels;
+    for (size_t i = 0; i < frame_count(pcm, channels); i++) {
+        size_t end = (i + 1) * frame < pcm.size() ? (i + 1) * frame : pcm.size();
+        double sum = 0;
+        int peak = 0;
+        for (size_t k = i * frame; k < end; k++) {
+            sum += (double)pcm[k] * pcm[k];
+            int v = abs(pcm[k]);
+            if (v > peak) peak = v;
+        }
+        FrameLevel level = { sqrt(sum / (end - i * frame)), peak };
+        levels.push_back(level);
+    }
+    return levels;
+}
+
+static bool load_golden(const std::string& path, Golden* golden) {
+    std::ifstream in(path.c_str());
+    if (!in.is_open()) return false;
+
+    golden->samples = 0;
+    golden->hashes.clear();
+    golden->eq_levels.clear();
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string key;
+        fields >> key;
+        if (key == "samples") {
+            fields >> golden->samples;
+        } else if (key == "pcm") {
+            size_t index;
+            std::string hex;
+            fields >> index >> hex;
+            golden->hashes.push_back(strtoull(hex.c_str(), NULL, 16));
+        } else if (key == "eq") {
+            size_t index;
+            FrameLevel level;
+            fields >> index >> level.rms >> level.peak;
+            golden->eq_levels.push_back(level);
+        }
+    }
+    return true;
+}
+
+static bool save_golden(const std::string& path, const Golden& golden) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) return false;
+    fprintf(f, "# Recorded by golden_pcm --update. Per %d-sample frame: hash of the\n", REFERENCE_FRAME_SAMPLES);
+    fprintf(f, "# decoded PCM (exact), RMS and peak with the speech EQ (tolerance).\n");
+    fprintf(f, "samples %llu\n", (unsigned long long)golden.samples);
+    for (size_t i = 0; i < golden.hashes.size(); i++) {
+        fprintf(f, "pcm %lu %016llx\n", (unsigned long)i, (unsigned long long)golden.hashes[i]);
+    }
+    for (size_t i = 0; i < golden.eq_levels.size(); i++) {
+        fprintf(f, "eq %lu %.3f %d\n", (unsigned long)i, golden.eq_levels[i].rms, golden.eq_levels[i].peak);
+    }
+    return fclose(f) == 0;
+}
+
+// =================================================================================
+// Checks
+// =================================================================================
+
+// Goertzel power of one channel at a frequency
+static double tone_power(const std::vector<int16_t>& pcm, unsigned int channels, unsigned int channel,
+                         size_t start_sample, double freq, unsigned long rate) {
+    double coeff = 2.0 * cos(2.0 * M_PI * freq / rate);
+    double s1 = 0, s2 = 0;
+    for (size_t i = 0; i < TONE_WINDOW; i++) {
+        size_t k = (start_sample + i) * channels + channel;
+        double x = k < pcm.size() ? pcm[k] : 0.0;
+        double s0 = x + coeff * s1 - s2;
+        s2 = s1;
+        s1 = s0;
+    }
+    return s1 * s1 + s2 * s2 - coeff * s1 * s2;
+}
+
+// The audio at start_sample must be the tone of the given chapter. pcm has
+// the channels the decoder wrote (mono may come out upmixed to stereo).
+static void check_tone(const ReferenceBook& book, const std::vector<int16_t>& pcm, unsigned int channels,
+                       size_t start_sample, unsigned int chapter, const char* what) {
+    for (unsigned int ch = 0; ch < book.channels; ch++) {
+        double own = tone_power(pcm, channels, ch, start_sample,
+                                reference_bin_frequency(reference_tone_bin(chapter, ch), book.samplerate),
+                                book.samplerate);
+        CHECK(own > 0, "%s %s: chapter %u channel %u is silent", book.name, what, chapter + 1, ch);
+        for (unsigned int other = 0; other < book.chapters; other++) {
+            if (other == chapter) continue;
+            double power = tone_power(pcm, channels, ch, start_sample,
+                                      reference_bin_frequency(reference_tone_bin(other, ch), book.samplerate),
+                                      book.samplerate);
+            CHECK(own > power * TONE_MIN_RATIO, "%s %s: chapter %u channel %u sounds like chapter %u",
+                  book.name, what, chapter + 1, ch, other + 1);
+        }
+    }
+}
+
+// A decode started at start_ns must match the full decode from the sample
+// the decoder computes for that position
+static void check_seek(const ReferenceBook& book, unsigned int channels, Decoder& decoder,
+                       const std::string& pipe_path, const std::string& file, const std::vector<int16_t>& full,
+                       gint64 start_ns, std::vector<int16_t>* seeked) {
+    uint64_t start_sample = (uint64_t)start_ns * book.samplerate / DECODER_SECOND;
+    size_t offset = (size_t)start_sample * channels;
+
+    CHECK(capture(decoder, pipe_path, file, start_ns, seeked), "%s: decode from %lld ns did not finish",
+          book.name, (long long)start_ns);
+    CHECK(offset <= full.size() && seeked->size() == full.size() - offset,
+          "%s: decode from sample %llu returned %lu samples, expected %lu", book.name,
+          (unsigned long long)start_sample, (unsigned long)seeked->size(),
+          (unsigned long)(full.size() > offset ? full.size() - offset : 0));
+
+    size_t mismatch = 0;
+    while (mismatch < seeked->size() && offset + mismatch < full.size() &&
+           (*seeked)[mismatch] == full[offset + mismatch]) {
+        mismatch++;
+    }
+    CHECK(mismatch == seeked->size(), "%s: decode from sample %llu differs from the full decode at sample %lu",
+          book.name, (unsigned long long)start_sample, (unsigned long)(mismatch / channels));
+}
+
+static void check_chapters(const ReferenceBook& book, const std::string& file) {
+    std::lock_guard<std::mutex> lock(mp4_mutex);
+    mp4config.verbose.tags = 1;
+    CHECK(mp4read_open(const_cast<char*>(file.c_str())) == 0, "%s: cannot open", book.name);
+    CHECK(mp4config.chapter_count == book.chapters, "%s: %u chapters parsed, expected %u",
+          book.name, mp4config.chapter_count, book.chapters);
+    for (unsigned int c = 0; c < mp4config.chapter_count && c < book.chapters; c++) {
+        char title[32];
+        snprintf(title, sizeof(title), "Chapter %u", c + 1);
+        CHECK(mp4config.chapters[c].timestamp == reference_chapter_time(book, c),
+              "%s: chapter %u starts at %llu", book.name, c + 1,
+              (unsigned long long)mp4config.chapters[c].timestamp);
+        CHECK(mp4config.chapters[c].title && strcmp(mp4config.chapters[c].title, title) == 0,
+              "%s: chapter %u title", book.name, c + 1);
+    }
+    mp4read_close();
+    mp4config.verbose.tags = 0;
+}
+
+static void run_book(const ReferenceBook& book, const std::string& work_dir,
+                     const std::string& golden_dir, bool update) {
+    std::string file = work_dir + "/" + book.name + ".m4b";
+    std::string pipe_path = work_dir + "/pcm_pipe";
+    if (!write_reference_m4b(file, book)) {
+        CHECK(false, "%s: cannot write %s", book.name, file.c_str());
+        return;
+    }
+
+    PlaybackMetrics metrics;
+    SpeechEq eq;
+    Decoder decoder(&metrics, &eq, pipe_path.c_str());
+
+    // Full decode: FAAD2 drops the first frame (it only primes the overlap).
+    // Everything is checked in the channels it was written in: FAAD2 built
+    // with parametric stereo (PS_DEC, its default) outputs mono as stereo.
+    std::vector<int16_t> full;
+    CHECK(capture(decoder, pipe_path, file, 0, &full), "%s: full decode did not finish", book.name);
+    unsigned int channels = decoder.output_channels();
+    CHECK(channels == book.channels || (book.channels == 1 && channels == 2),
+          "%s: %u channels written for %u", book.name, channels, book.channels);
+    if (channels == 0) channels = book.channels;
+    uint64_t expected = (uint64_t)(book.chapters * book.chapter_frames - 1) * REFERENCE_FRAME_SAMPLES * channels;
+    CHECK(full.size() == expected, "%s: %lu samples decoded, expected %llu",
+          book.name, (unsigned long)full.size(), (unsigned long long)expected);
+    CHECK(metrics.faad_errors.load() == 0, "%s: %llu FAAD2 errors", book.name,
+          (unsigned long long)metrics.faad_errors.load());
+
+    for (unsigned int c = 0; c < book.chapters; c++) {
+        // Two frames in: past the overlap with the previous chapter
+        check_tone(book, full, channels, (size_t)(c * book.chapter_frames + 2) * REFERENCE_FRAME_SAMPLES, c,
+                   "full decode");
+    }
+
+    // Seeks: frame aligned, mid-frame, first frames, last frame
+    std::vector<int16_t> seeked;
+    const gint64 second = (gint64)DECODER_SECOND;
+    const gint64 seeks[] = { 1, second / 100, second / 2, second + 12345678, second * 2 + 1 };
+    for (size_t i = 0; i < sizeof(seeks) / sizeof(seeks[0]); i++) {
+        check_seek(book, channels, decoder, pipe_path, file, full, seeks[i], &seeked);
+    }
+    gint64 last_frame_ns = (gint64)((uint64_t)(book.chapters * book.chapter_frames - 1) *
+                                    REFERENCE_FRAME_SAMPLES * DECODER_SECOND / book.samplerate);
+    check_seek(book, channels, decoder, pipe_path, file, full, last_frame_ns - second / 100, &seeked);
+
+    // Chapters: table, then landing on each chapter start
+    check_chapters(book, file);
+    for (unsigned int c = 1; c < book.chapters; c++) {
+        gint64 start_ns = (gint64)reference_chapter_time(book, c) * 100;
+        check_seek(book, channels, decoder, pipe_path, file, full, start_ns, &seeked);
+        check_tone(book, seeked, channels, 2 * REFERENCE_FRAME_SAMPLES, c, "chapter seek");
+    }
+
+    // Lossy DSP stage
+    std::vector<int16_t> filtered;
+    eq.set_preset(EQ_SPEECH);
+    CHECK(capture(decoder, pipe_path, file, 0, &filtered), "%s: EQ decode did not finish", book.name);
+    eq.set_preset(EQ_OFF);
+    CHECK(filtered.size() == full.size(), "%s: EQ changed the length", book.name);
+
+    Golden current;
+    current.samples = full.size();
+    current.hashes = frame_hashes(full, channels);
+    current.eq_levels = frame_levels(filtered, channels);
+
+    std::string golden_path = golden_dir + "/" + book.name + ".golden";
+    if (update) {
+        CHECK(save_golden(golden_path, current), "%s: cannot write %s", book.name, golden_path.c_str());
+        printf("%s: recorded %s\n", book.name, golden_path.c_str());
+        return;
+    }
+    Golden golden;
+    if (!load_golden(golden_path, &golden)) {
+        CHECK(false, "%s: no golden at %s (record with --update)", book.name, golden_path.c_str());
+        return;
+    }
+
+    CHECK(golden.samples == current.samples, "%s: %llu samples, golden has %llu", book.name,
+          (unsigned long long)current.samples, (unsigned long long)golden.samples);
+    CHECK(golden.hashes.size() == current.hashes.size(), "%s: frame count differs from golden", book.name);
+    for (size_t i = 0; i < golden.hashes.size() && i < current.hashes.size(); i++) {
+        CHECK(golden.hashes[i] == current.hashes[i], "%s: PCM of frame %lu differs from golden",
+              book.name, (unsigned long)i);
+    }
+    CHECK(golden.eq_levels.size() == current.eq_levels.size(), "%s: EQ frame count differs from golden", book.name);
+    for (size_t i = 0; i < golden.eq_levels.size() && i < current.eq_levels.size(); i++) {
+        const FrameLevel& want = golden.eq_levels[i];
+        const FrameLevel& got = current.eq_levels[i];
+        CHECK(fabs(got.rms - want.rms) <= want.rms * EQ_RMS_TOLERANCE + 0.5,
+              "%s: EQ frame %lu RMS %.3f, golden %.3f", book.name, (unsigned long)i, got.rms, want.rms);
+        CHECK(abs(got.peak - want.peak) <= (int)(want.peak * EQ_RMS_TOLERANCE) + EQ_PEAK_TOLERANCE,
+              "%s: EQ frame %lu peak %d, golden %d", book.name, (unsigned long)i, got.peak, want.peak);
+    }
+}
+
+int main(int argc, char** argv) {
+    bool update = false;
+    const char* golden_dir = NULL;
+    if (argc == 3 && strcmp(argv[1], "--update") == 0) {
+        update = true;
+        golden_dir = argv[2];
+    } else if (argc == 2 && argv[1][0] != '-') {
+        golden_dir = argv[1];
+    }
+    if (!golden_dir) {
+        fprintf(stderr, "usage: %s <golden dir>\n       %s --update <output dir>\n", argv[0], argv[0]);
+        return 2;
+    }
+    if (update) mkdir(golden_dir, 0755);
+
+    char work_dir[] = "/tmp/lark-golden-XXXXXX";
+    if (!mkdtemp(work_dir)) {
+        perror("mkdtemp");
+        return 2;
+    }
+
+    for (size_t i = 0; i < sizeof(books) / sizeof(books[0]); i++) {
+        int before = failures;
+        run_book(books[i], work_dir, golden_dir, update);
+        printf("%s %s\n", failures == before ? "PASS" : "FAIL", books[i].name);
+
+        std::string file = std::string(work_dir) + "/" + books[i].name + ".m4b";
+        unlink(file.c_str());
+    }
+    rmdir(work_dir);
+
+    printf("%d failure(s)\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,310 @@
+// Exactness tests and microbenchmarks for the PCM kernels.
+//
+// Every kernel of every table available on this CPU is checked against the
+// scalar reference (bit-identical output, on random input and lengths that
+// leave a tail after the last full vector), and the scalar reference is
+// checked against known values: rounding and clamping, ramp endpoints,
+// downmix coefficients, levels and interleave round trips.
+//
+//   pcm_kernels           run the tests
+//   pcm_kernels --bench   also time each kernel of each table
+//
+// LARK_SIMD does not affect this program: it always tests every table.
+
+#include "pcm_kernels.h"
+#include "test_check.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+// Lengths cover empty input, less than a vector and odd tails
+static const size_t lengths[] = { 0, 1, 3, 7, 8, 9, 15, 16, 17, 63, 1024, 4099 };
+
+#define BENCH_FRAMES 4096
+#define BENCH_MIN_NS 200000000ULL // per kernel and table
+
+static uint32_t rng_state = 12345;
+
+static uint32_t rng() {
+    rng_state = rng_state * 1664525u + 1013904223u;
+    return rng_state >> 8;
+}
+
+// Random PCM with full-scale extremes mixed in
+static std::vector<int16_t> random_pcm(size_t samples) {
+    std::vector<int16_t> pcm(samples);
+    for (size_t i = 0; i < samples; i++) {
+        uint32_t r = rng();
+        if (r % 17 == 0) pcm[i] = r & 1 ? 32767 : -32768;
+        else pcm[i] = (int16_t)(r & 0xffff);
+    }
+    return pcm;
+}
+
+static size_t first_difference(const int16_t* a, const int16_t* b, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (a[i] != b[i]) return i;
+    }
+    return n;
+}
+
+// =================================================================================
+// Scalar reference against known values
+// =================================================================================
+
+static void check_reference() {
+    const PcmKernels& k = *pcm_kernel_table(PCM_ISA_SCALAR);
+
+    // Half away from zero, clamped
+    const float in[] = { 0.0f, 0.4f / 32768, 0.5f / 32768, -0.5f / 32768, 1.5f / 32768, -1.5f / 32768,
+                         1.0f, -1.0f, 2.0f, -2.0f, 0.25f };
+    const int16_t want[] = { 0, 0, 1, -1, 2, -2, 32767, -32768, 32767, -32768, 8192 };
+    int16_t out[11];
+    k.float_to_s16(in, out, 11);
+    for (int i = 0; i < 11; i++) {
+        CHECK(out[i] == want[i], "float_to_s16(%g) = %d, expected %d", in[i], out[i], want[i]);
+    }
+
+    std::vector<int16_t> pcm = random_pcm(1000);
+    std::vector<float> f(pcm.size());
+    std::vector<int16_t> back(pcm.size());
+    k.s16_to_float(&pcm[0], &f[0], pcm.size());
+    k.float_to_s16(&f[0], &back[0], pcm.size());
+    CHECK(first_difference(&pcm[0], &back[0], pcm.size()) == pcm.size(), "int16 -> float -> int16 not lossless");
+    CHECK(f[0] == pcm[0] / 32768.0f, "s16_to_float scale");
+
+    // Ramp: unity stays exact, frame i of a 1 -> 0 ramp over n is 1 - i/n
+    std::vector<int16_t> ramp(400, 10000);
+    k.gain_ramp(&ramp[0], 200, 2, 1.0f, 1.0f);
+    CHECK(ramp[0] == 10000 && ramp[399] == 10000, "unity gain changed the PCM");
+    k.gain_ramp(&ramp[0], 200, 2, 1.0f, 0.0f);
+    CHECK(ramp[0] == 10000 && ramp[1] == 10000, "ramp does not start at `from`");
+    CHECK(ramp[200] == 5000 && ramp[201] == 5000, "ramp midpoint %d", ramp[200]);
+    CHECK(ramp[398] == 50, "ramp last frame %d", ramp[398]);
+
+    // Crossfade endpoints and a constant mix
+    int16_t a[4] = { 1000, -1000, 1000, -1000 };
+    int16_t b[4] = { 3000, 3000, 3000, 3000 };
+    int16_t m[4];
+    k.mix(a, b, m, 4, 1, 0.0f, 1.0f);
+    CHECK(m[0] == 1000 && m[2] == 2000, "crossfade %d %d", m[0], m[2]);
+    k.mix(a, b, m, 4, 1, 0.5f, 0.5f);
+    CHECK(m[0] == 2000 && m[1] == 1000, "mix %d %d", m[0], m[1]);
+
+    // 5.1 in AAC order: C, L, R, Ls, Rs, LFE
+    const unsigned char positions[6] = { 1, 2, 3, 4, 5, 9 };
+    float matrix[12];
+    pcm_stereo_downmix_matrix(positions, 6, matrix);
+    float norm = 1.0f / (1.0f + 2 * 0.70710678f);
+    CHECK(fabsf(matrix[1] - norm) < 1e-6f && matrix[2] == 0.0f && matrix[5] == 0.0f,
+          "left row %g %g %g", matrix[1], matrix[2], matrix[5]);
+    CHECK(fabsf(matrix[6] - 0.70710678f * norm) < 1e-6f && fabsf(matrix[8] - norm) < 1e-6f,
+          "right row %g %g", matrix[6], matrix[8]);
+    int16_t surround[12] = { 32767, 32767, 32767, 32767, 32767, 32767,
+                             -32768, -32768, -32768, -32768, -32768, -32768 };
+    int16_t stereo[4];
+    k.downmix(surround, stereo, 2, 6, 2, matrix);
+    CHECK(stereo[0] == 32767 && stereo[1] == 32767 && stereo[2] == -32768 && stereo[3] == -32768,
+          "full scale downmix %d %d %d %d", stereo[0], stereo[1], stereo[2], stereo[3]);
+
+    PcmLevel level = { 0, 0, 0 };
+    int16_t levels[4] = { 3, -4, -32768, 0 };
+    k.measure(levels, 4, &level);
+    CHECK(level.sum_squares == 9 + 16 + 1073741824ULL && level.samples == 4 && level.peak == 32768,
+          "levels %llu %d", (unsigned long long)level.sum_squares, level.peak);
+    PcmLevel sine = { 0, 0, 0 };
+    std::vector<int16_t> wave(4800);
+    for (size_t i = 0; i < wave.size(); i++) wave[i] = (int16_t)lrint(16384 * sin(2 * M_PI * i / 48.0));
+    k.measure(&wave[0], wave.size(), &sine);
+    CHECK(fabs(pcm_level_rms(sine) - 0.5 / sqrt(2.0)) < 1e-3, "sine RMS %f", pcm_level_rms(sine));
+
+    std::vector<int16_t> left(500), right(500), joined(1000);
+    k.deinterleave(&pcm[0], &left[0], &right[0], 500);
+    CHECK(left[7] == pcm[14] && right[7] == pcm[15], "deinterleave");
+    k.interleave(&left[0], &right[0], &joined[0], 500);
+    CHECK(first_difference(&pcm[0], &joined[0], 1000) == 1000, "interleave round trip");
+}
+
+// =================================================================================
+// Every table against the scalar reference
+// =================================================================================
+
+static void check_table(const PcmKernels& k) {
+    const PcmKernels& ref = *pcm_kernel_table(PCM_ISA_SCALAR);
+
+    for (size_t li = 0; li < sizeof(lengths) / sizeof(lengths[0]); li++) {
+        size_t n = lengths[li];
+        std::vector<int16_t> pcm = random_pcm(n * 8 + 1);
+        std::vector<int16_t> other = random_pcm(n * 8 + 1);
+        std::vector<int16_t> want(n * 8 + 1), got(n * 8 + 1);
+
+        std::vector<float> fwant(n + 1), fgot(n + 1);
+        ref.s16_to_float(&pcm[0], &fwant[0], n);
+        k.s16_to_float(&pcm[0], &fgot[0], n);
+        CHECK(memcmp(&fwant[0], &fgot[0], n * sizeof(float)) == 0, "%s s16_to_float, %lu samples", k.name, (unsigned long)n);
+
+        // Out of range and rounding edge values
+        for (size_t i = 0; i < n; i++) fwant[i] = (float)(int32_t)(rng() - (1u << 23)) / (1 << 21);
+        ref.float_to_s16(&fwant[0], &want[0], n);
+        k.float_to_s16(&fwant[0], &got[0], n);
+        CHECK(first_difference(&want[0], &got[0], n) == n, "%s float_to_s16, %lu samples", k.name, (unsigned long)n);
+
+        for (unsigned int ch = 1; ch <= 3; ch++) {
+            const float ramps[][2] = { { 1.0f, 0.0f }, { 0.25f, 1.75f }, { 1.0f, 1.0f } };
+            for (int r = 0; r < 3; r++) {
+                want = pcm;
+                got = pcm;
+                ref.gain_ramp(&want[0], n, ch, ramps[r][0], ramps[r][1]);
+                k.gain_ramp(&got[0], n, ch, ramps[r][0], ramps[r][1]);
+                CHECK(first_difference(&want[0], &got[0], n * ch) == n * ch,
+                      "%s gain_ramp %g..%g, %u ch, %lu frames", k.name, ramps[r][0], ramps[r][1], ch, (unsigned long)n);
+
+                ref.mix(&pcm[0], &other[0], &want[0], n, ch, ramps[r][1], ramps[r][0]);
+                k.mix(&pcm[0], &other[0], &got[0], n, ch, ramps[r][1], ramps[r][0]);
+                CHECK(first_difference(&want[0], &got[0], n * ch) == n * ch,
+                      "%s mix, %u ch, %lu frames", k.name, ch, (unsigned long)n);
+            }
+        }
+
+        // In place crossfade (the A/B loop head)
+        want = pcm;
+        got = pcm;
+        ref.mix(&other[0], &want[0], &want[0], n, 2, 0.1f, 0.9f);
+        k.mix(&other[0], &got[0], &got[0], n, 2, 0.1f, 0.9f);
+        CHECK(first_difference(&want[0], &got[0], n * 2) == n * 2, "%s in place mix", k.name);
+
+        const unsigned char layouts[][8] = {
+            { 1, 2, 3, 4, 5, 9 },          // 5.1
+            { 1, 2, 3 },                   // 3.0
+            { 1, 2, 3, 4, 5, 6, 7, 9 },    // 7.1
+        };
+        const unsigned int layout_channels[] = { 6, 3, 8 };
+        for (int l = 0; l < 3; l++) {
+            float matrix[16];
+            pcm_stereo_downmix_matrix(layouts[l], layout_channels[l], matrix);
+            ref.downmix(&pcm[0], &want[0], n, layout_channels[l], 2, matrix);
+            k.downmix(&pcm[0], &got[0], n, layout_channels[l], 2, matrix);
+            CHECK(first_difference(&want[0], &got[0], n * 2) == n * 2,
+                  "%s downmix %u -> 2, %lu frames", k.name, layout_channels[l], (unsigned long)n);
+        }
+
+        PcmLevel lwant = { 0, 0, 0 }, lgot = { 0, 0, 0 };
+        ref.measure(&pcm[0], n * 2, &lwant);
+        k.measure(&pcm[0], n * 2, &lgot);
+        CHECK(lwant.sum_squares == lgot.sum_squares && lwant.samples == lgot.samples && lwant.peak == lgot.peak,
+              "%s measure, %lu samples", k.name, (unsigned long)n * 2);
+
+        std::vector<int16_t> lw(n + 1), rw(n + 1), lg(n + 1), rg(n + 1);
+        ref.deinterleave(&pcm[0], &lw[0], &rw[0], n);
+        k.deinterleave(&pcm[0], &lg[0], &rg[0], n);
+        CHECK(first_difference(&lw[0], &lg[0], n) == n && first_difference(&rw[0], &rg[0], n) == n,
+              "%s deinterleave, %lu frames", k.name, (unsigned long)n);
+        ref.interleave(&pcm[0], &other[0], &want[0], n);
+        k.interleave(&pcm[0], &other[0], &got[0], n);
+        CHECK(first_difference(&want[0], &got[0], n * 2) == n * 2, "%s interleave, %lu frames", k.name, (unsigned long)n);
+    }
+}
+
+// =================================================================================
+// Microbenchmarks
+// =================================================================================
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+enum BenchKernel {
+    BENCH_S16_TO_FLOAT,
+    BENCH_FLOAT_TO_S16,
+    BENCH_GAIN_RAMP,
+    BENCH_MIX,
+    BENCH_DOWNMIX,
+    BENCH_MEASURE,
+    BENCH_DEINTERLEAVE,
+    BENCH_INTERLEAVE,
+    BENCH_COUNT,
+};
+
+static const char* bench_names[BENCH_COUNT] = {
+    "s16_to_float", "float_to_s16", "gain_ramp", "mix", "downmix 5.1", "measure", "deinterleave", "interleave",
+};
+
+// Stereo frames per microsecond (higher is better)
+static double bench(const PcmKernels& k, BenchKernel kernel) {
+    static std::vector<int16_t> a = random_pcm(BENCH_FRAMES * 6);
+    static std::vector<int16_t> b = random_pcm(BENCH_FRAMES * 2);
+    static std::vector<int16_t> out(BENCH_FRAMES * 2);
+    static std::vector<int16_t> left(BENCH_FRAMES), right(BENCH_FRAMES);
+    static std::vector<float> f(BENCH_FRAMES * 2, 0.25f);
+    static const unsigned char positions[6] = { 1, 2, 3, 4, 5, 9 };
+    float matrix[12];
+    pcm_stereo_downmix_matrix(positions, 6, matrix);
+
+    uint64_t iterations = 0;
+    uint64_t start = now_ns();
+    uint64_t elapsed = 0;
+    PcmLevel level = { 0, 0, 0 };
+    do {
+        for (int rep = 0; rep < 16; rep++) {
+            switch (kernel) {
+                case BENCH_S16_TO_FLOAT: k.s16_to_float(&b[0], &f[0], BENCH_FRAMES * 2); break;
+                case BENCH_FLOAT_TO_S16: k.float_to_s16(&f[0], &out[0], BENCH_FRAMES * 2); break;
+                case BENCH_GAIN_RAMP: k.gain_ramp(&out[0], BENCH_FRAMES, 2, 1.0f, 0.5f); break;
+                case BENCH_MIX: k.mix(&a[0], &b[0], &out[0], BENCH_FRAMES, 2, 0.0f, 1.0f); break;
+                case BENCH_DOWNMIX: k.downmix(&a[0], &out[0], BENCH_FRAMES, 6, 2, matrix); break;
+                case BENCH_MEASURE: k.measure(&b[0], BENCH_FRAMES * 2, &level); break;
+                case BENCH_DEINTERLEAVE: k.deinterleave(&b[0], &left[0], &right[0], BENCH_FRAMES); break;
+                case BENCH_INTERLEAVE: k.interleave(&left[0], &right[0], &out[0], BENCH_FRAMES); break;
+                default: break;
+            }
+            iterations++;
+        }
+        elapsed = now_ns() - start;
+    } while (elapsed < BENCH_MIN_NS);
+    if (level.peak < 0) printf("%d\n", level.peak); // keep the result alive
+    return (double)iterations * BENCH_FRAMES / (elapsed / 1000.0);
+}
+
+static void run_benchmarks() {
+    printf("\n%-14s", "frames/us");
+    for (int isa = 0; isa < PCM_ISA_COUNT; isa++) {
+        const PcmKernels* k = pcm_kernel_table((PcmIsa)isa);
+        if (k) printf("%10s", k->name);
+    }
+    printf("\n");
+    for (int kernel = 0; kernel < BENCH_COUNT; kernel++) {
+        printf("%-14s", bench_names[kernel]);
+        for (int isa = 0; isa < PCM_ISA_COUNT; isa++) {
+            const PcmKernels* k = pcm_kernel_table((PcmIsa)isa);
+            if (k) printf("%10.1f", bench(*k, (BenchKernel)kernel));
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char** argv) {
+    bool run_bench = argc > 1 && strcmp(argv[1], "--bench") == 0;
+
+    check_reference();
+    printf("%s scalar reference\n", failures == 0 ? "PASS" : "FAIL");
+    for (int isa = 1; isa < PCM_ISA_COUNT; isa++) {
+        const PcmKernels* k = pcm_kernel_table((PcmIsa)isa);
+        if (!k) continue;
+        int before = failures;
+        check_table(*k);
+        printf("%s %s\n", failures == before ? "PASS" : "FAIL", k->name);
+    }
+    printf("default table: %s\n", pcm_kernels().name);
+
+    if (run_bench) run_benchmarks();
+
+    printf("%d failure(s)\n", failures);
+    return failures == 0 ? 0 : 1;
+}
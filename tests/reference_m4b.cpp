@@ -0,0 +1,361 @@
+#include "reference_m4b.h"
+#include <stdio.h>
+#include <string.h>
+
+// Syntax elements (ISO/IEC 14496-3)
+#define AAC_ID_SCE 0
+#define AAC_ID_CPE 1
+#define AAC_ID_END 7
+#define AAC_PULSE_MAX_OFFSET 31
+
+// Scalefactors equal to the global gain of 128: 2^7 gain on the pulses
+#define REFERENCE_GLOBAL_GAIN 128
+
+// Bits are written MSB first
+class BitWriter {
+public:
+    BitWriter() : nbits(0) {}
+
+    void put(uint32_t value, int bits) {
+        for (int i = bits - 1; i >= 0; i--) {
+            if (nbits % 8 == 0) data.push_back(0);
+            if ((value >> i) & 1) data.back() |= (uint8_t)(0x80 >> (nbits % 8));
+            nbits++;
+        }
+    }
+    void align() {
+        while (nbits % 8) put(0, 1);
+    }
+    const std::vector<uint8_t>& bytes() const { return data; }
+
+private:
+    std::vector<uint8_t> data;
+    size_t nbits;
+};
+
+struct Pulse {
+    unsigned int bin;
+    unsigned int amp; // 0..15
+};
+
+static unsigned int sampling_index(unsigned long samplerate) {
+    return samplerate == 22050 ? 7 : 4;
+}
+
+// Scalefactor bands of a long window
+static unsigned int num_swb(unsigned long samplerate) {
+    return samplerate == 22050 ? 47 : 49;
+}
+
+unsigned int reference_tone_bin(unsigned int chapter, unsigned int channel) {
+    return 28 + 20 * chapter + 8 * channel;
+}
+
+double reference_bin_frequency(unsigned int bin, unsigned long samplerate) {
+    return (bin + 0.5) * samplerate / (2.0 * REFERENCE_FRAME_SAMPLES);
+}
+
+uint64_t reference_chapter_time(const ReferenceBook& book, unsigned int chapter) {
+    uint64_t sample = (uint64_t)chapter * book.chapter_frames * REFERENCE_FRAME_SAMPLES;
+    return sample * 10000000ULL / book.samplerate;
+}
+
+// One individual_channel_stream: long window, one codebook 1 section over
+// all bands with zero coefficients, pulses on top.
+static void write_ics(BitWriter& bw, unsigned long samplerate, const std::vector<Pulse>& pulses) {
+    unsigned int bands = num_swb(samplerate);
+
+    bw.put(REFERENCE_GLOBAL_GAIN, 8);
+
+    // ics_info
+    bw.put(0, 1);     // ics_reserved_bit
+    bw.put(0, 2);     // ONLY_LONG_SEQUENCE
+    bw.put(0, 1);     // sine window
+    bw.put(bands, 6); // max_sfb
+    bw.put(0, 1);     // predictor_data_present
+
+    // section_data: codebook 1 for every band
+    bw.put(1, 4);
+    unsigned int len = bands;
+    while (len >= 31) {
+        bw.put(31, 5);
+        len -= 31;
+    }
+    bw.put(len, 5);
+
+    // scale_factor_data: delta 0 from the global gain ('0')
+    for (unsigned int b = 0; b < bands; b++) bw.put(0, 1);
+
+    // pulse_data, from band 0; zero amplitude pulses bridge long gaps
+    std::vector<Pulse> coded;
+    unsigned int pos = 0;
+    for (size_t i = 0; i < pulses.size(); i++) {
+        while (pulses[i].bin - pos > AAC_PULSE_MAX_OFFSET) {
+            Pulse step = { AAC_PULSE_MAX_OFFSET, 0 };
+            coded.push_back(step);
+            pos += AAC_PULSE_MAX_OFFSET;
+        }
+        Pulse p = { pulses[i].bin - pos, pulses[i].amp };
+        coded.push_back(p);
+        pos = pulses[i].bin;
+    }
+    bw.put(1, 1);
+    bw.put((uint32_t)coded.size() - 1, 2);
+    bw.put(0, 6); // pulse_start_sfb
+    for (size_t i = 0; i < coded.size(); i++) {
+        bw.put(coded[i].bin, 5);
+        bw.put(coded[i].amp, 4);
+    }
+
+    bw.put(0, 1); // tns_data_present
+    bw.put(0, 1); // gain_control_data_present
+
+    // spectral_data: 1024 zero coefficients, one '0' codeword per quad
+    for (unsigned int q = 0; q < REFERENCE_FRAME_SAMPLES / 4; q++) bw.put(0, 1);
+}
+
+static std::vector<Pulse> frame_pulses(unsigned int frame, unsigned int chapter, unsigned int channel) {
+    // Quiet marker below the tones, different every frame; bins 10..21 keep
+    // the gap to the highest tone bridgeable within the four pulses allowed
+    Pulse marker = { 10 + (frame * 7) % 12, 1 + frame % 3 };
+    Pulse tone = { reference_tone_bin(chapter, channel), 10 + frame % 6 };
+    std::vector<Pulse> pulses;
+    pulses.push_back(marker);
+    pulses.push_back(tone);
+    return pulses;
+}
+
+static std::vector<uint8_t> make_frame(const ReferenceBook& book, unsigned int frame) {
+    unsigned int chapter = frame / book.chapter_frames;
+    BitWriter bw;
+    if (book.channels == 2) {
+        bw.put(AAC_ID_CPE, 3);
+        bw.put(0, 4); // element_instance_tag
+        bw.put(0, 1); // common_window
+        write_ics(bw, book.samplerate, frame_pulses(frame, chapter, 0));
+        write_ics(bw, book.samplerate, frame_pulses(frame, chapter, 1));
+    } else {
+        bw.put(AAC_ID_SCE, 3);
+        bw.put(0, 4);
+        write_ics(bw, book.samplerate, frame_pulses(frame, chapter, 0));
+    }
+    bw.put(AAC_ID_END, 3);
+    bw.align();
+    return bw.bytes();
+}
+
+// =================================================================================
+// MP4 container
+// =================================================================================
+
+static void put_u8(std::string& out, uint32_t v) {
+    out.push_back((char)(v & 0xFF));
+}
+
+static void put_u16(std::string& out, uint32_t v) {
+    put_u8(out, v >> 8);
+    put_u8(out, v);
+}
+
+static void put_u32(std::string& out, uint32_t v) {
+    put_u16(out, v >> 16);
+    put_u16(out, v);
+}
+
+static std::string box(const char* type, const std::string& payload) {
+    std::string out;
+    put_u32(out, (uint32_t)(8 + payload.size()));
+    out.append(type, 4);
+    return out + payload;
+}
+
+static std::string full_box(const char* type, uint32_t version_flags, const std::string& payload) {
+    std::string body;
+    put_u32(body, version_flags);
+    return box(type, body + payload);
+}
+
+static std::string esds(const ReferenceBook& book) {
+    // AudioSpecificConfig: AAC LC, sampling index, channel configuration,
+    // 1024-sample frames
+    std::string asc;
+    uint32_t bits = (2u << 11) | (sampling_index(book.samplerate) << 7) | (book.channels << 3);
+    put_u16(asc, bits);
+
+    std::string dsi;
+    put_u8(dsi, 5);
+    put_u8(dsi, (uint32_t)asc.size());
+    dsi += asc;
+
+    std::string dc;
+    put_u8(dc, 0x40); // MPEG-4 audio
+    put_u8(dc, 0x15); // audio stream
+    put_u8(dc, 0);    // buffer size (24 bits)
+    put_u16(dc, 0);
+    put_u32(dc, 0);   // max bitrate
+    put_u32(dc, 0);   // average bitrate
+    dc += dsi;
+
+    std::string slc;
+    put_u8(slc, 6);
+    put_u8(slc, 1);
+    put_u8(slc, 2);
+
+    std::string es;
+    put_u16(es, 1); // ES_ID
+    put_u8(es, 0);
+    put_u8(es, 4);
+    put_u8(es, (uint32_t)dc.size());
+    es += dc;
+    es += slc;
+
+    std::string desc;
+    put_u8(desc, 3);
+    put_u8(desc, (uint32_t)es.size());
+    return full_box("esds", 0, desc + es);
+}
+
+static std::string moov(const ReferenceBook& book, const std::vector<std::vector<uint8_t> >& frames,
+                        uint32_t mdat_offset) {
+    uint32_t samples = (uint32_t)frames.size() * REFERENCE_FRAME_SAMPLES;
+
+    std::string mvhd;
+    put_u32(mvhd, 0);              // creation time
+    put_u32(mvhd, 0);              // modification time
+    put_u32(mvhd, (uint32_t)book.samplerate);
+    put_u32(mvhd, samples);
+    put_u32(mvhd, 0x00010000);     // rate 1.0
+    put_u16(mvhd, 0x0100);         // volume 1.0
+    mvhd.append(10, '\0');
+    static const uint32_t matrix[9] = { 0x10000, 0, 0, 0, 0x10000, 0, 0, 0, 0x40000000 };
+    for (int i = 0; i < 9; i++) put_u32(mvhd, matrix[i]);
+    mvhd.append(24, '\0');
+    put_u32(mvhd, 2);              // next track id
+
+    std::string tkhd;
+    put_u32(tkhd, 0);
+    put_u32(tkhd, 0);
+    put_u32(tkhd, 1);              // track id
+    put_u32(tkhd, 0);
+    put_u32(tkhd, samples);
+    tkhd.append(8, '\0');
+    put_u16(tkhd, 0);              // layer
+    put_u16(tkhd, 0);              // alternate group
+    put_u16(tkhd, 0x0100);         // volume
+    put_u16(tkhd, 0);
+    for (int i = 0; i < 9; i++) put_u32(tkhd, matrix[i]);
+    put_u32(tkhd, 0);              // width
+    put_u32(tkhd, 0);              // height
+
+    std::string mdhd;
+    put_u32(mdhd, 0);
+    put_u32(mdhd, 0);
+    put_u32(mdhd, (uint32_t)book.samplerate);
+    put_u32(mdhd, samples);
+    put_u16(mdhd, 0x55C4);         // 'und'
+    put_u16(mdhd, 0);
+
+    std::string hdlr;
+    put_u32(hdlr, 0);
+    hdlr += "soun";
+    hdlr.append(12, '\0');
+    hdlr += "SoundHandler";
+    hdlr.push_back('\0');
+
+    std::string mp4a;
+    mp4a.append(6, '\0');
+    put_u16(mp4a, 1);              // data reference index
+    put_u16(mp4a, 0);              // version
+    put_u16(mp4a, 0);              // revision
+    put_u32(mp4a, 0);              // vendor
+    put_u16(mp4a, book.channels);
+    put_u16(mp4a, 16);
+    put_u16(mp4a, 0);
+    put_u16(mp4a, 0);
+    put_u16(mp4a, (uint32_t)book.samplerate);
+    put_u16(mp4a, 0);
+    mp4a += esds(book);
+
+    std::string stsd;
+    put_u32(stsd, 1);
+    stsd += box("mp4a", mp4a);
+
+    std::string stts;
+    put_u32(stts, 1);
+    put_u32(stts, (uint32_t)frames.size());
+    put_u32(stts, REFERENCE_FRAME_SAMPLES);
+
+    // Every frame in one chunk
+    std::string stsc;
+    put_u32(stsc, 1);
+    put_u32(stsc, 1);
+    put_u32(stsc, (uint32_t)frames.size());
+    put_u32(stsc, 1);
+
+    std::string stsz;
+    put_u32(stsz, 0);
+    put_u32(stsz, (uint32_t)frames.size());
+    for (size_t i = 0; i < frames.size(); i++) put_u32(stsz, (uint32_t)frames[i].size());
+
+    std::string stco;
+    put_u32(stco, 1);
+    put_u32(stco, mdat_offset);
+
+    std::string dref;
+    put_u32(dref, 1);
+    dref += full_box("url ", 1, "");
+
+    std::string stbl = full_box("stsd", 0, stsd) + full_box("stts", 0, stts) + full_box("stsc", 0, stsc) +
+                       full_box("stsz", 0, stsz) + full_box("stco", 0, stco);
+    std::string smhd;
+    put_u32(smhd, 0);
+    std::string minf = full_box("smhd", 0, smhd) + box("dinf", full_box("dref", 0, dref)) + box("stbl", stbl);
+    std::string mdia = full_box("mdhd", 0, mdhd) + full_box("hdlr", 0, hdlr) + box("minf", minf);
+    std::string trak = full_box("tkhd", 7, tkhd) + box("mdia", mdia);
+
+    // Nero chapters: u32 reserved, u8 count, then u64 time (100ns), title
+    std::string chpl;
+    put_u32(chpl, 0);
+    put_u8(chpl, book.chapters);
+    for (unsigned int c = 0; c < book.chapters; c++) {
+        uint64_t time = reference_chapter_time(book, c);
+        put_u32(chpl, (uint32_t)(time >> 32));
+        put_u32(chpl, (uint32_t)time);
+        char title[32];
+        snprintf(title, sizeof(title), "Chapter %u", c + 1);
+        put_u8(chpl, (uint32_t)strlen(title));
+        chpl += title;
+    }
+    std::string udta = box("udta", full_box("chpl", 0x01000000, chpl));
+
+    return box("moov", full_box("mvhd", 0, mvhd) + box("trak", trak) + udta);
+}
+
+bool write_reference_m4b(const std::string& path, const ReferenceBook& book) {
+    if (book.chapters == 0 || book.chapters > REFERENCE_MAX_CHAPTERS) return false;
+
+    std::vector<std::vector<uint8_t> > frames;
+    for (unsigned int i = 0; i < book.chapters * book.chapter_frames; i++) {
+        frames.push_back(make_frame(book, i));
+    }
+
+    std::string ftyp_payload = "M4B ";
+    put_u32(ftyp_payload, 0);
+    ftyp_payload += "M4B mp42isom";
+    std::string ftyp = box("ftyp", ftyp_payload);
+
+    // The moov size does not depend on the offset: build it twice
+    std::string header = ftyp + moov(book, frames, 0);
+    header = ftyp + moov(book, frames, (uint32_t)header.size() + 8);
+
+    std::string mdat;
+    for (size_t i = 0; i < frames.size(); i++) {
+        mdat.append((const char*)&frames[i][0], frames[i].size());
+    }
+
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    std::string data = header + box("mdat", mdat);
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    return fclose(f) == 0 && ok;
+}
@@ -0,0 +1,39 @@
+#ifndef REFERENCE_M4B_H
+#define REFERENCE_M4B_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Reference audiobooks for the regression tests, generated at test time so
+// that no binary media lives in the tree and no AAC encoder is needed.
+//
+// Every frame is a valid AAC-LC raw data block built by hand: all spectral
+// coefficients are coded as zero with codebook 1 and the audible content is
+// added with the pulse tool (up to four quantized coefficients per channel
+// and frame). Each chapter carries a steady tone at its own MDCT bin, plus a
+// quiet marker tone that changes every frame so that no two frames decode to
+// the same PCM. Chapters are stored in a Nero 'chpl' box, like real books.
+struct ReferenceBook {
+    const char* name;
+    unsigned long samplerate;  // 44100 or 22050
+    unsigned int channels;     // 1 (SCE) or 2 (CPE)
+    unsigned int chapters;     // at most REFERENCE_MAX_CHAPTERS
+    unsigned int chapter_frames;
+};
+
+#define REFERENCE_MAX_CHAPTERS 4
+#define REFERENCE_FRAME_SAMPLES 1024
+
+// MDCT bin of the tone of a chapter on a channel
+unsigned int reference_tone_bin(unsigned int chapter, unsigned int channel);
+
+// Frequency (Hz) at the center of an MDCT bin
+double reference_bin_frequency(unsigned int bin, unsigned long samplerate);
+
+// Chapter start in the 100ns units of 'chpl'
+uint64_t reference_chapter_time(const ReferenceBook& book, unsigned int chapter);
+
+bool write_reference_m4b(const std::string& path, const ReferenceBook& book);
+
+#endif // REFERENCE_M4B_H
@@ -0,0 +1,96 @@
+// Tests for the narrator speech rate: a tone in the vowel band, amplitude
+// modulated at a known syllable rate, must measure at that rate in words per
+// minute (pauses between phrases excluded from the speech time), and the
+// analysis of a reference book must run faster than real time.
+
+#include "reference_m4b.h"
+#include "speech_rate.h"
+#include "test_check.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#define RATE 44100
+#define CARRIER_HZ 950.0
+#define REGION_SECONDS 20
+// Measured rate against the modulation rate (relative)
+#define WPM_TOLERANCE 0.05
+
+static const ReferenceBook book = { "speech_44k", 44100, 2, 4, 300 };
+
+// Stereo tone whose envelope rises and falls syllables_per_second times a
+// second, in phrases of phrase_seconds separated by pause_seconds of silence
+static std::vector<int16_t> syllables(double syllables_per_second, double phrase_seconds, double pause_seconds) {
+    size_t frames = (size_t)REGION_SECONDS * RATE;
+    size_t phrase = (size_t)(phrase_seconds * RATE);
+    size_t period = phrase + (size_t)(pause_seconds * RATE);
+    std::vector<int16_t> pcm(frames * 2, 0);
+    for (size_t i = 0; i < frames; i++) {
+        size_t t = i % period;
+        if (t >= phrase) continue;
+        double envelope = 0.5 - 0.5 * cos(2.0 * M_PI * syllables_per_second * t / RATE);
+        int16_t v = (int16_t)(12000.0 * envelope * sin(2.0 * M_PI * CARRIER_HZ * i / RATE));
+        pcm[2 * i] = v;
+        pcm[2 * i + 1] = v;
+    }
+    return pcm;
+}
+
+static void check_rate(double syllables_per_second, double phrase_seconds, double pause_seconds) {
+    std::vector<int16_t> pcm = syllables(syllables_per_second, phrase_seconds, pause_seconds);
+    SpeechRateMeter meter(RATE);
+    // Fed in frame-sized pieces, like the analysis
+    for (size_t pos = 0; pos < pcm.size() / 2; pos += REFERENCE_FRAME_SAMPLES) {
+        size_t n = pcm.size() / 2 - pos < REFERENCE_FRAME_SAMPLES ? pcm.size() / 2 - pos : REFERENCE_FRAME_SAMPLES;
+        meter.feed(&pcm[pos * 2], n);
+    }
+    meter.finish_region();
+
+    double expected = syllables_per_second * 60.0 / SPEECH_RATE_SYLLABLES_PER_WORD;
+    double wpm = meter.words_per_minute();
+    CHECK(fabs(wpm - expected) <= expected * WPM_TOLERANCE,
+          "%.1f syllables/s, %.1f s pauses: %.1f wpm, expected %.1f", syllables_per_second, pause_seconds,
+          wpm, expected);
+    printf("%.1f syllables/s, %.1f s pauses: %.1f wpm (%lu syllables over %.1f s)\n", syllables_per_second,
+           pause_seconds, wpm, meter.syllables(), meter.speech_seconds());
+}
+
+int main() {
+    // Slow to fast narration, continuous and in phrases
+    check_rate(3.0, REGION_SECONDS, 0.0);
+    check_rate(4.0, REGION_SECONDS, 0.0);
+    check_rate(5.5, REGION_SECONDS, 0.0);
+    check_rate(4.0, 3.0, 1.0);
+
+    CHECK(speed_for_target_wpm(150.0, 300) == SPEECH_RATE_MAX_SPEED, "speed not clamped");
+    CHECK(speed_for_target_wpm(0.0, 200) == 1.0f, "unknown rate changed the speed");
+
+    char work_dir[] = "/tmp/lark-speech-XXXXXX";
+    if (!mkdtemp(work_dir)) {
+        perror("mkdtemp");
+        return 2;
+    }
+    std::string path = std::string(work_dir) + "/" + book.name + ".m4b";
+    if (!write_reference_m4b(path, book)) {
+        printf("FAIL cannot write %s\n", path.c_str());
+        return 2;
+    }
+
+    // Steady tones: no syllables, but the whole analysis runs
+    SpeechRate rate;
+    rate.audio_seconds = 0;
+    rate.realtime_factor = 0;
+    analyze_speech_rate(path.c_str(), &rate);
+    CHECK(rate.audio_seconds > 0, "reference book: nothing decoded");
+    CHECK(rate.realtime_factor > 1.0, "reference book: analysed at %.2fx real time", rate.realtime_factor);
+    printf("reference book: %.1f s of audio at %.0fx real time\n", rate.audio_seconds, rate.realtime_factor);
+
+    unlink(path.c_str());
+    rmdir(work_dir);
+    printf("%d failure(s)\n", failures);
+    return failures == 0 ? 0 : 1;
+}
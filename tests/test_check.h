@@ -0,0 +1,22 @@
+#ifndef TEST_CHECK_H
+#define TEST_CHECK_H
+
+// Shared harness of the test programs: CHECK() counts and reports a failed
+// condition and carries on, main() prints failures and returns non-zero if
+// there were any. Include from one translation unit per test program.
+
+#include <stdio.h>
+
+static int failures = 0;
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            failures++; \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+        } \
+    } while (0)
+
+#endif // TEST_CHECK_H
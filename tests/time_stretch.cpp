@@ -0,0 +1,76 @@
+// Tests for the time-stretch: speed 1 is bit-exact passthrough; at other
+// speeds the output length follows 1 / speed, a tone keeps its pitch and
+// the output does not depend on how the input is split into blocks.
+
+#include "test_check.h"
+#include "time_stretch.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#define RATE 44100
+#define SECONDS 4
+#define TONE_HZ 220.0
+
+static std::vector<int16_t> tone(size_t frames) {
+    std::vector<int16_t> pcm(frames * 2);
+    for (size_t i = 0; i < frames; i++) {
+        int16_t v = (int16_t)(8000.0 * sin(2.0 * M_PI * TONE_HZ * i / RATE));
+        pcm[2 * i] = v;
+        pcm[2 * i + 1] = v;
+    }
+    return pcm;
+}
+
+static std::vector<int16_t> stretch(const std::vector<int16_t>& in, float speed, size_t block) {
+    TimeStretch ts;
+    ts.configure(RATE, 2, speed);
+    std::vector<int16_t> all, out;
+    size_t frames = in.size() / 2;
+    for (size_t pos = 0; pos < frames; pos += block) {
+        size_t n = frames - pos < block ? frames - pos : block;
+        ts.process(&in[pos * 2], n, &out);
+        all.insert(all.end(), out.begin(), out.end());
+    }
+    return all;
+}
+
+// Frequency from the zero crossings of the left channel
+static double frequency(const std::vector<int16_t>& pcm) {
+    size_t frames = pcm.size() / 2;
+    size_t crossings = 0;
+    for (size_t i = 1; i < frames; i++) {
+        if ((pcm[2 * i - 2] < 0) != (pcm[2 * i] < 0)) crossings++;
+    }
+    return frames > 0 ? crossings / 2.0 / ((double)frames / RATE) : 0.0;
+}
+
+int main() {
+    std::vector<int16_t> in = tone(RATE * SECONDS);
+
+    std::vector<int16_t> same = stretch(in, 1.0f, 1024);
+    CHECK(same.size() == in.size() && memcmp(&same[0], &in[0], in.size() * sizeof(int16_t)) == 0,
+          "speed 1 changed the PCM");
+
+    static const float speeds[] = { 0.75f, 1.25f, 1.5f, 2.0f };
+    for (size_t s = 0; s < sizeof(speeds) / sizeof(speeds[0]); s++) {
+        float speed = speeds[s];
+        std::vector<int16_t> out = stretch(in, speed, 1024);
+        double expected = in.size() / 2 / speed;
+        double frames = out.size() / 2;
+        // The stretch holds back up to a segment and a seek window
+        CHECK(frames <= expected + 1 && frames > expected - RATE * 0.1,
+              "speed %.2f: %.0f frames out, expected %.0f", speed, frames, expected);
+        double hz = frequency(out);
+        CHECK(fabs(hz - TONE_HZ) < 2.0, "speed %.2f: tone at %.1f Hz", speed, hz);
+
+        std::vector<int16_t> split = stretch(in, speed, 317);
+        CHECK(split == out, "speed %.2f: output depends on the block size", speed);
+        printf("speed %.2f: %.0f frames, %.1f Hz\n", speed, frames, hz);
+    }
+
+    printf("%d failure(s)\n", failures);
+    return failures == 0 ? 0 : 1;
+}
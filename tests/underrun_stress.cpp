@@ -0,0 +1,209 @@
+// Underrun measurement under synthetic load, for comparing the audio path
+// with and without the real-time tuning of realtime.h.
+//
+// Plays a generated reference book through the real Decoder into a sink
+// that drains the PCM pipe at the audio rate in SINK_PERIOD_MS periods,
+// like the GStreamer sink on the device, while load threads keep every CPU
+// busy streaming through memory. A period the pipe cannot fill is an
+// audible underrun. The sink thread enters the real-time mode like the
+// GStreamer streaming threads do.
+//
+//   underrun_stress [--seconds n] [--load threads] [--pipe-kb n]
+//
+// --load defaults to twice the online CPUs; --pipe-kb shrinks the pipe
+// (F_SETPIPE_SZ) to get closer to a device with little slack (16 or more:
+// a pipe of one page is not refilled until it has been read empty, which
+// starves the sink by itself). Run it as is and with LARK_RT=1
+// (SCHED_FIFO needs CAP_SYS_NICE or an RLIMIT_RTPRIO; otherwise the nice
+// fallback is measured), and compare the reports. Timing dependent, so not
+// registered with ctest.
+
+#include "decoder.h"
+#include "realtime.h"
+#include "reference_m4b.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#define SINK_PERIOD_MS 10
+// Buffered before the sink starts its clock, like the GStreamer queue
+#define SINK_PREFILL_MS 200
+#define LOAD_BUFFER_BYTES (8 << 20) // per load thread, larger than the caches
+#define STRESS_RATE 44100
+#define STRESS_CHANNELS 2
+
+struct SinkReport {
+    unsigned long periods;
+    unsigned long underruns;
+    unsigned long missing_ms;
+    unsigned long max_late_us; // sink wake-up latency
+};
+
+static std::atomic<bool> load_stop(false);
+
+static void* load_thread_func(void* arg) {
+    (void)arg;
+    std::vector<unsigned char> buffer(LOAD_BUFFER_BYTES, 1);
+    unsigned int sum = 0;
+    while (!load_stop.load(std::memory_order_relaxed)) {
+        for (size_t i = 0; i < buffer.size(); i += 64) {
+            buffer[i] = (unsigned char)(buffer[i] + sum);
+            sum += buffer[i];
+        }
+    }
+    return (void*)(uintptr_t)sum;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Read up to len bytes without blocking; -1 once the writer closed
+static ssize_t drain(int fd, char* buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = read(fd, buf + got, len - got);
+        if (n > 0) {
+            got += (size_t)n;
+        } else if (n == 0) {
+            return got > 0 ? (ssize_t)got : -1;
+        } else if (errno != EINTR) {
+            break; // EAGAIN: pipe empty
+        }
+    }
+    return (ssize_t)got;
+}
+
+static bool run_sink(Decoder& decoder, const std::string& pipe_path, int pipe_kb, SinkReport* report) {
+    memset(report, 0, sizeof(*report));
+    realtime_enter_thread("sink");
+
+    int fd = open(pipe_path.c_str(), O_RDONLY | O_NONBLOCK);
+    if (fd == -1) return false;
+    if (pipe_kb > 0 && fcntl(fd, F_SETPIPE_SZ, pipe_kb * 1024) == -1) {
+        printf("F_SETPIPE_SZ %d KiB: %s\n", pipe_kb, strerror(errno));
+    }
+
+    size_t bytes_per_ms = STRESS_RATE * STRESS_CHANNELS * sizeof(int16_t) / 1000;
+    std::vector<char> buf(bytes_per_ms * SINK_PREFILL_MS);
+
+    // Prefill, then play at the audio rate
+    size_t prefilled = 0;
+    while (prefilled < buf.size() && decoder.exit_state() == Decoder::EXIT_NONE) {
+        ssize_t n = drain(fd, &buf[prefilled], buf.size() - prefilled);
+        if (n > 0) prefilled += (size_t)n;
+        usleep(1000);
+    }
+
+    size_t period = bytes_per_ms * SINK_PERIOD_MS;
+    uint64_t deadline = now_ns();
+    while (true) {
+        deadline += SINK_PERIOD_MS * 1000000ULL;
+        struct timespec ts = { (time_t)(deadline / 1000000000ULL), (long)(deadline % 1000000000ULL) };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+        }
+        uint64_t late = (now_ns() - deadline) / 1000;
+        if (late > report->max_late_us) report->max_late_us = (unsigned long)late;
+
+        ssize_t n = drain(fd, &buf[0], period);
+        if (n < 0) break;
+        report->periods++;
+        if ((size_t)n < period) {
+            if (decoder.exit_state() != Decoder::EXIT_NONE) break; // end of the book
+            report->underruns++;
+            report->missing_ms += (unsigned long)((period - (size_t)n) / bytes_per_ms);
+        }
+    }
+    close(fd);
+    return true;
+}
+
+static const char* mode_name(int mode) {
+    switch (mode) {
+        case REALTIME_FIFO: return "SCHED_FIFO";
+        case REALTIME_NICE: return "nice";
+        default: return "off";
+    }
+}
+
+int main(int argc, char** argv) {
+    int seconds = 60;
+    int load = 2 * (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int pipe_kb = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            seconds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc) {
+            load = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--pipe-kb") == 0 && i + 1 < argc) {
+            pipe_kb = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--seconds n] [--load threads] [--pipe-kb n]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (seconds < 1) seconds = 1;
+    if (load < 0) load = 0;
+
+    char work_dir[] = "/tmp/lark-stress-XXXXXX";
+    if (!mkdtemp(work_dir)) {
+        perror("mkdtemp");
+        return 2;
+    }
+    ReferenceBook book = { "stress_44k", STRESS_RATE, STRESS_CHANNELS, 1,
+                           (unsigned int)((uint64_t)seconds * STRESS_RATE / REFERENCE_FRAME_SAMPLES) };
+    std::string file = std::string(work_dir) + "/" + book.name + ".m4b";
+    std::string pipe_path = std::string(work_dir) + "/pcm_pipe";
+    if (!write_reference_m4b(file, book)) {
+        printf("FAIL cannot write %s\n", file.c_str());
+        return 2;
+    }
+
+    std::vector<pthread_t> threads(load);
+    int started = 0;
+    for (; started < load; started++) {
+        if (pthread_create(&threads[started], NULL, load_thread_func, NULL) != 0) break;
+    }
+
+    PlaybackMetrics metrics;
+    SpeechEq eq;
+    SinkReport report;
+    bool ok = false;
+    {
+        Decoder decoder(&metrics, &eq, pipe_path.c_str());
+        if (decoder.start(file.c_str(), 0)) {
+            ok = run_sink(decoder, pipe_path, pipe_kb, &report);
+            decoder.stop();
+            ok = ok && decoder.exit_state() == Decoder::EXIT_END_OF_FILE;
+        }
+    }
+
+    load_stop.store(true);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    unlink(file.c_str());
+    rmdir(work_dir);
+
+    if (!ok) {
+        printf("FAIL playback did not reach the end of the book\n");
+        return 1;
+    }
+    printf("realtime %s, %d load thread(s), %d s\n",
+           mode_name(metrics.realtime_mode.load()), started, seconds);
+    printf("sink: %lu periods of %d ms, %lu underrun(s), %lu ms missing, worst wake-up %lu us late\n",
+           report.periods, SINK_PERIOD_MS, report.underruns, report.missing_ms, report.max_late_us);
+    printf("decoder: %llu empty-pipe write(s)\n", (unsigned long long)metrics.underruns.load());
+    return 0;
+}
@@ -0,0 +1,119 @@
+// Tests for the book validator: an intact reference book is OK, a partial
+// copy is TRUNCATED with the stored frames found by bisection (cut inside a
+// frame and right after one), and a frame with all its bits flipped to 1
+// among the spot-decoded ones makes the book CORRUPT.
+
+#include "book_validator.h"
+#include "mp4_index.h"
+#include "reference_m4b.h"
+#include "test_check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+static const ReferenceBook book = { "validate_44k", 44100, 2, 2, 200 };
+
+static bool read_file(const std::string& path, std::vector<char>* data) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    data->clear();
+    char buf[16384];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) data->insert(data->end(), buf, buf + n);
+    fclose(f);
+    return true;
+}
+
+static bool write_file(const std::string& path, const std::vector<char>& data, size_t len) {
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    bool ok = fwrite(&data[0], 1, len, f) == len;
+    return fclose(f) == 0 && ok;
+}
+
+static bool locate(const std::string& path, uint32_t frame, uint64_t* offset, uint32_t* size) {
+    Mp4Index index;
+    return index.open(path.c_str()) && index.locate(frame, offset, size);
+}
+
+// A copy of the book cut at len bytes must be TRUNCATED with playable frames
+static void check_truncated(const std::string& copy, const std::vector<char>& data, size_t len,
+                            uint32_t frames, uint32_t playable) {
+    CHECK(write_file(copy, data, len), "cannot write %s", copy.c_str());
+    BookCheck check;
+    CHECK(validate_book(copy.c_str(), &check), "truncated at %lu: cancelled", (unsigned long)len);
+    CHECK(check.health == BOOK_TRUNCATED, "truncated at %lu: %s", (unsigned long)len,
+          book_health_name(check.health));
+    CHECK(check.frames == frames, "truncated at %lu: %u frames in the table, expected %u", (unsigned long)len,
+          check.frames, frames);
+    CHECK(check.playable_frames == playable, "truncated at %lu: %u playable frames, expected %u",
+          (unsigned long)len, check.playable_frames, playable);
+    CHECK(check.file_size == len, "truncated at %lu: file size %llu", (unsigned long)len,
+          (unsigned long long)check.file_size);
+    unlink(copy.c_str());
+}
+
+int main() {
+    char work_dir[] = "/tmp/lark-validate-XXXXXX";
+    if (!mkdtemp(work_dir)) {
+        perror("mkdtemp");
+        return 2;
+    }
+    std::string path = std::string(work_dir) + "/" + book.name + ".m4b";
+    std::string copy = std::string(work_dir) + "/copy.m4b";
+    std::vector<char> data;
+    if (!write_reference_m4b(path, book) || !read_file(path, &data)) {
+        printf("FAIL cannot write %s\n", path.c_str());
+        return 2;
+    }
+    uint32_t frames = book.chapters * book.chapter_frames;
+
+    BookCheck check;
+    CHECK(validate_book(path.c_str(), &check), "intact: cancelled");
+    CHECK(check.health == BOOK_OK, "intact: %s", book_health_name(check.health));
+    CHECK(check.frames == frames && check.playable_frames == frames, "intact: %u of %u frames playable",
+          check.playable_frames, check.frames);
+    CHECK(check.bad_frames == 0, "intact: %u bad frames", check.bad_frames);
+
+    // Cut inside a frame, right after one, and inside the last one
+    const uint32_t cuts[] = { 1, 157, 158, frames - 1 };
+    for (size_t i = 0; i < sizeof(cuts) / sizeof(cuts[0]); i++) {
+        uint64_t offset;
+        uint32_t size;
+        if (!locate(path, cuts[i], &offset, &size)) {
+            CHECK(false, "cannot locate frame %u", cuts[i]);
+            continue;
+        }
+        check_truncated(copy, data, (size_t)(offset + size / 2), frames, cuts[i]);
+        if (cuts[i] + 1 < frames) check_truncated(copy, data, (size_t)(offset + size), frames, cuts[i] + 1);
+    }
+    CHECK(validate_book((path + ".missing").c_str(), &check) && check.health == BOOK_UNREADABLE &&
+          check.file_size == 0, "missing book: %s", book_health_name(check.health));
+
+    // Every bit of a frame of the sixth spot (decoded after its priming
+    // frame) set: an empty raw data block, which FAAD2 rejects
+    uint32_t run = VALIDATE_SPOT_FRAMES;
+    uint32_t bad = (uint32_t)((uint64_t)(frames - run) * 5 / (VALIDATE_SPOTS - 1)) + 2;
+    uint64_t offset;
+    uint32_t size;
+    if (locate(path, bad, &offset, &size)) {
+        std::vector<char> corrupt = data;
+        for (uint32_t i = 0; i < size; i++) corrupt[offset + i] = (char)0xFF;
+        CHECK(write_file(copy, corrupt, corrupt.size()), "cannot write %s", copy.c_str());
+        CHECK(validate_book(copy.c_str(), &check), "corrupt: cancelled");
+        CHECK(check.health == BOOK_CORRUPT, "frame %u overwritten: %s", bad, book_health_name(check.health));
+        CHECK(check.bad_frames > 0, "frame %u overwritten: no bad frames", bad);
+        CHECK(check.playable_frames == frames, "corrupt: %u playable frames", check.playable_frames);
+        unlink(copy.c_str());
+    } else {
+        CHECK(false, "cannot locate frame %u", bad);
+    }
+
+    unlink(path.c_str());
+    rmdir(work_dir);
+    printf("%d failure(s)\n", failures);
+    return failures == 0 ? 0 : 1;
+}
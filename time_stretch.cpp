@@ -0,0 +1,146 @@
+#include "time_stretch.h"
+#include "pcm_kernels.h"
+#include <math.h>
+#include <string.h>
+
+// Alignment search: every COARSE_STEP-th offset on every other frame,
+// then each offset around the best one on every frame
+#define STRETCH_COARSE_STEP 4
+#define STRETCH_FINE_RADIUS 3
+
+// =================================================================================
+// TimeStretch Implementation
+// =================================================================================
+
+TimeStretch::TimeStretch()
+    : enabled(false), speed(1.0f), channels(2), sequence(0), overlap(0), seek(0),
+      head(0), pending(0), skip(0.0), have_tail(false) {
+}
+
+void TimeStretch::configure(unsigned long rate, unsigned int channels, float speed) {
+    if (speed < STRETCH_MIN_SPEED) speed = STRETCH_MIN_SPEED;
+    if (speed > STRETCH_MAX_SPEED) speed = STRETCH_MAX_SPEED;
+    this->speed = speed;
+    this->channels = channels > 0 ? channels : 2;
+    enabled = fabsf(speed - 1.0f) > 0.001f && rate > 0;
+
+    sequence = rate * STRETCH_SEQUENCE_MS / 1000;
+    overlap = rate * STRETCH_OVERLAP_MS / 1000;
+    seek = rate * STRETCH_SEEK_MS / 1000;
+    if (overlap < 1) overlap = 1;
+    if (sequence < 2 * overlap) sequence = 2 * overlap;
+    if (seek < 1) seek = 1;
+
+    tail.resize(overlap * this->channels);
+    tail_mono.resize(overlap);
+    window_mono.resize(seek + overlap);
+    reset();
+}
+
+void TimeStretch::reset() {
+    head = 0;
+    pending = 0;
+    skip = 0.0;
+    have_tail = false;
+}
+
+size_t TimeStretch::best_offset(const int16_t* window) {
+    // Correlate on the channel average, normalized by the candidate's energy
+    size_t span = seek + overlap;
+    for (size_t i = 0; i < span; i++) {
+        int32_t sum = 0;
+        for (unsigned int c = 0; c < channels; c++) sum += window[i * channels + c];
+        window_mono[i] = (float)sum / channels;
+    }
+
+    size_t best = 0;
+    float best_score = -INFINITY;
+    for (size_t o = 0; o < seek; o += STRETCH_COARSE_STEP) {
+        float corr = 0.0f, energy = 0.0f;
+        for (size_t i = 0; i < overlap; i += 2) {
+            float x = window_mono[o + i];
+            corr += tail_mono[i] * x;
+            energy += x * x;
+        }
+        float score = corr / sqrtf(energy + 1.0f);
+        if (score > best_score) {
+            best_score = score;
+            best = o;
+        }
+    }
+
+    size_t from = best > STRETCH_FINE_RADIUS ? best - STRETCH_FINE_RADIUS : 0;
+    size_t to = best + STRETCH_FINE_RADIUS < seek ? best + STRETCH_FINE_RADIUS + 1 : seek;
+    best_score = -INFINITY;
+    for (size_t o = from; o < to; o++) {
+        float corr = 0.0f, energy = 0.0f;
+        for (size_t i = 0; i < overlap; i++) {
+            float x = window_mono[o + i];
+            corr += tail_mono[i] * x;
+            energy += x * x;
+        }
+        float score = corr / sqrtf(energy + 1.0f);
+        if (score > best_score) {
+            best_score = score;
+            best = o;
+        }
+    }
+    return best;
+}
+
+size_t TimeStretch::process(const int16_t* in, size_t frames, std::vector<int16_t>* out) {
+    out->clear();
+    if (!enabled) {
+        out->assign(in, in + frames * channels);
+        return frames;
+    }
+
+    // Append to the unread input, moving it to the front when out of room
+    size_t needed = (head + pending + frames) * channels;
+    if (needed > input.size() && head > 0) {
+        if (pending > 0) memmove(&input[0], &input[head * channels], pending * channels * sizeof(int16_t));
+        head = 0;
+        needed = (pending + frames) * channels;
+    }
+    if (needed > input.size()) input.resize(needed);
+    if (frames > 0) memcpy(&input[(head + pending) * channels], in, frames * channels * sizeof(int16_t));
+    pending += frames;
+
+    const PcmKernels& kernels = pcm_kernels();
+    const size_t step = sequence - overlap;
+    while (true) {
+        // Input between segments is skipped (or, below speed 1, reused)
+        size_t drop = (size_t)skip < pending ? (size_t)skip : pending;
+        head += drop;
+        pending -= drop;
+        skip -= drop;
+        if (skip >= 1.0 || pending < seek + sequence) break;
+
+        const int16_t* window = &input[head * channels];
+        size_t offset = have_tail ? best_offset(window) : 0;
+        const int16_t* segment = window + offset * channels;
+
+        size_t base = out->size();
+        out->resize(base + step * channels);
+        int16_t* dst = &(*out)[base];
+        if (have_tail) {
+            // Weight of the new segment (i + 0.5) / overlap for frame i
+            kernels.mix(&tail[0], segment, dst, overlap, channels, 0.5f / overlap, (overlap + 0.5f) / overlap);
+        } else {
+            memcpy(dst, segment, overlap * channels * sizeof(int16_t));
+        }
+        memcpy(dst + overlap * channels, segment + overlap * channels,
+               (sequence - 2 * overlap) * channels * sizeof(int16_t));
+
+        // What follows the segment is crossfaded into the next one
+        memcpy(&tail[0], segment + step * channels, overlap * channels * sizeof(int16_t));
+        for (size_t i = 0; i < overlap; i++) {
+            int32_t sum = 0;
+            for (unsigned int c = 0; c < channels; c++) sum += tail[i * channels + c];
+            tail_mono[i] = (float)sum / channels;
+        }
+        have_tail = true;
+        skip += step * (double)speed;
+    }
+    return out->size() / channels;
+}
@@ -0,0 +1,60 @@
+#ifndef TIME_STRETCH_H
+#define TIME_STRETCH_H
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+// Playback speeds the time-stretch accepts
+#define STRETCH_MIN_SPEED 0.5f
+#define STRETCH_MAX_SPEED 2.5f
+
+// Segment length, crossfade and alignment search (ms), tuned for speech
+#define STRETCH_SEQUENCE_MS 40
+#define STRETCH_OVERLAP_MS 8
+#define STRETCH_SEEK_MS 15
+
+// --- TimeStretch Class ---
+// Changes the speed of speech without changing its pitch (WSOLA). The
+// input is cut into segments taken every (sequence - overlap) * speed
+// samples; each segment is aligned to the continuation of the previous one
+// by cross-correlation within the seek window, then crossfaded into it
+// over the overlap. Output lags input by about one segment.
+// Buffers grow to their working size on the first blocks and are reused
+// afterwards. Used by the decoder thread only.
+class TimeStretch {
+public:
+    TimeStretch();
+
+    // Resets the stream. A speed of 1 passes audio through untouched.
+    void configure(unsigned long rate, unsigned int channels, float speed);
+    void reset();
+    bool active() const { return enabled; }
+    float get_speed() const { return speed; }
+
+    // Stretch interleaved PCM; *out is replaced with what is ready (maybe
+    // nothing). Returns the number of output frames.
+    size_t process(const int16_t* in, size_t frames, std::vector<int16_t>* out);
+
+private:
+    bool enabled;
+    float speed;
+    unsigned int channels;
+    size_t sequence;  // frames per segment
+    size_t overlap;   // crossfade frames
+    size_t seek;      // alignment candidates
+
+    std::vector<int16_t> input; // interleaved; frames [head, head + pending) are unread
+    size_t head;
+    size_t pending;
+    double skip;                // input frames still to drop before the next segment
+
+    std::vector<int16_t> tail;  // continuation of the last segment (overlap frames)
+    bool have_tail;
+    std::vector<float> tail_mono;
+    std::vector<float> window_mono;
+
+    size_t best_offset(const int16_t* window);
+};
+
+#endif // TIME_STRETCH_H
@@ -0,0 +1,335 @@
+#include "worker_pool.h"
+#include "energy_profile.h"
+#include "logger.h"
+#include <glib.h>
+#include <atomic>
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define WORKER_DEFAULT_THREADS 1
+#define WORKER_MAX_THREADS 4
+#define WORKER_DEFAULT_THROTTLE_PCT 25
+#define WORKER_NICE 10
+// Polled while playback is starved
+#define WORKER_THROTTLE_POLL_MS 50
+// No write for this long: playback is paused or stopped, nothing to protect
+#define WORKER_PLAYBACK_IDLE_US 1000000
+
+// Not exported by older libc headers
+#ifndef SCHED_IDLE
+#define SCHED_IDLE 5
+#endif
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_BE_LOWEST 7
+
+static int env_int(const char* name, int fallback) {
+    const char* value = getenv(name);
+    if (!value || !value[0]) return fallback;
+    char* end = NULL;
+    long n = strtol(value, &end, 10);
+    return (end && *end == '\0') ? (int)n : fallback;
+}
+
+static WorkerConfig load_config() {
+    WorkerConfig config;
+    config.threads = env_int("LARK_WORKERS", WORKER_DEFAULT_THREADS);
+    config.throttle_pct = env_int("LARK_WORKER_THROTTLE_PCT", WORKER_DEFAULT_THROTTLE_PCT);
+    if (config.threads < 1) config.threads = 1;
+    if (config.threads > WORKER_MAX_THREADS) config.threads = WORKER_MAX_THREADS;
+    if (config.throttle_pct < 0) config.throttle_pct = 0;
+    if (config.throttle_pct > 100) config.throttle_pct = 100;
+    return config;
+}
+
+const WorkerConfig& worker_config() {
+    static const WorkerConfig config = load_config();
+    return config;
+}
+
+// Per thread on Linux (the tid is a "process" for ioprio_set)
+static void set_io_priority(int io_class, int level) {
+#ifdef SYS_ioprio_set
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, (io_class << IOPRIO_CLASS_SHIFT) | level) != 0) {
+        static std::atomic<bool> warned(false);
+        if (!warned.exchange(true)) {
+            LOG_W("Workers: cannot set I/O priority: %s\n", strerror(errno));
+        }
+    }
+#endif
+}
+
+// A thread that entered SCHED_IDLE can only come back to SCHED_OTHER with
+// CAP_SYS_NICE, or on 2.6.39+ within its RLIMIT_NICE; otherwise every later
+// task of the worker would run at idle priority. Tried once on a scratch
+// thread at the workers' nice value.
+static void* idle_probe_func(void* arg) {
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    *static_cast<bool*>(arg) = setpriority(PRIO_PROCESS, tid, WORKER_NICE) == 0 &&
+                               pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) == 0 &&
+                               pthread_setschedparam(pthread_self(), SCHED_OTHER, &param) == 0;
+    return NULL;
+}
+
+static bool probe_sched_idle() {
+    bool reversible = false;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, idle_probe_func, &reversible) == 0) {
+        pthread_join(thread, NULL);
+    }
+    if (!reversible) {
+        LOG_W("Workers: SCHED_IDLE cannot be left (RLIMIT_NICE), idle tasks only get idle I/O priority\n");
+    }
+    return reversible;
+}
+
+static bool sched_idle_usable() {
+    static const bool usable = probe_sched_idle();
+    return usable;
+}
+
+// IDLE work only gets the CPU and disk nobody else wants; the rest runs
+// niced with the lowest best-effort I/O priority.
+static void enter_class(WorkPriority priority) {
+    bool idle = priority == WORK_IDLE;
+    if (!idle || sched_idle_usable()) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        int err = pthread_setschedparam(pthread_self(), idle ? SCHED_IDLE : SCHED_OTHER, &param);
+        if (err != 0) {
+            static std::atomic<bool> warned(false);
+            if (!warned.exchange(true)) {
+                LOG_W("Workers: cannot switch to %s: %s\n", idle ? "SCHED_IDLE" : "SCHED_OTHER", strerror(err));
+            }
+        }
+    }
+    if (idle) {
+        set_io_priority(IOPRIO_CLASS_IDLE, 0);
+    } else {
+        set_io_priority(IOPRIO_CLASS_BE, IOPRIO_BE_LOWEST);
+    }
+}
+
+// =================================================================================
+// WorkerPool Implementation
+// =================================================================================
+
+thread_local WorkerPool::Task* WorkerPool::current = NULL;
+
+WorkerPool::WorkerPool() : stopping(false), playback(NULL) {}
+
+void WorkerPool::start(PlaybackMetrics* playback) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!threads.empty()) return;
+    this->playback = playback;
+    stopping = false;
+
+    const WorkerConfig& config = worker_config();
+    sched_idle_usable();
+    for (int i = 0; i < config.threads; i++) {
+        pthread_t thread;
+        int err = pthread_create(&thread, NULL, thread_func, this);
+        if (err != 0) {
+            LOG_E("Workers: Failed to create thread: %s\n", strerror(err));
+            break;
+        }
+        threads.push_back(thread);
+    }
+    LOG_I("Workers: %lu threads, throttled below %d%% playback buffer\n",
+          (unsigned long)threads.size(), config.throttle_pct);
+}
+
+void WorkerPool::shutdown() {
+    std::vector<Task*> dropped;
+    std::vector<pthread_t> joining;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        for (int p = 0; p < WORK_PRIORITY_COUNT; p++) {
+            dropped.insert(dropped.end(), queues[p].begin(), queues[p].end());
+            queues[p].clear();
+        }
+        for (size_t i = 0; i < running.size(); i++) {
+            running[i]->cancelled.store(true, std::memory_order_relaxed);
+        }
+        joining.swap(threads);
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < joining.size(); i++) {
+        pthread_join(joining[i], NULL);
+    }
+
+    // The main loop is going away: complete the never started tasks here
+    for (size_t i = 0; i < dropped.size(); i++) {
+        if (dropped[i]->done) dropped[i]->done(dropped[i]->data, true);
+        delete dropped[i];
+    }
+}
+
+void WorkerPool::submit(WorkPriority priority, int group, WorkRunFunc run, WorkDoneFunc done, void* data) {
+    Task* task = new Task;
+    task->priority = priority;
+    task->group = group;
+    task->run = run;
+    task->done = done;
+    task->data = data;
+    task->cancelled.store(false, std::memory_order_relaxed);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!stopping && !threads.empty()) {
+            queues[priority].push_back(task);
+            task = NULL;
+        }
+    }
+    if (!task) {
+        wake.notify_one();
+        return;
+    }
+    // No workers: report it cancelled rather than leak data
+    task->cancelled.store(true, std::memory_order_relaxed);
+    post_done(task);
+}
+
+void WorkerPool::cancel_group(int group) {
+    std::vector<Task*> dropped;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int p = 0; p < WORK_PRIORITY_COUNT; p++) {
+            std::deque<Task*>& queue = queues[p];
+            for (std::deque<Task*>::iterator it = queue.begin(); it != queue.end();) {
+                if ((*it)->group == group) {
+                    dropped.push_back(*it);
+                    it = queue.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        // Running ones notice at their next checkpoint()
+        for (size_t i = 0; i < running.size(); i++) {
+            if (running[i]->group == group) running[i]->cancelled.store(true, std::memory_order_relaxed);
+        }
+    }
+    for (size_t i = 0; i < dropped.size(); i++) {
+        dropped[i]->cancelled.store(true, std::memory_order_relaxed);
+        post_done(dropped[i]);
+    }
+}
+
+bool WorkerPool::checkpoint() {
+    Task* task = current;
+    if (!task) return true;
+    return worker_pool().wait_for_playback(task);
+}
+
+void* WorkerPool::thread_func(void* arg) {
+    static_cast<WorkerPool*>(arg)->worker_loop();
+    return NULL;
+}
+
+void WorkerPool::worker_loop() {
+    energy_name_thread("lark-worker");
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    if (setpriority(PRIO_PROCESS, tid, WORKER_NICE) != 0) {
+        LOG_W("Workers: cannot set nice %d: %s\n", WORKER_NICE, strerror(errno));
+    }
+    // Only switch scheduling class when it changes between tasks
+    int current_class = -1;
+
+    for (;;) {
+        Task* task = next_task();
+        if (!task) break;
+
+        int task_class = task->priority == WORK_IDLE ? WORK_IDLE : WORK_BACKGROUND;
+        if (task_class != current_class) {
+            enter_class(task->priority);
+            current_class = task_class;
+        }
+
+        current = task;
+        if (wait_for_playback(task)) {
+            task->run(task->data);
+            if (playback) PlaybackMetrics::add(playback->worker_tasks, 1);
+        }
+        current = NULL;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < running.size(); i++) {
+                if (running[i] == task) {
+                    running.erase(running.begin() + i);
+                    break;
+                }
+            }
+        }
+        post_done(task);
+    }
+}
+
+WorkerPool::Task* WorkerPool::next_task() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        if (stopping) return NULL;
+        for (int p = 0; p < WORK_PRIORITY_COUNT; p++) {
+            if (!queues[p].empty()) {
+                Task* task = queues[p].front();
+                queues[p].pop_front();
+                running.push_back(task);
+                return task;
+            }
+        }
+        wake.wait(lock);
+    }
+}
+
+bool WorkerPool::playback_starved() const {
+    if (!playback) return false;
+    uint64_t last_write = playback->last_write_us.load(std::memory_order_relaxed);
+    if (last_write == 0 || metrics_now_us() - last_write > WORKER_PLAYBACK_IDLE_US) return false;
+    uint64_t capacity = playback->buffer_capacity.load(std::memory_order_relaxed);
+    uint64_t fill = playback->buffer_fill.load(std::memory_order_relaxed);
+    return capacity > 0 && fill * 100 < capacity * (uint64_t)worker_config().throttle_pct;
+}
+
+bool WorkerPool::wait_for_playback(Task* task) {
+    uint64_t start = 0;
+    while (!task->cancelled.load(std::memory_order_relaxed) && playback_starved()) {
+        if (start == 0) start = metrics_now_us();
+        usleep(WORKER_THROTTLE_POLL_MS * 1000);
+    }
+    if (start != 0 && playback) {
+        PlaybackMetrics::add(playback->worker_throttle_ms, (metrics_now_us() - start) / 1000);
+    }
+    return !task->cancelled.load(std::memory_order_relaxed);
+}
+
+void WorkerPool::post_done(Task* task) {
+    if (!task->done) {
+        delete task;
+        return;
+    }
+    g_idle_add(done_idle, task);
+}
+
+int WorkerPool::done_idle(void* data) {
+    Task* task = static_cast<Task*>(data);
+    task->done(task->data, task->cancelled.load(std::memory_order_relaxed));
+    delete task;
+    return FALSE;
+}
+
+WorkerPool& worker_pool() {
+    static WorkerPool pool;
+    return pool;
+}
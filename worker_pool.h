@@ -0,0 +1,106 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "playback_metrics.h"
+
+// Priority classes, served in this order. USER work is waited for by the
+// UI (cover art); BACKGROUND and IDLE only prepare things for later.
+// IDLE tasks run under SCHED_IDLE with idle I/O priority, the others at
+// nice 10 with the lowest best-effort I/O priority. Where a worker could
+// not leave SCHED_IDLE again (RLIMIT_NICE), IDLE tasks keep nice 10 and
+// only get the idle I/O priority.
+enum WorkPriority {
+    WORK_USER = 0,
+    WORK_BACKGROUND,
+    WORK_IDLE,
+    WORK_PRIORITY_COUNT,
+};
+
+// Cancellation groups: everything tied to the open book is cancelled when
+// the user switches books
+#define WORK_GROUP_NONE 0
+#define WORK_GROUP_BOOK 1
+
+// Runs on a worker thread. Long tasks call WorkerPool::checkpoint()
+// between steps and return early when it says so.
+typedef void (*WorkRunFunc)(void* data);
+// Runs on the GTK main loop once the task finished or was cancelled
+// (possibly before it ran); frees data.
+typedef void (*WorkDoneFunc)(void* data, bool cancelled);
+
+// Read once from the environment:
+//   LARK_WORKERS=n             worker threads (default 1)
+//   LARK_WORKER_THROTTLE_PCT=n pause workers while the playback buffer is
+//                              below n% of its capacity (default 25)
+struct WorkerConfig {
+    int threads;
+    int throttle_pct;
+};
+
+const WorkerConfig& worker_config();
+
+// --- WorkerPool Class ---
+// Shared pool for background CPU and I/O (thumbnails, analysis, scans) that
+// must never cause an audible glitch: besides the low scheduling classes,
+// workers stop picking up tasks, and tasks block in checkpoint(), while
+// the decoder is writing into a nearly empty pipe.
+class WorkerPool {
+public:
+    WorkerPool();
+
+    // playback: the metrics of the running decoder (pipe fill), for the
+    // throttle
+    void start(PlaybackMetrics* playback);
+    // Cancel everything and join the workers. Queued tasks get their done
+    // callback right here; running ones still post theirs.
+    void shutdown();
+
+    void submit(WorkPriority priority, int group, WorkRunFunc run, WorkDoneFunc done, void* data);
+    // Drop queued tasks of the group and flag running ones
+    void cancel_group(int group);
+
+    // From inside a task: waits while playback is starved; false if the
+    // task was cancelled and should return.
+    static bool checkpoint();
+
+private:
+    struct Task {
+        WorkPriority priority;
+        int group;
+        WorkRunFunc run;
+        WorkDoneFunc done;
+        void* data;
+        std::atomic<bool> cancelled;
+    };
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Task*> queues[WORK_PRIORITY_COUNT];
+    std::vector<Task*> running;
+    std::vector<pthread_t> threads;
+    bool stopping;
+    PlaybackMetrics* playback;
+    // Task of the calling worker thread, for checkpoint()
+    static thread_local Task* current;
+
+    static void* thread_func(void* arg);
+    void worker_loop();
+    Task* next_task();
+    bool playback_starved() const;
+    // Wait until playback has enough buffered; false if the task was cancelled
+    bool wait_for_playback(Task* task);
+    void post_done(Task* task);
+    static int done_idle(void* data);
+};
+
+WorkerPool& worker_pool();
+
+#endif // WORKER_POOL_H